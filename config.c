@@ -0,0 +1,657 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "libsltpwmt.h"
+#include "profile.h"
+
+static const unsigned VOLUME_SNAP_MAX = 50;
+static const unsigned VOLUME_RAMP_MAX_MS = 60000;
+static const unsigned SCHEDULE_FADE_MAX_S = 4 * 3600;
+static const uint32_t DAY_S = 24 * 3600;
+static const unsigned IDLE_MAX_S = 24 * 3600;
+static const unsigned PTT_KEY_MAX = 0x2ff; // KEY_MAX
+
+static const char *const BACKEND_NAMES[] = {
+    [SLTP_BRIGHTNESS_AUTO] = "auto",
+    [SLTP_BRIGHTNESS_SYSFS] = "sysfs",
+    [SLTP_BRIGHTNESS_LOGIND] = "logind",
+    [SLTP_BRIGHTNESS_GAMMA] = "gamma",
+};
+
+static const struct sltp_config_point DEFAULT_ALS_CURVE[] = {
+    {0, 0.05}, {10, 0.15}, {50, 0.30}, {200, 0.50}, {1000, 0.80}, {5000, 1.00},
+};
+
+void sltp_config_defaults(struct sltp_config *cfg) {
+    *cfg = (struct sltp_config){
+        .brightness_backend = SLTP_BRIGHTNESS_AUTO,
+        .volume_step = PA_VOLUME_NORM / 20,
+        .volume_snap = 2,
+        .schedule_fade_s = 600,
+        .idle_dim_level = 30,
+        .als_points = sizeof(DEFAULT_ALS_CURVE) / sizeof(DEFAULT_ALS_CURVE[0]),
+    };
+    memcpy(cfg->als_curve, DEFAULT_ALS_CURVE, sizeof(DEFAULT_ALS_CURVE));
+}
+
+int sltp_config_dir(char *const buf, size_t buflen) {
+    const char *config = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+    int len;
+    if (config && *config) {
+        len = snprintf(buf, buflen, "%s/%s", config, SLTP_CONFIG_DIR);
+    } else if (home && *home) {
+        len = snprintf(buf, buflen, "%s/.config/%s", home, SLTP_CONFIG_DIR);
+    } else {
+        return -1;
+    }
+    if (len < 0 || (size_t)len >= buflen) {
+        fprintf(stderr, "config path too long\n");
+        return -1;
+    }
+    return 0;
+}
+
+static bool config_curve_valid(const struct sltp_config_point *curve, uint32_t npoints) {
+    if (npoints < 1 || npoints > SLTP_CONFIG_CURVE_MAX) {
+        return false;
+    }
+    for (uint32_t n = 0; n < npoints; ++n) {
+        if (!isfinite(curve[n].lux) || curve[n].lux < 0 || (n && curve[n].lux <= curve[n - 1].lux)
+            || !(curve[n].frac >= 0 && curve[n].frac <= 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Empty is valid: no schedule.
+static bool config_schedule_valid(const struct sltp_config_time *schedule, uint32_t npoints) {
+    if (npoints > SLTP_CONFIG_SCHEDULE_MAX) {
+        return false;
+    }
+    for (uint32_t n = 0; n < npoints; ++n) {
+        if (schedule[n].second >= DAY_S || (n && schedule[n].second <= schedule[n - 1].second)
+            || !(schedule[n].frac >= 0 && schedule[n].frac <= 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool config_change_valid(const struct sltp_scene_change *c) {
+    if (!memchr(c->name, '\0', sizeof(c->name))) {
+        return false;
+    }
+    switch (c->set) {
+    case SLTP_SCENE_VALUE:
+        return c->value >= 0 && (c->target == SLTP_SCENE_BACKLIGHT || c->value <= (int32_t)PA_VOLUME_NORM);
+    case SLTP_SCENE_PERCENT:
+        return c->value >= 0 && c->value <= 100;
+    case SLTP_SCENE_MUTE:
+    case SLTP_SCENE_UNMUTE:
+        return c->target == SLTP_SCENE_SINK || c->target == SLTP_SCENE_SOURCE;
+    default:
+        return false;
+    }
+}
+
+static bool config_scenes_valid(const struct sltp_config *cfg) {
+    if (cfg->nscenes > SLTP_CONFIG_SCENES_MAX || cfg->nchanges > SLTP_CONFIG_CHANGES_MAX) {
+        return false;
+    }
+    for (uint32_t n = 0; n < cfg->nscenes; ++n) {
+        const struct sltp_scene *sc = &cfg->scenes[n];
+        if (!sc->name[0] || !memchr(sc->name, '\0', sizeof(sc->name))
+            || sc->count < 1 || sc->count > SLTP_CONFIG_SCENE_CHANGES_MAX
+            || sc->first > cfg->nchanges || sc->count > cfg->nchanges - sc->first) {
+            return false;
+        }
+    }
+    for (uint32_t n = 0; n < cfg->nchanges; ++n) {
+        if (cfg->changes[n].target < SLTP_SCENE_BACKLIGHT || cfg->changes[n].target > SLTP_SCENE_SOURCE
+            || !config_change_valid(&cfg->changes[n])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool config_ptt_sources_valid(const struct sltp_config *cfg) {
+    if (cfg->ptt_nsources > SLTP_CONFIG_PTT_SOURCES_MAX) {
+        return false;
+    }
+    for (uint32_t n = 0; n < cfg->ptt_nsources; ++n) {
+        if (!memchr(cfg->ptt_sources[n], '\0', sizeof(cfg->ptt_sources[n])) || !cfg->ptt_sources[n][0]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Everything a parse could have produced, so a cache that was truncated,
+// scribbled on or written by another build is never used.
+static bool config_valid(const struct sltp_config *cfg) {
+    return !(cfg->set & ~(uint32_t)SLTP_CONFIG_ALL)
+        && memchr(cfg->backlight, '\0', sizeof(cfg->backlight))
+        && cfg->brightness_backend >= 0
+        && (size_t)cfg->brightness_backend < sizeof(BACKEND_NAMES) / sizeof(BACKEND_NAMES[0])
+        && cfg->brightness_step >= 0
+        && cfg->volume_step >= 1 && cfg->volume_step <= PA_VOLUME_NORM
+        && cfg->volume_snap <= VOLUME_SNAP_MAX
+        && cfg->volume_ramp_ms <= VOLUME_RAMP_MAX_MS
+        && config_curve_valid(cfg->als_curve, cfg->als_points)
+        && config_schedule_valid(cfg->schedule, cfg->schedule_points)
+        && cfg->schedule_fade_s <= SCHEDULE_FADE_MAX_S
+        && cfg->idle_dim_s <= IDLE_MAX_S && cfg->idle_off_s <= IDLE_MAX_S && cfg->idle_dim_level <= 100
+        && cfg->ptt_key <= PTT_KEY_MAX && config_ptt_sources_valid(cfg)
+        && config_scenes_valid(cfg);
+}
+
+static bool config_uint(const char *value, unsigned long max, unsigned long *out) {
+    char *end;
+    errno = 0;
+    *out = strtoul(value, &end, 10);
+    return isdigit((unsigned char)*value) && !*end && !errno && *out <= max;
+}
+
+static const char *config_curve(struct sltp_config *cfg, const char *value) {
+    struct sltp_config_point curve[SLTP_CONFIG_CURVE_MAX];
+    uint32_t npoints = 0;
+    for (const char *p = value; *p;) {
+        int used = 0;
+        if (npoints == SLTP_CONFIG_CURVE_MAX) {
+            return "als_curve has too many points";
+        }
+        if (sscanf(p, "%lf:%lf%n", &curve[npoints].lux, &curve[npoints].frac, &used) < 2) {
+            return "als_curve wants lux:fraction pairs";
+        }
+        ++npoints;
+        p += used;
+        p += strspn(p, " \t,");
+    }
+    if (!config_curve_valid(curve, npoints)) {
+        return "als_curve wants rising lux and fractions from 0 to 1";
+    }
+    memcpy(cfg->als_curve, curve, npoints * sizeof(curve[0]));
+    cfg->als_points = npoints;
+    return NULL;
+}
+
+static const char *config_schedule(struct sltp_config *cfg, const char *value) {
+    struct sltp_config_time schedule[SLTP_CONFIG_SCHEDULE_MAX];
+    uint32_t npoints = 0;
+    for (const char *p = value; *p;) {
+        unsigned hour, minute, percent;
+        int used = 0;
+        if (npoints == SLTP_CONFIG_SCHEDULE_MAX) {
+            return "schedule has too many points";
+        }
+        if (sscanf(p, "%u:%u %u%%%n", &hour, &minute, &percent, &used) < 3 || !used
+            || hour > 23 || minute > 59 || percent > 100) {
+            return "schedule wants HH:MM percent% pairs";
+        }
+        schedule[npoints++] = (struct sltp_config_time){ hour * 3600 + minute * 60, percent / 100.0 };
+        p += used;
+        p += strspn(p, " \t,");
+    }
+    if (!npoints || !config_schedule_valid(schedule, npoints)) {
+        return "schedule wants times in order through the day";
+    }
+    memcpy(cfg->schedule, schedule, npoints * sizeof(schedule[0]));
+    cfg->schedule_points = npoints;
+    return NULL;
+}
+
+// Source names separated by spaces or commas.
+static const char *config_ptt_sources(struct sltp_config *cfg, char *value) {
+    uint32_t n = 0;
+    for (char *save = NULL, *w = strtok_r(value, " \t,", &save); w; w = strtok_r(NULL, " \t,", &save)) {
+        if (n == SLTP_CONFIG_PTT_SOURCES_MAX) {
+            return "push_to_talk_sources takes up to four sources";
+        }
+        if (strlen(w) >= sizeof(cfg->ptt_sources[n])) {
+            return "push_to_talk_sources name too long";
+        }
+        snprintf(cfg->ptt_sources[n], sizeof(cfg->ptt_sources[n]), "%s", w);
+        ++n;
+    }
+    cfg->ptt_nsources = n;
+    return NULL;
+}
+
+static char *config_trim(char *p) {
+    while (isspace((unsigned char)*p)) {
+        ++p;
+    }
+    char *end = p + strlen(p);
+    while (end > p && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return p;
+}
+
+// "<target> [name] <value|N%|mute|unmute>"
+static const char *config_change(char *text, struct sltp_scene_change *c) {
+    char *words[4];
+    size_t nwords = 0;
+    for (char *save = NULL, *w = strtok_r(text, " \t", &save); w; w = strtok_r(NULL, " \t", &save)) {
+        if (nwords == 4) {
+            return "scene changes are <backlight|sink|source> [name] <value>";
+        }
+        words[nwords++] = w;
+    }
+    if (nwords < 2 || nwords > 3) {
+        return "scene changes are <backlight|sink|source> [name] <value>";
+    }
+    *c = (struct sltp_scene_change){0};
+    if (!strcmp(words[0], "backlight")) {
+        c->target = SLTP_SCENE_BACKLIGHT;
+    } else if (!strcmp(words[0], "sink")) {
+        c->target = SLTP_SCENE_SINK;
+    } else if (!strcmp(words[0], "source")) {
+        c->target = SLTP_SCENE_SOURCE;
+    } else {
+        return "scene changes are <backlight|sink|source> [name] <value>";
+    }
+    if (nwords == 3 && (size_t)snprintf(c->name, sizeof(c->name), "%s", words[1]) >= sizeof(c->name)) {
+        return "scene device name too long";
+    }
+
+    const char *value = words[nwords - 1];
+    size_t len = strlen(value);
+    unsigned long u;
+    if (!strcmp(value, "mute") || !strcmp(value, "unmute")) {
+        c->set = value[0] == 'm' ? SLTP_SCENE_MUTE : SLTP_SCENE_UNMUTE;
+    } else if (len > 1 && value[len - 1] == '%') {
+        char digits[16];
+        snprintf(digits, sizeof(digits), "%.*s", (int)(len - 1), value);
+        if (!config_uint(digits, 100, &u)) {
+            return "scene percentages go from 0% to 100%";
+        }
+        c->set = SLTP_SCENE_PERCENT;
+        c->value = (int32_t)u;
+    } else if (config_uint(value, INT32_MAX, &u)) {
+        c->set = SLTP_SCENE_VALUE;
+        c->value = (int32_t)u;
+    } else {
+        return "scene values are a number, a percentage, mute or unmute";
+    }
+    return config_change_valid(c) ? NULL : "scene value out of range for the device";
+}
+
+// "scene <name> = <change>, <change>, ..."; the scene is only added once
+// every change has parsed.
+static const char *config_scene(struct sltp_config *cfg, const char *name, char *value) {
+    struct sltp_scene *sc;
+    if (!*name || strlen(name) >= sizeof(sc->name) || strcspn(name, " \t") != strlen(name)) {
+        return "scene names are one word, shorter than 32 characters";
+    }
+    if (sltp_config_scene(cfg, name)) {
+        return "scene defined twice";
+    }
+    if (cfg->nscenes == SLTP_CONFIG_SCENES_MAX) {
+        return "too many scenes";
+    }
+    sc = &cfg->scenes[cfg->nscenes];
+    *sc = (struct sltp_scene){ .first = cfg->nchanges };
+    snprintf(sc->name, sizeof(sc->name), "%s", name);
+    for (char *save = NULL, *item = strtok_r(value, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        if (sc->count == SLTP_CONFIG_SCENE_CHANGES_MAX || sc->first + sc->count == SLTP_CONFIG_CHANGES_MAX) {
+            return "too many scene changes";
+        }
+        const char *err = config_change(item, &cfg->changes[sc->first + sc->count]);
+        if (err) {
+            return err;
+        }
+        ++sc->count;
+    }
+    if (!sc->count) {
+        return "scene has no changes";
+    }
+    cfg->nchanges += sc->count;
+    ++cfg->nscenes;
+    return NULL;
+}
+
+// Returns why the value was refused, or NULL.
+static const char *config_key(struct sltp_config *cfg, char *key, char *value) {
+    unsigned long u;
+    if (!strncmp(key, "scene", 5) && isspace((unsigned char)key[5])) {
+        const char *err = config_scene(cfg, config_trim(key + 5), value);
+        if (err) {
+            return err;
+        }
+        cfg->set |= SLTP_CONFIG_SCENES;
+    } else if (!strcmp(key, "backlight")) {
+        if (*value != '/' || strlen(value) >= sizeof(cfg->backlight)) {
+            return "backlight wants an absolute path";
+        }
+        snprintf(cfg->backlight, sizeof(cfg->backlight), "%s", value);
+        cfg->set |= SLTP_CONFIG_BACKLIGHT;
+    } else if (!strcmp(key, "brightness_backend")) {
+        size_t n = 0;
+        while (n < sizeof(BACKEND_NAMES) / sizeof(BACKEND_NAMES[0]) && strcmp(value, BACKEND_NAMES[n])) {
+            ++n;
+        }
+        if (n == sizeof(BACKEND_NAMES) / sizeof(BACKEND_NAMES[0])) {
+            return "brightness_backend wants auto, sysfs, logind or gamma";
+        }
+        cfg->brightness_backend = (int32_t)n;
+        cfg->set |= SLTP_CONFIG_BRIGHTNESS_BACKEND;
+    } else if (!strcmp(key, "brightness_step")) {
+        if (!config_uint(value, INT32_MAX, &u)) {
+            return "brightness_step wants a whole number";
+        }
+        cfg->brightness_step = (int32_t)u;
+        cfg->set |= SLTP_CONFIG_BRIGHTNESS_STEP;
+    } else if (!strcmp(key, "volume_step")) {
+        char *end;
+        double step = strtod(value, &end);
+        if (*end == '%') {
+            step = step * PA_VOLUME_NORM / 100;
+            ++end;
+        }
+        if (end == value || *end || !(step >= 1 && step <= PA_VOLUME_NORM)) {
+            return "volume_step wants a percentage or PulseAudio units, up to 100%";
+        }
+        cfg->volume_step = (uint32_t)lround(step);
+        cfg->set |= SLTP_CONFIG_VOLUME_STEP;
+    } else if (!strcmp(key, "volume_snap")) {
+        if (!config_uint(value, VOLUME_SNAP_MAX, &u)) {
+            return "volume_snap wants a percentage up to 50";
+        }
+        cfg->volume_snap = (uint32_t)u;
+        cfg->set |= SLTP_CONFIG_VOLUME_SNAP;
+    } else if (!strcmp(key, "volume_ramp")) {
+        if (!config_uint(value, VOLUME_RAMP_MAX_MS, &u)) {
+            return "volume_ramp wants milliseconds, up to a minute";
+        }
+        cfg->volume_ramp_ms = (uint32_t)u;
+        cfg->set |= SLTP_CONFIG_VOLUME_RAMP;
+    } else if (!strcmp(key, "als_curve")) {
+        const char *err = config_curve(cfg, value);
+        if (err) {
+            return err;
+        }
+        cfg->set |= SLTP_CONFIG_ALS_CURVE;
+    } else if (!strcmp(key, "schedule")) {
+        const char *err = config_schedule(cfg, value);
+        if (err) {
+            return err;
+        }
+        cfg->set |= SLTP_CONFIG_SCHEDULE;
+    } else if (!strcmp(key, "schedule_fade")) {
+        if (!config_uint(value, SCHEDULE_FADE_MAX_S, &u)) {
+            return "schedule_fade wants seconds, up to four hours";
+        }
+        cfg->schedule_fade_s = (uint32_t)u;
+        cfg->set |= SLTP_CONFIG_SCHEDULE_FADE;
+    } else if (!strcmp(key, "idle_dim") || !strcmp(key, "idle_off")) {
+        if (!config_uint(value, IDLE_MAX_S, &u)) {
+            return "idle_dim and idle_off want seconds, up to a day";
+        }
+        if (key[5] == 'd') {
+            cfg->idle_dim_s = (uint32_t)u;
+            cfg->set |= SLTP_CONFIG_IDLE_DIM;
+        } else {
+            cfg->idle_off_s = (uint32_t)u;
+            cfg->set |= SLTP_CONFIG_IDLE_OFF;
+        }
+    } else if (!strcmp(key, "idle_dim_level")) {
+        if (!config_uint(value, 100, &u)) {
+            return "idle_dim_level wants a percentage";
+        }
+        cfg->idle_dim_level = (uint32_t)u;
+        cfg->set |= SLTP_CONFIG_IDLE_DIM_LEVEL;
+    } else if (!strcmp(key, "push_to_talk")) {
+        if (!config_uint(value, PTT_KEY_MAX, &u)) {
+            return "push_to_talk wants an evdev key code, or 0 for off";
+        }
+        cfg->ptt_key = (uint32_t)u;
+        cfg->set |= SLTP_CONFIG_PTT_KEY;
+    } else if (!strcmp(key, "push_to_talk_sources")) {
+        const char *err = config_ptt_sources(cfg, value);
+        if (err) {
+            return err;
+        }
+        cfg->set |= SLTP_CONFIG_PTT_SOURCES;
+    } else {
+        return "unknown key";
+    }
+    return NULL;
+}
+
+static int config_parse(FILE *f, const char *path, struct sltp_config *cfg) {
+    char line[4096];
+    unsigned lineno = 0;
+    int errors = 0;
+    while (fgets(line, sizeof(line), f)) {
+        ++lineno;
+        const char *err = NULL;
+        char *comment = strchr(line, '#'), *eq;
+        if (comment) {
+            *comment = '\0';
+        }
+        char *key = config_trim(line);
+        if (!*key) {
+            continue;
+        }
+        if (!(eq = strchr(key, '='))) {
+            err = "expected key = value";
+        } else {
+            *eq = '\0';
+            err = config_key(cfg, config_trim(key), config_trim(eq + 1));
+        }
+        if (err) {
+            fprintf(stderr, "%s:%u: %s\n", path, lineno, err);
+            ++errors;
+        }
+    }
+    if (ferror(f)) {
+        perror("sltp_config_load failed (read)");
+        return -1;
+    }
+    return errors;
+}
+
+static bool config_same_source(const struct sltp_config_blob *b, const struct stat *st) {
+    return b->source_dev == (uint64_t)st->st_dev && b->source_ino == (uint64_t)st->st_ino
+        && b->source_size == (int64_t)st->st_size
+        && b->source_mtime_sec == (int64_t)st->st_mtim.tv_sec && b->source_mtime_nsec == (int64_t)st->st_mtim.tv_nsec;
+}
+
+static bool config_cached(const char *cache, const struct stat *source, struct sltp_config *cfg) {
+    struct stat st;
+    const struct sltp_config_blob *b = MAP_FAILED;
+    const int fd = open(cache, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size == sizeof(*b)) {
+        b = mmap(NULL, sizeof(*b), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (b == MAP_FAILED) {
+        return false;
+    }
+    const bool ok = b->magic == SLTP_CONFIG_MAGIC && b->version == SLTP_CONFIG_VERSION && b->size == sizeof(*b)
+        && config_same_source(b, source) && config_valid(&b->config);
+    if (ok) {
+        *cfg = b->config;
+    }
+    munmap((void *)b, sizeof(*b));
+    return ok;
+}
+
+// Renamed into place like the saved values. A cache that cannot be written
+// (e.g. a read-only config directory) only costs the next load a parse.
+static void config_store(const char *cache, const struct stat *source, const struct sltp_config *cfg) {
+    char tmp[530];
+    struct sltp_config_blob b;
+    memset(&b, 0, sizeof(b));
+    b.magic = SLTP_CONFIG_MAGIC;
+    b.version = SLTP_CONFIG_VERSION;
+    b.size = sizeof(b);
+    b.source_dev = (uint64_t)source->st_dev;
+    b.source_ino = (uint64_t)source->st_ino;
+    b.source_size = (int64_t)source->st_size;
+    b.source_mtime_sec = (int64_t)source->st_mtim.tv_sec;
+    b.source_mtime_nsec = (int64_t)source->st_mtim.tv_nsec;
+    b.config = *cfg;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", cache, (int)getpid());
+    const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return;
+    }
+    const bool ok = write(fd, &b, sizeof(b)) == (ssize_t)sizeof(b);
+    if (close(fd) == -1 || !ok || rename(tmp, cache) == -1) {
+        unlink(tmp);
+    }
+}
+
+static int config_load(struct sltp_config *cfg) {
+    char dir[480], path[512], cache[512];
+    struct stat st;
+    sltp_config_defaults(cfg);
+    if (sltp_config_dir(dir, sizeof(dir)) < 0) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, SLTP_CONFIG_FILE);
+    snprintf(cache, sizeof(cache), "%s/%s", dir, SLTP_CONFIG_CACHE);
+
+    // The cache is checked against the text as it was before reading it, so
+    // an edit racing the parse makes the next load parse again.
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        perror("sltp_config_load failed (open)");
+        return -1;
+    }
+    if (fstat(fd, &st) == -1) {
+        perror("sltp_config_load failed (fstat)");
+        close(fd);
+        return -1;
+    }
+    if (config_cached(cache, &st, cfg)) {
+        close(fd);
+        return 0;
+    }
+    FILE *f = fdopen(fd, "r");
+    if (!f) {
+        perror("sltp_config_load failed (fdopen)");
+        close(fd);
+        return -1;
+    }
+    const int errors = config_parse(f, path, cfg);
+    fclose(f);
+    if (errors == 0) {
+        config_store(cache, &st, cfg);
+    }
+    return errors;
+}
+
+int sltp_config_load(struct sltp_config *cfg) {
+    struct sltp_profile_mark mark;
+    sltp_profile_begin(&mark);
+    const int ret = config_load(cfg);
+    sltp_profile_end(SLTP_PROFILE_CONFIG, &mark);
+    return ret;
+}
+
+void sltp_config_merge(struct sltp_config *dst, const struct sltp_config *src) {
+    if (src->set & SLTP_CONFIG_BACKLIGHT) {
+        memcpy(dst->backlight, src->backlight, sizeof(dst->backlight));
+    }
+    if (src->set & SLTP_CONFIG_BRIGHTNESS_BACKEND) {
+        dst->brightness_backend = src->brightness_backend;
+    }
+    if (src->set & SLTP_CONFIG_BRIGHTNESS_STEP) {
+        dst->brightness_step = src->brightness_step;
+    }
+    if (src->set & SLTP_CONFIG_VOLUME_STEP) {
+        dst->volume_step = src->volume_step;
+    }
+    if (src->set & SLTP_CONFIG_VOLUME_SNAP) {
+        dst->volume_snap = src->volume_snap;
+    }
+    if (src->set & SLTP_CONFIG_VOLUME_RAMP) {
+        dst->volume_ramp_ms = src->volume_ramp_ms;
+    }
+    if (src->set & SLTP_CONFIG_ALS_CURVE) {
+        memcpy(dst->als_curve, src->als_curve, sizeof(dst->als_curve));
+        dst->als_points = src->als_points;
+    }
+    if (src->set & SLTP_CONFIG_SCHEDULE) {
+        memcpy(dst->schedule, src->schedule, sizeof(dst->schedule));
+        dst->schedule_points = src->schedule_points;
+    }
+    if (src->set & SLTP_CONFIG_SCHEDULE_FADE) {
+        dst->schedule_fade_s = src->schedule_fade_s;
+    }
+    if (src->set & SLTP_CONFIG_IDLE_DIM) {
+        dst->idle_dim_s = src->idle_dim_s;
+    }
+    if (src->set & SLTP_CONFIG_IDLE_DIM_LEVEL) {
+        dst->idle_dim_level = src->idle_dim_level;
+    }
+    if (src->set & SLTP_CONFIG_IDLE_OFF) {
+        dst->idle_off_s = src->idle_off_s;
+    }
+    if (src->set & SLTP_CONFIG_PTT_KEY) {
+        dst->ptt_key = src->ptt_key;
+    }
+    if (src->set & SLTP_CONFIG_PTT_SOURCES) {
+        memcpy(dst->ptt_sources, src->ptt_sources, sizeof(dst->ptt_sources));
+        dst->ptt_nsources = src->ptt_nsources;
+    }
+    if (src->set & SLTP_CONFIG_SCENES) {
+        memcpy(dst->scenes, src->scenes, sizeof(dst->scenes));
+        memcpy(dst->changes, src->changes, sizeof(dst->changes));
+        dst->nscenes = src->nscenes;
+        dst->nchanges = src->nchanges;
+    }
+    dst->set |= src->set;
+}
+
+const struct sltp_scene *sltp_config_scene(const struct sltp_config *cfg, const char *name) {
+    for (uint32_t n = 0; n < cfg->nscenes; ++n) {
+        if (!strcmp(cfg->scenes[n].name, name)) {
+            return &cfg->scenes[n];
+        }
+    }
+    return NULL;
+}
+
+void sltp_config_apply(struct sltp_ctx *ctx, const struct sltp_config *cfg) {
+    const char *env = getenv("SLTPWMT_BACKLIGHT");
+    sltp_set_backlight(ctx, cfg->set & SLTP_CONFIG_BACKLIGHT && !(env && *env) ? cfg->backlight : NULL);
+    sltp_set_brightness_backend(ctx, (enum sltp_brightness_backend)cfg->brightness_backend);
+    sltp_set_volume_snap(ctx, cfg->volume_snap);
+    const char *mics[SLTP_CONFIG_PTT_SOURCES_MAX];
+    for (uint32_t n = 0; n < cfg->ptt_nsources; ++n) {
+        mics[n] = cfg->ptt_sources[n];
+    }
+    sltp_set_mic_sources(ctx, mics, cfg->ptt_nsources);
+}
@@ -0,0 +1,168 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTP_CONFIG_H
+#define SLTP_CONFIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct sltp_ctx;
+
+// Settings from $XDG_CONFIG_HOME/sltpwmt/config (~/.config by default), one
+// "key = value" per line, # starting a comment:
+//
+//   backlight = /sys/class/backlight/amdgpu_bl0
+//   brightness_backend = auto | sysfs | logind | gamma
+//   brightness_step = 0          # daemon keys; 0 is a twentieth of the range
+//   volume_step = 5%             # daemon keys; or PulseAudio units
+//   volume_snap = 2              # percent either side of 100% that lands on it
+//   volume_ramp = 0              # ms
+//   als_curve = 0:0.05 10:0.15 50:0.30 200:0.50 1000:0.80 5000:1.00
+//   schedule = 07:30 100%, 19:00 60%, 22:30 20%   # daemon; off by default
+//   schedule_fade = 600          # seconds to fade into each schedule level
+//   idle_dim = 0                 # daemon; seconds without X input, 0 for never
+//   idle_dim_level = 30          # percent of the brightness before dimming
+//   idle_off = 0                 # daemon; seconds until bl_power goes off
+//   push_to_talk = 0             # daemon keys; evdev key code, e.g. 191 (F21)
+//   push_to_talk_sources = alsa_input.usb-Blue_Yeti-00.analog-stereo
+//
+// and any number of scenes, applied together by `sltpwmt apply <name>`:
+//
+//   scene meeting = backlight 60%, backlight /sys/class/backlight/ddcci3 80%,
+//       sink mute, source unmute, sink bluez_sink.00_1B_66.a2dp_sink 40%
+//
+// (on one line). Each change names a backlight directory, sink or source, or
+// leaves it out for the default one, and sets it to a value, a percentage,
+// mute or unmute.
+//
+// The text is parsed once into a struct sltp_config and cached next to it as
+// config.cache; later loads map the cache and only check it against the
+// text's inode, size and mtime.
+
+#define SLTP_CONFIG_DIR "sltpwmt"
+#define SLTP_CONFIG_FILE "config"
+#define SLTP_CONFIG_CACHE "config.cache"
+#define SLTP_CONFIG_MAGIC 0x66636c73u
+#define SLTP_CONFIG_VERSION 5u
+#define SLTP_CONFIG_CURVE_MAX 16
+#define SLTP_CONFIG_SCHEDULE_MAX 16
+#define SLTP_CONFIG_SCENES_MAX 8
+#define SLTP_CONFIG_SCENE_NAME_MAX 32
+#define SLTP_CONFIG_SCENE_CHANGES_MAX 16 // per scene
+#define SLTP_CONFIG_CHANGES_MAX 32 // in all
+#define SLTP_CONFIG_PTT_SOURCES_MAX 4
+
+// Which keys the file set; the rest hold their defaults.
+enum {
+    SLTP_CONFIG_BACKLIGHT = 1u << 0,
+    SLTP_CONFIG_BRIGHTNESS_BACKEND = 1u << 1,
+    SLTP_CONFIG_BRIGHTNESS_STEP = 1u << 2,
+    SLTP_CONFIG_VOLUME_STEP = 1u << 3,
+    SLTP_CONFIG_VOLUME_SNAP = 1u << 4,
+    SLTP_CONFIG_VOLUME_RAMP = 1u << 5,
+    SLTP_CONFIG_ALS_CURVE = 1u << 6,
+    SLTP_CONFIG_SCENES = 1u << 7,
+    SLTP_CONFIG_SCHEDULE = 1u << 8,
+    SLTP_CONFIG_SCHEDULE_FADE = 1u << 9,
+    SLTP_CONFIG_IDLE_DIM = 1u << 10,
+    SLTP_CONFIG_IDLE_DIM_LEVEL = 1u << 11,
+    SLTP_CONFIG_IDLE_OFF = 1u << 12,
+    SLTP_CONFIG_PTT_KEY = 1u << 13,
+    SLTP_CONFIG_PTT_SOURCES = 1u << 14,
+    SLTP_CONFIG_ALL = (1u << 15) - 1,
+};
+
+enum sltp_scene_target {
+    SLTP_SCENE_BACKLIGHT,
+    SLTP_SCENE_SINK,
+    SLTP_SCENE_SOURCE,
+};
+
+enum sltp_scene_set {
+    SLTP_SCENE_VALUE, // brightness, or a pa_volume_t
+    SLTP_SCENE_PERCENT,
+    SLTP_SCENE_MUTE,
+    SLTP_SCENE_UNMUTE,
+};
+
+struct sltp_scene_change {
+    int32_t target; // enum sltp_scene_target
+    int32_t set; // enum sltp_scene_set
+    int32_t value;
+    char name[256]; // backlight directory, sink or source; empty for the default
+};
+
+struct sltp_scene {
+    char name[SLTP_CONFIG_SCENE_NAME_MAX];
+    uint32_t first; // into sltp_config.changes
+    uint32_t count;
+};
+
+struct sltp_config_point {
+    double lux;
+    double frac; // of max_brightness
+};
+
+struct sltp_config_time {
+    uint32_t second; // of the local day
+    double frac; // of max_brightness
+};
+
+struct sltp_config {
+    uint32_t set; // SLTP_CONFIG_* bits
+    char backlight[256];
+    int32_t brightness_backend; // enum sltp_brightness_backend
+    int32_t brightness_step;
+    uint32_t volume_step; // pa_volume_t
+    uint32_t volume_snap; // percent
+    uint32_t volume_ramp_ms;
+    uint32_t als_points;
+    struct sltp_config_point als_curve[SLTP_CONFIG_CURVE_MAX];
+    uint32_t schedule_points; // 0 for none
+    uint32_t schedule_fade_s;
+    struct sltp_config_time schedule[SLTP_CONFIG_SCHEDULE_MAX];
+    uint32_t idle_dim_s; // 0 for never
+    uint32_t idle_dim_level; // percent
+    uint32_t idle_off_s; // 0 for never
+    uint32_t ptt_key; // evdev key code; 0 for none
+    uint32_t ptt_nsources; // 0 for the default source
+    char ptt_sources[SLTP_CONFIG_PTT_SOURCES_MAX][128];
+    uint32_t nscenes;
+    uint32_t nchanges;
+    struct sltp_scene scenes[SLTP_CONFIG_SCENES_MAX];
+    struct sltp_scene_change changes[SLTP_CONFIG_CHANGES_MAX];
+};
+
+// The cache file: the parsed config and the text it was parsed from.
+struct sltp_config_blob {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size; // of the whole blob
+    uint32_t reserved;
+    uint64_t source_dev;
+    uint64_t source_ino;
+    int64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    struct sltp_config config;
+};
+
+void sltp_config_defaults(struct sltp_config *cfg);
+// A missing file is all defaults. Lines that do not parse are reported on
+// stderr and skipped, and keep the cache from being written so the next load
+// reports them again; returns the number of such lines, or -1 if the file
+// could not be read.
+int sltp_config_load(struct sltp_config *cfg);
+// Takes the keys src set over dst, e.g. command-line flags over the file.
+void sltp_config_merge(struct sltp_config *dst, const struct sltp_config *src);
+// Backlight, backend, snap and push-to-talk sources; $SLTPWMT_BACKLIGHT still wins over the file.
+void sltp_config_apply(struct sltp_ctx *ctx, const struct sltp_config *cfg);
+const struct sltp_scene *sltp_config_scene(const struct sltp_config *cfg, const char *name);
+// The directory the file lives in, for watching it.
+int sltp_config_dir(char *buf, size_t buflen);
+
+#endif
@@ -0,0 +1,636 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <byteswap.h>
+
+#include "dbus.h"
+
+#define DBUS_IN_MAX 65536
+
+static const char *DBUS_SYSTEM_SOCKET = "/run/dbus/system_bus_socket";
+static const char *DBUS_DISCONNECTED = "org.freedesktop.DBus.Error.Disconnected";
+static const pa_usec_t DBUS_RETRY = PA_USEC_PER_SEC;
+static const uint8_t DBUS_NO_REPLY_EXPECTED = 0x1;
+
+enum dbus_field {
+    DBUS_FIELD_PATH = 1,
+    DBUS_FIELD_INTERFACE = 2,
+    DBUS_FIELD_MEMBER = 3,
+    DBUS_FIELD_ERROR_NAME = 4,
+    DBUS_FIELD_REPLY_SERIAL = 5,
+    DBUS_FIELD_DESTINATION = 6,
+    DBUS_FIELD_SIGNATURE = 8,
+};
+
+enum dbus_state {
+    DBUS_DOWN,
+    DBUS_AUTH, // waiting for OK
+    DBUS_READY,
+};
+
+struct dbus_buf {
+    uint8_t *p;
+    size_t len;
+    size_t cap;
+    bool fail;
+};
+
+struct dbus_call {
+    uint32_t serial;
+    sltp_dbus_cb cb;
+    void *userdata;
+    struct dbus_call *next;
+};
+
+struct dbus_match {
+    char *rule;
+    char *interface;
+    char *member;
+    sltp_dbus_cb cb;
+    void *userdata;
+    struct dbus_match *next;
+};
+
+struct sltp_dbus {
+    pa_mainloop_api *api;
+    struct sockaddr_un addr;
+    int fd;
+    pa_io_event *io;
+    pa_time_event *retry;
+    enum dbus_state state;
+    bool retrying; // lost a connection, and has not got it back yet
+    uint32_t serial;
+    struct dbus_buf out; // on its way to the socket
+    struct dbus_buf held; // messages made before authentication finished
+    uint8_t in[DBUS_IN_MAX];
+    size_t in_len;
+    struct dbus_call *calls;
+    struct dbus_match *matches;
+};
+
+// Marshalling. Alignment is relative to the start of the message, which is
+// always the start of the buffer being written.
+
+static void buf_put(struct dbus_buf *b, const void *data, size_t len) {
+    if (b->fail) {
+        return;
+    }
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 256;
+        while (cap < b->len + len) {
+            cap *= 2;
+        }
+        uint8_t *p = realloc(b->p, cap);
+        if (!p) {
+            b->fail = true;
+            return;
+        }
+        b->p = p;
+        b->cap = cap;
+    }
+    memcpy(b->p + b->len, data, len);
+    b->len += len;
+}
+
+static void buf_align(struct dbus_buf *b, size_t n) {
+    static const uint8_t zero[8];
+    buf_put(b, zero, (n - b->len % n) % n);
+}
+
+static void put_byte(struct dbus_buf *b, uint8_t v) {
+    buf_put(b, &v, 1);
+}
+
+static void put_u32(struct dbus_buf *b, uint32_t v) {
+    buf_align(b, 4);
+    buf_put(b, &v, 4);
+}
+
+static void put_string(struct dbus_buf *b, const char *s) {
+    const size_t len = strlen(s);
+    put_u32(b, (uint32_t)len);
+    buf_put(b, s, len + 1);
+}
+
+static void put_signature(struct dbus_buf *b, const char *s) {
+    const size_t len = strlen(s);
+    put_byte(b, (uint8_t)len);
+    buf_put(b, s, len + 1);
+}
+
+static void put_field(struct dbus_buf *b, enum dbus_field code, char type, const char *value) {
+    const char sig[2] = { type, '\0' };
+    buf_align(b, 8);
+    put_byte(b, (uint8_t)code);
+    put_signature(b, sig);
+    type == 'g' ? put_signature(b, value) : put_string(b, value);
+}
+
+static void patch_u32(struct dbus_buf *b, size_t at, uint32_t v) {
+    if (!b->fail) {
+        memcpy(b->p + at, &v, 4);
+    }
+}
+
+// Unmarshalling, bounds-checked against the message.
+
+struct dbus_reader {
+    const uint8_t *p;
+    size_t len;
+    size_t pos;
+    bool swap;
+};
+
+static int get_align(struct dbus_reader *r, size_t n) {
+    r->pos = (r->pos + n - 1) / n * n;
+    return r->pos <= r->len ? 0 : -1;
+}
+
+static int get_u32(struct dbus_reader *r, uint32_t *v) {
+    if (get_align(r, 4) < 0 || r->len - r->pos < 4) {
+        return -1;
+    }
+    memcpy(v, r->p + r->pos, 4);
+    *v = r->swap ? bswap_32(*v) : *v;
+    r->pos += 4;
+    return 0;
+}
+
+static int get_string(struct dbus_reader *r, const char **s, bool sig) {
+    uint32_t len;
+    if (sig) {
+        if (r->pos >= r->len) {
+            return -1;
+        }
+        len = r->p[r->pos++];
+    } else if (get_u32(r, &len) < 0) {
+        return -1;
+    }
+    if (r->len - r->pos <= len || r->p[r->pos + len] != '\0') {
+        return -1;
+    }
+    *s = (const char *)r->p + r->pos;
+    r->pos += len + 1;
+    return 0;
+}
+
+// Connection
+
+static void dbus_io(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
+static int dbus_connect(struct sltp_dbus *bus);
+
+static void dbus_retry(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)tv;
+    struct sltp_dbus *bus = userdata;
+    a->time_free(e);
+    bus->retry = NULL;
+    dbus_connect(bus);
+}
+
+// Every outstanding call is answered with an error; subscriptions survive
+// and come back with the connection.
+static void dbus_disconnect(struct sltp_dbus *bus) {
+    bus->retrying |= bus->state == DBUS_READY;
+    if (bus->io) {
+        bus->api->io_free(bus->io);
+        bus->io = NULL;
+    }
+    if (bus->fd != -1) {
+        close(bus->fd);
+        bus->fd = -1;
+    }
+    bus->state = DBUS_DOWN;
+    bus->out.len = bus->held.len = bus->in_len = 0;
+    bus->out.fail = bus->held.fail = false;
+
+    const struct sltp_dbus_msg msg = { .type = SLTP_DBUS_ERROR, .error_name = DBUS_DISCONNECTED, .signature = "" };
+    while (bus->calls) {
+        struct dbus_call *c = bus->calls;
+        bus->calls = c->next;
+        if (c->cb) {
+            c->cb(bus, &msg, c->userdata);
+        }
+        free(c);
+    }
+    if (bus->matches && bus->retrying && !bus->retry) {
+        struct timeval tv;
+        bus->retry = bus->api->time_new(bus->api, pa_timeval_add(pa_gettimeofday(&tv), DBUS_RETRY), dbus_retry, bus);
+    }
+}
+
+static void dbus_want_write(struct sltp_dbus *bus) {
+    if (bus->io) {
+        bus->api->io_enable(bus->io, PA_IO_EVENT_INPUT | (bus->out.len ? PA_IO_EVENT_OUTPUT : 0));
+    }
+}
+
+// Builds a complete message; it goes to the socket if authenticated, or is
+// held until then.
+static int dbus_send(struct sltp_dbus *bus, uint8_t type, uint8_t flags, const char *dest, const char *path,
+    const char *interface, const char *member, const char *signature, va_list *ap, uint32_t *serial) {
+    struct dbus_buf m = {0};
+    if (!++bus->serial) {
+        ++bus->serial;
+    }
+    put_byte(&m, __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? 'l' : 'B');
+    put_byte(&m, type);
+    put_byte(&m, flags);
+    put_byte(&m, 1);
+    put_u32(&m, 0); // body length
+    put_u32(&m, bus->serial);
+    put_u32(&m, 0); // header field array length
+    const size_t fields = m.len;
+    put_field(&m, DBUS_FIELD_PATH, 'o', path);
+    if (interface) {
+        put_field(&m, DBUS_FIELD_INTERFACE, 's', interface);
+    }
+    put_field(&m, DBUS_FIELD_MEMBER, 's', member);
+    if (dest) {
+        put_field(&m, DBUS_FIELD_DESTINATION, 's', dest);
+    }
+    if (*signature) {
+        put_field(&m, DBUS_FIELD_SIGNATURE, 'g', signature);
+    }
+    patch_u32(&m, 12, (uint32_t)(m.len - fields));
+    buf_align(&m, 8);
+
+    const size_t body = m.len;
+    for (const char *t = signature; *t; ++t) {
+        switch (*t) {
+        case 's':
+        case 'o':
+            put_string(&m, va_arg(*ap, const char *));
+            break;
+        case 'u':
+            put_u32(&m, va_arg(*ap, unsigned));
+            break;
+        case 'i':
+            put_u32(&m, (uint32_t)va_arg(*ap, int));
+            break;
+        case 'b':
+            put_u32(&m, va_arg(*ap, int) != 0);
+            break;
+        default:
+            free(m.p);
+            return -1;
+        }
+    }
+    patch_u32(&m, 4, (uint32_t)(m.len - body));
+
+    struct dbus_buf *to = bus->state == DBUS_READY ? &bus->out : &bus->held;
+    if (!m.fail) {
+        buf_put(to, m.p, m.len);
+    }
+    free(m.p);
+    if (m.fail || to->fail) {
+        return -1;
+    }
+    if (serial) {
+        *serial = bus->serial;
+    }
+    dbus_want_write(bus);
+    return 0;
+}
+
+static int dbus_send_simple(struct sltp_dbus *bus, uint8_t flags, const char *dest, const char *path,
+    const char *interface, const char *member, const char *signature, ...) {
+    va_list ap;
+    va_start(ap, signature);
+    const int ret = dbus_send(bus, SLTP_DBUS_METHOD_CALL, flags, dest, path, interface, member, signature, &ap, NULL);
+    va_end(ap);
+    return ret;
+}
+
+static int dbus_add_match(struct sltp_dbus *bus, const struct dbus_match *m) {
+    return dbus_send_simple(bus, DBUS_NO_REPLY_EXPECTED, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+        "org.freedesktop.DBus", "AddMatch", "s", m->rule);
+}
+
+// Hello has to be the first message, and matches are renewed on every
+// connection; anything held back follows them.
+static void dbus_ready(struct sltp_dbus *bus) {
+    static const char begin[] = "BEGIN\r\n";
+    bus->state = DBUS_READY;
+    bus->retrying = false;
+    buf_put(&bus->out, begin, sizeof(begin) - 1);
+    dbus_send_simple(bus, 0, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "Hello", "");
+    for (const struct dbus_match *m = bus->matches; m; m = m->next) {
+        dbus_add_match(bus, m);
+    }
+    buf_put(&bus->out, bus->held.p, bus->held.len);
+    bus->held.len = 0;
+    if (bus->out.fail) {
+        dbus_disconnect(bus);
+    }
+}
+
+static void dbus_dispatch(struct sltp_dbus *bus, const struct sltp_dbus_msg *msg, uint32_t reply_serial) {
+    if (msg->type == SLTP_DBUS_METHOD_RETURN || msg->type == SLTP_DBUS_ERROR) {
+        for (struct dbus_call **p = &bus->calls; *p; p = &(*p)->next) {
+            struct dbus_call *c = *p;
+            if (c->serial == reply_serial) {
+                *p = c->next;
+                if (c->cb) {
+                    c->cb(bus, msg, c->userdata);
+                }
+                free(c);
+                return;
+            }
+        }
+    } else if (msg->type == SLTP_DBUS_SIGNAL && msg->interface && msg->member) {
+        for (const struct dbus_match *m = bus->matches; m; m = m->next) {
+            if (!strcmp(m->interface, msg->interface) && !strcmp(m->member, msg->member)) {
+                m->cb(bus, msg, m->userdata);
+            }
+        }
+    }
+}
+
+// Returns the message's length, 0 if it is not all here yet, or -1 if it
+// makes no sense.
+static ssize_t dbus_parse(struct sltp_dbus *bus, const uint8_t *p, size_t len) {
+    if (len < 16) {
+        return 0;
+    }
+    struct dbus_reader r = { p, len, 4, p[0] != (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? 'l' : 'B') };
+    uint32_t body_len, serial, fields_len;
+    get_u32(&r, &body_len);
+    get_u32(&r, &serial);
+    get_u32(&r, &fields_len);
+    const size_t header = (16 + (size_t)fields_len + 7) / 8 * 8;
+    if ((p[0] != 'l' && p[0] != 'B') || fields_len > DBUS_IN_MAX || body_len > DBUS_IN_MAX
+        || header + body_len > DBUS_IN_MAX) {
+        return -1;
+    }
+    if (len < header + body_len) {
+        return 0;
+    }
+
+    struct sltp_dbus_msg msg = {
+        .type = p[1],
+        .signature = "",
+        .body = p + header,
+        .body_len = body_len,
+        .swap = r.swap,
+    };
+    uint32_t reply_serial = 0;
+    r.len = 16 + fields_len;
+    while (r.pos < r.len) {
+        const char *sig, *str;
+        if (get_align(&r, 8) < 0 || r.pos >= r.len) {
+            break;
+        }
+        const uint8_t code = p[r.pos++];
+        if (get_string(&r, &sig, true) < 0) {
+            return -1;
+        }
+        if (!strcmp(sig, "u")) {
+            if (get_u32(&r, code == DBUS_FIELD_REPLY_SERIAL ? &reply_serial : &serial) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if ((strcmp(sig, "s") && strcmp(sig, "o") && strcmp(sig, "g")) || get_string(&r, &str, *sig == 'g') < 0) {
+            return -1;
+        }
+        switch (code) {
+        case DBUS_FIELD_PATH:
+            msg.path = str;
+            break;
+        case DBUS_FIELD_INTERFACE:
+            msg.interface = str;
+            break;
+        case DBUS_FIELD_MEMBER:
+            msg.member = str;
+            break;
+        case DBUS_FIELD_ERROR_NAME:
+            msg.error_name = str;
+            break;
+        case DBUS_FIELD_SIGNATURE:
+            msg.signature = str;
+            break;
+        }
+    }
+    dbus_dispatch(bus, &msg, reply_serial);
+    return (ssize_t)(header + body_len);
+}
+
+static int dbus_read(struct sltp_dbus *bus) {
+    ssize_t n = recv(bus->fd, bus->in + bus->in_len, sizeof(bus->in) - bus->in_len, 0);
+    if (n == 0 || (n == -1 && errno != EAGAIN)) {
+        return -1;
+    }
+    bus->in_len += n > 0 ? (size_t)n : 0;
+
+    size_t used = 0;
+    if (bus->state == DBUS_AUTH) {
+        const uint8_t *eol = memmem(bus->in, bus->in_len, "\r\n", 2);
+        if (!eol) {
+            return bus->in_len == sizeof(bus->in) ? -1 : 0;
+        }
+        if (bus->in_len < 3 || memcmp(bus->in, "OK ", 3)) {
+            fprintf(stderr, "sltp_dbus: authentication rejected\n");
+            return -1;
+        }
+        used = (size_t)(eol - bus->in) + 2;
+        dbus_ready(bus);
+    }
+    // Callbacks may make calls, but never disconnect or read.
+    while (bus->state == DBUS_READY) {
+        const ssize_t len = dbus_parse(bus, bus->in + used, bus->in_len - used);
+        if (len < 0) {
+            fprintf(stderr, "sltp_dbus: bad message\n");
+            return -1;
+        }
+        if (len == 0) {
+            break;
+        }
+        used += (size_t)len;
+    }
+    bus->in_len -= used;
+    memmove(bus->in, bus->in + used, bus->in_len);
+    return 0;
+}
+
+static void dbus_io(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)a; (void)e;
+    struct sltp_dbus *bus = userdata;
+    if ((events & PA_IO_EVENT_INPUT) && dbus_read(bus) < 0) {
+        dbus_disconnect(bus);
+        return;
+    }
+    if (!(events & PA_IO_EVENT_INPUT) && (events & (PA_IO_EVENT_HANGUP | PA_IO_EVENT_ERROR))) {
+        dbus_disconnect(bus);
+        return;
+    }
+    if (bus->out.len) {
+        ssize_t n = send(fd, bus->out.p, bus->out.len, MSG_NOSIGNAL);
+        if (n == -1 && errno != EAGAIN) {
+            dbus_disconnect(bus);
+            return;
+        }
+        if (n > 0) {
+            bus->out.len -= (size_t)n;
+            memmove(bus->out.p, bus->out.p + n, bus->out.len);
+        }
+    }
+    dbus_want_write(bus);
+}
+
+// SASL EXTERNAL: the bus takes our uid from the socket's credentials.
+static int dbus_connect(struct sltp_dbus *bus) {
+    char auth[64], uid[16];
+    if (bus->state != DBUS_DOWN) {
+        return 0;
+    }
+    bus->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (bus->fd == -1 || connect(bus->fd, (const struct sockaddr *)&bus->addr, sizeof(bus->addr)) == -1) {
+        if (!bus->retrying) {
+            perror("sltp_dbus: connect failed");
+        }
+        dbus_disconnect(bus);
+        return -1;
+    }
+    const int uid_len = snprintf(uid, sizeof(uid), "%u", (unsigned)getuid());
+    int len = snprintf(auth, sizeof(auth), "%cAUTH EXTERNAL ", '\0');
+    for (int n = 0; n < uid_len; ++n) {
+        len += snprintf(auth + len, sizeof(auth) - (size_t)len, "%02x", (unsigned char)uid[n]);
+    }
+    len += snprintf(auth + len, sizeof(auth) - (size_t)len, "\r\n");
+    buf_put(&bus->out, auth, (size_t)len);
+    if (bus->out.fail || !(bus->io = bus->api->io_new(bus->api, bus->fd, PA_IO_EVENT_INPUT | PA_IO_EVENT_OUTPUT, dbus_io, bus))) {
+        dbus_disconnect(bus);
+        return -1;
+    }
+    bus->state = DBUS_AUTH;
+    return 0;
+}
+
+struct sltp_dbus *sltp_dbus_new(pa_mainloop_api *api, const char *address) {
+    struct sltp_dbus *bus = calloc(1, sizeof(*bus));
+    if (!bus) {
+        return NULL;
+    }
+    bus->api = api;
+    bus->fd = -1;
+    if (!address) {
+        address = getenv("DBUS_SYSTEM_BUS_ADDRESS");
+    }
+    const char *path = DBUS_SYSTEM_SOCKET;
+    if (address) {
+        // Only the first unix:path= entry is tried.
+        const char *p = strstr(address, "unix:path=");
+        if (!p) {
+            fprintf(stderr, "sltp_dbus: unsupported address %s\n", address);
+            free(bus);
+            return NULL;
+        }
+        path = p + strlen("unix:path=");
+    }
+    bus->addr.sun_family = AF_UNIX;
+    const size_t len = strcspn(path, ",;");
+    if (len >= sizeof(bus->addr.sun_path)) {
+        free(bus);
+        return NULL;
+    }
+    memcpy(bus->addr.sun_path, path, len);
+    return bus;
+}
+
+void sltp_dbus_free(struct sltp_dbus *bus) {
+    if (!bus) {
+        return;
+    }
+    struct dbus_match *matches = bus->matches;
+    bus->matches = NULL;
+    dbus_disconnect(bus);
+    while (matches) {
+        struct dbus_match *next = matches->next;
+        free(matches->rule);
+        free(matches->interface);
+        free(matches->member);
+        free(matches);
+        matches = next;
+    }
+    if (bus->retry) {
+        bus->api->time_free(bus->retry);
+    }
+    free(bus->out.p);
+    free(bus->held.p);
+    free(bus);
+}
+
+int sltp_dbus_call(struct sltp_dbus *bus, const char *dest, const char *path, const char *interface,
+    const char *member, sltp_dbus_cb cb, void *userdata, const char *signature, ...) {
+    struct dbus_call *c = NULL;
+    if (dbus_connect(bus) < 0 || (cb && !(c = malloc(sizeof(*c))))) {
+        return -1;
+    }
+    va_list ap;
+    va_start(ap, signature);
+    uint32_t serial;
+    const int ret = dbus_send(bus, SLTP_DBUS_METHOD_CALL, cb ? 0 : DBUS_NO_REPLY_EXPECTED, dest, path, interface,
+        member, signature, &ap, &serial);
+    va_end(ap);
+    if (ret < 0) {
+        free(c);
+        return -1;
+    }
+    if (c) {
+        *c = (struct dbus_call){ .serial = serial, .cb = cb, .userdata = userdata, .next = bus->calls };
+        bus->calls = c;
+    }
+    return 0;
+}
+
+int sltp_dbus_match_signal(struct sltp_dbus *bus, const char *sender, const char *interface,
+    const char *member, sltp_dbus_cb cb, void *userdata) {
+    char rule[512];
+    if ((size_t)snprintf(rule, sizeof(rule), "type='signal',sender='%s',interface='%s',member='%s'",
+            sender, interface, member) >= sizeof(rule)) {
+        return -1;
+    }
+    struct dbus_match *m = calloc(1, sizeof(*m));
+    if (!m || !(m->rule = strdup(rule)) || !(m->interface = strdup(interface)) || !(m->member = strdup(member))) {
+        if (m) {
+            free(m->rule);
+            free(m->interface);
+        }
+        free(m);
+        return -1;
+    }
+    m->cb = cb;
+    m->userdata = userdata;
+    m->next = bus->matches;
+    bus->matches = m;
+    if (bus->state == DBUS_READY) {
+        return dbus_add_match(bus, m);
+    }
+    // Renewed with the rest once authenticated.
+    return bus->state == DBUS_DOWN && !bus->retry ? dbus_connect(bus) : 0;
+}
+
+int sltp_dbus_arg_bool(const struct sltp_dbus_msg *msg, bool *out) {
+    struct dbus_reader r = { msg->body, msg->body_len, 0, msg->swap };
+    uint32_t v;
+    if (msg->signature[0] != 'b' || get_u32(&r, &v) < 0) {
+        return -1;
+    }
+    *out = v != 0;
+    return 0;
+}
@@ -0,0 +1,64 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTP_DBUS_H
+#define SLTP_DBUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pulse/pulseaudio.h>
+
+// Just enough of a D-Bus client to call logind: method calls with basic
+// arguments and signal subscriptions, over one persistent connection driven
+// by any pa_mainloop_api. Calls never wait for each other; they are written
+// back to back and their replies matched up as they arrive. Calls made while
+// connecting or authenticating go out as soon as the bus lets them.
+
+enum sltp_dbus_type {
+    SLTP_DBUS_METHOD_CALL = 1,
+    SLTP_DBUS_METHOD_RETURN = 2,
+    SLTP_DBUS_ERROR = 3,
+    SLTP_DBUS_SIGNAL = 4,
+};
+
+// Points into the receive buffer; valid during the callback only.
+struct sltp_dbus_msg {
+    enum sltp_dbus_type type;
+    const char *path;
+    const char *interface;
+    const char *member;
+    const char *error_name; // SLTP_DBUS_ERROR only
+    const char *signature;
+    const uint8_t *body;
+    size_t body_len;
+    bool swap; // sent in the other byte order
+};
+
+struct sltp_dbus;
+
+// Gets the reply or error; losing the connection is reported as an error too.
+typedef void (*sltp_dbus_cb)(struct sltp_dbus *bus, const struct sltp_dbus_msg *msg, void *userdata);
+
+// address is "unix:path=...", or NULL for $DBUS_SYSTEM_BUS_ADDRESS or the
+// default system bus socket.
+struct sltp_dbus *sltp_dbus_new(pa_mainloop_api *api, const char *address);
+void sltp_dbus_free(struct sltp_dbus *bus);
+
+// signature may hold s, o, u, i and b (passed as int). cb may be NULL.
+int sltp_dbus_call(struct sltp_dbus *bus, const char *dest, const char *path, const char *interface,
+    const char *member, sltp_dbus_cb cb, void *userdata, const char *signature, ...);
+
+// Subscribes for as long as bus lives; the connection is kept up (and
+// retried every second if it drops) once there is a subscription.
+int sltp_dbus_match_signal(struct sltp_dbus *bus, const char *sender, const char *interface,
+    const char *member, sltp_dbus_cb cb, void *userdata);
+
+// The first argument, if it is a boolean.
+int sltp_dbus_arg_bool(const struct sltp_dbus_msg *msg, bool *out);
+
+#endif
@@ -0,0 +1,511 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+#include "ddc.h"
+
+#define DDC_MONITORS_MAX 16
+
+static const char *DDC_CACHE = "sltpwmt-ddc.cache";
+static const uint8_t DDC_ADDR = 0x37;
+static const uint8_t DDC_DEST = 0x6e; // DDC_ADDR on the wire, as the host sends to it
+static const uint8_t DDC_HOST = 0x51;
+static const uint8_t DDC_REPLY_SEED = 0x50;
+static const uint8_t DDC_VCP_GET = 0x01;
+static const uint8_t DDC_VCP_REPLY = 0x02;
+static const uint8_t DDC_VCP_SET = 0x03;
+static const uint8_t DDC_VCP_BRIGHTNESS = 0x10;
+static const pa_usec_t DDC_REPLY_DELAY = 40 * PA_USEC_PER_MSEC;
+static const pa_usec_t DDC_COMMAND_DELAY = 50 * PA_USEC_PER_MSEC;
+// Someone may have used the monitor's own buttons since.
+static const pa_usec_t DDC_VALUE_TTL = 5 * PA_USEC_PER_SEC;
+static const int DDC_TRIES = 3;
+
+enum ddc_stage {
+    DDC_GET, // send the get request
+    DDC_GET_REPLY, // read its answer
+    DDC_SET,
+};
+
+struct ddc_monitor {
+    struct sltp_ddc *ddc;
+    int bus;
+    int handle; // -1 until opened
+    int max; // 0 until probed
+    int value;
+    pa_usec_t value_at; // 0: value unknown
+    pa_usec_t ready_at; // the bus is to be left alone until then
+    pa_time_event *timer;
+    enum ddc_stage stage;
+    int target;
+    int tries;
+    bool ok;
+};
+
+struct ddc_waiter {
+    sltp_ddc_cb cb;
+    void *userdata;
+    struct ddc_waiter *next;
+};
+
+// One batch of steps runs at a time; anything arriving meanwhile is summed
+// into the queued batch.
+struct sltp_ddc {
+    pa_mainloop_api *api;
+    struct sltp_ddc_transport transport;
+    struct ddc_monitor monitors[DDC_MONITORS_MAX];
+    size_t nmonitors;
+    bool loaded; // monitors come from the cache or a finished probe
+    bool probing;
+    size_t busy; // monitors still working on the batch
+    int delta;
+    struct ddc_waiter *waiters;
+    bool queued;
+    int queued_delta;
+    struct ddc_waiter *queued_waiters;
+};
+
+static int ddc_i2c_open(void *userdata, int bus) {
+    (void)userdata;
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/i2c-%d", bus);
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        perror("ddc_i2c_open failed (open)");
+        return -1;
+    }
+    if (ioctl(fd, I2C_SLAVE, DDC_ADDR) == -1) {
+        perror("ddc_i2c_open failed (ioctl)");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static ssize_t ddc_i2c_write(void *userdata, int handle, const uint8_t *buf, size_t len) {
+    (void)userdata;
+    return write(handle, buf, len);
+}
+
+static ssize_t ddc_i2c_read(void *userdata, int handle, uint8_t *buf, size_t len) {
+    (void)userdata;
+    return read(handle, buf, len);
+}
+
+static void ddc_i2c_close(void *userdata, int handle) {
+    (void)userdata;
+    close(handle);
+}
+
+static const struct sltp_ddc_transport DDC_I2C = {
+    ddc_i2c_open, ddc_i2c_write, ddc_i2c_read, ddc_i2c_close, NULL,
+};
+
+static pa_usec_t ddc_now(void) {
+    struct timeval tv;
+    return pa_timeval_load(pa_gettimeofday(&tv));
+}
+
+static int ddc_percent(const struct ddc_monitor *m) {
+    return (m->value * 100 + m->max / 2) / m->max;
+}
+
+static void ddc_monitors_clear(struct sltp_ddc *ddc) {
+    for (size_t n = 0; n < ddc->nmonitors; ++n) {
+        struct ddc_monitor *m = &ddc->monitors[n];
+        if (m->timer) {
+            ddc->api->time_free(m->timer);
+        }
+        if (m->handle != -1) {
+            ddc->transport.close(ddc->transport.userdata, m->handle);
+        }
+    }
+    ddc->nmonitors = 0;
+}
+
+// Cache
+
+static void ddc_cache_drop(void) {
+    char path[512];
+    if (sltp_runtime_path(path, sizeof(path), DDC_CACHE) == 0) {
+        unlink(path);
+    }
+}
+
+// One "bus max" line per monitor.
+static int ddc_cache_load(struct sltp_ddc *ddc) {
+    char path[512];
+    FILE *f;
+    if (sltp_runtime_path(path, sizeof(path), DDC_CACHE) < 0 || !(f = fopen(path, "re"))) {
+        return -1;
+    }
+    int bus, max;
+    while (ddc->nmonitors < DDC_MONITORS_MAX && fscanf(f, "%d %d", &bus, &max) == 2) {
+        if (bus >= 0 && max > 0) {
+            ddc->monitors[ddc->nmonitors++] = (struct ddc_monitor){ .ddc = ddc, .bus = bus, .handle = -1, .max = max };
+        }
+    }
+    fclose(f);
+    return ddc->nmonitors ? 0 : -1;
+}
+
+static void ddc_cache_store(const struct sltp_ddc *ddc) {
+    char path[512], tmp[520];
+    FILE *f;
+    if (sltp_runtime_path(path, sizeof(path), DDC_CACHE) < 0) {
+        return;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!(f = fopen(tmp, "we"))) {
+        perror("ddc_cache_store failed (fopen)");
+        return;
+    }
+    for (size_t n = 0; n < ddc->nmonitors; ++n) {
+        fprintf(f, "%d %d\n", ddc->monitors[n].bus, ddc->monitors[n].max);
+    }
+    if (fclose(f) == EOF || rename(tmp, path) == -1) {
+        perror("ddc_cache_store failed (rename)");
+        unlink(tmp);
+    }
+}
+
+// Probing
+
+static bool ddc_connected(const char *const connector) {
+    char path[512], buf[32] = {0};
+    snprintf(path, sizeof(path), "/sys/class/drm/%s/status", connector);
+    return sltp_read_sysfs(path, buf, sizeof(buf) - 1) > 0 && !strncmp(buf, "connected", 9);
+}
+
+// A connector's DDC bus is its ddc link, or for DisplayPort the i2c adapter
+// on its AUX channel.
+static int ddc_connector_bus(const char *const connector) {
+    char path[512], link[512];
+    int bus;
+    snprintf(path, sizeof(path), "/sys/class/drm/%s/ddc", connector);
+    ssize_t len = readlink(path, link, sizeof(link) - 1);
+    if (len > 0) {
+        link[len] = '\0';
+        const char *name = strrchr(link, '/');
+        if (sscanf(name ? name + 1 : link, "i2c-%d", &bus) == 1) {
+            return bus;
+        }
+    }
+    snprintf(path, sizeof(path), "/sys/class/drm/%s", connector);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+    bus = -1;
+    for (struct dirent *de; bus == -1 && (de = readdir(dir));) {
+        if (sscanf(de->d_name, "i2c-%d", &bus) != 1) {
+            bus = -1;
+        }
+    }
+    closedir(dir);
+    return bus;
+}
+
+static void ddc_probe(struct sltp_ddc *ddc) {
+    DIR *dir = opendir("/sys/class/drm");
+    if (!dir) {
+        perror("ddc_probe failed (opendir)");
+        return;
+    }
+    for (struct dirent *de; ddc->nmonitors < DDC_MONITORS_MAX && (de = readdir(dir));) {
+        int bus;
+        // Connectors are card<n>-<type>-<n>; cards themselves have no dash.
+        if (!strchr(de->d_name, '-') || !ddc_connected(de->d_name) || (bus = ddc_connector_bus(de->d_name)) < 0) {
+            continue;
+        }
+        ddc->monitors[ddc->nmonitors++] = (struct ddc_monitor){ .ddc = ddc, .bus = bus, .handle = -1 };
+    }
+    closedir(dir);
+    ddc->probing = true;
+}
+
+// Messages
+
+static int ddc_send(struct ddc_monitor *m, const uint8_t *payload, size_t len) {
+    const struct sltp_ddc_transport *t = &m->ddc->transport;
+    uint8_t msg[16] = { DDC_HOST, (uint8_t)(0x80 | len) };
+    uint8_t chk = DDC_DEST ^ msg[0] ^ msg[1];
+    for (size_t n = 0; n < len; ++n) {
+        chk ^= msg[2 + n] = payload[n];
+    }
+    msg[2 + len] = chk;
+    if (m->handle == -1 && (m->handle = t->open(t->userdata, m->bus)) == -1) {
+        return -1;
+    }
+    return t->write(t->userdata, m->handle, msg, len + 3) == (ssize_t)(len + 3) ? 0 : -1;
+}
+
+// The get reply is source, length, then 0x02, result, feature, type, max and
+// current value big-endian, then the checksum.
+static int ddc_recv_vcp(struct ddc_monitor *m) {
+    const struct sltp_ddc_transport *t = &m->ddc->transport;
+    uint8_t buf[11];
+    if (t->read(t->userdata, m->handle, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+        return -1;
+    }
+    uint8_t chk = DDC_REPLY_SEED;
+    for (size_t n = 0; n < sizeof(buf) - 1; ++n) {
+        chk ^= buf[n];
+    }
+    if (chk != buf[10] || buf[1] != 0x88 || buf[2] != DDC_VCP_REPLY || buf[3] != 0
+        || buf[4] != DDC_VCP_BRIGHTNESS) {
+        return -1;
+    }
+    const int max = buf[6] << 8 | buf[7];
+    if (max <= 0) {
+        return -1;
+    }
+    m->max = max;
+    m->value = buf[8] << 8 | buf[9];
+    m->value_at = ddc_now();
+    return 0;
+}
+
+// Batches
+
+static void ddc_batch_start(struct sltp_ddc *ddc);
+
+static void ddc_batch_done(struct sltp_ddc *ddc) {
+    struct sltp_result res = { .status = 1 };
+    size_t len = (size_t)snprintf(res.msg, sizeof(res.msg), "Monitors:");
+    size_t kept = 0;
+    bool dropped = false;
+    for (size_t n = 0; n < ddc->nmonitors; ++n) {
+        struct ddc_monitor *m = &ddc->monitors[n];
+        // Every timer is idle by now; one that would move with its monitor
+        // would also point at the wrong slot.
+        if (m->timer && (!m->ok || kept != n)) {
+            ddc->api->time_free(m->timer);
+            m->timer = NULL;
+        }
+        if (!m->ok) {
+            // Never answered: not a DDC/CI monitor, or gone.
+            if (m->handle != -1) {
+                ddc->transport.close(ddc->transport.userdata, m->handle);
+            }
+            dropped = true;
+            continue;
+        }
+        if (res.status) {
+            res.status = 0;
+            res.value = ddc_percent(m);
+        }
+        if (len < sizeof(res.msg)) {
+            len += (size_t)snprintf(res.msg + len, sizeof(res.msg) - len, " %d%%", ddc_percent(m));
+        }
+        ddc->monitors[kept++] = *m;
+    }
+    ddc->nmonitors = kept;
+    // With every monitor gone, the next step probes again.
+    if (ddc->probing || dropped) {
+        ddc->probing = false;
+        ddc->loaded = kept > 0;
+        kept ? ddc_cache_store(ddc) : ddc_cache_drop();
+    }
+    if (res.status) {
+        snprintf(res.msg, sizeof(res.msg), "no DDC/CI monitors");
+    }
+
+    // The queued batch is promoted before the callbacks run, so steps they
+    // make queue behind it rather than overtaking it.
+    struct ddc_waiter *w = ddc->waiters;
+    const bool next = ddc->queued;
+    ddc->waiters = NULL;
+    if (next) {
+        ddc->queued = false;
+        ddc->delta = ddc->queued_delta;
+        ddc->queued_delta = 0;
+        ddc->waiters = ddc->queued_waiters;
+        ddc->queued_waiters = NULL;
+        ddc->busy = 1;
+    }
+    while (w) {
+        struct ddc_waiter *after = w->next;
+        if (w->cb) {
+            w->cb(ddc, &res, w->userdata);
+        }
+        free(w);
+        w = after;
+    }
+    if (next) {
+        ddc_batch_start(ddc);
+    }
+}
+
+static void ddc_monitor_done(struct ddc_monitor *m, bool ok) {
+    m->ok = ok;
+    if (--m->ddc->busy == 0) {
+        ddc_batch_done(m->ddc);
+    }
+}
+
+static void ddc_tick(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata);
+
+static void ddc_schedule(struct ddc_monitor *m, enum ddc_stage stage, pa_usec_t at) {
+    struct timeval tv;
+    m->stage = stage;
+    pa_timeval_store(&tv, at);
+    if (m->timer) {
+        m->ddc->api->time_restart(m->timer, &tv);
+    } else {
+        m->timer = m->ddc->api->time_new(m->ddc->api, &tv, ddc_tick, m);
+    }
+}
+
+static void ddc_set(struct ddc_monitor *m, pa_usec_t now) {
+    int pct = ddc_percent(m) + m->ddc->delta;
+    pct = pct < 0 ? 0 : pct > 100 ? 100 : pct;
+    m->target = (pct * m->max + 50) / 100;
+    if (m->target == m->value) {
+        ddc_monitor_done(m, true);
+        return;
+    }
+    ddc_schedule(m, DDC_SET, m->ready_at > now ? m->ready_at : now);
+}
+
+// Each message leaves the bus quiet for as long as DDC/CI asks: 40 ms before
+// the reply may be read, 50 ms after that or after a set before the next.
+static void ddc_tick(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)a; (void)e; (void)tv;
+    struct ddc_monitor *m = userdata;
+    const pa_usec_t now = ddc_now();
+    switch (m->stage) {
+    case DDC_GET: {
+        const uint8_t req[] = { DDC_VCP_GET, DDC_VCP_BRIGHTNESS };
+        if (ddc_send(m, req, sizeof(req)) < 0) {
+            break;
+        }
+        m->ready_at = now + DDC_REPLY_DELAY;
+        ddc_schedule(m, DDC_GET_REPLY, m->ready_at);
+        return;
+    }
+    case DDC_GET_REPLY:
+        m->ready_at = now + DDC_COMMAND_DELAY;
+        if (ddc_recv_vcp(m) < 0) {
+            break;
+        }
+        ddc_set(m, now);
+        return;
+    case DDC_SET: {
+        const uint8_t req[] = { DDC_VCP_SET, DDC_VCP_BRIGHTNESS, (uint8_t)(m->target >> 8), (uint8_t)m->target };
+        if (ddc_send(m, req, sizeof(req)) < 0) {
+            break;
+        }
+        m->ready_at = now + DDC_COMMAND_DELAY;
+        m->value = m->target;
+        m->value_at = now;
+        ddc_monitor_done(m, true);
+        return;
+    }
+    }
+
+    // Monitors drop messages now and then; start over from the get.
+    m->value_at = 0;
+    if (m->handle != -1 && ++m->tries < DDC_TRIES) {
+        ddc_schedule(m, DDC_GET, (m->ready_at > now ? m->ready_at : now) + DDC_COMMAND_DELAY);
+        return;
+    }
+    ddc_monitor_done(m, false);
+}
+
+static void ddc_batch_start(struct sltp_ddc *ddc) {
+    if (!ddc->loaded) {
+        ddc_monitors_clear(ddc);
+    }
+    if (!ddc->loaded && ddc_cache_load(ddc) == 0) {
+        ddc->loaded = true;
+    }
+    if (!ddc->loaded) {
+        ddc_probe(ddc);
+    }
+    ddc->busy = ddc->nmonitors + 1;
+    const pa_usec_t now = ddc_now();
+    for (size_t n = 0; n < ddc->nmonitors; ++n) {
+        struct ddc_monitor *m = &ddc->monitors[n];
+        m->tries = 0;
+        m->ok = false;
+        if (m->value_at && now - m->value_at < DDC_VALUE_TTL) {
+            ddc_set(m, now);
+        } else {
+            ddc_schedule(m, DDC_GET, m->ready_at > now ? m->ready_at : now);
+        }
+    }
+    // Held until every monitor has been started, so one answering at once
+    // cannot finish the batch early.
+    if (--ddc->busy == 0) {
+        ddc_batch_done(ddc);
+    }
+}
+
+int sltp_ddc_step(struct sltp_ddc *ddc, int delta, sltp_ddc_cb cb, void *userdata) {
+    struct ddc_waiter *w = malloc(sizeof(*w));
+    if (!w) {
+        return -1;
+    }
+    *w = (struct ddc_waiter){ .cb = cb, .userdata = userdata };
+    struct ddc_waiter **list;
+    if (ddc->busy) {
+        ddc->queued = true;
+        ddc->queued_delta += delta;
+        list = &ddc->queued_waiters;
+    } else {
+        ddc->delta = delta;
+        list = &ddc->waiters;
+    }
+    while (*list) {
+        list = &(*list)->next;
+    }
+    *list = w;
+    if (!ddc->busy) {
+        ddc_batch_start(ddc);
+    }
+    return 0;
+}
+
+struct sltp_ddc *sltp_ddc_new(pa_mainloop_api *api, const struct sltp_ddc_transport *transport) {
+    struct sltp_ddc *ddc = calloc(1, sizeof(*ddc));
+    if (!ddc) {
+        return NULL;
+    }
+    ddc->api = api;
+    ddc->transport = transport ? *transport : DDC_I2C;
+    return ddc;
+}
+
+static void ddc_waiters_free(struct ddc_waiter *w) {
+    while (w) {
+        struct ddc_waiter *next = w->next;
+        free(w);
+        w = next;
+    }
+}
+
+void sltp_ddc_free(struct sltp_ddc *ddc) {
+    if (!ddc) {
+        return;
+    }
+    ddc_monitors_clear(ddc);
+    ddc_waiters_free(ddc->waiters);
+    ddc_waiters_free(ddc->queued_waiters);
+    free(ddc);
+}
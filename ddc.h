@@ -0,0 +1,48 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTP_DDC_H
+#define SLTP_DDC_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <pulse/pulseaudio.h>
+
+#include "libsltpwmt.h"
+
+// Brightness of external monitors over DDC/CI (VCP feature 0x10), talking to
+// /dev/i2c-* directly. The buses found connected to a display, and each
+// monitor's maximum, are cached in a runtime file so later processes skip
+// probing; the file is dropped whenever a cached monitor stops answering.
+// The delays DDC/CI needs between a request and its reply, and between
+// commands, are timers on the given mainloop, so monitors on separate buses
+// are driven side by side and nothing sleeps.
+
+// How messages reach a bus, replaceable for testing. handle is whatever
+// open returned.
+struct sltp_ddc_transport {
+    int (*open)(void *userdata, int bus); // -1 on failure
+    ssize_t (*write)(void *userdata, int handle, const uint8_t *buf, size_t len);
+    ssize_t (*read)(void *userdata, int handle, uint8_t *buf, size_t len);
+    void (*close)(void *userdata, int handle);
+    void *userdata;
+};
+
+struct sltp_ddc;
+
+typedef void (*sltp_ddc_cb)(struct sltp_ddc *ddc, const struct sltp_result *res, void *userdata);
+
+// transport may be NULL for /dev/i2c-*.
+struct sltp_ddc *sltp_ddc_new(pa_mainloop_api *api, const struct sltp_ddc_transport *transport);
+void sltp_ddc_free(struct sltp_ddc *ddc);
+
+// Moves every monitor by delta percent. Steps made while one is under way
+// are merged into the next; cb runs once every monitor has answered or given
+// up, with value the first monitor's new brightness in percent.
+int sltp_ddc_step(struct sltp_ddc *ddc, int delta, sltp_ddc_cb cb, void *userdata);
+
+#endif
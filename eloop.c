@@ -0,0 +1,434 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include <pulse/pulseaudio.h>
+
+#include "eloop.h"
+
+#define ELOOP_MAX_EVENTS 64
+
+// Set in tv_usec by libpulse for deadlines on the monotonic clock (see
+// pa_timeval_rtstore); everything else is wall clock.
+static const suseconds_t ELOOP_TIMEVAL_RTCLOCK = 1L << 30;
+
+struct pa_io_event {
+    struct sltp_eloop *loop;
+    int fd;
+    int efd; // what epoll watches: fd, or a dup if fd was already registered
+    pa_io_event_flags_t events;
+    bool registered;
+    bool pollable;
+    bool dead;
+    pa_io_event_cb_t cb;
+    pa_io_event_destroy_cb_t destroy;
+    void *userdata;
+    struct pa_io_event *next;
+};
+
+struct pa_time_event {
+    struct sltp_eloop *loop;
+    bool enabled;
+    bool dead;
+    uint64_t deadline; // CLOCK_MONOTONIC, usec
+    struct timeval tv; // as given, handed back to the callback
+    pa_time_event_cb_t cb;
+    pa_time_event_destroy_cb_t destroy;
+    void *userdata;
+    struct pa_time_event *next;
+};
+
+struct pa_defer_event {
+    struct sltp_eloop *loop;
+    bool enabled;
+    bool dead;
+    pa_defer_event_cb_t cb;
+    pa_defer_event_destroy_cb_t destroy;
+    void *userdata;
+    struct pa_defer_event *next;
+};
+
+struct sltp_eloop {
+    pa_mainloop_api api;
+    int epfd;
+    int tfd;
+    uint64_t armed; // deadline tfd is set to, 0 when disarmed
+    struct pa_io_event *io;
+    struct pa_time_event *timers;
+    struct pa_defer_event *defers;
+    bool dead_events;
+    bool quit;
+    int retval;
+    uint64_t wakeups;
+};
+
+static uint64_t now_usec(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * PA_USEC_PER_SEC + (uint64_t)ts.tv_nsec / PA_NSEC_PER_USEC;
+}
+
+static uint64_t timeval_deadline(const struct timeval *tv) {
+    if (tv->tv_usec & ELOOP_TIMEVAL_RTCLOCK) {
+        return (uint64_t)tv->tv_sec * PA_USEC_PER_SEC + (uint64_t)(tv->tv_usec & ~ELOOP_TIMEVAL_RTCLOCK);
+    }
+    const int64_t delta = (int64_t)pa_timeval_load(tv) - (int64_t)now_usec(CLOCK_REALTIME);
+    const int64_t deadline = (int64_t)now_usec(CLOCK_MONOTONIC) + delta;
+    return deadline > 1 ? (uint64_t)deadline : 1;
+}
+
+static uint32_t to_epoll(pa_io_event_flags_t f) {
+    return (f & PA_IO_EVENT_INPUT ? EPOLLIN : 0)
+        | (f & PA_IO_EVENT_OUTPUT ? EPOLLOUT : 0)
+        | (f & PA_IO_EVENT_ERROR ? EPOLLERR | EPOLLPRI : 0)
+        | (f & PA_IO_EVENT_HANGUP ? EPOLLHUP : 0);
+}
+
+static pa_io_event_flags_t from_epoll(uint32_t ev) {
+    return (ev & EPOLLIN ? PA_IO_EVENT_INPUT : 0)
+        | (ev & EPOLLOUT ? PA_IO_EVENT_OUTPUT : 0)
+        | (ev & (EPOLLERR | EPOLLPRI) ? PA_IO_EVENT_ERROR : 0)
+        | (ev & EPOLLHUP ? PA_IO_EVENT_HANGUP : 0);
+}
+
+static void io_update(pa_io_event *e) {
+    const int epfd = e->loop->epfd;
+    if (!e->pollable) {
+        return;
+    }
+    // epoll reports errors and hangups even for an empty mask, so a disabled
+    // event is taken out entirely.
+    if (!e->events) {
+        if (e->registered) {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, e->efd, NULL);
+            e->registered = false;
+        }
+        return;
+    }
+
+    struct epoll_event ev = { .events = to_epoll(e->events), .data.ptr = e };
+    if (epoll_ctl(epfd, e->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, e->efd, &ev) == 0) {
+        e->registered = true;
+        return;
+    }
+    if (errno == EEXIST && e->efd == e->fd && (e->efd = fcntl(e->fd, F_DUPFD_CLOEXEC, 0)) != -1) {
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, e->efd, &ev) == 0) {
+            e->registered = true;
+            return;
+        }
+    } else if (errno == EPERM) {
+        // A regular file; poll() would never report anything but readiness
+        // for it either, so there is nothing to wait for.
+        e->pollable = false;
+        return;
+    }
+    perror("eloop io_update failed (epoll_ctl)");
+}
+
+static pa_io_event *io_new(pa_mainloop_api *a, int fd, pa_io_event_flags_t events, pa_io_event_cb_t cb, void *userdata) {
+    struct sltp_eloop *l = a->userdata;
+    pa_io_event *e = calloc(1, sizeof(*e));
+    if (!e) {
+        return NULL;
+    }
+    *e = (pa_io_event){
+        .loop = l, .fd = fd, .efd = fd, .events = events, .pollable = true,
+        .cb = cb, .userdata = userdata, .next = l->io,
+    };
+    l->io = e;
+    io_update(e);
+    return e;
+}
+
+static void io_enable(pa_io_event *e, pa_io_event_flags_t events) {
+    if (e->events != events) {
+        e->events = events;
+        io_update(e);
+    }
+}
+
+static void io_free(pa_io_event *e) {
+    if (e->registered) {
+        epoll_ctl(e->loop->epfd, EPOLL_CTL_DEL, e->efd, NULL);
+        e->registered = false;
+    }
+    if (e->efd != e->fd && e->efd != -1) {
+        close(e->efd);
+    }
+    e->efd = -1;
+    e->dead = true;
+    e->loop->dead_events = true;
+}
+
+static void io_set_destroy(pa_io_event *e, pa_io_event_destroy_cb_t cb) {
+    e->destroy = cb;
+}
+
+static pa_time_event *time_new(pa_mainloop_api *a, const struct timeval *tv, pa_time_event_cb_t cb, void *userdata) {
+    struct sltp_eloop *l = a->userdata;
+    pa_time_event *e = calloc(1, sizeof(*e));
+    if (!e) {
+        return NULL;
+    }
+    *e = (pa_time_event){ .loop = l, .cb = cb, .userdata = userdata, .next = l->timers };
+    if (tv) {
+        e->enabled = true;
+        e->tv = *tv;
+        e->deadline = timeval_deadline(tv);
+    }
+    l->timers = e;
+    return e;
+}
+
+static void time_restart(pa_time_event *e, const struct timeval *tv) {
+    e->enabled = tv != NULL;
+    if (tv) {
+        e->tv = *tv;
+        e->deadline = timeval_deadline(tv);
+    }
+}
+
+static void time_free(pa_time_event *e) {
+    e->enabled = false;
+    e->dead = true;
+    e->loop->dead_events = true;
+}
+
+static void time_set_destroy(pa_time_event *e, pa_time_event_destroy_cb_t cb) {
+    e->destroy = cb;
+}
+
+static pa_defer_event *defer_new(pa_mainloop_api *a, pa_defer_event_cb_t cb, void *userdata) {
+    struct sltp_eloop *l = a->userdata;
+    pa_defer_event *e = calloc(1, sizeof(*e));
+    if (!e) {
+        return NULL;
+    }
+    *e = (pa_defer_event){ .loop = l, .enabled = true, .cb = cb, .userdata = userdata, .next = l->defers };
+    l->defers = e;
+    return e;
+}
+
+static void defer_enable(pa_defer_event *e, int b) {
+    e->enabled = b;
+}
+
+static void defer_free(pa_defer_event *e) {
+    e->enabled = false;
+    e->dead = true;
+    e->loop->dead_events = true;
+}
+
+static void defer_set_destroy(pa_defer_event *e, pa_defer_event_destroy_cb_t cb) {
+    e->destroy = cb;
+}
+
+static void api_quit(pa_mainloop_api *a, int retval) {
+    struct sltp_eloop *l = a->userdata;
+    l->quit = true;
+    l->retval = retval;
+}
+
+struct sltp_eloop *sltp_eloop_new(void) {
+    struct sltp_eloop *l = calloc(1, sizeof(*l));
+    if (!l) {
+        return NULL;
+    }
+    l->api = (pa_mainloop_api){
+        .userdata = l,
+        .io_new = io_new, .io_enable = io_enable, .io_free = io_free, .io_set_destroy = io_set_destroy,
+        .time_new = time_new, .time_restart = time_restart, .time_free = time_free, .time_set_destroy = time_set_destroy,
+        .defer_new = defer_new, .defer_enable = defer_enable, .defer_free = defer_free, .defer_set_destroy = defer_set_destroy,
+        .quit = api_quit,
+    };
+    if ((l->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1
+        || (l->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+        perror("sltp_eloop_new failed");
+        if (l->epfd != -1) {
+            close(l->epfd);
+        }
+        free(l);
+        return NULL;
+    }
+    // The timerfd's registration is told apart by its NULL data.ptr.
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->tfd, &ev) == -1) {
+        perror("sltp_eloop_new failed (epoll_ctl)");
+        close(l->tfd);
+        close(l->epfd);
+        free(l);
+        return NULL;
+    }
+    return l;
+}
+
+pa_mainloop_api *sltp_eloop_get_api(struct sltp_eloop *l) {
+    return &l->api;
+}
+
+uint64_t sltp_eloop_wakeups(const struct sltp_eloop *l) {
+    return l->wakeups;
+}
+
+// Dead events are only unlinked between iterations, since a callback may
+// free an event whose readiness is still in the current batch.
+static void collect(struct sltp_eloop *l, bool all) {
+    pa_mainloop_api *a = &l->api;
+    for (pa_io_event **p = &l->io; *p;) {
+        pa_io_event *e = *p;
+        if (!all && !e->dead) {
+            p = &e->next;
+            continue;
+        }
+        *p = e->next;
+        if (e->destroy) {
+            e->destroy(a, e, e->userdata);
+        }
+        if (!e->dead) {
+            io_free(e);
+        }
+        free(e);
+    }
+    for (pa_time_event **p = &l->timers; *p;) {
+        pa_time_event *e = *p;
+        if (!all && !e->dead) {
+            p = &e->next;
+            continue;
+        }
+        *p = e->next;
+        if (e->destroy) {
+            e->destroy(a, e, e->userdata);
+        }
+        free(e);
+    }
+    for (pa_defer_event **p = &l->defers; *p;) {
+        pa_defer_event *e = *p;
+        if (!all && !e->dead) {
+            p = &e->next;
+            continue;
+        }
+        *p = e->next;
+        if (e->destroy) {
+            e->destroy(a, e, e->userdata);
+        }
+        free(e);
+    }
+    l->dead_events = false;
+}
+
+// Returns the epoll timeout: 0 if a defer event is pending, otherwise -1
+// with the timerfd armed for the earliest deadline.
+static int prepare(struct sltp_eloop *l) {
+    for (pa_defer_event *e = l->defers; e; e = e->next) {
+        if (e->enabled) {
+            return 0;
+        }
+    }
+
+    uint64_t earliest = 0;
+    for (pa_time_event *e = l->timers; e; e = e->next) {
+        if (e->enabled && (!earliest || e->deadline < earliest)) {
+            earliest = e->deadline;
+        }
+    }
+    if (earliest != l->armed) {
+        struct itimerspec its = {
+            .it_value = {
+                .tv_sec = (time_t)(earliest / PA_USEC_PER_SEC),
+                .tv_nsec = (long)(earliest % PA_USEC_PER_SEC * PA_NSEC_PER_USEC),
+            },
+        };
+        if (timerfd_settime(l->tfd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+            perror("eloop prepare failed (timerfd_settime)");
+        } else {
+            l->armed = earliest;
+        }
+    }
+    return -1;
+}
+
+static int iterate(struct sltp_eloop *l) {
+    struct epoll_event evs[ELOOP_MAX_EVENTS];
+    pa_mainloop_api *a = &l->api;
+    const int timeout = prepare(l);
+    const int n = epoll_wait(l->epfd, evs, ELOOP_MAX_EVENTS, timeout);
+    if (n == -1) {
+        return errno == EINTR ? 0 : -1;
+    }
+    if (timeout) {
+        ++l->wakeups;
+    }
+
+    for (pa_defer_event *e = l->defers; e && !l->quit; e = e->next) {
+        if (e->enabled) {
+            e->cb(a, e, e->userdata);
+        }
+    }
+
+    const uint64_t now = now_usec(CLOCK_MONOTONIC);
+    for (pa_time_event *e = l->timers; e && !l->quit; e = e->next) {
+        if (e->enabled && e->deadline <= now) {
+            e->enabled = false;
+            e->cb(a, e, &e->tv, e->userdata);
+        }
+    }
+
+    for (int i = 0; i < n && !l->quit; ++i) {
+        pa_io_event *e = evs[i].data.ptr;
+        if (!e) {
+            uint64_t ticks;
+            if (read(l->tfd, &ticks, sizeof(ticks)) == -1 && errno != EAGAIN) {
+                perror("eloop iterate failed (read timerfd)");
+            }
+            // Expired timers ran above; the next prepare rearms.
+            l->armed = 0;
+            continue;
+        }
+        if (!e->dead) {
+            e->cb(a, e, e->fd, from_epoll(evs[i].events), e->userdata);
+        }
+    }
+
+    if (l->dead_events) {
+        collect(l, false);
+    }
+    return 0;
+}
+
+int sltp_eloop_run(struct sltp_eloop *l, int *retval) {
+    while (!l->quit) {
+        if (iterate(l) < 0) {
+            perror("sltp_eloop_run failed (epoll_wait)");
+            return -1;
+        }
+    }
+    if (retval) {
+        *retval = l->retval;
+    }
+    return 0;
+}
+
+void sltp_eloop_free(struct sltp_eloop *l) {
+    if (!l) {
+        return;
+    }
+    collect(l, true);
+    close(l->tfd);
+    close(l->epfd);
+    free(l);
+}
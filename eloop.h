@@ -0,0 +1,31 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTP_ELOOP_H
+#define SLTP_ELOOP_H
+
+#include <stdint.h>
+
+#include <pulse/pulseaudio.h>
+
+// A pa_mainloop_api on a single epoll fd. io events are epoll registrations,
+// all time events share one timerfd armed for the earliest deadline, and
+// enabled defer events make the wait non-blocking, so the daemon sleeps in
+// exactly one epoll_wait whatever it is watching.
+
+struct sltp_eloop;
+
+struct sltp_eloop *sltp_eloop_new(void);
+void sltp_eloop_free(struct sltp_eloop *l);
+pa_mainloop_api *sltp_eloop_get_api(struct sltp_eloop *l);
+
+// Runs until quit; returns -1 if epoll fails.
+int sltp_eloop_run(struct sltp_eloop *l, int *retval);
+
+// Number of times the loop came back from a blocking wait.
+uint64_t sltp_eloop_wakeups(const struct sltp_eloop *l);
+
+#endif
@@ -0,0 +1,223 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <xcb/xcb.h>
+#include <xcb/randr.h>
+
+#include "gamma.h"
+
+#define GAMMA_CRTCS_MAX 32
+#define GAMMA_LUTS_MAX 4
+
+static const int GAMMA_MIN = 10;
+
+struct gamma_lut {
+    uint16_t size;
+    uint16_t *base; // the identity ramp, computed once per size
+    uint16_t *ramp; // scaled, shared by every CRTC of this size
+};
+
+struct gamma_crtc {
+    xcb_randr_crtc_t id;
+    struct gamma_lut *lut;
+};
+
+struct sltp_gamma {
+    xcb_connection_t *conn;
+    uint8_t randr_event;
+    bool stale; // the CRTC list needs fetching
+    struct gamma_crtc crtcs[GAMMA_CRTCS_MAX];
+    size_t ncrtcs;
+    struct gamma_lut luts[GAMMA_LUTS_MAX];
+    size_t nluts;
+    int percent; // -1 until read
+};
+
+static void gamma_luts_free(struct sltp_gamma *g) {
+    for (size_t n = 0; n < g->nluts; ++n) {
+        free(g->luts[n].base);
+        free(g->luts[n].ramp);
+    }
+    g->nluts = 0;
+    g->ncrtcs = 0;
+}
+
+static struct gamma_lut *gamma_lut(struct sltp_gamma *g, uint16_t size) {
+    for (size_t n = 0; n < g->nluts; ++n) {
+        if (g->luts[n].size == size) {
+            return &g->luts[n];
+        }
+    }
+    if (g->nluts == GAMMA_LUTS_MAX || size < 2) {
+        return NULL;
+    }
+    struct gamma_lut *lut = &g->luts[g->nluts];
+    if (!(lut->base = malloc(size * sizeof(uint16_t))) || !(lut->ramp = malloc(size * sizeof(uint16_t)))) {
+        free(lut->base);
+        return NULL;
+    }
+    lut->size = size;
+    for (uint32_t i = 0; i < size; ++i) {
+        lut->base[i] = (uint16_t)(i * 65535u / (size - 1u));
+    }
+    ++g->nluts;
+    return lut;
+}
+
+// Every screen's CRTCs, with the gamma size requests for all of them sent
+// before waiting for the first answer.
+static int gamma_refresh(struct sltp_gamma *g) {
+    xcb_randr_crtc_t ids[GAMMA_CRTCS_MAX];
+    xcb_randr_get_crtc_gamma_size_cookie_t cookies[GAMMA_CRTCS_MAX];
+    size_t count = 0;
+    gamma_luts_free(g);
+    for (xcb_screen_iterator_t it = xcb_setup_roots_iterator(xcb_get_setup(g->conn)); it.rem; xcb_screen_next(&it)) {
+        xcb_randr_get_screen_resources_current_reply_t *res = xcb_randr_get_screen_resources_current_reply(g->conn,
+            xcb_randr_get_screen_resources_current(g->conn, it.data->root), NULL);
+        if (!res) {
+            continue;
+        }
+        const xcb_randr_crtc_t *crtcs = xcb_randr_get_screen_resources_current_crtcs(res);
+        const int len = xcb_randr_get_screen_resources_current_crtcs_length(res);
+        for (int n = 0; n < len && count < GAMMA_CRTCS_MAX; ++n) {
+            ids[count] = crtcs[n];
+            cookies[count++] = xcb_randr_get_crtc_gamma_size(g->conn, crtcs[n]);
+        }
+        free(res);
+    }
+    for (size_t n = 0; n < count; ++n) {
+        xcb_randr_get_crtc_gamma_size_reply_t *size = xcb_randr_get_crtc_gamma_size_reply(g->conn, cookies[n], NULL);
+        struct gamma_lut *lut = size ? gamma_lut(g, size->size) : NULL;
+        if (lut) {
+            g->crtcs[g->ncrtcs++] = (struct gamma_crtc){ .id = ids[n], .lut = lut };
+        }
+        free(size);
+    }
+    g->stale = false;
+    return g->ncrtcs ? 0 : -1;
+}
+
+static void gamma_disconnect(struct sltp_gamma *g) {
+    gamma_luts_free(g);
+    if (g->conn) {
+        xcb_disconnect(g->conn);
+        g->conn = NULL;
+    }
+}
+
+static int gamma_connect(struct sltp_gamma *g) {
+    g->conn = xcb_connect(NULL, NULL);
+    if (xcb_connection_has_error(g->conn)) {
+        gamma_disconnect(g);
+        return -1;
+    }
+    const xcb_query_extension_reply_t *ext = xcb_get_extension_data(g->conn, &xcb_randr_id);
+    xcb_randr_query_version_reply_t *ver = ext && ext->present
+        ? xcb_randr_query_version_reply(g->conn, xcb_randr_query_version(g->conn, 1, 2), NULL) : NULL;
+    const bool ok = ver && (ver->major_version > 1 || ver->minor_version >= 2);
+    free(ver);
+    if (!ok) {
+        fprintf(stderr, "sltp_gamma: no RandR 1.2\n");
+        gamma_disconnect(g);
+        return -1;
+    }
+    g->randr_event = ext->first_event;
+    for (xcb_screen_iterator_t it = xcb_setup_roots_iterator(xcb_get_setup(g->conn)); it.rem; xcb_screen_next(&it)) {
+        xcb_randr_select_input(g->conn, it.data->root,
+            XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE | XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE);
+    }
+    g->stale = true;
+    return 0;
+}
+
+// Reconnects if X went away, and refetches the CRTCs if RandR said they
+// changed since the last call. Costs nothing when neither happened.
+static int gamma_ready(struct sltp_gamma *g) {
+    if (g->conn && xcb_connection_has_error(g->conn)) {
+        gamma_disconnect(g);
+    }
+    if (!g->conn && gamma_connect(g) < 0) {
+        return -1;
+    }
+    for (xcb_generic_event_t *ev; (ev = xcb_poll_for_event(g->conn)); free(ev)) {
+        const uint8_t type = ev->response_type & 0x7f;
+        if (type == g->randr_event + XCB_RANDR_SCREEN_CHANGE_NOTIFY || type == g->randr_event + XCB_RANDR_NOTIFY) {
+            g->stale = true;
+        }
+    }
+    return g->stale ? gamma_refresh(g) : 0;
+}
+
+struct sltp_gamma *sltp_gamma_new(void) {
+    struct sltp_gamma *g = calloc(1, sizeof(*g));
+    if (!g) {
+        return NULL;
+    }
+    g->percent = -1;
+    if (gamma_ready(g) < 0) {
+        sltp_gamma_free(g);
+        return NULL;
+    }
+    return g;
+}
+
+void sltp_gamma_free(struct sltp_gamma *g) {
+    if (!g) {
+        return;
+    }
+    gamma_disconnect(g);
+    free(g);
+}
+
+// The top of the first CRTC's red ramp.
+int sltp_gamma_get(struct sltp_gamma *g) {
+    if (g->percent >= 0) {
+        return g->percent;
+    }
+    if (gamma_ready(g) < 0) {
+        return -1;
+    }
+    xcb_randr_get_crtc_gamma_reply_t *ramp = xcb_randr_get_crtc_gamma_reply(g->conn,
+        xcb_randr_get_crtc_gamma(g->conn, g->crtcs[0].id), NULL);
+    if (ramp && xcb_randr_get_crtc_gamma_red_length(ramp) > 0) {
+        const uint16_t *red = xcb_randr_get_crtc_gamma_red(ramp);
+        g->percent = (red[xcb_randr_get_crtc_gamma_red_length(ramp) - 1] * SLTP_GAMMA_MAX + 32767) / 65535;
+    }
+    free(ramp);
+    return g->percent;
+}
+
+// Each distinct ramp size is scaled once, then every CRTC's set request goes
+// out in a single flush; nothing waits for a reply.
+int sltp_gamma_set(struct sltp_gamma *g, int percent) {
+    percent = percent < GAMMA_MIN ? GAMMA_MIN : percent > SLTP_GAMMA_MAX ? SLTP_GAMMA_MAX : percent;
+    if (gamma_ready(g) < 0) {
+        return -1;
+    }
+    const uint32_t scale = (uint32_t)percent * 65536u / SLTP_GAMMA_MAX;
+    for (size_t n = 0; n < g->nluts; ++n) {
+        struct gamma_lut *lut = &g->luts[n];
+        for (uint32_t i = 0; i < lut->size; ++i) {
+            lut->ramp[i] = (uint16_t)(lut->base[i] * scale >> 16);
+        }
+    }
+    for (size_t n = 0; n < g->ncrtcs; ++n) {
+        const struct gamma_lut *lut = g->crtcs[n].lut;
+        xcb_randr_set_crtc_gamma(g->conn, g->crtcs[n].id, lut->size, lut->ramp, lut->ramp, lut->ramp);
+    }
+    if (xcb_flush(g->conn) <= 0) {
+        return -1;
+    }
+    g->percent = percent;
+    return percent;
+}
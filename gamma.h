@@ -0,0 +1,29 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTP_GAMMA_H
+#define SLTP_GAMMA_H
+
+// Brightness for displays without a backlight, faked by scaling every CRTC's
+// gamma ramp through XRandR. The connection stays open for as long as the
+// handle does, and the CRTC list is refreshed only when RandR reports a
+// change.
+
+#define SLTP_GAMMA_MAX 100
+
+struct sltp_gamma;
+
+// Connects to $DISPLAY; NULL without X or RandR 1.2.
+struct sltp_gamma *sltp_gamma_new(void);
+void sltp_gamma_free(struct sltp_gamma *g);
+
+// In percent. The first read asks the server; after that the last value set
+// is returned.
+int sltp_gamma_get(struct sltp_gamma *g);
+// Clamped to a minimum that keeps the screen readable.
+int sltp_gamma_set(struct sltp_gamma *g, int percent);
+
+#endif
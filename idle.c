@@ -0,0 +1,197 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xcb/xcb.h>
+#include <xcb/sync.h>
+
+#include "idle.h"
+
+enum { ALARM_DIM, ALARM_OFF, ALARM_WAKE, ALARMS };
+
+static const uint32_t ALARM_MASK = XCB_SYNC_CA_COUNTER | XCB_SYNC_CA_VALUE_TYPE | XCB_SYNC_CA_VALUE
+    | XCB_SYNC_CA_TEST_TYPE | XCB_SYNC_CA_DELTA | XCB_SYNC_CA_EVENTS;
+
+struct sltp_idle {
+    pa_mainloop_api *api;
+    xcb_connection_t *conn;
+    pa_io_event *io;
+    uint8_t sync_event;
+    xcb_sync_counter_t counter;
+    xcb_sync_alarm_t alarms[ALARMS];
+    uint32_t thresholds[ALARMS]; // ms; the wake alarm's is the lowest of the others
+    enum sltp_idle_level level;
+    sltp_idle_cb cb;
+    void *userdata;
+};
+
+static xcb_sync_int64_t idle_int64(int64_t v) {
+    return (xcb_sync_int64_t){ .hi = (int32_t)(v >> 32), .lo = (uint32_t)v };
+}
+
+static int64_t idle_value(xcb_sync_int64_t v) {
+    return (int64_t)((uint64_t)(uint32_t)v.hi << 32 | v.lo);
+}
+
+// Comparison alarms fire straight away if their test already holds, so input
+// that lands while the wake alarm is being armed is not missed. With no delta
+// an alarm goes inactive once it has fired, until it is armed again. A
+// disarmed alarm waits for a value the counter never reaches.
+static void idle_arm(struct sltp_idle *idle, int alarm, bool on) {
+    const bool wake = alarm == ALARM_WAKE;
+    const int64_t value = on && idle->thresholds[alarm] ? idle->thresholds[alarm] : wake ? 0 : INT64_MAX;
+    const xcb_sync_change_alarm_value_list_t v = {
+        .counter = idle->counter,
+        .valueType = XCB_SYNC_VALUETYPE_ABSOLUTE,
+        .value = idle_int64(value),
+        .testType = wake ? XCB_SYNC_TESTTYPE_NEGATIVE_COMPARISON : XCB_SYNC_TESTTYPE_POSITIVE_COMPARISON,
+        .delta = idle_int64(0),
+        .events = 1,
+    };
+    xcb_sync_change_alarm_aux(idle->conn, idle->alarms[alarm], ALARM_MASK, &v);
+}
+
+static void idle_report(struct sltp_idle *idle, enum sltp_idle_level level) {
+    if (level != idle->level) {
+        idle->level = level;
+        idle->cb(idle, level, idle->userdata);
+    }
+}
+
+// Checked against the counter value the event carries, so a notification
+// that was already on its way when its alarm was rearmed changes nothing.
+static void idle_alarm(struct sltp_idle *idle, const xcb_sync_alarm_notify_event_t *ev) {
+    const int64_t ms = idle_value(ev->counter_value);
+    if (ev->state == XCB_SYNC_ALARMSTATE_DESTROYED) {
+        return;
+    }
+    if (ev->alarm == idle->alarms[ALARM_WAKE]) {
+        if (idle->level == SLTP_IDLE_ACTIVE || ms >= idle->thresholds[ALARM_WAKE]) {
+            return;
+        }
+        idle_arm(idle, ALARM_WAKE, false);
+        idle_arm(idle, ALARM_DIM, true);
+        idle_arm(idle, ALARM_OFF, true);
+        idle_report(idle, SLTP_IDLE_ACTIVE);
+        return;
+    }
+    for (int n = ALARM_DIM; n <= ALARM_OFF; ++n) {
+        if (ev->alarm != idle->alarms[n] || !idle->thresholds[n] || ms < idle->thresholds[n]) {
+            continue;
+        }
+        if (idle->level == SLTP_IDLE_ACTIVE) {
+            idle_arm(idle, ALARM_WAKE, true);
+        }
+        const enum sltp_idle_level level = n == ALARM_DIM ? SLTP_IDLE_DIM : SLTP_IDLE_OFF;
+        if (level > idle->level) {
+            idle_report(idle, level);
+        }
+    }
+}
+
+static void idle_event(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)fd; (void)events;
+    struct sltp_idle *idle = userdata;
+    for (xcb_generic_event_t *ev; (ev = xcb_poll_for_event(idle->conn)); free(ev)) {
+        if ((ev->response_type & 0x7f) == idle->sync_event + XCB_SYNC_ALARM_NOTIFY) {
+            idle_alarm(idle, (const xcb_sync_alarm_notify_event_t *)ev);
+        }
+    }
+    if (xcb_connection_has_error(idle->conn)) {
+        fprintf(stderr, "sltp_idle: lost the X connection\n");
+        a->io_free(e);
+        idle->io = NULL;
+        idle_report(idle, SLTP_IDLE_ACTIVE);
+        return;
+    }
+    xcb_flush(idle->conn);
+}
+
+static int idle_connect(struct sltp_idle *idle) {
+    idle->conn = xcb_connect(NULL, NULL);
+    if (xcb_connection_has_error(idle->conn)) {
+        return -1;
+    }
+    const xcb_query_extension_reply_t *ext = xcb_get_extension_data(idle->conn, &xcb_sync_id);
+    xcb_sync_initialize_reply_t *ver = ext && ext->present
+        ? xcb_sync_initialize_reply(idle->conn,
+            xcb_sync_initialize(idle->conn, XCB_SYNC_MAJOR_VERSION, XCB_SYNC_MINOR_VERSION), NULL)
+        : NULL;
+    const bool ok = ver != NULL;
+    free(ver);
+    if (!ok) {
+        fprintf(stderr, "sltp_idle: no XSync\n");
+        return -1;
+    }
+    idle->sync_event = ext->first_event;
+
+    xcb_sync_list_system_counters_reply_t *list = xcb_sync_list_system_counters_reply(idle->conn,
+        xcb_sync_list_system_counters(idle->conn), NULL);
+    if (list) {
+        for (xcb_sync_systemcounter_iterator_t it = xcb_sync_list_system_counters_counters_iterator(list); it.rem;
+            xcb_sync_systemcounter_next(&it)) {
+            if (xcb_sync_systemcounter_name_length(it.data) == 8
+                && !memcmp(xcb_sync_systemcounter_name(it.data), "IDLETIME", 8)) {
+                idle->counter = it.data->counter;
+            }
+        }
+        free(list);
+    }
+    if (!idle->counter) {
+        fprintf(stderr, "sltp_idle: no IDLETIME counter\n");
+        return -1;
+    }
+
+    // Created without a counter, so inactive until armed.
+    const xcb_sync_create_alarm_value_list_t events = { .events = 1 };
+    for (int n = 0; n < ALARMS; ++n) {
+        idle->alarms[n] = xcb_generate_id(idle->conn);
+        xcb_sync_create_alarm_aux(idle->conn, idle->alarms[n], XCB_SYNC_CA_EVENTS, &events);
+    }
+    idle_arm(idle, ALARM_DIM, true);
+    idle_arm(idle, ALARM_OFF, true);
+    idle_arm(idle, ALARM_WAKE, false);
+    return xcb_flush(idle->conn) > 0 ? 0 : -1;
+}
+
+struct sltp_idle *sltp_idle_new(pa_mainloop_api *api, uint32_t dim_ms, uint32_t off_ms, sltp_idle_cb cb,
+    void *userdata) {
+    struct sltp_idle *idle = calloc(1, sizeof(*idle));
+    if (!idle) {
+        return NULL;
+    }
+    *idle = (struct sltp_idle){ .api = api, .cb = cb, .userdata = userdata, .level = SLTP_IDLE_ACTIVE };
+    idle->thresholds[ALARM_DIM] = dim_ms;
+    idle->thresholds[ALARM_OFF] = off_ms;
+    idle->thresholds[ALARM_WAKE] = dim_ms && (!off_ms || dim_ms < off_ms) ? dim_ms : off_ms;
+    if (idle_connect(idle) < 0) {
+        sltp_idle_free(idle);
+        return NULL;
+    }
+    idle->io = api->io_new(api, xcb_get_file_descriptor(idle->conn), PA_IO_EVENT_INPUT, idle_event, idle);
+    return idle;
+}
+
+// Disconnecting destroys the alarms with everything else the client made.
+void sltp_idle_free(struct sltp_idle *idle) {
+    if (!idle) {
+        return;
+    }
+    if (idle->io) {
+        idle->api->io_free(idle->io);
+    }
+    if (idle->conn) {
+        xcb_disconnect(idle->conn);
+    }
+    free(idle);
+}
@@ -0,0 +1,38 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTP_IDLE_H
+#define SLTP_IDLE_H
+
+#include <stdint.h>
+
+#include <pulse/pulseaudio.h>
+
+// User idleness from the X server's IDLETIME counter, without polling it:
+// an XSync alarm per threshold makes the server send an event once the user
+// has been idle that long, and another alarm sends one on the first input
+// after that. The events arrive on the X connection's fd, driven by any
+// pa_mainloop_api.
+
+enum sltp_idle_level {
+    SLTP_IDLE_ACTIVE,
+    SLTP_IDLE_DIM,
+    SLTP_IDLE_OFF,
+};
+
+struct sltp_idle;
+
+// Only called when the level changes. Losing the X connection reports
+// SLTP_IDLE_ACTIVE, and nothing after that.
+typedef void (*sltp_idle_cb)(struct sltp_idle *idle, enum sltp_idle_level level, void *userdata);
+
+// Thresholds are in ms of idleness; 0 leaves that level out. Connects to
+// $DISPLAY; NULL without X or XSync's IDLETIME counter.
+struct sltp_idle *sltp_idle_new(pa_mainloop_api *api, uint32_t dim_ms, uint32_t off_ms, sltp_idle_cb cb,
+    void *userdata);
+void sltp_idle_free(struct sltp_idle *idle);
+
+#endif
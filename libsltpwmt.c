@@ -0,0 +1,2142 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <pulse/pulseaudio.h>
+
+#include "dbus.h"
+#include "gamma.h"
+#include "libsltpwmt.h"
+#include "profile.h"
+
+static const char *DEFAULT_BACKLIGHT = "/sys/class/backlight/intel_backlight";
+static const pa_usec_t RECONNECT_DELAY = PA_USEC_PER_SEC;
+static const pa_usec_t RAMP_FRAME = 16 * PA_USEC_PER_MSEC;
+static const double RAMP_FLOOR_DB = -60.0;
+static const unsigned DEFAULT_VOLUME_SNAP = 2;
+static const pa_usec_t DUCK_RAMP = 250 * PA_USEC_PER_MSEC;
+
+enum sltp_op_type {
+    SLTP_OP_VOLUME,
+    SLTP_OP_MUTE,
+    SLTP_OP_SINK_NEXT,
+    SLTP_OP_RESTORE,
+    SLTP_OP_SCENE,
+    SLTP_OP_MIC_SET,
+};
+
+struct sltp_sink {
+    uint32_t index;
+    char *name;
+    char *description;
+};
+
+// A sink input seen by the ducking engine. Streams matching the rule are
+// triggers; everything else is ducked while a trigger plays.
+struct sltp_duck {
+    uint32_t index;
+    bool trigger;
+    bool playing; // not corked
+    bool held; // ducked by us: restore is what to put back
+    pa_cvolume restore;
+};
+
+// What a sink or source in a scene was before, to put back on failure.
+struct sltp_scene_undo {
+    struct sltp_op *op;
+    bool read;
+    pa_cvolume volume;
+    bool muted;
+};
+
+enum sltp_scene_phase {
+    SLTP_SCENE_READ,
+    SLTP_SCENE_WRITE,
+    SLTP_SCENE_PUT_BACK,
+};
+
+struct sltp_op {
+    struct sltp_ctx *ctx;
+    enum sltp_op_type type;
+    int arg;
+    sltp_result_cb cb;
+    void *userdata;
+    struct sltp_result res;
+    bool started;
+    int pending;
+    struct sltp_profile_mark profile;
+
+    // sink-next
+    struct sltp_sink *sinks;
+    size_t nsinks;
+    uint32_t *inputs;
+    size_t ninputs;
+
+    // restore: a copy of the saved sinks
+    struct sltp_saved_entry *restore;
+    size_t nrestore;
+
+    // scene: a copy of the sink and source changes
+    struct sltp_scene_change *scene;
+    struct sltp_scene_undo *scene_undo;
+    size_t nscene;
+    enum sltp_scene_phase scene_phase;
+
+    struct sltp_op *next;
+};
+
+struct sltp_mic_source {
+    char name[128];
+    uint32_t index; // PA_INVALID_INDEX while the server has none by that name
+};
+
+struct sltp_ctx {
+    char backlight_dir[256];
+    char max_brightness_path[300];
+    char brightness_path[300];
+    int max_brightness; // read once; 0 until then
+    enum sltp_brightness_backend backend;
+    bool no_backlight; // the directory does not exist: brightness is gamma
+    struct sltp_gamma *gamma; // no_backlight only, connected on first use
+    bool logind; // brightness is not writable: logind sets it for us
+    struct sltp_dbus *dbus; // logind only, connected on first use
+    int logind_pending; // SetBrightness calls not yet answered
+    bool logind_failed; // one of them was refused
+
+    bool private_loop;
+    pa_mainloop *mainloop; // private_loop only, created on first connect
+    pa_mainloop_api *api;
+    pa_context *context;
+    pa_time_event *reconnect_event;
+    bool failed;
+    bool ready;
+    int info_pending;
+    uint32_t sink_index;
+    uint32_t source_index;
+    char *sink_name;
+    char *source_name;
+    pa_cvolume sink_volume; // where the sink is going, mid-ramp included
+    unsigned volume_snap; // percent
+    struct sltp_op *ops;
+
+    pa_usec_t ramp_duration; // 0: volume steps apply at once
+    pa_time_event *ramp_event;
+    pa_usec_t ramp_start;
+    pa_cvolume ramp_from;
+    pa_cvolume ramp_current; // last volume sent
+    struct sltp_op *ramp_op; // answered once the ramp lands
+
+    char *duck_match; // fnmatch pattern; NULL: ducking off
+    double duck_db; // attenuation while ducked, <= 0
+    struct sltp_duck *ducks;
+    size_t nducks;
+    pa_time_event *duck_event;
+    pa_usec_t duck_start;
+    double duck_from;
+    double duck_to;
+    double duck_level; // dB currently applied to held streams
+    struct sltp_mic_source *mics; // push-to-talk sources; none: the default one
+    size_t nmics;
+    sltp_mic_level_cb level_cb; // NULL: the mic level is not watched
+    void *level_userdata;
+    float level_threshold; // peak, of full scale
+    pa_stream *level_stream; // only while another client records
+    uint32_t level_source; // what level_stream reads
+    uint32_t level_failed; // a source the stream failed on, not tried again
+    pa_operation *level_scan_op; // a source output list in flight
+    bool level_rescan; // and something changed since it was asked for
+    unsigned level_count; // records counted by the list in flight
+    unsigned level_captures; // by the last list
+    unsigned level_quiet; // reads under the threshold in a row
+    bool level_reported;
+    struct sltp_mic_level level; // as last reported
+    struct sltp_profile_mark profile;
+    enum sltp_profile_phase profile_phase; // connect, then introspection
+
+    struct sltp_state state;
+    sltp_state_cb state_cb;
+    void *state_userdata;
+    sltp_applied_cb applied_cb;
+    void *applied_userdata;
+};
+
+int sltp_runtime_path(char *const buf, size_t buflen, const char *const name) {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    int len = dir && *dir
+        ? snprintf(buf, buflen, "%s/%s", dir, name)
+        : snprintf(buf, buflen, "/tmp/sltpwmt-%u-%s", (unsigned)getuid(), name);
+    if (len < 0 || (size_t)len >= buflen) {
+        fprintf(stderr, "runtime path too long\n");
+        return -1;
+    }
+    return 0;
+}
+
+static ssize_t read_sysfs(const char *const path, char *const buf, ssize_t buflen) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("read_sysfs failed (open)");
+        return -1;
+    }
+    ssize_t rdlen = read(fd, buf, buflen - 1);
+    if (rdlen == -1) {
+        perror("read_sysfs failed (read)");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    buf[rdlen] = '\0';
+    return rdlen;
+}
+
+static ssize_t write_sysfs(const char *const path, const char *const buf, ssize_t nbytes) {
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("write_sysfs failed (open)");
+        return -1;
+    }
+    ssize_t wrlen = write(fd, buf, nbytes);
+    if (wrlen == -1 || wrlen < nbytes) {
+        perror("write_sysfs failed (write)");
+    }
+    close(fd);
+    return wrlen;
+}
+
+ssize_t sltp_read_sysfs(const char *const path, char *const buf, ssize_t buflen) {
+    struct sltp_profile_mark mark;
+    sltp_profile_begin(&mark);
+    const ssize_t ret = read_sysfs(path, buf, buflen);
+    sltp_profile_end(SLTP_PROFILE_READ_SYSFS, &mark);
+    return ret;
+}
+
+ssize_t sltp_write_sysfs(const char *const path, const char *const buf, ssize_t nbytes) {
+    struct sltp_profile_mark mark;
+    sltp_profile_begin(&mark);
+    const ssize_t ret = write_sysfs(path, buf, nbytes);
+    sltp_profile_end(SLTP_PROFILE_WRITE_SYSFS, &mark);
+    return ret;
+}
+
+static void notify_state(struct sltp_ctx *ctx) {
+    if (ctx->state_cb) {
+        ctx->state_cb(ctx, &ctx->state, ctx->state_userdata);
+    }
+}
+
+void sltp_backlight_changed(struct sltp_ctx *ctx) {
+    ctx->max_brightness = 0;
+    switch (ctx->backend) {
+    case SLTP_BRIGHTNESS_AUTO:
+        ctx->no_backlight = access(ctx->backlight_dir, F_OK) == -1 && errno == ENOENT;
+        ctx->logind = !ctx->no_backlight && access(ctx->brightness_path, W_OK) == -1
+            && (errno == EACCES || errno == EPERM || errno == EROFS);
+        break;
+    case SLTP_BRIGHTNESS_SYSFS:
+    case SLTP_BRIGHTNESS_LOGIND:
+        ctx->no_backlight = false;
+        ctx->logind = ctx->backend == SLTP_BRIGHTNESS_LOGIND;
+        break;
+    case SLTP_BRIGHTNESS_GAMMA:
+        ctx->no_backlight = true;
+        ctx->logind = false;
+        break;
+    }
+    if (ctx->state.valid & SLTP_STATE_BRIGHTNESS) {
+        ctx->state.valid &= ~(uint32_t)SLTP_STATE_BRIGHTNESS;
+        notify_state(ctx);
+    }
+}
+
+int sltp_set_backlight(struct sltp_ctx *ctx, const char *dir) {
+    if (!dir) {
+        const char *env = getenv("SLTPWMT_BACKLIGHT");
+        dir = env && *env ? env : DEFAULT_BACKLIGHT;
+    }
+    if ((size_t)snprintf(ctx->backlight_dir, sizeof(ctx->backlight_dir), "%s", dir) >= sizeof(ctx->backlight_dir)) {
+        return -1;
+    }
+    snprintf(ctx->max_brightness_path, sizeof(ctx->max_brightness_path), "%s/max_brightness", dir);
+    snprintf(ctx->brightness_path, sizeof(ctx->brightness_path), "%s/brightness", dir);
+    sltp_backlight_changed(ctx);
+    return 0;
+}
+
+void sltp_set_brightness_backend(struct sltp_ctx *ctx, enum sltp_brightness_backend backend) {
+    ctx->backend = backend;
+    sltp_backlight_changed(ctx);
+}
+
+const char *sltp_backlight_dir(const struct sltp_ctx *ctx) {
+    return ctx->backlight_dir;
+}
+
+void sltp_set_volume_ramp(struct sltp_ctx *ctx, pa_usec_t duration) {
+    ctx->ramp_duration = duration;
+}
+
+void sltp_set_volume_snap(struct sltp_ctx *ctx, unsigned percent) {
+    ctx->volume_snap = percent;
+}
+
+void sltp_set_state_callback(struct sltp_ctx *ctx, sltp_state_cb cb, void *userdata) {
+    ctx->state_cb = cb;
+    ctx->state_userdata = userdata;
+}
+
+const struct sltp_state *sltp_cached_state(const struct sltp_ctx *ctx) {
+    return &ctx->state;
+}
+
+void sltp_set_applied_callback(struct sltp_ctx *ctx, sltp_applied_cb cb, void *userdata) {
+    ctx->applied_cb = cb;
+    ctx->applied_userdata = userdata;
+}
+
+static void notify_applied_brightness(struct sltp_ctx *ctx, int br) {
+    struct sltp_saved_entry e = { .kind = SLTP_SAVED_BACKLIGHT, .brightness = br };
+    if (ctx->applied_cb) {
+        snprintf(e.name, sizeof(e.name), "%s", ctx->backlight_dir);
+        ctx->applied_cb(ctx, &e, ctx->applied_userdata);
+    }
+}
+
+// Where the default sink is going, which is what a restore should bring back.
+static void notify_applied_sink(struct sltp_ctx *ctx) {
+    struct sltp_saved_entry e = { .kind = SLTP_SAVED_SINK, .volume = ctx->sink_volume, .muted = ctx->state.muted };
+    if (ctx->applied_cb && ctx->sink_name
+        && (size_t)snprintf(e.name, sizeof(e.name), "%s", ctx->sink_name) < sizeof(e.name)) {
+        ctx->applied_cb(ctx, &e, ctx->applied_userdata);
+    }
+}
+
+struct sltp_ctx *sltp_new(pa_mainloop_api *api) {
+    struct sltp_ctx *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        return NULL;
+    }
+    sltp_set_backlight(ctx, NULL);
+    ctx->volume_snap = DEFAULT_VOLUME_SNAP;
+    ctx->sink_index = ctx->source_index = ctx->level_failed = PA_INVALID_INDEX;
+    // A private mainloop waits for the first audio call, so brightness-only
+    // users never pay for it.
+    ctx->private_loop = !api;
+    ctx->api = api;
+    return ctx;
+}
+
+// Brightness
+
+static int parse_sysfs_int(const char *const buf, int *const out) {
+    return sscanf(buf, "%d", out) < 1 ? -1 : 0;
+}
+
+// Desktops and some external panels have no backlight device; their
+// brightness is faked with the gamma ramps instead, in percent.
+static struct sltp_gamma *brightness_gamma(struct sltp_ctx *ctx) {
+    if (!ctx->gamma && !(ctx->gamma = sltp_gamma_new())) {
+        fprintf(stderr, "no backlight, and no X display for gamma\n");
+    }
+    return ctx->gamma;
+}
+
+// Without write access to the backlight, the session's logind writes it on
+// our behalf. Calls are not waited for, so quick steps pipeline on the bus.
+static void logind_reply(struct sltp_dbus *bus, const struct sltp_dbus_msg *msg, void *userdata) {
+    (void)bus;
+    struct sltp_ctx *ctx = userdata;
+    --ctx->logind_pending;
+    if (msg->type == SLTP_DBUS_ERROR) {
+        fprintf(stderr, "logind SetBrightness failed: %s\n", msg->error_name ? msg->error_name : "?");
+        ctx->logind_failed = true;
+    }
+}
+
+static int logind_set(struct sltp_ctx *ctx, int br) {
+    if (ctx->private_loop && !ctx->mainloop) {
+        if (!(ctx->mainloop = pa_mainloop_new())) {
+            fprintf(stderr, "pa_mainloop_new failed\n");
+            return -1;
+        }
+        ctx->api = pa_mainloop_get_api(ctx->mainloop);
+    }
+    if (!ctx->dbus && !(ctx->dbus = sltp_dbus_new(ctx->api, NULL))) {
+        return -1;
+    }
+    const char *dev = strrchr(ctx->backlight_dir, '/');
+    dev = dev ? dev + 1 : ctx->backlight_dir;
+    ctx->logind_failed = false;
+    if (sltp_dbus_call(ctx->dbus, "org.freedesktop.login1", "/org/freedesktop/login1/session/auto",
+            "org.freedesktop.login1.Session", "SetBrightness", logind_reply, ctx, "ssu",
+            "backlight", dev, (unsigned)br) < 0) {
+        return -1;
+    }
+    ++ctx->logind_pending;
+    if (!ctx->private_loop) {
+        return 0;
+    }
+    // One-shot callers exit right after, so this one has to land first.
+    while (ctx->logind_pending) {
+        if (pa_mainloop_iterate(ctx->mainloop, 1, NULL) < 0) {
+            return -1;
+        }
+    }
+    return ctx->logind_failed ? -1 : 0;
+}
+
+int sltp_brightness_get(struct sltp_ctx *ctx, int *const br, int *const max_br) {
+    char buf[512] = {0};
+    const int buflen = sizeof(buf);
+    if (ctx->logind_pending && (ctx->state.valid & SLTP_STATE_BRIGHTNESS)) {
+        // sysfs still says where we were before the calls in flight.
+        *br = ctx->state.brightness;
+        *max_br = ctx->state.max_brightness;
+        return 0;
+    } else if (ctx->no_backlight) {
+        struct sltp_gamma *g = brightness_gamma(ctx);
+        if (!g || (*br = sltp_gamma_get(g)) < 0) {
+            return 1;
+        }
+        *max_br = SLTP_GAMMA_MAX;
+    } else {
+        // Fixed by the driver, so only sltp_backlight_changed reads it again.
+        if (!ctx->max_brightness) {
+            if (sltp_read_sysfs(ctx->max_brightness_path, buf, buflen) == -1) {
+                return 1;
+            }
+            if (parse_sysfs_int(buf, &ctx->max_brightness) < 0 || ctx->max_brightness <= 0) {
+                ctx->max_brightness = 2147483647;
+            }
+        }
+        *max_br = ctx->max_brightness;
+
+        if (sltp_read_sysfs(ctx->brightness_path, buf, buflen) == -1) {
+            return 1;
+        }
+
+        if (parse_sysfs_int(buf, br) < 0) {
+            fprintf(stderr, "invalid brightness from sysfs\n");
+            return 1;
+        }
+    }
+
+    ctx->state.brightness = *br;
+    ctx->state.max_brightness = *max_br;
+    ctx->state.valid |= SLTP_STATE_BRIGHTNESS;
+    notify_state(ctx);
+    return 0;
+}
+
+static int write_brightness(struct sltp_ctx *ctx, int br, int max_br, struct sltp_result *res) {
+    char buf[32];
+    br = br < 0 ? 0 : br > max_br ? max_br : br;
+    int len = snprintf(buf, sizeof(buf), "%d", br);
+    if (ctx->no_backlight ? !ctx->gamma || (br = sltp_gamma_set(ctx->gamma, br)) < 0
+        : ctx->logind ? logind_set(ctx, br) < 0
+        : sltp_write_sysfs(ctx->brightness_path, buf, len) == -1) {
+        snprintf(res->msg, sizeof(res->msg), "brightness change failed");
+        return res->status = 1;
+    }
+    res->value = br;
+    snprintf(res->msg, sizeof(res->msg), "Brightness: %d", br);
+    notify_applied_brightness(ctx, br);
+
+    ctx->state.brightness = br;
+    ctx->state.max_brightness = max_br;
+    ctx->state.valid |= SLTP_STATE_BRIGHTNESS;
+    notify_state(ctx);
+    return res->status = 0;
+}
+
+int sltp_brightness_set(struct sltp_ctx *ctx, int value, struct sltp_result *res) {
+    int br, max_br;
+    if (sltp_brightness_get(ctx, &br, &max_br)) {
+        snprintf(res->msg, sizeof(res->msg), "brightness read failed");
+        return res->status = 1;
+    }
+    return write_brightness(ctx, value, max_br, res);
+}
+
+// FB_BLANK_UNBLANK and FB_BLANK_POWERDOWN.
+int sltp_backlight_power(struct sltp_ctx *ctx, bool on) {
+    char path[300];
+    snprintf(path, sizeof(path), "%.280s/bl_power", ctx->backlight_dir);
+    return sltp_write_sysfs(path, on ? "0" : "4", 1) == 1 ? 0 : -1;
+}
+
+static int step_brightness(struct sltp_ctx *ctx, int delta, struct sltp_result *res) {
+    int br = -1, max_br;
+    if (sltp_brightness_get(ctx, &br, &max_br)) {
+        snprintf(res->msg, sizeof(res->msg), "brightness read failed");
+        return res->status = 1;
+    }
+    return write_brightness(ctx, br + delta, max_br, res);
+}
+
+static int brightness_lock_paths(const struct sltp_ctx *ctx, char *const lock, char *const queue, size_t buflen) {
+    const char *dev = strrchr(ctx->backlight_dir, '/');
+    dev = dev ? dev + 1 : ctx->backlight_dir;
+    char name[300];
+    snprintf(name, sizeof(name), "sltpwmt-%s.lock", dev);
+    if (sltp_runtime_path(lock, buflen, name) < 0) {
+        return -1;
+    }
+    snprintf(name, sizeof(name), "sltpwmt-%s.queue", dev);
+    return sltp_runtime_path(queue, buflen, name);
+}
+
+static int brightness_queue_drain(int qfd) {
+    int32_t deltas[256];
+    int total = 0;
+    ssize_t len;
+    off_t off = 0;
+    flock(qfd, LOCK_EX);
+    while ((len = pread(qfd, deltas, sizeof(deltas), off)) > 0) {
+        for (size_t n = 0; n < (size_t)len / sizeof(deltas[0]); ++n) {
+            total += deltas[n];
+        }
+        off += len;
+    }
+    if (ftruncate(qfd, 0) == -1) {
+        perror("brightness_queue_drain failed (ftruncate)");
+    }
+    flock(qfd, LOCK_UN);
+    return total;
+}
+
+// Overlapping invocations (autorepeat spawns them faster than they finish)
+// would otherwise read the same old brightness and lose increments. The
+// process holding the per-device lock applies its own delta plus everything
+// others appended to the queue; the others append and leave instead of
+// waiting. Anyone releasing the lock rechecks the queue afterwards, so a
+// delta appended just as the holder finished is never stranded.
+int sltp_brightness_step(struct sltp_ctx *ctx, int delta, struct sltp_result *res) {
+    char lock_path[512], queue_path[512];
+    int lfd = -1, qfd = -1;
+    const int requested = delta;
+    *res = (struct sltp_result){ .status = 1 };
+    if (brightness_lock_paths(ctx, lock_path, queue_path, sizeof(lock_path)) < 0
+        || (lfd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1
+        || (qfd = open(queue_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600)) == -1) {
+        perror("sltp_brightness_step: running unlocked (open)");
+        if (lfd != -1) {
+            close(lfd);
+        }
+        return step_brightness(ctx, delta, res);
+    }
+
+    if (flock(lfd, LOCK_EX | LOCK_NB) == -1) {
+        const int32_t rec = delta;
+        flock(qfd, LOCK_SH);
+        ssize_t wrlen = write(qfd, &rec, sizeof(rec));
+        flock(qfd, LOCK_UN);
+        if (wrlen != sizeof(rec)) {
+            perror("sltp_brightness_step failed (write)");
+            snprintf(res->msg, sizeof(res->msg), "brightness change failed");
+            goto exit;
+        }
+        if (flock(lfd, LOCK_EX | LOCK_NB) == -1) {
+            res->status = 0;
+            snprintf(res->msg, sizeof(res->msg), "Brightness: queued %+d", requested);
+            goto exit;
+        }
+        // The holder left in the meantime; our delta is in the queue now.
+        delta = 0;
+    }
+
+    for (bool first = true;; first = false) {
+        const int total = delta + brightness_queue_drain(qfd);
+        delta = 0;
+        if (first || total) {
+            step_brightness(ctx, total, res);
+        }
+        flock(lfd, LOCK_UN);
+
+        struct stat sb;
+        if (fstat(qfd, &sb) == -1 || sb.st_size == 0 || flock(lfd, LOCK_EX | LOCK_NB) == -1) {
+            break;
+        }
+    }
+
+exit:
+    close(qfd);
+    close(lfd);
+    return res->status;
+}
+
+// Our own backlight goes through the usual path, so logind and gamma work
+// and the cached state follows; any other is a plain sysfs write.
+int sltp_restore_backlights(struct sltp_ctx *ctx, const struct sltp_saved *saved, struct sltp_result *res) {
+    struct sltp_result one;
+    size_t count = 0;
+    *res = (struct sltp_result){0};
+    for (size_t n = 0; n < saved->count; ++n) {
+        const struct sltp_saved_entry *e = &saved->entries[n];
+        char path[SLTP_SAVED_NAME_MAX + 16], buf[32];
+        if (e->kind != SLTP_SAVED_BACKLIGHT) {
+            continue;
+        }
+        ++count;
+        if (!strcmp(e->name, ctx->backlight_dir)) {
+            res->value += sltp_brightness_set(ctx, e->brightness, &one) == 0;
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/brightness", e->name);
+        const int len = snprintf(buf, sizeof(buf), "%d", e->brightness);
+        res->value += sltp_write_sysfs(path, buf, len) == len;
+    }
+    res->status = res->value < (int)count;
+    snprintf(res->msg, sizeof(res->msg), "Restored %d of %zu backlights", res->value, count);
+    return res->status;
+}
+
+static int backlight_read(const char *const dir, int *const br, int *const max_br) {
+    char path[300], buf[64];
+    snprintf(path, sizeof(path), "%s/max_brightness", dir);
+    if (sltp_read_sysfs(path, buf, sizeof(buf)) == -1 || parse_sysfs_int(buf, max_br) < 0) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/brightness", dir);
+    if (sltp_read_sysfs(path, buf, sizeof(buf)) == -1 || parse_sysfs_int(buf, br) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+struct scene_write {
+    char path[300];
+    char buf[32];
+    int len;
+    bool ok;
+    bool threaded;
+    pthread_t thread;
+};
+
+static void *scene_write(void *userdata) {
+    struct scene_write *w = userdata;
+    w->ok = sltp_write_sysfs(w->path, w->buf, w->len) == w->len;
+    return NULL;
+}
+
+// A DDC/CI panel can take tens of milliseconds per write, so each one gets a
+// thread. The context's own backlight stays on this thread, as it may go
+// through logind or gamma and reports to the state callback.
+int sltp_scene_backlights(struct sltp_ctx *ctx, const struct sltp_scene_change *changes, size_t count,
+    struct sltp_saved *undo, struct sltp_result *res) {
+    struct scene_write writes[SLTP_SAVED_MAX];
+    size_t nwrites = 0;
+    int own = -1;
+    *res = (struct sltp_result){0};
+    *undo = (struct sltp_saved){0};
+    for (size_t n = 0; n < count; ++n) {
+        const struct sltp_scene_change *c = &changes[n];
+        if (c->target != SLTP_SCENE_BACKLIGHT) {
+            continue;
+        }
+        const char *dir = c->name[0] ? c->name : ctx->backlight_dir;
+        const bool mine = !strcmp(dir, ctx->backlight_dir);
+        int br, max_br;
+        if (undo->count == SLTP_SAVED_MAX) {
+            res->status = 1;
+            snprintf(res->msg, sizeof(res->msg), "too many backlights");
+            return 1;
+        }
+        if (mine ? sltp_brightness_get(ctx, &br, &max_br) : backlight_read(dir, &br, &max_br)) {
+            res->status = 1;
+            snprintf(res->msg, sizeof(res->msg), "cannot read %.100s", dir);
+            return 1;
+        }
+        struct sltp_saved_entry *e = &undo->entries[undo->count++];
+        *e = (struct sltp_saved_entry){ .kind = SLTP_SAVED_BACKLIGHT, .brightness = br };
+        snprintf(e->name, sizeof(e->name), "%s", dir);
+
+        int value = c->set == SLTP_SCENE_PERCENT ? (int)((int64_t)max_br * c->value / 100) : c->value;
+        value = value < 0 ? 0 : value > max_br ? max_br : value;
+        if (mine) {
+            own = value;
+            continue;
+        }
+        struct scene_write *w = &writes[nwrites++];
+        snprintf(w->path, sizeof(w->path), "%s/brightness", dir);
+        w->len = snprintf(w->buf, sizeof(w->buf), "%d", value);
+    }
+
+    // Everything was read before anything is written, so a panel that is not
+    // there fails the scene without touching the others.
+    for (size_t n = 0; n < nwrites; ++n) {
+        writes[n].threaded = pthread_create(&writes[n].thread, NULL, scene_write, &writes[n]) == 0;
+        if (!writes[n].threaded) {
+            scene_write(&writes[n]);
+        }
+    }
+    struct sltp_result scratch;
+    bool ok = own < 0 || sltp_brightness_set(ctx, own, &scratch) == 0;
+    for (size_t n = 0; n < nwrites; ++n) {
+        if (writes[n].threaded) {
+            pthread_join(writes[n].thread, NULL);
+        }
+        ok &= writes[n].ok;
+    }
+    if (!ok) {
+        sltp_restore_backlights(ctx, undo, &scratch);
+        res->status = 1;
+        snprintf(res->msg, sizeof(res->msg), "backlight change failed, put back");
+        return 1;
+    }
+    res->value = (int)undo->count;
+    snprintf(res->msg, sizeof(res->msg), "Set %zu backlights", undo->count);
+    return 0;
+}
+
+// PulseAudio
+
+static int pulse_step_volume(pa_cvolume *const cvol, int delta, unsigned snap) {
+    int new_volume = (int)pa_cvolume_max(cvol) + delta;
+    const int normal_volume = (int)PA_VOLUME_NORM;
+    const int window = normal_volume * (int)snap / 100;
+    new_volume = new_volume > normal_volume - window && new_volume < normal_volume + window
+        ? normal_volume : new_volume;
+    new_volume = PA_CLAMP_UNLIKELY(new_volume, (int)PA_VOLUME_MUTED, normal_volume);
+    pa_cvolume_scale(cvol, new_volume);
+    return new_volume;
+}
+
+static void op_free(struct sltp_op *op) {
+    for (size_t n = 0; n < op->nsinks; ++n) {
+        free(op->sinks[n].name);
+        free(op->sinks[n].description);
+    }
+    free(op->sinks);
+    free(op->inputs);
+    free(op->restore);
+    free(op->scene);
+    free(op->scene_undo);
+    free(op);
+}
+
+static void op_complete(struct sltp_op *op) {
+    struct sltp_ctx *ctx = op->ctx;
+    sltp_profile_end(SLTP_PROFILE_SET, &op->profile);
+    for (struct sltp_op **p = &ctx->ops; *p; p = &(*p)->next) {
+        if (*p == op) {
+            *p = op->next;
+            break;
+        }
+    }
+    if (op->cb) {
+        op->cb(ctx, &op->res, op->userdata);
+    }
+    op_free(op);
+}
+
+static void op_fail(struct sltp_op *op, const char *const msg) {
+    op->res.status = 1;
+    snprintf(op->res.msg, sizeof(op->res.msg), "%s", msg);
+    op_complete(op);
+}
+
+static void ramp_stop(struct sltp_ctx *ctx) {
+    if (ctx->ramp_event) {
+        ctx->api->time_free(ctx->ramp_event);
+        ctx->ramp_event = NULL;
+    }
+    ctx->ramp_op = NULL;
+}
+
+// Answers the step a ramp was for without finishing it, e.g. when the sink
+// it was ramping went away.
+static void ramp_abandon(struct sltp_ctx *ctx) {
+    struct sltp_op *op = ctx->ramp_op;
+    ramp_stop(ctx);
+    if (op) {
+        op_complete(op);
+    }
+}
+
+// Requests that were issued before the context died are cancelled by libpulse
+// without their callbacks running, so everything outstanding fails here.
+static void fail_ops(struct sltp_ctx *ctx, const char *const msg) {
+    ramp_stop(ctx);
+    while (ctx->ops) {
+        op_fail(ctx->ops, msg);
+    }
+}
+
+static void op_success(pa_context *c, int success, void *userdata) {
+    (void)c;
+    struct sltp_op *op = userdata;
+    if (!success) {
+        op->res.status = 1;
+    }
+    if (--op->pending == 0) {
+        op_complete(op);
+    }
+}
+
+static pa_usec_t ramp_now(void) {
+    struct timeval tv;
+    return pa_timeval_load(pa_gettimeofday(&tv));
+}
+
+static double ramp_db(pa_volume_t v) {
+    const double db = pa_sw_volume_to_dB(v);
+    return db < RAMP_FLOOR_DB ? RAMP_FLOOR_DB : db;
+}
+
+// One volume update per frame, interpolated in dB so the ramp sounds even;
+// the last frame lands exactly on the target and answers the step.
+static void ramp_frame(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)tv;
+    struct sltp_ctx *ctx = userdata;
+    const pa_usec_t now = ramp_now();
+    const pa_usec_t elapsed = now > ctx->ramp_start ? now - ctx->ramp_start : 0;
+    if (elapsed >= ctx->ramp_duration || ctx->ramp_from.channels != ctx->sink_volume.channels) {
+        struct sltp_op *op = ctx->ramp_op;
+        a->time_free(e);
+        ctx->ramp_event = NULL;
+        ctx->ramp_op = NULL;
+        ctx->ramp_current = ctx->sink_volume;
+        if (op) {
+            op->pending = 1;
+        }
+        pa_operation_unref(pa_context_set_sink_volume_by_index(ctx->context, ctx->sink_index, &ctx->sink_volume,
+            op ? op_success : NULL, op));
+        return;
+    }
+
+    const double t = (double)elapsed / (double)ctx->ramp_duration;
+    ctx->ramp_current.channels = ctx->sink_volume.channels;
+    for (unsigned n = 0; n < ctx->sink_volume.channels; ++n) {
+        const double from = ramp_db(ctx->ramp_from.values[n]), to = ramp_db(ctx->sink_volume.values[n]);
+        ctx->ramp_current.values[n] = pa_sw_volume_from_dB(from + (to - from) * t);
+    }
+    pa_operation_unref(pa_context_set_sink_volume_by_index(ctx->context, ctx->sink_index, &ctx->ramp_current, NULL, NULL));
+    struct timeval next;
+    a->time_restart(e, pa_timeval_add(pa_gettimeofday(&next), RAMP_FRAME));
+}
+
+// A step that arrives mid-ramp carries on from wherever the ramp has got to,
+// towards the new target, on the same timer; the step it supersedes is
+// answered then and there.
+static void ramp_to(struct sltp_ctx *ctx, struct sltp_op *op, const pa_cvolume *before) {
+    struct sltp_op *superseded = ctx->ramp_op;
+    if (!ctx->ramp_event) {
+        struct timeval now;
+        ctx->ramp_current = *before;
+        ctx->ramp_event = ctx->api->time_new(ctx->api, pa_gettimeofday(&now), ramp_frame, ctx);
+    }
+    ctx->ramp_from = ctx->ramp_current;
+    ctx->ramp_start = ramp_now();
+    ctx->ramp_op = op;
+    if (superseded) {
+        op_complete(superseded);
+    }
+}
+
+static bool duck_is_trigger(const struct sltp_ctx *ctx, const pa_sink_input_info *i) {
+    static const char *const keys[] = {
+        PA_PROP_MEDIA_ROLE, PA_PROP_APPLICATION_NAME, PA_PROP_APPLICATION_PROCESS_BINARY,
+    };
+    for (size_t n = 0; n < sizeof(keys) / sizeof(*keys); ++n) {
+        const char *v = pa_proplist_gets(i->proplist, keys[n]);
+        if (v && !fnmatch(ctx->duck_match, v, 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static struct sltp_duck *duck_find(struct sltp_ctx *ctx, uint32_t index) {
+    for (size_t n = 0; n < ctx->nducks; ++n) {
+        if (ctx->ducks[n].index == index) {
+            return &ctx->ducks[n];
+        }
+    }
+    return NULL;
+}
+
+static void duck_set(struct sltp_ctx *ctx, const struct sltp_duck *d, double level) {
+    pa_cvolume v = d->restore;
+    if (level < 0) {
+        pa_sw_cvolume_multiply_scalar(&v, &d->restore, pa_sw_volume_from_dB(level));
+    }
+    pa_operation_unref(pa_context_set_sink_input_volume(ctx->context, d->index, &v, NULL, NULL));
+}
+
+// Every held stream is set back to back, so a frame is one pipelined batch
+// however many streams are playing. Back at 0 dB, streams are let go.
+static void duck_apply(struct sltp_ctx *ctx) {
+    for (size_t n = 0; n < ctx->nducks; ++n) {
+        struct sltp_duck *d = &ctx->ducks[n];
+        if (d->held) {
+            duck_set(ctx, d, ctx->duck_level);
+            d->held = ctx->duck_level < 0;
+        }
+    }
+}
+
+static void duck_frame(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)tv;
+    struct sltp_ctx *ctx = userdata;
+    const pa_usec_t now = ramp_now();
+    const pa_usec_t elapsed = now > ctx->duck_start ? now - ctx->duck_start : 0;
+    if (elapsed >= DUCK_RAMP) {
+        a->time_free(e);
+        ctx->duck_event = NULL;
+        ctx->duck_level = ctx->duck_to;
+    } else {
+        struct timeval next;
+        ctx->duck_level = ctx->duck_from + (ctx->duck_to - ctx->duck_from) * (double)elapsed / (double)DUCK_RAMP;
+        a->time_restart(e, pa_timeval_add(pa_gettimeofday(&next), RAMP_FRAME));
+    }
+    duck_apply(ctx);
+}
+
+// Ducks while any trigger is playing. A change of mind mid-ramp turns
+// around from the current level.
+static void duck_update(struct sltp_ctx *ctx) {
+    bool playing = false;
+    for (size_t n = 0; n < ctx->nducks; ++n) {
+        playing |= ctx->ducks[n].trigger && ctx->ducks[n].playing;
+    }
+    const double to = playing ? ctx->duck_db : 0;
+    if (to == ctx->duck_to) {
+        return;
+    }
+    if (ctx->duck_level == 0) {
+        for (size_t n = 0; n < ctx->nducks; ++n) {
+            struct sltp_duck *d = &ctx->ducks[n];
+            d->held = !d->trigger && pa_cvolume_valid(&d->restore);
+        }
+    }
+    ctx->duck_from = ctx->duck_level;
+    ctx->duck_to = to;
+    ctx->duck_start = ramp_now();
+    if (!ctx->duck_event) {
+        struct timeval now;
+        ctx->duck_event = ctx->api->time_new(ctx->api, pa_gettimeofday(&now), duck_frame, ctx);
+    }
+}
+
+static void duck_input(pa_context *c, const pa_sink_input_info *i, int eol, void *userdata) {
+    (void)c;
+    struct sltp_ctx *ctx = userdata;
+    if (eol || !ctx->duck_match) {
+        return;
+    }
+    struct sltp_duck *d = duck_find(ctx, i->index);
+    if (!d) {
+        struct sltp_duck *ducks = realloc(ctx->ducks, (ctx->nducks + 1) * sizeof(*ducks));
+        if (!ducks) {
+            return;
+        }
+        ctx->ducks = ducks;
+        d = &ducks[ctx->nducks++];
+        *d = (struct sltp_duck){ .index = i->index };
+    }
+    d->trigger = duck_is_trigger(ctx, i);
+    d->playing = !i->corked;
+    if (d->trigger) {
+        if (d->held) {
+            duck_set(ctx, d, 0);
+            d->held = false;
+        }
+    } else if (!d->held) {
+        // Not ours yet, so this is the volume to come back to.
+        pa_cvolume_init(&d->restore);
+        if (i->has_volume && i->volume_writable) {
+            d->restore = i->volume;
+        }
+        // A stream that turns up while others are ducked joins them.
+        if ((ctx->duck_level < 0 || ctx->duck_to < 0) && pa_cvolume_valid(&d->restore)) {
+            d->held = true;
+            duck_set(ctx, d, ctx->duck_level);
+        }
+    }
+    duck_update(ctx);
+}
+
+static void duck_remove(struct sltp_ctx *ctx, uint32_t index) {
+    struct sltp_duck *d = duck_find(ctx, index);
+    if (d) {
+        *d = ctx->ducks[--ctx->nducks];
+        duck_update(ctx);
+    }
+}
+
+// Forgets every stream; whatever is ducked stays so.
+static void duck_reset(struct sltp_ctx *ctx) {
+    if (ctx->duck_event) {
+        ctx->api->time_free(ctx->duck_event);
+        ctx->duck_event = NULL;
+    }
+    free(ctx->ducks);
+    ctx->ducks = NULL;
+    ctx->nducks = 0;
+    ctx->duck_level = ctx->duck_to = 0;
+}
+
+int sltp_set_ducking(struct sltp_ctx *ctx, const char *const match, double db) {
+    char *copy = NULL;
+    if (ctx->private_loop || (match && !(copy = strdup(match)))) {
+        return 1;
+    }
+    if (ctx->ready) {
+        for (size_t n = 0; n < ctx->nducks; ++n) {
+            if (ctx->ducks[n].held) {
+                duck_set(ctx, &ctx->ducks[n], 0);
+            }
+        }
+    }
+    duck_reset(ctx);
+    free(ctx->duck_match);
+    ctx->duck_match = copy;
+    db = -fabs(db);
+    ctx->duck_db = db < RAMP_FLOOR_DB ? RAMP_FLOOR_DB : db;
+    if (copy && ctx->ready) {
+        pa_operation_unref(pa_context_get_sink_input_info_list(ctx->context, duck_input, ctx));
+    }
+    return 0;
+}
+
+// Push-to-talk sources are looked up by name ahead of time, so a key press is
+// only ever a set request by index.
+static void mic_found(struct sltp_ctx *ctx, const pa_source_info *i) {
+    for (size_t n = 0; n < ctx->nmics; ++n) {
+        if (!strcmp(ctx->mics[n].name, i->name)) {
+            ctx->mics[n].index = i->index;
+        }
+    }
+}
+
+static void mic_info(pa_context *c, const pa_source_info *i, int eol, void *userdata) {
+    (void)c;
+    if (!eol) {
+        mic_found(userdata, i);
+    }
+}
+
+static bool mic_missing(const struct sltp_ctx *ctx) {
+    for (size_t n = 0; n < ctx->nmics; ++n) {
+        if (ctx->mics[n].index == PA_INVALID_INDEX) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void mic_lookup(struct sltp_ctx *ctx) {
+    for (size_t n = 0; n < ctx->nmics; ++n) {
+        if (ctx->mics[n].index == PA_INVALID_INDEX) {
+            pa_operation_unref(pa_context_get_source_info_by_name(ctx->context, ctx->mics[n].name, mic_info, ctx));
+        }
+    }
+}
+
+static void mic_removed(struct sltp_ctx *ctx, uint32_t idx) {
+    for (size_t n = 0; n < ctx->nmics; ++n) {
+        if (ctx->mics[n].index == idx) {
+            ctx->mics[n].index = PA_INVALID_INDEX;
+        }
+    }
+}
+
+int sltp_set_mic_sources(struct sltp_ctx *ctx, const char *const *names, size_t count) {
+    struct sltp_mic_source *mics = count ? calloc(count, sizeof(*mics)) : NULL;
+    if (count && !mics) {
+        return 1;
+    }
+    for (size_t n = 0; n < count; ++n) {
+        if ((size_t)snprintf(mics[n].name, sizeof(mics[n].name), "%s", names[n]) >= sizeof(mics[n].name)) {
+            free(mics);
+            return 1;
+        }
+        mics[n].index = PA_INVALID_INDEX;
+    }
+    free(ctx->mics);
+    ctx->mics = mics;
+    ctx->nmics = count;
+    if (ctx->ready) {
+        mic_lookup(ctx);
+    }
+    return 0;
+}
+
+// One set request per source, all sent back to back. The default source's
+// cached state is updated optimistically, as a toggle does.
+static void op_mic_set(struct sltp_op *op) {
+    struct sltp_ctx *ctx = op->ctx;
+    const bool mute = op->arg;
+    if (!ctx->nmics) {
+        if (ctx->source_index != PA_INVALID_INDEX) {
+            op->pending = 1;
+            pa_operation_unref(pa_context_set_source_mute_by_index(ctx->context, ctx->source_index, mute, op_success, op));
+        }
+    } else {
+        for (size_t n = 0; n < ctx->nmics; ++n) {
+            if (ctx->mics[n].index != PA_INVALID_INDEX) {
+                ++op->pending;
+                pa_operation_unref(pa_context_set_source_mute_by_index(ctx->context, ctx->mics[n].index, mute, op_success, op));
+            }
+        }
+    }
+    if (!op->pending) {
+        op_fail(op, "no source");
+        return;
+    }
+    op->res.value = mute;
+    snprintf(op->res.msg, sizeof(op->res.msg), "%s", mute ? "Mic muted" : "Mic on");
+    if (!ctx->nmics) {
+        ctx->state.mic_muted = mute;
+        notify_state(ctx);
+    }
+}
+
+// The mic level comes from a peak-detect stream: each sample the server
+// sends is the peak over 1/LEVEL_RATE s, and reads are LEVEL_FRAGMENT samples
+// apart, so the stream costs a few wakeups a second on either side.
+static const uint32_t LEVEL_RATE = 10;
+static const uint32_t LEVEL_FRAGMENT = 2;
+static const unsigned LEVEL_HOLD = 3; // quiet reads before active turns off
+
+static void level_notify(struct sltp_ctx *ctx, const struct sltp_mic_level *level) {
+    if (!ctx->level_cb) {
+        return;
+    }
+    if (ctx->level_reported && level->capturing == ctx->level.capturing && level->muted == ctx->level.muted
+        && level->active == ctx->level.active) {
+        return;
+    }
+    ctx->level = *level;
+    ctx->level_reported = true;
+    ctx->level_cb(ctx, level, ctx->level_userdata);
+}
+
+static void level_stop(struct sltp_ctx *ctx) {
+    if (ctx->level_stream) {
+        pa_stream_set_state_callback(ctx->level_stream, NULL, NULL);
+        pa_stream_set_read_callback(ctx->level_stream, NULL, NULL);
+        pa_stream_disconnect(ctx->level_stream);
+        pa_stream_unref(ctx->level_stream);
+        ctx->level_stream = NULL;
+    }
+    ctx->level_quiet = 0;
+}
+
+static void level_read(pa_stream *s, size_t nbytes, void *userdata) {
+    (void)nbytes;
+    struct sltp_ctx *ctx = userdata;
+    const void *data;
+    size_t len;
+    float peak = 0;
+    // A hole has no data but still has to be dropped.
+    while (pa_stream_peek(s, &data, &len) == 0 && len) {
+        for (size_t n = 0; data && n < len / sizeof(float); ++n) {
+            const float v = fabsf(((const float *)data)[n]);
+            peak = v > peak ? v : peak;
+        }
+        pa_stream_drop(s);
+    }
+    struct sltp_mic_level level = ctx->level;
+    if (peak >= ctx->level_threshold) {
+        ctx->level_quiet = 0;
+        level.active = true;
+    } else if (++ctx->level_quiet >= LEVEL_HOLD) {
+        level.active = false;
+    }
+    level_notify(ctx, &level);
+}
+
+static void level_update(struct sltp_ctx *ctx);
+
+static void level_stream_state(pa_stream *s, void *userdata) {
+    struct sltp_ctx *ctx = userdata;
+    const pa_stream_state_t state = pa_stream_get_state(s);
+    if (state == PA_STREAM_FAILED || state == PA_STREAM_TERMINATED) {
+        ctx->level_failed = ctx->level_source;
+        level_stop(ctx);
+        level_update(ctx);
+    }
+}
+
+static void level_start(struct sltp_ctx *ctx) {
+    const pa_sample_spec ss = { .format = PA_SAMPLE_FLOAT32NE, .rate = LEVEL_RATE, .channels = 1 };
+    const pa_buffer_attr attr = { .maxlength = UINT32_MAX, .fragsize = sizeof(float) * LEVEL_FRAGMENT };
+    if (!ctx->source_name || !(ctx->level_stream = pa_stream_new(ctx->context, "sltpwmt mic level", &ss, NULL))) {
+        return;
+    }
+    ctx->level_source = ctx->source_index;
+    pa_stream_set_state_callback(ctx->level_stream, level_stream_state, ctx);
+    pa_stream_set_read_callback(ctx->level_stream, level_read, ctx);
+    if (pa_stream_connect_record(ctx->level_stream, ctx->source_name, &attr, PA_STREAM_PEAK_DETECT
+        | PA_STREAM_ADJUST_LATENCY | PA_STREAM_DONT_MOVE | PA_STREAM_DONT_INHIBIT_AUTO_SUSPEND) < 0) {
+        level_stop(ctx);
+    }
+}
+
+// The level stream is open only while another client records from the
+// default source and it is not muted, so watching never holds the source
+// open, and a muted mic costs nothing.
+static void level_update(struct sltp_ctx *ctx) {
+    if (!ctx->level_cb) {
+        return;
+    }
+    const bool have = ctx->source_index != PA_INVALID_INDEX;
+    struct sltp_mic_level level = {
+        .capturing = have && ctx->level_captures > 0,
+        .muted = have && ctx->state.mic_muted,
+        .active = ctx->level.active,
+    };
+    const bool want = level.capturing && !level.muted;
+    if (ctx->level_stream && (!want || ctx->level_source != ctx->source_index)) {
+        level_stop(ctx);
+    }
+    if (want && !ctx->level_stream && ctx->level_failed != ctx->source_index) {
+        level_start(ctx);
+    }
+    level.active &= ctx->level_stream != NULL;
+    level_notify(ctx, &level);
+}
+
+static void level_scan(struct sltp_ctx *ctx);
+
+// Our own level stream does not count, nor does a corked one.
+static void level_output(pa_context *c, const pa_source_output_info *i, int eol, void *userdata) {
+    struct sltp_ctx *ctx = userdata;
+    if (!ctx->level_cb) {
+        return;
+    }
+    if (!eol) {
+        ctx->level_count += i->source == ctx->source_index && i->client != pa_context_get_index(c) && !i->corked;
+        return;
+    }
+    pa_operation_unref(ctx->level_scan_op);
+    ctx->level_scan_op = NULL;
+    if (ctx->level_rescan) {
+        level_scan(ctx);
+        return;
+    }
+    ctx->level_captures = ctx->level_count;
+    level_update(ctx);
+}
+
+// Record streams come and go rarely, so each change lists them all again
+// rather than keeping track of them one by one.
+static void level_scan(struct sltp_ctx *ctx) {
+    if (ctx->level_scan_op) {
+        ctx->level_rescan = true;
+        return;
+    }
+    ctx->level_rescan = false;
+    ctx->level_count = 0;
+    ctx->level_scan_op = pa_context_get_source_output_info_list(ctx->context, level_output, ctx);
+}
+
+// A list still in flight is cancelled rather than left to land on a
+// callback that may have gone away.
+static void level_reset(struct sltp_ctx *ctx) {
+    level_stop(ctx);
+    if (ctx->level_scan_op) {
+        pa_operation_cancel(ctx->level_scan_op);
+        pa_operation_unref(ctx->level_scan_op);
+        ctx->level_scan_op = NULL;
+    }
+    ctx->level_rescan = false;
+    ctx->level_captures = 0;
+    ctx->level_failed = PA_INVALID_INDEX;
+}
+
+int sltp_set_mic_level_callback(struct sltp_ctx *ctx, double threshold, sltp_mic_level_cb cb, void *userdata) {
+    if (ctx->private_loop) {
+        return 1;
+    }
+    if (!cb) {
+        level_reset(ctx);
+    }
+    ctx->level_cb = cb;
+    ctx->level_userdata = userdata;
+    ctx->level_threshold = (float)threshold;
+    ctx->level_reported = false;
+    ctx->level = (struct sltp_mic_level){0};
+    if (cb && ctx->ready && !ctx->level_scan_op) {
+        level_scan(ctx);
+    }
+    return 0;
+}
+
+// Called once both the sink and sink input lists are in; fires the default
+// sink change and every move back to back, so the whole switch costs one
+// round trip regardless of how many streams are playing.
+static void op_sink_next_switch(struct sltp_op *op) {
+    struct sltp_ctx *ctx = op->ctx;
+    if (op->nsinks == 0) {
+        op_fail(op, "no sinks");
+        return;
+    }
+
+    // With no default sink, or one that just went away, start from the first.
+    size_t next = 0;
+    for (size_t n = 0; n < op->nsinks; ++n) {
+        if (ctx->sink_name && !strcmp(op->sinks[n].name, ctx->sink_name)) {
+            next = (n + 1) % op->nsinks;
+            break;
+        }
+    }
+    const struct sltp_sink *sink = &op->sinks[next];
+
+    op->pending = 1 + (int)op->ninputs;
+    op->res.value = (int)op->ninputs;
+    snprintf(op->res.msg, sizeof(op->res.msg), "Output: %s", sink->description ? sink->description : sink->name);
+    pa_operation_unref(pa_context_set_default_sink(ctx->context, sink->name, op_success, op));
+    for (size_t n = 0; n < op->ninputs; ++n) {
+        pa_operation_unref(pa_context_move_sink_input_by_index(ctx->context, op->inputs[n], sink->index, op_success, op));
+    }
+}
+
+static void op_sink_next_sinks(pa_context *c, const pa_sink_info *i, int eol, void *userdata) {
+    (void)c;
+    struct sltp_op *op = userdata;
+    if (eol < 0) {
+        op->res.status = 1;
+    }
+    if (eol) {
+        if (--op->pending == 0) {
+            op->res.status ? op_fail(op, "pa_context_get_sink_info_list failed") : op_sink_next_switch(op);
+        }
+        return;
+    }
+
+    struct sltp_sink *sinks = realloc(op->sinks, (op->nsinks + 1) * sizeof(*sinks));
+    if (!sinks) {
+        op->res.status = 1;
+        return;
+    }
+    op->sinks = sinks;
+    char *const name = strdup(i->name);
+    char *const description = i->description ? strdup(i->description) : NULL;
+    if (!name || (i->description && !description)) {
+        free(name);
+        free(description);
+        op->res.status = 1;
+        return;
+    }
+    sinks[op->nsinks++] = (struct sltp_sink){
+        .index = i->index,
+        .name = name,
+        .description = description,
+    };
+}
+
+static void op_sink_next_inputs(pa_context *c, const pa_sink_input_info *i, int eol, void *userdata) {
+    (void)c;
+    struct sltp_op *op = userdata;
+    if (eol < 0) {
+        op->res.status = 1;
+    }
+    if (eol) {
+        if (--op->pending == 0) {
+            op->res.status ? op_fail(op, "pa_context_get_sink_input_info_list failed") : op_sink_next_switch(op);
+        }
+        return;
+    }
+
+    uint32_t *inputs = realloc(op->inputs, (op->ninputs + 1) * sizeof(*inputs));
+    if (!inputs) {
+        op->res.status = 1;
+        return;
+    }
+    op->inputs = inputs;
+    inputs[op->ninputs++] = i->index;
+}
+
+static void op_restore_done(struct sltp_op *op) {
+    if (--op->pending == 0) {
+        snprintf(op->res.msg, sizeof(op->res.msg), "Restored %d of %zu sinks", op->res.value, op->nrestore);
+        op_complete(op);
+    }
+}
+
+static void op_restore_volume(pa_context *c, int success, void *userdata) {
+    (void)c;
+    struct sltp_op *op = userdata;
+    op->res.value += success > 0;
+    op_restore_done(op);
+}
+
+static void op_restore_mute(pa_context *c, int success, void *userdata) {
+    (void)c; (void)success;
+    op_restore_done(userdata);
+}
+
+// Every set goes out back to back by name, without looking up which sinks
+// exist first; the ones that do not simply fail.
+static void op_restore(struct sltp_op *op) {
+    struct sltp_ctx *ctx = op->ctx;
+    op->pending = 1 + 2 * (int)op->nrestore;
+    for (size_t n = 0; n < op->nrestore; ++n) {
+        const struct sltp_saved_entry *e = &op->restore[n];
+        if (ctx->sink_name && !strcmp(e->name, ctx->sink_name)) {
+            if (ctx->ramp_event) {
+                ramp_abandon(ctx);
+            }
+            ctx->sink_volume = e->volume;
+            ctx->state.volume = pa_cvolume_max(&e->volume);
+            ctx->state.muted = e->muted;
+            notify_state(ctx);
+        }
+        pa_operation_unref(pa_context_set_sink_volume_by_name(ctx->context, e->name, &e->volume, op_restore_volume, op));
+        pa_operation_unref(pa_context_set_sink_mute_by_name(ctx->context, e->name, e->muted, op_restore_mute, op));
+    }
+    op_restore_done(op);
+}
+
+static const char *scene_device(const struct sltp_scene_change *c) {
+    return c->name[0] ? c->name : c->target == SLTP_SCENE_SINK ? "@DEFAULT_SINK@" : "@DEFAULT_SOURCE@";
+}
+
+static void op_scene_done(struct sltp_op *op);
+
+static void op_scene_sink(pa_context *c, const pa_sink_info *i, int eol, void *userdata) {
+    (void)c;
+    struct sltp_scene_undo *u = userdata;
+    if (!eol) {
+        *u = (struct sltp_scene_undo){ .op = u->op, .read = true, .volume = i->volume, .muted = i->mute };
+        return;
+    }
+    op_scene_done(u->op);
+}
+
+static void op_scene_source(pa_context *c, const pa_source_info *i, int eol, void *userdata) {
+    (void)c;
+    struct sltp_scene_undo *u = userdata;
+    if (!eol) {
+        *u = (struct sltp_scene_undo){ .op = u->op, .read = true, .volume = i->volume, .muted = i->mute };
+        return;
+    }
+    op_scene_done(u->op);
+}
+
+static void op_scene_success(pa_context *c, int success, void *userdata) {
+    (void)c;
+    struct sltp_op *op = userdata;
+    if (!success) {
+        op->res.status = 1;
+    }
+    op_scene_done(op);
+}
+
+// A NULL volume or negative mute is left alone.
+static void op_scene_set(struct sltp_op *op, size_t n, const pa_cvolume *volume, int mute) {
+    pa_context *c = op->ctx->context;
+    const char *name = scene_device(&op->scene[n]);
+    const bool sink = op->scene[n].target == SLTP_SCENE_SINK;
+    if (volume) {
+        ++op->pending;
+        pa_operation_unref(sink ? pa_context_set_sink_volume_by_name(c, name, volume, op_scene_success, op)
+            : pa_context_set_source_volume_by_name(c, name, volume, op_scene_success, op));
+    }
+    if (mute >= 0) {
+        ++op->pending;
+        pa_operation_unref(sink ? pa_context_set_sink_mute_by_name(c, name, mute, op_scene_success, op)
+            : pa_context_set_source_mute_by_name(c, name, mute, op_scene_success, op));
+    }
+}
+
+// Every change goes out back to back; the replies are only counted once all
+// have been sent.
+static void op_scene_write(struct sltp_op *op) {
+    struct sltp_ctx *ctx = op->ctx;
+    op->scene_phase = SLTP_SCENE_WRITE;
+    op->pending = 1;
+    for (size_t n = 0; n < op->nscene; ++n) {
+        const struct sltp_scene_change *c = &op->scene[n];
+        const struct sltp_scene_undo *u = &op->scene_undo[n];
+        if (c->target == SLTP_SCENE_SINK && ctx->ramp_event
+            && (!c->name[0] || (ctx->sink_name && !strcmp(c->name, ctx->sink_name)))) {
+            ramp_abandon(ctx);
+        }
+        if (c->set == SLTP_SCENE_MUTE || c->set == SLTP_SCENE_UNMUTE) {
+            op_scene_set(op, n, NULL, c->set == SLTP_SCENE_MUTE);
+        } else {
+            pa_cvolume volume = u->volume;
+            pa_cvolume_scale(&volume, c->set == SLTP_SCENE_PERCENT
+                ? (pa_volume_t)((uint64_t)PA_VOLUME_NORM * (uint64_t)c->value / 100) : (pa_volume_t)c->value);
+            op_scene_set(op, n, &volume, -1);
+        }
+    }
+    op_scene_done(op);
+}
+
+static void op_scene_put_back(struct sltp_op *op) {
+    op->scene_phase = SLTP_SCENE_PUT_BACK;
+    op->pending = 1;
+    for (size_t n = 0; n < op->nscene; ++n) {
+        op_scene_set(op, n, &op->scene_undo[n].volume, op->scene_undo[n].muted);
+    }
+    op_scene_done(op);
+}
+
+static void op_scene_done(struct sltp_op *op) {
+    if (--op->pending) {
+        return;
+    }
+    switch (op->scene_phase) {
+    case SLTP_SCENE_READ:
+        for (size_t n = 0; n < op->nscene; ++n) {
+            if (!op->scene_undo[n].read) {
+                snprintf(op->res.msg, sizeof(op->res.msg), "no %s %.100s",
+                    op->scene[n].target == SLTP_SCENE_SINK ? "sink" : "source", scene_device(&op->scene[n]));
+                op->res.status = 1;
+                op_complete(op);
+                return;
+            }
+        }
+        op_scene_write(op);
+        break;
+    case SLTP_SCENE_WRITE:
+        if (op->res.status) {
+            op_scene_put_back(op);
+            break;
+        }
+        op->res.value = (int)op->nscene;
+        snprintf(op->res.msg, sizeof(op->res.msg), "Set %zu sinks and sources", op->nscene);
+        op_complete(op);
+        break;
+    case SLTP_SCENE_PUT_BACK:
+        op->res.status = 1;
+        snprintf(op->res.msg, sizeof(op->res.msg), "audio change failed, put back");
+        op_complete(op);
+        break;
+    }
+}
+
+// Reads what every sink and source is at first, so that a change the server
+// refuses can be undone; nothing is changed unless all of them exist.
+static void op_scene(struct sltp_op *op) {
+    op->scene_phase = SLTP_SCENE_READ;
+    op->pending = 1 + (int)op->nscene;
+    for (size_t n = 0; n < op->nscene; ++n) {
+        const char *name = scene_device(&op->scene[n]);
+        op->scene_undo[n].op = op;
+        pa_operation_unref(op->scene[n].target == SLTP_SCENE_SINK
+            ? pa_context_get_sink_info_by_name(op->ctx->context, name, op_scene_sink, &op->scene_undo[n])
+            : pa_context_get_source_info_by_name(op->ctx->context, name, op_scene_source, &op->scene_undo[n]));
+    }
+    op_scene_done(op);
+}
+
+// Works off the cached default sink/source, so each op is a single set
+// request. The cache is updated optimistically so back-to-back steps build on
+// each other; the subscription corrects it if the server disagrees.
+static void op_start(struct sltp_op *op) {
+    struct sltp_ctx *ctx = op->ctx;
+    op->started = true;
+    sltp_profile_begin(&op->profile);
+    switch (op->type) {
+    case SLTP_OP_VOLUME: {
+        if (ctx->sink_index == PA_INVALID_INDEX || ctx->sink_volume.channels < 1) {
+            op_fail(op, "no sink");
+            return;
+        }
+        const pa_cvolume before = ctx->sink_volume;
+        int new_volume = pulse_step_volume(&ctx->sink_volume, op->arg, ctx->volume_snap);
+        if (ctx->ramp_duration) {
+            ramp_to(ctx, op, &before);
+        } else {
+            op->pending = 1;
+            pa_operation_unref(pa_context_set_sink_volume_by_index(ctx->context, ctx->sink_index, &ctx->sink_volume, op_success, op));
+        }
+        char buf[PA_VOLUME_SNPRINT_MAX] = {0};
+        pa_volume_snprint(buf, PA_VOLUME_SNPRINT_MAX, new_volume);
+        op->res.value = new_volume;
+        snprintf(op->res.msg, sizeof(op->res.msg), "Speakers %s", buf);
+        ctx->state.volume = new_volume;
+        notify_state(ctx);
+        notify_applied_sink(ctx);
+        break;
+    }
+    case SLTP_OP_MUTE:
+        if (op->arg == SLTP_SPEAKERS) {
+            if (ctx->sink_index == PA_INVALID_INDEX) {
+                op_fail(op, "no sink");
+                return;
+            }
+            op->res.value = ctx->state.muted = !ctx->state.muted;
+            op->pending = 1;
+            pa_operation_unref(pa_context_set_sink_mute_by_index(ctx->context, ctx->sink_index, ctx->state.muted, op_success, op));
+            snprintf(op->res.msg, sizeof(op->res.msg), "%s", ctx->state.muted ? "Speakers muted" : "Speakers on");
+            notify_applied_sink(ctx);
+        } else {
+            if (ctx->source_index == PA_INVALID_INDEX) {
+                op_fail(op, "no source");
+                return;
+            }
+            op->res.value = ctx->state.mic_muted = !ctx->state.mic_muted;
+            op->pending = 1;
+            pa_operation_unref(pa_context_set_source_mute_by_index(ctx->context, ctx->source_index, ctx->state.mic_muted, op_success, op));
+            snprintf(op->res.msg, sizeof(op->res.msg), "%s", ctx->state.mic_muted ? "Mic muted" : "Mic on");
+        }
+        notify_state(ctx);
+        break;
+    case SLTP_OP_SINK_NEXT:
+        op->pending = 2;
+        pa_operation_unref(pa_context_get_sink_info_list(ctx->context, op_sink_next_sinks, op));
+        pa_operation_unref(pa_context_get_sink_input_info_list(ctx->context, op_sink_next_inputs, op));
+        break;
+    case SLTP_OP_RESTORE:
+        op_restore(op);
+        break;
+    case SLTP_OP_SCENE:
+        op_scene(op);
+        break;
+    case SLTP_OP_MIC_SET:
+        op_mic_set(op);
+        break;
+    }
+}
+
+static void set_ready(struct sltp_ctx *ctx) {
+    ctx->ready = true;
+    sltp_profile_end(SLTP_PROFILE_INTROSPECT, &ctx->profile);
+    for (struct sltp_op *op = ctx->ops, *next; op; op = next) {
+        next = op->next;
+        if (!op->started) {
+            op_start(op);
+        }
+    }
+}
+
+static void ctx_sink_update(struct sltp_ctx *ctx, const pa_sink_info *i) {
+    if (ctx->ramp_event && i->index != ctx->sink_index) {
+        // The default sink changed under the ramp.
+        ramp_abandon(ctx);
+    }
+    ctx->sink_index = i->index;
+    // Mid-ramp the server reports where the ramp has got to, not where it
+    // is going.
+    if (!ctx->ramp_event) {
+        ctx->sink_volume = i->volume;
+        ctx->state.volume = pa_cvolume_max(&i->volume);
+    }
+    ctx->state.muted = i->mute;
+    ctx->state.valid |= SLTP_STATE_SINK;
+    notify_state(ctx);
+}
+
+static void ctx_source_update(struct sltp_ctx *ctx, const pa_source_info *i) {
+    const bool moved = ctx->source_index != i->index;
+    ctx->source_index = i->index;
+    ctx->state.mic_muted = i->mute;
+    ctx->state.valid |= SLTP_STATE_SOURCE;
+    notify_state(ctx);
+    if (ctx->level_cb && moved) {
+        level_scan(ctx);
+    } else if (ctx->level_cb) {
+        level_update(ctx);
+    }
+}
+
+static void ctx_info_done(struct sltp_ctx *ctx) {
+    if (--ctx->info_pending == 0 && !ctx->ready) {
+        set_ready(ctx);
+    }
+}
+
+static void ctx_sink_info(pa_context *c, const pa_sink_info *i, int eol, void *userdata) {
+    (void)c;
+    struct sltp_ctx *ctx = userdata;
+    if (eol) {
+        ctx_info_done(ctx);
+        return;
+    }
+    ctx_sink_update(ctx, i);
+}
+
+static void ctx_source_info(pa_context *c, const pa_source_info *i, int eol, void *userdata) {
+    (void)c;
+    struct sltp_ctx *ctx = userdata;
+    if (eol) {
+        ctx_info_done(ctx);
+        return;
+    }
+    ctx_source_update(ctx, i);
+}
+
+static void ctx_sink_refresh(pa_context *c, const pa_sink_info *i, int eol, void *userdata) {
+    (void)c;
+    if (!eol) {
+        ctx_sink_update(userdata, i);
+    }
+}
+
+static void ctx_source_refresh(pa_context *c, const pa_source_info *i, int eol, void *userdata) {
+    (void)c;
+    if (!eol) {
+        ctx_source_update(userdata, i);
+    }
+}
+
+// A device that was just plugged in, adopted if it is the default we lost.
+static void ctx_sink_new(pa_context *c, const pa_sink_info *i, int eol, void *userdata) {
+    (void)c;
+    struct sltp_ctx *ctx = userdata;
+    if (!eol && ctx->sink_index == PA_INVALID_INDEX && ctx->sink_name && !strcmp(i->name, ctx->sink_name)) {
+        ctx_sink_update(ctx, i);
+    }
+}
+
+static void ctx_source_new(pa_context *c, const pa_source_info *i, int eol, void *userdata) {
+    (void)c;
+    struct sltp_ctx *ctx = userdata;
+    if (eol) {
+        return;
+    }
+    if (ctx->source_index == PA_INVALID_INDEX && ctx->source_name && !strcmp(i->name, ctx->source_name)) {
+        ctx_source_update(ctx, i);
+    }
+    mic_found(ctx, i);
+}
+
+// Takes the new default name; returns whether it differs from the old one.
+static bool ctx_default_changed(char **cached, const char *name) {
+    if (*cached && name && !strcmp(*cached, name)) {
+        return false;
+    }
+    free(*cached);
+    *cached = name ? strdup(name) : NULL;
+    return true;
+}
+
+// Server changes are mostly not about the defaults, so only a default that
+// moved, or one we do not have, is looked up again.
+static void ctx_server_info(pa_context *c, const pa_server_info *i, void *userdata) {
+    struct sltp_ctx *ctx = userdata;
+    if (ctx_default_changed(&ctx->sink_name, i->default_sink_name) || ctx->sink_index == PA_INVALID_INDEX) {
+        ++ctx->info_pending;
+        pa_operation_unref(pa_context_get_sink_info_by_name(c, i->default_sink_name, ctx_sink_info, ctx));
+    }
+    if (ctx_default_changed(&ctx->source_name, i->default_source_name) || ctx->source_index == PA_INVALID_INDEX) {
+        ++ctx->info_pending;
+        pa_operation_unref(pa_context_get_source_info_by_name(c, i->default_source_name, ctx_source_info, ctx));
+    }
+    mic_lookup(ctx);
+}
+
+// The default went away. Its name is kept so that it is picked up again if
+// it comes back before the server settles on another.
+static void ctx_sink_removed(struct sltp_ctx *ctx) {
+    if (ctx->ramp_event) {
+        ramp_abandon(ctx);
+    }
+    ctx->sink_index = PA_INVALID_INDEX;
+    ctx->state.valid &= ~(uint32_t)SLTP_STATE_SINK;
+    notify_state(ctx);
+}
+
+static void ctx_source_removed(struct sltp_ctx *ctx) {
+    ctx->source_index = PA_INVALID_INDEX;
+    ctx->state.valid &= ~(uint32_t)SLTP_STATE_SOURCE;
+    notify_state(ctx);
+    if (ctx->level_cb) {
+        level_update(ctx);
+    }
+}
+
+static void ctx_subscribe(pa_context *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata) {
+    struct sltp_ctx *ctx = userdata;
+    switch (t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) {
+    case PA_SUBSCRIPTION_EVENT_SERVER:
+        // The default sink or source may have changed.
+        pa_operation_unref(pa_context_get_server_info(c, ctx_server_info, ctx));
+        break;
+    case PA_SUBSCRIPTION_EVENT_SINK:
+        switch (t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) {
+        case PA_SUBSCRIPTION_EVENT_CHANGE:
+            if (idx == ctx->sink_index) {
+                pa_operation_unref(pa_context_get_sink_info_by_index(c, idx, ctx_sink_refresh, ctx));
+            }
+            break;
+        case PA_SUBSCRIPTION_EVENT_NEW:
+            if (ctx->sink_index == PA_INVALID_INDEX) {
+                pa_operation_unref(pa_context_get_sink_info_by_index(c, idx, ctx_sink_new, ctx));
+            }
+            break;
+        case PA_SUBSCRIPTION_EVENT_REMOVE:
+            if (idx == ctx->sink_index) {
+                ctx_sink_removed(ctx);
+            }
+            break;
+        }
+        break;
+    case PA_SUBSCRIPTION_EVENT_SOURCE:
+        switch (t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) {
+        case PA_SUBSCRIPTION_EVENT_CHANGE:
+            if (idx == ctx->source_index) {
+                pa_operation_unref(pa_context_get_source_info_by_index(c, idx, ctx_source_refresh, ctx));
+            }
+            break;
+        case PA_SUBSCRIPTION_EVENT_NEW:
+            if (ctx->source_index == PA_INVALID_INDEX || mic_missing(ctx)) {
+                pa_operation_unref(pa_context_get_source_info_by_index(c, idx, ctx_source_new, ctx));
+            }
+            break;
+        case PA_SUBSCRIPTION_EVENT_REMOVE:
+            if (idx == ctx->source_index) {
+                ctx_source_removed(ctx);
+            }
+            mic_removed(ctx, idx);
+            break;
+        }
+        break;
+    case PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT:
+        // Our own level stream shows up here too; the list leaves it out.
+        if (ctx->level_cb && ctx->source_index != PA_INVALID_INDEX) {
+            level_scan(ctx);
+        }
+        break;
+    case PA_SUBSCRIPTION_EVENT_SINK_INPUT:
+        if (!ctx->duck_match) {
+            break;
+        }
+        if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE) {
+            duck_remove(ctx, idx);
+        } else {
+            // Changes to a held stream are our own ramp coming back.
+            const struct sltp_duck *d = duck_find(ctx, idx);
+            if (!d || !d->held) {
+                pa_operation_unref(pa_context_get_sink_input_info(c, idx, duck_input, ctx));
+            }
+        }
+        break;
+    }
+}
+
+static void ctx_disconnect(struct sltp_ctx *ctx) {
+    ramp_stop(ctx);
+    duck_reset(ctx);
+    level_reset(ctx);
+    if (ctx->context) {
+        pa_context_set_state_callback(ctx->context, NULL, NULL);
+        pa_context_set_subscribe_callback(ctx->context, NULL, NULL);
+        pa_context_disconnect(ctx->context);
+        pa_context_unref(ctx->context);
+        ctx->context = NULL;
+    }
+}
+
+static void ctx_reconnect(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)tv;
+    struct sltp_ctx *ctx = userdata;
+    a->time_free(e);
+    ctx->reconnect_event = NULL;
+    ctx_disconnect(ctx);
+    sltp_connect(ctx);
+}
+
+static void ctx_sm(pa_context *c, void *userdata) {
+    struct sltp_ctx *ctx = userdata;
+    switch (pa_context_get_state(c)) {
+    case PA_CONTEXT_READY:
+        sltp_profile_end(SLTP_PROFILE_CONNECT, &ctx->profile);
+        sltp_profile_begin(&ctx->profile);
+        ctx->profile_phase = SLTP_PROFILE_INTROSPECT;
+        if (!ctx->private_loop) {
+            pa_context_set_subscribe_callback(c, ctx_subscribe, ctx);
+            pa_operation_unref(pa_context_subscribe(c,
+                PA_SUBSCRIPTION_MASK_SINK | PA_SUBSCRIPTION_MASK_SOURCE | PA_SUBSCRIPTION_MASK_SERVER
+                | PA_SUBSCRIPTION_MASK_SINK_INPUT | PA_SUBSCRIPTION_MASK_SOURCE_OUTPUT, NULL, NULL));
+            if (ctx->duck_match) {
+                pa_operation_unref(pa_context_get_sink_input_info_list(c, duck_input, ctx));
+            }
+        }
+        pa_operation_unref(pa_context_get_server_info(c, ctx_server_info, ctx));
+        break;
+    case PA_CONTEXT_FAILED:
+    case PA_CONTEXT_TERMINATED:
+        sltp_profile_end(ctx->profile_phase, &ctx->profile);
+        ctx->ready = false;
+        ctx->info_pending = 0;
+        ctx->sink_index = ctx->source_index = PA_INVALID_INDEX;
+        for (size_t n = 0; n < ctx->nmics; ++n) {
+            ctx->mics[n].index = PA_INVALID_INDEX;
+        }
+        duck_reset(ctx);
+        ctx->state.valid &= ~(uint32_t)(SLTP_STATE_SINK | SLTP_STATE_SOURCE);
+        notify_state(ctx);
+        level_reset(ctx);
+        if (ctx->level_cb) {
+            level_update(ctx);
+        }
+        if (ctx->private_loop) {
+            // One-shot use; do not keep retrying behind the caller's back.
+            ctx->failed = true;
+        } else if (!ctx->reconnect_event) {
+            struct timeval tv;
+            pa_timeval_add(pa_gettimeofday(&tv), RECONNECT_DELAY);
+            ctx->reconnect_event = ctx->api->time_new(ctx->api, &tv, ctx_reconnect, ctx);
+        }
+        fail_ops(ctx, "PulseAudio connection failed");
+        break;
+    default:
+        break;
+    }
+}
+
+int sltp_connect(struct sltp_ctx *ctx) {
+    if ((ctx->context && !ctx->failed) || ctx->reconnect_event) {
+        return 0;
+    }
+    ctx_disconnect(ctx);
+    ctx->failed = false;
+    if (ctx->private_loop && !ctx->mainloop) {
+        if (!(ctx->mainloop = pa_mainloop_new())) {
+            fprintf(stderr, "pa_mainloop_new failed\n");
+            ctx->failed = true;
+            return 1;
+        }
+        ctx->api = pa_mainloop_get_api(ctx->mainloop);
+    }
+    if (!(ctx->context = pa_context_new(ctx->api, "sltpwmt"))) {
+        fprintf(stderr, "pa_context_new failed\n");
+        ctx->failed = true;
+        return 1;
+    }
+    pa_context_set_state_callback(ctx->context, ctx_sm, ctx);
+    sltp_profile_begin(&ctx->profile);
+    ctx->profile_phase = SLTP_PROFILE_CONNECT;
+    if (pa_context_connect(ctx->context, NULL, ctx->private_loop ? PA_CONTEXT_NOFLAGS : PA_CONTEXT_NOFAIL, NULL) < 0) {
+        fprintf(stderr, "pa_context_connect failed: %s\n", pa_strerror(pa_context_errno(ctx->context)));
+        ctx->failed = true;
+        return 1;
+    }
+    return 0;
+}
+
+// What restores and scenes work through; copied into the op.
+struct op_args {
+    const struct sltp_saved *saved; // SLTP_OP_RESTORE: its sinks
+    const struct sltp_scene_change *scene; // SLTP_OP_SCENE: its sinks and sources
+    size_t nscene;
+};
+
+static int op_submit(struct sltp_ctx *ctx, enum sltp_op_type type, int arg, const struct op_args *args,
+    sltp_result_cb cb, void *userdata) {
+    const struct sltp_saved *saved = args ? args->saved : NULL;
+    struct sltp_op *op = calloc(1, sizeof(*op));
+    if (!op) {
+        return -1;
+    }
+    *op = (struct sltp_op){ .ctx = ctx, .type = type, .arg = arg, .cb = cb, .userdata = userdata };
+    for (size_t n = 0; saved && n < saved->count; ++n) {
+        if (saved->entries[n].kind != SLTP_SAVED_SINK) {
+            continue;
+        }
+        if (!op->restore && !(op->restore = calloc(saved->count, sizeof(*op->restore)))) {
+            free(op);
+            return -1;
+        }
+        op->restore[op->nrestore++] = saved->entries[n];
+    }
+    for (size_t n = 0; args && n < args->nscene; ++n) {
+        if (args->scene[n].target == SLTP_SCENE_BACKLIGHT) {
+            continue;
+        }
+        if (!op->scene && (!(op->scene = calloc(args->nscene, sizeof(*op->scene)))
+            || !(op->scene_undo = calloc(args->nscene, sizeof(*op->scene_undo))))) {
+            op_free(op);
+            return -1;
+        }
+        op->scene[op->nscene++] = args->scene[n];
+    }
+
+    // Connect before queueing: a synchronous failure fails everything queued.
+    if (sltp_connect(ctx) || ctx->failed) {
+        op_fail(op, "PulseAudio connection failed");
+        return 0;
+    }
+    // While waiting to reconnect, answer now rather than whenever the server
+    // comes back.
+    if (!ctx->ready && ctx->reconnect_event) {
+        op_fail(op, "PulseAudio not connected");
+        return 0;
+    }
+
+    struct sltp_op **tail = &ctx->ops;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = op;
+    if (ctx->ready) {
+        op_start(op);
+    }
+    return 0;
+}
+
+int sltp_volume_step_async(struct sltp_ctx *ctx, int delta, sltp_result_cb cb, void *userdata) {
+    return op_submit(ctx, SLTP_OP_VOLUME, delta, NULL, cb, userdata);
+}
+
+int sltp_toggle_mute_async(struct sltp_ctx *ctx, enum sltp_device dev, sltp_result_cb cb, void *userdata) {
+    return op_submit(ctx, SLTP_OP_MUTE, dev, NULL, cb, userdata);
+}
+
+int sltp_set_mic_mute_async(struct sltp_ctx *ctx, bool mute, sltp_result_cb cb, void *userdata) {
+    return op_submit(ctx, SLTP_OP_MIC_SET, mute, NULL, cb, userdata);
+}
+
+int sltp_sink_next_async(struct sltp_ctx *ctx, sltp_result_cb cb, void *userdata) {
+    return op_submit(ctx, SLTP_OP_SINK_NEXT, 0, NULL, cb, userdata);
+}
+
+int sltp_restore_sinks_async(struct sltp_ctx *ctx, const struct sltp_saved *saved, sltp_result_cb cb, void *userdata) {
+    const struct op_args args = { .saved = saved };
+    return op_submit(ctx, SLTP_OP_RESTORE, 0, &args, cb, userdata);
+}
+
+int sltp_scene_audio_async(struct sltp_ctx *ctx, const struct sltp_scene_change *changes, size_t count,
+    sltp_result_cb cb, void *userdata) {
+    const struct op_args args = { .scene = changes, .nscene = count };
+    return op_submit(ctx, SLTP_OP_SCENE, 0, &args, cb, userdata);
+}
+
+struct sync_wait {
+    bool done;
+    struct sltp_result *res;
+};
+
+static void sync_done(struct sltp_ctx *ctx, const struct sltp_result *res, void *userdata) {
+    (void)ctx;
+    struct sync_wait *w = userdata;
+    *w->res = *res;
+    w->done = true;
+}
+
+static int sync_run(struct sltp_ctx *ctx, enum sltp_op_type type, int arg, const struct op_args *args,
+    struct sltp_result *res) {
+    struct sync_wait w = { .res = res };
+    *res = (struct sltp_result){ .status = 1 };
+    if (!ctx->private_loop) {
+        snprintf(res->msg, sizeof(res->msg), "blocking call on a shared mainloop");
+        return 1;
+    }
+    if (op_submit(ctx, type, arg, args, sync_done, &w)) {
+        snprintf(res->msg, sizeof(res->msg), "out of memory");
+        return 1;
+    }
+    while (!w.done) {
+        if (pa_mainloop_iterate(ctx->mainloop, 1, NULL) < 0) {
+            snprintf(res->msg, sizeof(res->msg), "mainloop stopped");
+            return 1;
+        }
+    }
+    return res->status;
+}
+
+int sltp_volume_step(struct sltp_ctx *ctx, int delta, struct sltp_result *res) {
+    return sync_run(ctx, SLTP_OP_VOLUME, delta, NULL, res);
+}
+
+int sltp_toggle_mute(struct sltp_ctx *ctx, enum sltp_device dev, struct sltp_result *res) {
+    return sync_run(ctx, SLTP_OP_MUTE, dev, NULL, res);
+}
+
+int sltp_set_mic_mute(struct sltp_ctx *ctx, bool mute, struct sltp_result *res) {
+    return sync_run(ctx, SLTP_OP_MIC_SET, mute, NULL, res);
+}
+
+int sltp_sink_next(struct sltp_ctx *ctx, struct sltp_result *res) {
+    return sync_run(ctx, SLTP_OP_SINK_NEXT, 0, NULL, res);
+}
+
+int sltp_restore(struct sltp_ctx *ctx, const struct sltp_saved *saved, struct sltp_result *res) {
+    struct sltp_result br;
+    sltp_restore_backlights(ctx, saved, &br);
+    for (size_t n = 0; n < saved->count; ++n) {
+        if (saved->entries[n].kind == SLTP_SAVED_SINK) {
+            const struct op_args args = { .saved = saved };
+            sync_run(ctx, SLTP_OP_RESTORE, 0, &args, res);
+            if (br.status) {
+                snprintf(res->msg, sizeof(res->msg), "%s", br.msg);
+            }
+            return res->status |= br.status;
+        }
+    }
+    *res = br;
+    return res->status;
+}
+
+int sltp_scene_apply(struct sltp_ctx *ctx, const struct sltp_scene_change *changes, size_t count,
+    struct sltp_result *res) {
+    struct sltp_saved undo;
+    struct sltp_result br, scratch;
+    if (sltp_scene_backlights(ctx, changes, count, &undo, &br)) {
+        *res = br;
+        return res->status;
+    }
+    for (size_t n = 0; n < count; ++n) {
+        if (changes[n].target != SLTP_SCENE_BACKLIGHT) {
+            const struct op_args args = { .scene = changes, .nscene = count };
+            if (sync_run(ctx, SLTP_OP_SCENE, 0, &args, res)) {
+                sltp_restore_backlights(ctx, &undo, &scratch);
+            }
+            return res->status;
+        }
+    }
+    *res = br;
+    return res->status;
+}
+
+int sltp_get_state(struct sltp_ctx *ctx, struct sltp_state *st) {
+    int br, max_br;
+    sltp_brightness_get(ctx, &br, &max_br);
+    if (ctx->private_loop) {
+        sltp_connect(ctx);
+        while (!ctx->ready && !ctx->failed) {
+            if (pa_mainloop_iterate(ctx->mainloop, 1, NULL) < 0) {
+                break;
+            }
+        }
+    }
+    *st = ctx->state;
+    return st->valid ? 0 : 1;
+}
+
+void sltp_free(struct sltp_ctx *ctx) {
+    if (!ctx) {
+        return;
+    }
+    fail_ops(ctx, "context freed");
+    ctx_disconnect(ctx);
+    if (ctx->reconnect_event) {
+        ctx->api->time_free(ctx->reconnect_event);
+    }
+    free(ctx->sink_name);
+    free(ctx->source_name);
+    free(ctx->duck_match);
+    free(ctx->mics);
+    sltp_gamma_free(ctx->gamma);
+    sltp_dbus_free(ctx->dbus);
+    if (ctx->mainloop) {
+        pa_mainloop_free(ctx->mainloop);
+    }
+    free(ctx);
+}
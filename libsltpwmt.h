@@ -0,0 +1,158 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef LIBSLTPWMT_H
+#define LIBSLTPWMT_H
+
+#include <stdbool.h>
+
+#include <pulse/pulseaudio.h>
+
+#include "config.h"
+#include "saved.h"
+#include "state.h"
+
+// Everything sltpwmt does, minus the process around it. All state lives in a
+// struct sltp_ctx, so several contexts can coexist in one process (e.g. a
+// window manager) and nothing here touches signals or stdout.
+//
+// A context created with a NULL mainloop API owns a private pa_mainloop and
+// the blocking calls iterate it until their answer arrives; if the connection
+// fails, only the next call tries again. A context created on the
+// caller's mainloop API never blocks: use the _async variants, whose
+// callbacks run from that mainloop. It keeps a subscription to the default
+// sink and source and reconnects whenever the server goes away.
+
+struct sltp_ctx;
+
+enum sltp_device {
+    SLTP_SPEAKERS,
+    SLTP_MIC,
+};
+
+struct sltp_result {
+    int status; // 0 on success
+    int value; // new brightness or volume, mute state, or streams moved
+    char msg[128]; // human-readable, e.g. "Speakers 45%"
+};
+
+typedef void (*sltp_result_cb)(struct sltp_ctx *ctx, const struct sltp_result *res, void *userdata);
+typedef void (*sltp_state_cb)(struct sltp_ctx *ctx, const struct sltp_state *st, void *userdata);
+struct sltp_mic_level {
+    bool capturing; // another client records from the default source
+    bool muted;
+    bool active; // and its peak is over the threshold
+};
+
+typedef void (*sltp_mic_level_cb)(struct sltp_ctx *ctx, const struct sltp_mic_level *level, void *userdata);
+typedef void (*sltp_applied_cb)(struct sltp_ctx *ctx, const struct sltp_saved_entry *e, void *userdata);
+
+struct sltp_ctx *sltp_new(pa_mainloop_api *api);
+void sltp_free(struct sltp_ctx *ctx);
+
+enum sltp_brightness_backend {
+    SLTP_BRIGHTNESS_AUTO, // gamma without a backlight, logind if sysfs is read-only
+    SLTP_BRIGHTNESS_SYSFS,
+    SLTP_BRIGHTNESS_LOGIND,
+    SLTP_BRIGHTNESS_GAMMA,
+};
+
+// NULL, the default, is $SLTPWMT_BACKLIGHT, or intel_backlight.
+int sltp_set_backlight(struct sltp_ctx *ctx, const char *dir);
+const char *sltp_backlight_dir(const struct sltp_ctx *ctx);
+// The backlight directory appeared or went away: looks at it again, and
+// rereads max_brightness on the next get.
+void sltp_backlight_changed(struct sltp_ctx *ctx);
+void sltp_set_brightness_backend(struct sltp_ctx *ctx, enum sltp_brightness_backend backend);
+
+// Volume steps glide to their target over duration instead of jumping; 0
+// (the default) turns this off. Blocking steps return once the ramp lands.
+void sltp_set_volume_ramp(struct sltp_ctx *ctx, pa_usec_t duration);
+
+// A step landing within percent of 100% lands on 100%; 2 by default.
+void sltp_set_volume_snap(struct sltp_ctx *ctx, unsigned percent);
+
+// While a stream whose media.role, application.name or binary matches the
+// fnmatch pattern plays, every other stream is turned down by db decibels,
+// and back up once none does. NULL turns this off and gives streams back at
+// once. Needs a context on the caller's mainloop.
+int sltp_set_ducking(struct sltp_ctx *ctx, const char *match, double db);
+
+// Push-to-talk mutes and unmutes these sources instead of the default one;
+// none (the default) goes back to the default source. Each is looked up once,
+// and again when it is plugged back in, so setting the mute never waits on a
+// lookup. A source that is missing is skipped. Names are under 128 bytes.
+int sltp_set_mic_sources(struct sltp_ctx *ctx, const char *const *names, size_t count);
+
+// Called once with where the default source stands, and then whenever one of
+// the three changes. The level is only read while another client records
+// from the unmuted source, through a peak-detect stream at a few samples a
+// second that does not keep the source from suspending. threshold is a
+// fraction of full scale. Needs a context on the caller's mainloop; a NULL
+// cb turns it off.
+int sltp_set_mic_level_callback(struct sltp_ctx *ctx, double threshold, sltp_mic_level_cb cb, void *userdata);
+
+// Starts connecting to PulseAudio; the first audio call does this anyway.
+int sltp_connect(struct sltp_ctx *ctx);
+
+// Called with the cached state whenever it changes.
+void sltp_set_state_callback(struct sltp_ctx *ctx, sltp_state_cb cb, void *userdata);
+const struct sltp_state *sltp_cached_state(const struct sltp_ctx *ctx);
+
+// Called with every brightness, sink volume or sink mute the context sets
+// itself, ready for sltp_saved_record; changes made by anyone else are not
+// reported, so a panel waking up at full brightness is never saved.
+void sltp_set_applied_callback(struct sltp_ctx *ctx, sltp_applied_cb cb, void *userdata);
+
+// Brightness is plain sysfs and always synchronous. Steps are serialised with
+// other processes touching the same device; a step handed to another
+// process's lock holder reports "queued" and no value.
+int sltp_brightness_get(struct sltp_ctx *ctx, int *br, int *max_br);
+int sltp_brightness_set(struct sltp_ctx *ctx, int value, struct sltp_result *res);
+int sltp_brightness_step(struct sltp_ctx *ctx, int delta, struct sltp_result *res);
+// Switches the panel off or on through bl_power, keeping its brightness; -1
+// if the backlight has no bl_power or it is not writable.
+int sltp_backlight_power(struct sltp_ctx *ctx, bool on);
+
+// Blocking variants return res->status and need a private mainloop.
+int sltp_volume_step(struct sltp_ctx *ctx, int delta, struct sltp_result *res);
+int sltp_toggle_mute(struct sltp_ctx *ctx, enum sltp_device dev, struct sltp_result *res);
+int sltp_set_mic_mute(struct sltp_ctx *ctx, bool mute, struct sltp_result *res);
+int sltp_sink_next(struct sltp_ctx *ctx, struct sltp_result *res);
+int sltp_get_state(struct sltp_ctx *ctx, struct sltp_state *st);
+
+// Return 0 once the request is queued; cb may be NULL.
+int sltp_volume_step_async(struct sltp_ctx *ctx, int delta, sltp_result_cb cb, void *userdata);
+int sltp_toggle_mute_async(struct sltp_ctx *ctx, enum sltp_device dev, sltp_result_cb cb, void *userdata);
+int sltp_set_mic_mute_async(struct sltp_ctx *ctx, bool mute, sltp_result_cb cb, void *userdata);
+int sltp_sink_next_async(struct sltp_ctx *ctx, sltp_result_cb cb, void *userdata);
+
+// Puts back what was saved: one write per backlight, then every sink's volume
+// and mute in a single pipelined batch. Sinks that are gone are skipped;
+// res->value is the number of sinks restored.
+int sltp_restore_backlights(struct sltp_ctx *ctx, const struct sltp_saved *saved, struct sltp_result *res);
+int sltp_restore_sinks_async(struct sltp_ctx *ctx, const struct sltp_saved *saved, sltp_result_cb cb, void *userdata);
+int sltp_restore(struct sltp_ctx *ctx, const struct sltp_saved *saved, struct sltp_result *res);
+
+// Scenes, as defined in config.h. Every backlight in one is read, then all
+// are written at once; undo gets what they were, and if any write fails they
+// are put back before this returns. Sinks and sources go out as one
+// pipelined batch: their volume and mute are read, every change is sent, and
+// if the server refuses any they are all set back. sltp_scene_apply does
+// both, putting the backlights back too if the audio half fails.
+int sltp_scene_backlights(struct sltp_ctx *ctx, const struct sltp_scene_change *changes, size_t count,
+    struct sltp_saved *undo, struct sltp_result *res);
+int sltp_scene_audio_async(struct sltp_ctx *ctx, const struct sltp_scene_change *changes, size_t count,
+    sltp_result_cb cb, void *userdata);
+int sltp_scene_apply(struct sltp_ctx *ctx, const struct sltp_scene_change *changes, size_t count,
+    struct sltp_result *res);
+
+// Shared with the CLI.
+int sltp_runtime_path(char *buf, size_t buflen, const char *name);
+ssize_t sltp_read_sysfs(const char *path, char *buf, ssize_t buflen);
+ssize_t sltp_write_sysfs(const char *path, const char *buf, ssize_t nbytes);
+
+#endif
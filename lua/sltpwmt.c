@@ -0,0 +1,229 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+// AwesomeWM module: `local sltpwmt = require("sltpwmt")` runs everything
+// inside the WM process on its GLib main loop, so a hotkey costs no fork.
+//
+//   sltpwmt.brightness(delta)          -> value, message | nil, error
+//   sltpwmt.volume(delta[, cb])
+//   sltpwmt.volume_ramp(ms)            glide volume steps over ms, 0 = off
+//   sltpwmt.duck(pattern[, dB])        turn others down while pattern plays
+//   sltpwmt.mute("speakers"|"mic"[, cb])
+//   sltpwmt.sink_next([cb])
+//   sltpwmt.state()                    -> table
+//   sltpwmt.on_change(fn)              fn(state table), or nil to stop
+//
+// Audio calls return immediately; cb(ok, value, message) runs once the
+// server has answered.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <pulse/glib-mainloop.h>
+
+#include "libsltpwmt.h"
+
+static lua_State *lua_main = NULL;
+static pa_glib_mainloop *lua_mainloop = NULL;
+static struct sltp_ctx *lua_ctx = NULL;
+static int lua_change_ref = LUA_NOREF;
+
+static struct sltp_ctx *ctx_get(lua_State *L) {
+    if (!lua_ctx) {
+        if (!(lua_mainloop = pa_glib_mainloop_new(NULL))
+            || !(lua_ctx = sltp_new(pa_glib_mainloop_get_api(lua_mainloop)))) {
+            luaL_error(L, "sltpwmt: initialisation failed");
+        }
+        sltp_connect(lua_ctx);
+    }
+    return lua_ctx;
+}
+
+static void push_state(lua_State *L, const struct sltp_state *st) {
+    lua_newtable(L);
+    if (st->valid & SLTP_STATE_BRIGHTNESS) {
+        lua_pushinteger(L, st->brightness);
+        lua_setfield(L, -2, "brightness");
+        lua_pushinteger(L, st->max_brightness);
+        lua_setfield(L, -2, "max_brightness");
+    }
+    if (st->valid & SLTP_STATE_SINK) {
+        lua_pushnumber(L, (double)st->volume * 100 / PA_VOLUME_NORM);
+        lua_setfield(L, -2, "volume");
+        lua_pushboolean(L, st->muted);
+        lua_setfield(L, -2, "muted");
+    }
+    if (st->valid & SLTP_STATE_SOURCE) {
+        lua_pushboolean(L, st->mic_muted);
+        lua_setfield(L, -2, "mic_muted");
+    }
+}
+
+static void call_ref(lua_State *L, int ref, int nargs) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    lua_insert(L, -1 - nargs);
+    if (lua_pcall(L, nargs, 0, 0)) {
+        fprintf(stderr, "sltpwmt: callback failed: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+static void on_state(struct sltp_ctx *ctx, const struct sltp_state *st, void *userdata) {
+    (void)ctx; (void)userdata;
+    if (lua_change_ref != LUA_NOREF) {
+        push_state(lua_main, st);
+        call_ref(lua_main, lua_change_ref, 1);
+    }
+}
+
+// The Lua callback's registry ref travels as the op's userdata.
+static void on_result(struct sltp_ctx *ctx, const struct sltp_result *res, void *userdata) {
+    (void)ctx;
+    const int ref = (int)(intptr_t)userdata;
+    lua_State *L = lua_main;
+    lua_pushboolean(L, res->status == 0);
+    lua_pushinteger(L, res->value);
+    lua_pushstring(L, res->msg);
+    call_ref(L, ref, 3);
+    luaL_unref(L, LUA_REGISTRYINDEX, ref);
+}
+
+static sltp_result_cb opt_callback(lua_State *L, int idx, void **userdata) {
+    if (lua_isnoneornil(L, idx)) {
+        *userdata = NULL;
+        return NULL;
+    }
+    luaL_checktype(L, idx, LUA_TFUNCTION);
+    lua_pushvalue(L, idx);
+    *userdata = (void *)(intptr_t)luaL_ref(L, LUA_REGISTRYINDEX);
+    return on_result;
+}
+
+static int push_result(lua_State *L, const struct sltp_result *res) {
+    if (res->status) {
+        lua_pushnil(L);
+        lua_pushstring(L, res->msg);
+        return 2;
+    }
+    lua_pushinteger(L, res->value);
+    lua_pushstring(L, res->msg);
+    return 2;
+}
+
+static int l_brightness(lua_State *L) {
+    struct sltp_result res;
+    sltp_brightness_step(ctx_get(L), (int)luaL_checkinteger(L, 1), &res);
+    return push_result(L, &res);
+}
+
+static int l_volume(lua_State *L) {
+    const int delta = (int)luaL_checkinteger(L, 1);
+    void *ud;
+    sltp_result_cb cb = opt_callback(L, 2, &ud);
+    if (sltp_volume_step_async(ctx_get(L), delta, cb, ud)) {
+        return luaL_error(L, "sltpwmt: out of memory");
+    }
+    return 0;
+}
+
+static int l_volume_ramp(lua_State *L) {
+    sltp_set_volume_ramp(ctx_get(L), (pa_usec_t)luaL_checkinteger(L, 1) * PA_USEC_PER_MSEC);
+    return 0;
+}
+
+static int l_duck(lua_State *L) {
+    const char *match = luaL_optstring(L, 1, NULL);
+    if (sltp_set_ducking(ctx_get(L), match, luaL_optnumber(L, 2, 12))) {
+        return luaL_error(L, "sltpwmt: out of memory");
+    }
+    return 0;
+}
+
+static int l_mute(lua_State *L) {
+    static const char *const devices[] = { "speakers", "mic", NULL };
+    const int dev = luaL_checkoption(L, 1, "speakers", devices);
+    void *ud;
+    sltp_result_cb cb = opt_callback(L, 2, &ud);
+    if (sltp_toggle_mute_async(ctx_get(L), dev ? SLTP_MIC : SLTP_SPEAKERS, cb, ud)) {
+        return luaL_error(L, "sltpwmt: out of memory");
+    }
+    return 0;
+}
+
+static int l_sink_next(lua_State *L) {
+    void *ud;
+    sltp_result_cb cb = opt_callback(L, 1, &ud);
+    if (sltp_sink_next_async(ctx_get(L), cb, ud)) {
+        return luaL_error(L, "sltpwmt: out of memory");
+    }
+    return 0;
+}
+
+static int l_state(lua_State *L) {
+    struct sltp_ctx *ctx = ctx_get(L);
+    int br, max_br;
+    sltp_brightness_get(ctx, &br, &max_br);
+    push_state(L, sltp_cached_state(ctx));
+    return 1;
+}
+
+static int l_on_change(lua_State *L) {
+    struct sltp_ctx *ctx = ctx_get(L);
+    luaL_unref(L, LUA_REGISTRYINDEX, lua_change_ref);
+    lua_change_ref = LUA_NOREF;
+    if (!lua_isnoneornil(L, 1)) {
+        luaL_checktype(L, 1, LUA_TFUNCTION);
+        lua_pushvalue(L, 1);
+        lua_change_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    sltp_set_state_callback(ctx, lua_change_ref == LUA_NOREF ? NULL : on_state, NULL);
+    return 0;
+}
+
+static int l_gc(lua_State *L) {
+    (void)L;
+    sltp_free(lua_ctx);
+    lua_ctx = NULL;
+    if (lua_mainloop) {
+        pa_glib_mainloop_free(lua_mainloop);
+        lua_mainloop = NULL;
+    }
+    return 0;
+}
+
+static const luaL_Reg sltpwmt_funcs[] = {
+    { "brightness", l_brightness },
+    { "volume", l_volume },
+    { "volume_ramp", l_volume_ramp },
+    { "duck", l_duck },
+    { "mute", l_mute },
+    { "sink_next", l_sink_next },
+    { "state", l_state },
+    { "on_change", l_on_change },
+    { NULL, NULL },
+};
+
+int luaopen_sltpwmt(lua_State *L) {
+    lua_main = L;
+#if LUA_VERSION_NUM < 502
+    luaL_register(L, "sltpwmt", sltpwmt_funcs);
+#else
+    luaL_newlib(L, sltpwmt_funcs);
+#endif
+
+    // Tears the context down with the Lua state, e.g. on an awesome restart.
+    lua_newuserdata(L, 1);
+    lua_newtable(L);
+    lua_pushcfunction(L, l_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, -2, "__context");
+    return 1;
+}
@@ -0,0 +1,129 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "metrics.h"
+
+static const char *const METRIC_OP_NAMES[SLTP_METRIC_OPS] = {
+    "brightness", "volume", "mute", "mic_mute",
+};
+
+static const char *const METRIC_FAILURE_NAMES[SLTP_METRIC_FAILURES] = {
+    "sysfs", "pa_connect", "pa_op", "busy",
+};
+
+static const char *const METRIC_PHASE_NAMES[SLTP_METRIC_PHASES] = {
+    "request", "sysfs", "audio_queue", "pa",
+};
+
+struct metrics_buf {
+    char *p;
+    size_t len;
+    size_t used;
+    bool overflow;
+};
+
+__attribute__((format(printf, 2, 3)))
+static void metrics_printf(struct metrics_buf *b, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    const int n = vsnprintf(b->p + b->used, b->len - b->used, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= b->len - b->used) {
+        b->overflow = true;
+        return;
+    }
+    b->used += (size_t)n;
+}
+
+static uint64_t load(const _Atomic uint64_t *v) {
+    return atomic_load_explicit(v, memory_order_relaxed);
+}
+
+int sltp_metrics_format(const struct sltp_metrics *m, char *buf, size_t len) {
+    struct metrics_buf b = { .p = buf, .len = len };
+    if (!len) {
+        return -1;
+    }
+
+    metrics_printf(&b, "# HELP sltpwmt_ops_total Operations started, by type.\n"
+        "# TYPE sltpwmt_ops_total counter\n");
+    for (int n = 0; n < SLTP_METRIC_OPS; ++n) {
+        metrics_printf(&b, "sltpwmt_ops_total{op=\"%s\"} %llu\n",
+            METRIC_OP_NAMES[n], (unsigned long long)load(&m->ops[n]));
+    }
+    metrics_printf(&b, "# HELP sltpwmt_failures_total Failed operations, by cause.\n"
+        "# TYPE sltpwmt_failures_total counter\n");
+    for (int n = 0; n < SLTP_METRIC_FAILURES; ++n) {
+        metrics_printf(&b, "sltpwmt_failures_total{cause=\"%s\"} %llu\n",
+            METRIC_FAILURE_NAMES[n], (unsigned long long)load(&m->failures[n]));
+    }
+    metrics_printf(&b, "# HELP sltpwmt_coalesced_deltas_total Key deltas merged into a pending step.\n"
+        "# TYPE sltpwmt_coalesced_deltas_total counter\n"
+        "sltpwmt_coalesced_deltas_total %llu\n"
+        "# HELP sltpwmt_pa_reconnects_total Times the PulseAudio connection came back.\n"
+        "# TYPE sltpwmt_pa_reconnects_total counter\n"
+        "sltpwmt_pa_reconnects_total %llu\n",
+        (unsigned long long)load(&m->coalesced), (unsigned long long)load(&m->reconnects));
+
+    metrics_printf(&b, "# HELP sltpwmt_latency_seconds Time spent, by phase.\n"
+        "# TYPE sltpwmt_latency_seconds histogram\n");
+    for (int n = 0; n < SLTP_METRIC_PHASES; ++n) {
+        const struct sltp_histogram *h = &m->latency[n];
+        uint64_t count = 0;
+        for (int i = 0; i < SLTP_METRIC_BUCKETS; ++i) {
+            count += load(&h->buckets[i]);
+            if (i == SLTP_METRIC_BUCKETS - 1) {
+                metrics_printf(&b, "sltpwmt_latency_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n",
+                    METRIC_PHASE_NAMES[n], (unsigned long long)count);
+            } else {
+                metrics_printf(&b, "sltpwmt_latency_seconds_bucket{phase=\"%s\",le=\"%.6f\"} %llu\n",
+                    METRIC_PHASE_NAMES[n], (double)(1ull << i) / 1e6, (unsigned long long)count);
+            }
+        }
+        metrics_printf(&b, "sltpwmt_latency_seconds_sum{phase=\"%s\"} %.6f\n"
+            "sltpwmt_latency_seconds_count{phase=\"%s\"} %llu\n",
+            METRIC_PHASE_NAMES[n], (double)load(&h->sum_usec) / 1e6,
+            METRIC_PHASE_NAMES[n], (unsigned long long)count);
+    }
+    return b.overflow ? -1 : (int)b.used;
+}
+
+int sltp_metrics_write_file(const struct sltp_metrics *m, const char *path) {
+    static char text[SLTP_METRICS_TEXT_MAX];
+    char tmp[512];
+    const int len = sltp_metrics_format(m, text, sizeof(text));
+    if (len < 0 || snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        return -1;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("sltp_metrics_write_file failed (open)");
+        return -1;
+    }
+    if (write(fd, text, (size_t)len) != len) {
+        perror("sltp_metrics_write_file failed (write)");
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+    if (rename(tmp, path) == -1) {
+        perror("sltp_metrics_write_file failed (rename)");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTP_METRICS_H
+#define SLTP_METRICS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// The daemon's counters and latency histograms. Everything is a fixed-size
+// array of relaxed atomics, so either thread can record without a lock or an
+// allocation; only formatting for Prometheus touches more than one word.
+
+enum sltp_metric_op {
+    SLTP_METRIC_OP_BRIGHTNESS,
+    SLTP_METRIC_OP_VOLUME,
+    SLTP_METRIC_OP_MUTE,
+    SLTP_METRIC_OP_MIC_MUTE,
+    SLTP_METRIC_OPS,
+};
+
+enum sltp_metric_failure {
+    SLTP_METRIC_FAIL_SYSFS,
+    SLTP_METRIC_FAIL_PA_CONNECT, // no connection to the server
+    SLTP_METRIC_FAIL_PA_OP, // the server refused the operation
+    SLTP_METRIC_FAIL_BUSY, // queues full
+    SLTP_METRIC_FAILURES,
+};
+
+enum sltp_metric_phase {
+    SLTP_METRIC_PHASE_REQUEST, // control socket request to reply
+    SLTP_METRIC_PHASE_SYSFS, // one brightness step
+    SLTP_METRIC_PHASE_AUDIO_QUEUE, // waiting for the audio thread
+    SLTP_METRIC_PHASE_PA, // PulseAudio round trip
+    SLTP_METRIC_PHASES,
+};
+
+// Bucket n counts values up to 2^n usec and the last one everything else:
+// within a factor of two anywhere from 1 usec to 16 s.
+#define SLTP_METRIC_BUCKETS 26
+
+// Enough for sltp_metrics_format.
+#define SLTP_METRICS_TEXT_MAX 16384
+
+struct sltp_histogram {
+    _Atomic uint64_t buckets[SLTP_METRIC_BUCKETS];
+    _Atomic uint64_t sum_usec;
+};
+
+struct sltp_metrics {
+    _Atomic uint64_t ops[SLTP_METRIC_OPS];
+    _Atomic uint64_t failures[SLTP_METRIC_FAILURES];
+    _Atomic uint64_t coalesced; // deltas merged into one already pending
+    _Atomic uint64_t reconnects;
+    struct sltp_histogram latency[SLTP_METRIC_PHASES];
+};
+
+static inline uint64_t sltp_metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static inline void sltp_metrics_count(_Atomic uint64_t *counter) {
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static inline void sltp_metrics_observe(struct sltp_metrics *m, enum sltp_metric_phase phase, uint64_t since) {
+    const uint64_t usec = sltp_metrics_now() - since;
+    unsigned bucket = usec <= 1 ? 0 : 64 - (unsigned)__builtin_clzll(usec - 1);
+    if (bucket >= SLTP_METRIC_BUCKETS) {
+        bucket = SLTP_METRIC_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&m->latency[phase].buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&m->latency[phase].sum_usec, usec, memory_order_relaxed);
+}
+
+// Prometheus text exposition format. Returns the length, or -1 if buf is
+// too small.
+int sltp_metrics_format(const struct sltp_metrics *m, char *buf, size_t len);
+
+// Replaces path atomically, for node_exporter's textfile collector.
+int sltp_metrics_write_file(const struct sltp_metrics *m, const char *path);
+
+#endif
@@ -0,0 +1,42 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <stddef.h>
+
+#include "gamma.h"
+#include "idle.h"
+
+// Built instead of gamma.c and idle.c when xcb is not available: there is
+// never an X connection, so brightness needs a backlight and the daemon
+// does not dim when idle.
+
+struct sltp_gamma *sltp_gamma_new(void) {
+    return NULL;
+}
+
+void sltp_gamma_free(struct sltp_gamma *g) {
+    (void)g;
+}
+
+int sltp_gamma_get(struct sltp_gamma *g) {
+    (void)g;
+    return -1;
+}
+
+int sltp_gamma_set(struct sltp_gamma *g, int percent) {
+    (void)g; (void)percent;
+    return -1;
+}
+
+struct sltp_idle *sltp_idle_new(pa_mainloop_api *api, uint32_t dim_ms, uint32_t off_ms, sltp_idle_cb cb,
+    void *userdata) {
+    (void)api; (void)dim_ms; (void)off_ms; (void)cb; (void)userdata;
+    return NULL;
+}
+
+void sltp_idle_free(struct sltp_idle *idle) {
+    (void)idle;
+}
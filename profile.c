@@ -0,0 +1,175 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "profile.h"
+
+static const char *const PROFILE_PHASE_NAMES[SLTP_PROFILE_PHASES] = {
+    "read_sysfs", "write_sysfs", "pa_context_connect", "introspection", "set operation", "config load",
+};
+
+// Counters are read as two groups with one read() each: the software events
+// always open, the hardware pair may not.
+struct profile_event {
+    uint32_t type;
+    uint64_t config;
+};
+
+static const struct profile_event PROFILE_EVENTS[SLTP_PROFILE_COUNTERS] = {
+    [SLTP_PROFILE_TASK_CLOCK] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    [SLTP_PROFILE_CONTEXT_SWITCHES] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    [SLTP_PROFILE_PAGE_FAULTS] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    [SLTP_PROFILE_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [SLTP_PROFILE_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+};
+
+static const int PROFILE_SW_FIRST = SLTP_PROFILE_TASK_CLOCK;
+static const int PROFILE_HW_FIRST = SLTP_PROFILE_CYCLES;
+
+struct profile_thread {
+    bool opened;
+    int sw_fd; // group leaders, -1 if unavailable
+    int hw_fd;
+};
+
+struct profile_phase {
+    _Atomic uint64_t calls;
+    _Atomic uint64_t values[SLTP_PROFILE_COUNTERS];
+};
+
+static bool profile_enabled = false;
+static atomic_bool profile_have_hw = false;
+static _Thread_local struct profile_thread profile_thread = { .sw_fd = -1, .hw_fd = -1 };
+static struct profile_phase profile_phases[SLTP_PROFILE_PHASES];
+
+static int profile_open(int counter, int group, bool exclude_kernel) {
+    struct perf_event_attr attr = {
+        .size = sizeof(attr),
+        .type = PROFILE_EVENTS[counter].type,
+        .config = PROFILE_EVENTS[counter].config,
+        .read_format = PERF_FORMAT_GROUP,
+        .exclude_kernel = exclude_kernel,
+        .exclude_hv = 1,
+    };
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Opens counters first through last as one group. With perf_event_paranoid
+// at 2 only user space may be counted, which for the software events still
+// leaves page faults and task-clock meaningful.
+static int profile_open_group(int first, int last) {
+    int fds[SLTP_PROFILE_COUNTERS];
+    for (bool exclude_kernel = false;; exclude_kernel = true) {
+        if ((fds[first] = profile_open(first, -1, exclude_kernel)) != -1) {
+            for (int n = first + 1; n <= last; ++n) {
+                if ((fds[n] = profile_open(n, fds[first], exclude_kernel)) == -1) {
+                    while (n-- > first) {
+                        close(fds[n]);
+                    }
+                    return -1;
+                }
+            }
+            return fds[first];
+        }
+        if (errno != EACCES || exclude_kernel) {
+            return -1;
+        }
+    }
+}
+
+static struct profile_thread *profile_thread_open(void) {
+    struct profile_thread *t = &profile_thread;
+    if (!t->opened) {
+        t->opened = true;
+        if ((t->sw_fd = profile_open_group(PROFILE_SW_FIRST, SLTP_PROFILE_PAGE_FAULTS)) == -1) {
+            perror("sltp_profile: no counters (perf_event_open)");
+        }
+        if ((t->hw_fd = profile_open_group(PROFILE_HW_FIRST, SLTP_PROFILE_INSTRUCTIONS)) != -1) {
+            atomic_store(&profile_have_hw, true);
+        }
+    }
+    return t->sw_fd == -1 ? NULL : t;
+}
+
+static int profile_read(int fd, uint64_t *const out, int count) {
+    uint64_t buf[1 + SLTP_PROFILE_COUNTERS];
+    const ssize_t want = (ssize_t)((1 + count) * sizeof(uint64_t));
+    if (read(fd, buf, sizeof(buf)) < want || buf[0] != (uint64_t)count) {
+        return -1;
+    }
+    memcpy(out, buf + 1, count * sizeof(uint64_t));
+    return 0;
+}
+
+void sltp_profile_enable(void) {
+    profile_enabled = true;
+}
+
+void sltp_profile_begin(struct sltp_profile_mark *mark) {
+    struct profile_thread *t;
+    mark->thread = NULL;
+    if (!profile_enabled || !(t = profile_thread_open())) {
+        return;
+    }
+    memset(mark->values, 0, sizeof(mark->values));
+    if (profile_read(t->sw_fd, mark->values + PROFILE_SW_FIRST, PROFILE_HW_FIRST - PROFILE_SW_FIRST) < 0
+        || (t->hw_fd != -1 && profile_read(t->hw_fd, mark->values + PROFILE_HW_FIRST,
+            SLTP_PROFILE_COUNTERS - PROFILE_HW_FIRST) < 0)) {
+        return;
+    }
+    mark->thread = t;
+}
+
+void sltp_profile_end(enum sltp_profile_phase phase, struct sltp_profile_mark *mark) {
+    struct sltp_profile_mark now;
+    if (!mark->thread || mark->thread != &profile_thread) {
+        return;
+    }
+    sltp_profile_begin(&now);
+    mark->thread = NULL;
+    if (!now.thread) {
+        return;
+    }
+    struct profile_phase *p = &profile_phases[phase];
+    atomic_fetch_add_explicit(&p->calls, 1, memory_order_relaxed);
+    for (int n = 0; n < SLTP_PROFILE_COUNTERS; ++n) {
+        atomic_fetch_add_explicit(&p->values[n], now.values[n] - mark->values[n], memory_order_relaxed);
+    }
+}
+
+// Means per call; task-clock is in microseconds.
+void sltp_profile_print(FILE *out) {
+    const bool hw = atomic_load(&profile_have_hw);
+    fprintf(out, "%-20s %8s %12s %8s %8s %12s %12s\n",
+        "phase", "calls", "task-clock", "ctx-sw", "faults", "cycles", "instructions");
+    for (int n = 0; n < SLTP_PROFILE_PHASES; ++n) {
+        const struct profile_phase *p = &profile_phases[n];
+        const uint64_t calls = atomic_load_explicit(&p->calls, memory_order_relaxed);
+        double mean[SLTP_PROFILE_COUNTERS] = {0};
+        for (int c = 0; calls && c < SLTP_PROFILE_COUNTERS; ++c) {
+            mean[c] = (double)atomic_load_explicit(&p->values[c], memory_order_relaxed) / (double)calls;
+        }
+        fprintf(out, "%-20s %8llu %12.1f %8.1f %8.1f ",
+            PROFILE_PHASE_NAMES[n], (unsigned long long)calls,
+            mean[SLTP_PROFILE_TASK_CLOCK] / 1e3, mean[SLTP_PROFILE_CONTEXT_SWITCHES], mean[SLTP_PROFILE_PAGE_FAULTS]);
+        if (hw) {
+            fprintf(out, "%12.0f %12.0f\n", mean[SLTP_PROFILE_CYCLES], mean[SLTP_PROFILE_INSTRUCTIONS]);
+        } else {
+            fprintf(out, "%12s %12s\n", "-", "-");
+        }
+    }
+}
@@ -0,0 +1,50 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTP_PROFILE_H
+#define SLTP_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Self-profiling with perf_event_open. Once enabled, each thread that marks
+// a phase opens its own counters: task-clock, context switches and page
+// faults always, cycles and instructions where the PMU lets us (not in most
+// VMs). A phase's cost is the difference between its begin and end marks,
+// summed over every time it ran. Disabled, a mark is one branch.
+
+enum sltp_profile_phase {
+    SLTP_PROFILE_READ_SYSFS,
+    SLTP_PROFILE_WRITE_SYSFS,
+    SLTP_PROFILE_CONNECT, // pa_context_connect until ready or failed
+    SLTP_PROFILE_INTROSPECT, // server, sink and source info after connecting
+    SLTP_PROFILE_SET, // an audio operation until the server has answered
+    SLTP_PROFILE_CONFIG, // sltp_config_load, cached or parsed
+    SLTP_PROFILE_PHASES,
+};
+
+enum sltp_profile_counter {
+    SLTP_PROFILE_TASK_CLOCK,
+    SLTP_PROFILE_CONTEXT_SWITCHES,
+    SLTP_PROFILE_PAGE_FAULTS,
+    SLTP_PROFILE_CYCLES,
+    SLTP_PROFILE_INSTRUCTIONS,
+    SLTP_PROFILE_COUNTERS,
+};
+
+struct sltp_profile_mark {
+    const void *thread; // counters are per thread; NULL if not taken
+    uint64_t values[SLTP_PROFILE_COUNTERS];
+};
+
+void sltp_profile_enable(void);
+void sltp_profile_begin(struct sltp_profile_mark *mark);
+// Ignored unless the mark was taken on this thread.
+void sltp_profile_end(enum sltp_profile_phase phase, struct sltp_profile_mark *mark);
+void sltp_profile_print(FILE *out);
+
+#endif
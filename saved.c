@@ -0,0 +1,168 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "libsltpwmt.h"
+#include "saved.h"
+
+// $XDG_STATE_HOME, or its default under $HOME; the runtime directory only
+// if there is no home, which does not survive a reboot but beats nothing.
+static int saved_path(char *const buf, size_t buflen, bool create) {
+    const char *state = getenv("XDG_STATE_HOME");
+    const char *home = getenv("HOME");
+    int len;
+    if (state && *state) {
+        len = snprintf(buf, buflen, "%s/%s", state, SLTP_SAVED_FILE);
+    } else if (home && *home) {
+        len = snprintf(buf, buflen, "%s/.local/state/%s", home, SLTP_SAVED_FILE);
+    } else {
+        return sltp_runtime_path(buf, buflen, SLTP_SAVED_FILE);
+    }
+    if (len < 0 || (size_t)len >= buflen) {
+        fprintf(stderr, "saved path too long\n");
+        return -1;
+    }
+    // mkdir -p the directory.
+    for (char *slash = buf + 1; create && (slash = strchr(slash, '/')); ++slash) {
+        *slash = '\0';
+        const int ret = mkdir(buf, 0700);
+        *slash = '/';
+        if (ret == -1 && errno != EEXIST) {
+            perror("saved_path failed (mkdir)");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static bool saved_parse(const char *line, struct sltp_saved_entry *e) {
+    int used = 0;
+    unsigned muted, channels;
+    *e = (struct sltp_saved_entry){0};
+    if (sscanf(line, "b %d %n", &e->brightness, &used) == 1) {
+        e->kind = SLTP_SAVED_BACKLIGHT;
+    } else if (sscanf(line, "s %u %u %n", &muted, &channels, &used) == 2
+        && channels >= 1 && channels <= PA_CHANNELS_MAX) {
+        e->kind = SLTP_SAVED_SINK;
+        e->muted = muted;
+        e->volume.channels = (uint8_t)channels;
+        for (unsigned n = 0; n < channels; ++n) {
+            int more;
+            if (sscanf(line + used, "%u %n", &e->volume.values[n], &more) < 1) {
+                return false;
+            }
+            used += more;
+        }
+    } else {
+        return false;
+    }
+    const size_t len = strcspn(line + used, "\n");
+    if (!len || len >= sizeof(e->name)) {
+        return false;
+    }
+    memcpy(e->name, line + used, len);
+    return true;
+}
+
+int sltp_saved_load(struct sltp_saved *saved) {
+    char path[512], line[SLTP_SAVED_NAME_MAX + PA_CHANNELS_MAX * 12 + 32];
+    FILE *f;
+    saved->count = 0;
+    saved->dirty = false;
+    if (saved_path(path, sizeof(path), false) < 0) {
+        return -1;
+    }
+    if (!(f = fopen(path, "re"))) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    while (saved->count < SLTP_SAVED_MAX && fgets(line, sizeof(line), f)) {
+        if (saved_parse(line, &saved->entries[saved->count])) {
+            ++saved->count;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+bool sltp_saved_record(struct sltp_saved *saved, const struct sltp_saved_entry *e) {
+    size_t at = 0;
+    while (at < saved->count && (saved->entries[at].kind != e->kind || strcmp(saved->entries[at].name, e->name))) {
+        ++at;
+    }
+    if (at < saved->count) {
+        const struct sltp_saved_entry *old = &saved->entries[at];
+        if (e->kind == SLTP_SAVED_BACKLIGHT ? old->brightness == e->brightness
+            : old->muted == e->muted && pa_cvolume_equal(&old->volume, &e->volume)) {
+            return false;
+        }
+    } else if (at == SLTP_SAVED_MAX) {
+        --at;
+    } else {
+        ++saved->count;
+    }
+    memmove(&saved->entries[1], &saved->entries[0], at * sizeof(saved->entries[0]));
+    saved->entries[0] = *e;
+    return saved->dirty = true;
+}
+
+// Written to a temporary file and renamed over the old one, so a crash
+// leaves one or the other, never half of each. The temporary name is per
+// process, as overlapping one-shot runs each store their own.
+int sltp_saved_store(struct sltp_saved *saved, bool sync) {
+    char path[512], tmp[520];
+    FILE *f;
+    if (saved_path(path, sizeof(path), true) < 0) {
+        return -1;
+    }
+    snprintf(tmp, sizeof(tmp), "%.500s.%d.tmp", path, (int)getpid());
+    if (!(f = fopen(tmp, "we"))) {
+        perror("sltp_saved_store failed (fopen)");
+        return -1;
+    }
+    for (size_t n = 0; n < saved->count; ++n) {
+        const struct sltp_saved_entry *e = &saved->entries[n];
+        if (e->kind == SLTP_SAVED_BACKLIGHT) {
+            fprintf(f, "b %d %s\n", e->brightness, e->name);
+            continue;
+        }
+        fprintf(f, "s %d %u", e->muted, e->volume.channels);
+        for (unsigned c = 0; c < e->volume.channels; ++c) {
+            fprintf(f, " %u", e->volume.values[c]);
+        }
+        fprintf(f, " %s\n", e->name);
+    }
+    bool ok = !sync || (fflush(f) != EOF && fsync(fileno(f)) != -1);
+    ok = fclose(f) != EOF && ok;
+    if (!ok || rename(tmp, path) == -1) {
+        perror("sltp_saved_store failed (rename)");
+        unlink(tmp);
+        return -1;
+    }
+    if (sync) {
+        // The rename itself lives in the directory.
+        char *slash = strrchr(path, '/');
+        *slash = '\0';
+        const int dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dfd == -1 || fsync(dfd) == -1) {
+            perror("sltp_saved_store failed (fsync)");
+        }
+        if (dfd != -1) {
+            close(dfd);
+        }
+    }
+    saved->dirty = false;
+    return 0;
+}
@@ -0,0 +1,55 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTP_SAVED_H
+#define SLTP_SAVED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <pulse/pulseaudio.h>
+
+// The last brightness set on each backlight and the last volume and mute set
+// on each sink, kept across reboots in $XDG_STATE_HOME/sltpwmt.saved so they
+// can be put back after the hardware forgets them. The file is a line per
+// entry, most recently set first:
+//
+//   b <brightness> <backlight directory>
+//   s <muted> <channels> <volume>... <sink name>
+
+#define SLTP_SAVED_FILE "sltpwmt.saved"
+#define SLTP_SAVED_MAX 16
+#define SLTP_SAVED_NAME_MAX 256
+
+enum sltp_saved_kind {
+    SLTP_SAVED_BACKLIGHT,
+    SLTP_SAVED_SINK,
+};
+
+struct sltp_saved_entry {
+    enum sltp_saved_kind kind;
+    char name[SLTP_SAVED_NAME_MAX]; // backlight directory or sink name
+    int brightness; // SLTP_SAVED_BACKLIGHT
+    pa_cvolume volume; // SLTP_SAVED_SINK
+    bool muted; // SLTP_SAVED_SINK
+};
+
+struct sltp_saved {
+    struct sltp_saved_entry entries[SLTP_SAVED_MAX];
+    size_t count;
+    bool dirty; // changed since the last load or store
+};
+
+// A missing file loads as empty.
+int sltp_saved_load(struct sltp_saved *saved);
+// Moves the entry to the front, dropping the oldest if full. Returns whether
+// anything changed.
+bool sltp_saved_record(struct sltp_saved *saved, const struct sltp_saved_entry *e);
+// Replaces the file atomically. With sync, it also reaches the disk before
+// this returns, at the cost of an fsync.
+int sltp_saved_store(struct sltp_saved *saved, bool sync);
+
+#endif
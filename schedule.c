@@ -0,0 +1,75 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <time.h>
+
+#include "schedule.h"
+
+static const int64_t USEC = 1000000;
+
+// The given second of the local day `days` after `day`. mktime works out
+// the UTC offset for that date, so a point keeps its wall-clock time on
+// either side of a DST change.
+static int64_t schedule_time(const struct tm *day, uint32_t second, int days) {
+    struct tm t = *day;
+    t.tm_hour = (int)(second / 3600);
+    t.tm_min = (int)(second / 60 % 60);
+    t.tm_sec = (int)(second % 60);
+    t.tm_mday += days;
+    t.tm_isdst = -1;
+    return (int64_t)mktime(&t) * USEC;
+}
+
+int sltp_schedule_plan(const struct sltp_config *cfg, int64_t now, int max_brightness,
+    struct sltp_schedule_step *step) {
+    const uint32_t npoints = cfg->schedule_points;
+    if (!npoints) {
+        return -1;
+    }
+    const time_t sec = (time_t)(now / USEC);
+    struct tm day;
+    localtime_r(&sec, &day);
+    const uint32_t second = (uint32_t)(day.tm_hour * 3600 + day.tm_min * 60 + day.tm_sec);
+
+    // The point in effect is the last one at or before now, or yesterday's
+    // last one before the first of the day.
+    uint32_t n = npoints - 1;
+    int days = -1;
+    for (uint32_t k = 0; k < npoints && cfg->schedule[k].second <= second; ++k) {
+        n = k;
+        days = 0;
+    }
+    const int64_t start = schedule_time(&day, cfg->schedule[n].second, days);
+    int64_t end = n + 1 < npoints ? schedule_time(&day, cfg->schedule[n + 1].second, days)
+        : schedule_time(&day, cfg->schedule[0].second, days + 1);
+    end = end > now ? end : now + USEC;
+
+    const double from = cfg->schedule[(n + npoints - 1) % npoints].frac, to = cfg->schedule[n].frac;
+    int64_t fade = (int64_t)cfg->schedule_fade_s * USEC;
+    fade = fade < end - start ? fade : end - start;
+    const int64_t elapsed = now > start ? now - start : 0;
+    if (elapsed >= fade || from == to) {
+        step->frac = to;
+        step->next = end;
+        return 0;
+    }
+
+    step->frac = from + (to - from) * (double)elapsed / (double)fade;
+    step->next = start + fade;
+    if (max_brightness > 0) {
+        // Brightness is rounded to the nearest whole value, so it changes
+        // when the level crosses halfway to the next one.
+        const double v = step->frac * max_brightness;
+        const double edge = to > from ? floor(v + 0.5) + 0.5 : ceil(v - 0.5) - 0.5;
+        int64_t at = start + (int64_t)ceil((edge / max_brightness - from) / (to - from) * (double)fade);
+        at = at > now ? at : now + 1;
+        step->next = at < step->next ? at : step->next;
+    }
+    return 0;
+}
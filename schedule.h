@@ -0,0 +1,34 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTP_SCHEDULE_H
+#define SLTP_SCHEDULE_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+// Brightness by time of day, from the config's schedule. Each point's level
+// is faded into linearly from the one before over schedule_fade seconds, or
+// until the next point if that comes first, and held until the next point.
+// Times are local wall-clock times, so they stay put across DST changes.
+//
+// The clock is an argument: the daemon passes CLOCK_REALTIME, and `sltpwmt
+// schedule <time>` can ask about any moment without waiting for it.
+
+struct sltp_schedule_step {
+    double frac; // level at the time asked about, of max_brightness
+    int64_t next; // usec since the epoch when the brightness next changes
+};
+
+// `now` is in usec since the epoch. The next change is when the level next
+// crosses to another whole brightness out of max_brightness, the end of the
+// fade, or the next point, whichever is first; it is always after `now`.
+// Returns -1 if the config has no schedule.
+int sltp_schedule_plan(const struct sltp_config *cfg, int64_t now, int max_brightness,
+    struct sltp_schedule_step *step);
+
+#endif
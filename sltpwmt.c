@@ -4,18 +4,49 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <glob.h>
+#include <math.h>
+#include <time.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 #include <fcntl.h>
+#include <linux/input.h>
+#include <linux/netlink.h>
 
 #include <pulse/pulseaudio.h>
 
-static const char *MAX_BRIGHTNESS_PATH = "/sys/class/backlight/intel_backlight/max_brightness";
-static const char *BRIGHTNESS_PATH = "/sys/class/backlight/intel_backlight/brightness";
+#include "config.h"
+#include "dbus.h"
+#include "ddc.h"
+#include "eloop.h"
+#include "idle.h"
+#include "libsltpwmt.h"
+#include "metrics.h"
+#include "profile.h"
+#include "saved.h"
+#include "schedule.h"
+#include "spsc.h"
+#include "state.h"
 
 static void rtrim(char *const str) {
     char *c = str + strlen(str);
@@ -26,280 +57,2328 @@ static void rtrim(char *const str) {
     *(c + 1) = '\0';
 }
 
-static ssize_t read_sysfs(const char *const path, char *const buf, ssize_t buflen) {
-    int fd = open(path, O_RDONLY);
+static const char *CONTROL_SOCKET = "sltpwmt.sock";
+
+static int control_address(struct sockaddr_un *const addr) {
+    *addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+    return sltp_runtime_path(addr->sun_path, sizeof(addr->sun_path), CONTROL_SOCKET);
+}
+
+static int control_connect(void) {
+    struct sockaddr_un addr;
+    if (control_address(&addr) < 0) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
     if (fd == -1) {
-        perror("read_sysfs failed (open)");
         return -1;
     }
-    ssize_t rdlen = read(fd, buf, buflen - 1);
-    if (rdlen == -1) {
-        perror("read_sysfs failed (read)");
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
     }
-    close(fd);
-    buf[rdlen] = '\0';
-    return rdlen;
+    return fd;
 }
 
-static ssize_t write_sysfs(const char *const path, const char *const buf, ssize_t nbytes) {
-    int fd = open(path, O_WRONLY);
+// Hands a command to a running daemon. Returns -1 if there is none (the
+// caller should do the work itself), otherwise the daemon's exit status with
+// its output in res.
+static int daemon_request(const char *const req, struct sltp_result *const res) {
+    int fd = control_connect();
     if (fd == -1) {
-        perror("write_sysfs failed (open)");
         return -1;
     }
-    ssize_t wrlen = write(fd, buf, nbytes);
-    if (wrlen == -1 || wrlen < nbytes) {
-        perror("write_sysfs failed (write)");
+    char buf[sizeof(res->msg) + 1];
+    ssize_t len = -1;
+    if (send(fd, req, strlen(req), MSG_NOSIGNAL) == -1
+        || (len = recv(fd, buf, sizeof(buf) - 1, 0)) < 1) {
+        perror("daemon_request failed");
+        close(fd);
+        *res = (struct sltp_result){ .status = 1 };
+        return 1;
     }
     close(fd);
-    return wrlen;
+    buf[len] = '\0';
+    rtrim(buf);
+    res->status = buf[0] == '0' ? 0 : 1;
+    snprintf(res->msg, sizeof(res->msg), "%s", buf + 1);
+    return res->status;
 }
 
-static int do_brightness(int delta) {
-    char buf[512] = {0};
-    const int buflen = sizeof(buf);
-    ssize_t rwlen = -1;
-    if ((rwlen = read_sysfs(MAX_BRIGHTNESS_PATH, buf, buflen)) == -1) {
-        return 1;
+// The daemon holds an exclusive flock on the state file for as long as it
+// runs, so it is the page's only writer; the fd stays open until it exits.
+static int state_lock_fd = -1;
+
+static struct sltp_state_page *state_map(bool writable) {
+    char path[512];
+    if (sltp_runtime_path(path, sizeof(path), SLTP_STATE_FILE) < 0) {
+        return NULL;
+    }
+    int fd = open(path, writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        if (writable) {
+            perror("state_map failed (open)");
+        }
+        return NULL;
+    }
+    // A reader that can take a shared lock has no daemon behind the page:
+    // it crashed, or was killed before clearing it, and the page is stale.
+    if (!writable && flock(fd, LOCK_SH | LOCK_NB) != -1) {
+        close(fd);
+        return NULL;
     }
-    int max_br;
-    if (sscanf(buf, "%d", &max_br) < 1) {
-        max_br  = 2147483647;
+    // Taken before anything is written: another daemon's page is left alone.
+    if (writable && flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        if (errno == EWOULDBLOCK) {
+            fprintf(stderr, "daemon already running\n");
+        } else {
+            perror("state_map failed (flock)");
+        }
+        close(fd);
+        return NULL;
+    }
+    if (writable && ftruncate(fd, SLTP_STATE_SIZE) == -1) {
+        perror("state_map failed (ftruncate)");
+        close(fd);
+        return NULL;
+    }
+    struct stat sb;
+    if (!writable && (fstat(fd, &sb) == -1 || sb.st_size < SLTP_STATE_SIZE)) {
+        close(fd);
+        return NULL;
+    }
+    void *p = mmap(NULL, SLTP_STATE_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        perror("state_map failed (mmap)");
+        close(fd);
+        return NULL;
     }
+    if (writable) {
+        state_lock_fd = fd;
+    } else {
+        close(fd);
+    }
+    return p;
+}
 
-    if ((rwlen = read_sysfs(BRIGHTNESS_PATH, buf, buflen)) == -1) {
-        return 1;
+static void print_state(const struct sltp_state *st) {
+    if (st->valid & SLTP_STATE_BRIGHTNESS) {
+        printf("brightness %d/%d\n", st->brightness, st->max_brightness);
+    }
+    if (st->valid & SLTP_STATE_SINK) {
+        printf("volume %u%%\n", (unsigned)(((uint64_t)st->volume * 100 + PA_VOLUME_NORM / 2) / PA_VOLUME_NORM));
+        printf("speakers %s\n", st->muted ? "muted" : "on");
     }
+    if (st->valid & SLTP_STATE_SOURCE) {
+        printf("mic %s\n", st->mic_muted ? "muted" : "on");
+    }
+}
+
+static int print_result(const struct sltp_result *res) {
+    if (res->status) {
+        if (*res->msg) {
+            fprintf(stderr, "%s\n", res->msg);
+        }
+    } else {
+        printf("%s", res->msg);
+    }
+    return res->status;
+}
+
+static double elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
 
-    int br = -1;
-    if (sscanf(buf, "%d", &br) < 1) {
-        fprintf(stderr, "invalid brightness from sysfs\n");
+static int pa_disable_sigpipe(void) {
+    struct sigaction sa = {0};
+    if (sigaction(SIGPIPE, NULL, &sa) < 0) {
+        perror("pa_disable_sigpipe (sigaction 1)");
         return 1;
     }
-    br += delta;
-    br = br < 0 ? 0 : br > max_br ? max_br : br;
-    rwlen = snprintf(buf, buflen, "%d", br);
-    if ((rwlen = write_sysfs(BRIGHTNESS_PATH, buf, rwlen)) == -1) {
+
+    sa.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &sa, NULL) < 0) {
+        perror("pa_disable_sigpipe (sigaction 1)");
         return 1;
     }
 
-    rtrim(buf);
-    printf("Brightness: %s", buf);
     return 0;
 }
 
-static pa_mainloop_api *pulse_mapi = NULL;
-static int pulse_arg = 0;
-static char pulse_op = '\0';
+static void daemon_sigint_callback(pa_mainloop_api *m, pa_signal_event *e, int sig, void *userdata) {
+    (void)e; (void)sig; (void)userdata;
+    m->quit(m, 0);
+}
+
+static struct sltp_eloop *daemon_loop = NULL;
+static pa_mainloop_api *daemon_mapi = NULL;
+static struct sltp_ctx *daemon_ctx = NULL;
+static struct sltp_ddc *daemon_ddc = NULL; // created by the first monitor step
+static struct sltp_state_page *daemon_page = NULL;
+static int daemon_brightness_fd = -1;
+static struct sltp_state daemon_state;
+static struct sltp_metrics daemon_metrics;
+static struct sltp_config daemon_config; // the file, with daemon_flags over it
+static struct sltp_config daemon_flags; // from the command line
 
-static void pulse_quit(int e) {
-    if (pulse_mapi) {
-        pulse_mapi->quit(pulse_mapi, e);
-    }
+static void daemon_publish(void) {
+    sltp_state_write(daemon_page, &daemon_state);
 }
 
-static void do_pulse_success(pa_context *c, int success, void *userdata) {
-    (void)c; (void)success; (void)userdata;
-    pulse_quit(0);
+static void daemon_brightness_changed(struct sltp_ctx *ctx, const struct sltp_state *st, void *userdata) {
+    (void)ctx; (void)userdata;
+    daemon_state.brightness = st->brightness;
+    daemon_state.max_brightness = st->max_brightness;
+    daemon_state.valid = (daemon_state.valid & ~(uint32_t)SLTP_STATE_BRIGHTNESS) | (st->valid & SLTP_STATE_BRIGHTNESS);
+    daemon_publish();
 }
 
-static void do_pulse_vs(pa_context *c, const pa_sink_info *i, int eol, void *userdata) {
-    (void)userdata;
-    if (eol < 0) {
-        fprintf(stderr, "pa_context_get_sink_info_by_name failed: %d\n", eol);
-        pulse_quit(1);
-        return;
-    }
-    if (eol) {
+// PulseAudio runs on its own pa_threaded_mainloop with its own sltp_ctx, so
+// a slow or reconnecting server never holds up brightness work on the main
+// loop. The threads share nothing but two SPSC queues, each paired with an
+// eventfd to wake the other side; the main thread never takes the threaded
+// mainloop's lock.
+
+enum audio_msg_type {
+    AUDIO_VOLUME,
+    AUDIO_MUTE,
+    AUDIO_MIC_SET,
+    AUDIO_RESTORE,
+    AUDIO_SCENE,
+    AUDIO_RESULT,
+    AUDIO_STATE,
+    AUDIO_APPLIED,
+    AUDIO_CONFIG,
+};
+
+// A scene's backlights are set on the main thread, then its sinks and
+// sources on the audio thread; if those fail, the backlights are put back
+// when the result comes home.
+struct daemon_scene {
+    int fd;
+    uint64_t start;
+    char name[SLTP_CONFIG_SCENE_NAME_MAX];
+    struct sltp_saved undo;
+    size_t count;
+    struct sltp_scene_change changes[SLTP_CONFIG_SCENE_CHANGES_MAX];
+};
+
+struct audio_msg {
+    enum audio_msg_type type;
+    int arg;
+    int fd; // client waiting for the result, or -1
+    uint64_t start; // when the request came in, for metrics
+    struct sltp_saved *restore; // AUDIO_RESTORE; the audio thread frees it
+    pa_usec_t ramp; // AUDIO_CONFIG, with the volume snap in arg
+    char (*mics)[128]; // AUDIO_CONFIG: push-to-talk sources; the audio thread frees them
+    size_t nmics;
+    struct daemon_scene *scene; // AUDIO_SCENE, and the AUDIO_RESULT for it
+    struct sltp_result res;
+    struct sltp_state state;
+    struct sltp_saved_entry applied;
+};
+
+static const size_t AUDIO_QUEUE_SIZE = 256;
+// Requests the main thread may have outstanding that answer with an
+// AUDIO_RESULT. The reply queue keeps this many slots for them, so a result,
+// and with it a client fd or a scene to roll back, is never dropped.
+static const size_t AUDIO_RESULTS_MAX = 256;
+static size_t audio_results_owed = 0; // main thread only
+
+// Operations handed to audio_ctx and not yet answered, so results can be
+// timed and routed without allocating. Only the audio thread touches these.
+#define AUDIO_PENDING_MAX 256
+
+struct audio_pending {
+    int fd;
+    struct daemon_scene *scene;
+    uint64_t start;
+    uint64_t submitted;
+    struct audio_pending *next_free;
+};
+
+static struct audio_pending audio_pending[AUDIO_PENDING_MAX];
+static struct audio_pending *audio_pending_free = NULL;
+static bool audio_connected = false;
+static bool audio_was_connected = false;
+
+static pa_threaded_mainloop *audio_loop = NULL;
+static const char *audio_duck_match = NULL;
+static double audio_duck_db = 12;
+static struct sltp_ctx *audio_ctx = NULL;
+static struct sltp_spsc audio_requests; // main -> audio
+static struct sltp_spsc audio_replies; // audio -> main
+static int audio_request_efd = -1;
+static int audio_reply_efd = -1;
+static pa_io_event *audio_request_event = NULL;
+static pa_io_event *audio_reply_event = NULL;
+
+static void audio_reply(const struct audio_msg *msg) {
+    // Only state and applied notifications can find the queue full; the main
+    // thread is hopelessly behind and the next one will do.
+    if (!sltp_spsc_push_leaving(&audio_replies, msg, msg->type == AUDIO_RESULT ? 0 : AUDIO_RESULTS_MAX)) {
         return;
     }
+    eventfd_write(audio_reply_efd, 1);
+}
 
-    assert(i);
+static void audio_result(struct sltp_ctx *ctx, const struct sltp_result *res, void *userdata) {
+    struct audio_pending *p = userdata;
+    sltp_metrics_observe(&daemon_metrics, SLTP_METRIC_PHASE_PA, p->submitted);
+    if (res->status) {
+        // The context drops its sink before failing what was queued on it.
+        sltp_metrics_count(&daemon_metrics.failures[sltp_cached_state(ctx)->valid & SLTP_STATE_SINK
+            ? SLTP_METRIC_FAIL_PA_OP : SLTP_METRIC_FAIL_PA_CONNECT]);
+    }
+    if (p->fd != -1 || p->scene) {
+        const struct audio_msg msg = { .type = AUDIO_RESULT, .fd = p->fd, .start = p->start, .res = *res,
+            .scene = p->scene };
+        audio_reply(&msg);
+    }
+    p->next_free = audio_pending_free;
+    audio_pending_free = p;
+}
 
-    switch (pulse_op) {
-    case 's': {
-        int new_mute = !i->mute;
-        pa_operation_unref(pa_context_set_sink_mute_by_index(c, i->index, new_mute, do_pulse_success, NULL));
-        printf("%s", new_mute ? "Speakers muted" : "Speakers on");
-        break;
+static void audio_state(struct sltp_ctx *ctx, const struct sltp_state *st, void *userdata) {
+    (void)ctx; (void)userdata;
+    const bool connected = st->valid & SLTP_STATE_SINK;
+    if (connected && !audio_connected && audio_was_connected) {
+        sltp_metrics_count(&daemon_metrics.reconnects);
     }
+    audio_was_connected |= audio_connected = connected;
+    const struct audio_msg msg = { .type = AUDIO_STATE, .fd = -1, .state = *st };
+    audio_reply(&msg);
+}
 
-    case 'v':
-        if (i->volume.channels < 1) {
-            pulse_quit(0);
-            return;
-        }
+static void audio_applied(struct sltp_ctx *ctx, const struct sltp_saved_entry *e, void *userdata) {
+    (void)ctx; (void)userdata;
+    const struct audio_msg msg = { .type = AUDIO_APPLIED, .fd = -1, .applied = *e };
+    audio_reply(&msg);
+}
 
-        pa_cvolume new_cvol = i->volume;
-        int new_volume = (int)pa_cvolume_max(&new_cvol) + pulse_arg;
-        const int normal_volume = (int)PA_VOLUME_NORM;
-        new_volume = new_volume > (normal_volume * 98 / 100) && new_volume < (normal_volume * 102 / 100)
-            ? normal_volume : new_volume;
-        new_volume = PA_CLAMP_UNLIKELY(new_volume, (int)PA_VOLUME_MUTED, normal_volume);
-        pa_cvolume_scale(&new_cvol, new_volume);
-        pa_operation_unref(pa_context_set_sink_volume_by_index(c, i->index, &new_cvol, do_pulse_success, NULL));
-        char buf[PA_VOLUME_SNPRINT_MAX] = {0};
-        pa_volume_snprint(buf, PA_VOLUME_SNPRINT_MAX, new_volume);
-        printf("Speakers %s", buf);
-        break;
-    default:
-        fprintf(stderr, "unexpected pulse op %c in do_pulse_vs\n", pulse_op);
-        pulse_quit(1);
-        break;
+static void audio_mics(char (*mics)[128], size_t count) {
+    const char *names[SLTP_CONFIG_PTT_SOURCES_MAX];
+    for (size_t n = 0; n < count; ++n) {
+        names[n] = mics[n];
+    }
+    if (sltp_set_mic_sources(audio_ctx, names, count)) {
+        fprintf(stderr, "audio_mics: push-to-talk sources not set\n");
     }
 }
 
-static void do_pulse_m(pa_context *c, const pa_source_info *i, int eol, void *userdata) {
-    (void)userdata;
-    if (eol < 0) {
-        fprintf(stderr, "pa_context_get_source_info_by_name failed: %d\n", eol);
-        pulse_quit(1);
-        return;
+// Runs on the audio thread.
+static void audio_request(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)a; (void)e; (void)events; (void)userdata;
+    eventfd_t count;
+    struct audio_msg msg;
+    eventfd_read(fd, &count);
+    while (sltp_spsc_pop(&audio_requests, &msg)) {
+        if (msg.type == AUDIO_CONFIG) {
+            sltp_set_volume_snap(audio_ctx, (unsigned)msg.arg);
+            sltp_set_volume_ramp(audio_ctx, msg.ramp);
+            audio_mics(msg.mics, msg.nmics);
+            free(msg.mics);
+            continue;
+        }
+        sltp_metrics_observe(&daemon_metrics, SLTP_METRIC_PHASE_AUDIO_QUEUE, msg.start);
+        struct audio_pending *p = audio_pending_free;
+        if (!p) {
+            sltp_metrics_count(&daemon_metrics.failures[SLTP_METRIC_FAIL_BUSY]);
+            if (msg.fd != -1 || msg.scene) {
+                const struct audio_msg reply = { .type = AUDIO_RESULT, .fd = msg.fd, .start = msg.start,
+                    .res = { .status = 1, .msg = "audio busy" }, .scene = msg.scene };
+                audio_reply(&reply);
+            }
+            continue;
+        }
+        audio_pending_free = p->next_free;
+        *p = (struct audio_pending){ .fd = msg.fd, .scene = msg.scene, .start = msg.start,
+            .submitted = sltp_metrics_now() };
+        int ret = msg.type == AUDIO_VOLUME ? sltp_volume_step_async(audio_ctx, msg.arg, audio_result, p)
+            : msg.type == AUDIO_MIC_SET ? sltp_set_mic_mute_async(audio_ctx, msg.arg, audio_result, p)
+            : msg.type == AUDIO_RESTORE ? sltp_restore_sinks_async(audio_ctx, msg.restore, audio_result, p)
+            : msg.type == AUDIO_SCENE ? sltp_scene_audio_async(audio_ctx, msg.scene->changes, msg.scene->count, audio_result, p)
+            : sltp_toggle_mute_async(audio_ctx, msg.arg, audio_result, p);
+        free(msg.restore);
+        if (ret) {
+            const struct sltp_result res = { .status = 1, .msg = "out of memory" };
+            audio_result(audio_ctx, &res, p);
+        }
     }
-    if (eol) {
-        return;
+}
+
+static int audio_push(const struct audio_msg *msg) {
+    const bool result = msg->fd != -1 || msg->scene;
+    if ((result && audio_results_owed >= AUDIO_RESULTS_MAX) || !sltp_spsc_push(&audio_requests, msg)) {
+        sltp_metrics_count(&daemon_metrics.failures[SLTP_METRIC_FAIL_BUSY]);
+        return -1;
     }
+    audio_results_owed += result;
+    eventfd_write(audio_request_efd, 1);
+    return 0;
+}
 
-    assert(i);
-    int new_mute = !i->mute;
-    pa_operation_unref(pa_context_set_source_mute_by_index(c, i->index, new_mute, do_pulse_success, NULL));
-    printf("%s", new_mute ? "Mic muted" : "Mic on");
+static int audio_submit(enum audio_msg_type type, int arg, int fd) {
+    const struct audio_msg msg = { .type = type, .arg = arg, .fd = fd, .start = sltp_metrics_now() };
+    sltp_metrics_count(&daemon_metrics.ops[type == AUDIO_VOLUME ? SLTP_METRIC_OP_VOLUME
+        : type == AUDIO_MIC_SET || arg == SLTP_MIC ? SLTP_METRIC_OP_MIC_MUTE : SLTP_METRIC_OP_MUTE]);
+    return audio_push(&msg);
 }
 
-static void do_pulse_server_info(pa_context *c, const pa_server_info *i, void *userdata) {
-    (void)userdata;
-    switch (pulse_op) {
-    case 'v':
-    case 's':
-        pa_operation_unref(pa_context_get_sink_info_by_name(c, i->default_sink_name, do_pulse_vs, NULL));
-        break;
-    case 'm':
-        pa_operation_unref(pa_context_get_source_info_by_name(c, i->default_source_name, do_pulse_m, NULL));
-        break;
-    }
+// Push-to-talk: the mic is live only while the key is held. Each change is
+// one set request on the audio thread's connected context, by the source
+// index it already has. Autorepeat changes nothing.
+static int ptt_set(bool held, int fd) {
+    return audio_submit(AUDIO_MIC_SET, !held, fd);
 }
 
-static int pa_disable_sigpipe(void) {
-    struct sigaction sa = {0};
-    if (sigaction(SIGPIPE, NULL, &sa) < 0) {
-        perror("pa_disable_sigpipe (sigaction 1)");
-        return 1;
+// Set while the panel is dimmed or off for idleness; the sensor and the
+// schedule leave it alone until the user is back.
+static enum sltp_idle_level idle_level = SLTP_IDLE_ACTIVE;
+
+static const double ALS_EMA_ALPHA = 0.25;
+static const int ALS_HYSTERESIS_PERCENT = 3;
+
+static bool als_enabled = false;
+static char als_dev[256] = {0};
+static int als_interval_ms = 500;
+static int als_fd = -1;
+static bool als_buffered = false;
+static double als_scale = 1.0;
+static double als_offset = 0.0;
+static unsigned als_sample_bytes, als_sample_bits, als_sample_shift;
+static bool als_sample_signed, als_sample_be;
+static double als_ema = -1.0;
+static int als_shift = 0;
+static int als_applied = -1;
+static pa_time_event *als_timer = NULL;
+
+static double als_curve(double lux) {
+    const struct sltp_config_point *curve = daemon_config.als_curve;
+    const size_t npoints = daemon_config.als_points;
+    if (lux <= curve[0].lux) {
+        return curve[0].frac;
     }
+    for (size_t n = 1; n < npoints; ++n) {
+        if (lux < curve[n].lux) {
+            const double x0 = log1p(curve[n - 1].lux), x1 = log1p(curve[n].lux);
+            const double t = (log1p(lux) - x0) / (x1 - x0);
+            return curve[n - 1].frac + t * (curve[n].frac - curve[n - 1].frac);
+        }
+    }
+    return curve[npoints - 1].frac;
+}
 
-    sa.sa_handler = SIG_IGN;
-    if (sigaction(SIGPIPE, &sa, NULL) < 0) {
-        perror("pa_disable_sigpipe (sigaction 1)");
+static int als_apply(bool force, struct sltp_result *const res) {
+    const int max_br = sltp_cached_state(daemon_ctx)->max_brightness;
+    int target = (int)lround(als_curve(als_ema) * max_br) + als_shift;
+    target = target < 0 ? 0 : target > max_br ? max_br : target;
+    int band = max_br * ALS_HYSTERESIS_PERCENT / 100;
+    if (!force && als_applied >= 0 && abs(target - als_applied) <= (band > 0 ? band : 0)) {
+        return 0;
+    }
+    struct sltp_result scratch;
+    struct sltp_result *const out = res ? res : &scratch;
+    if (sltp_brightness_set(daemon_ctx, target, out)) {
         return 1;
     }
-
+    als_applied = out->value;
     return 0;
 }
 
-static void pulse_sigint_callback(pa_mainloop_api *m, pa_signal_event *e, int sig, void *userdata) {
-    (void)m; (void)e; (void)sig; (void)userdata;
-    pulse_quit(0);
+static void als_sample(double raw) {
+    const double lux = (raw + als_offset) * als_scale;
+    als_ema = als_ema < 0 ? lux : als_ema + ALS_EMA_ALPHA * (lux - als_ema);
+    if (idle_level == SLTP_IDLE_ACTIVE) {
+        als_apply(false, NULL);
+    }
 }
 
-static void pulse_sm(pa_context *c, void *userdata) {
-    (void)userdata;
-    switch (pa_context_get_state(c)) {
-    case PA_CONTEXT_FAILED:
-        pulse_quit(1);
-        break;
-    case PA_CONTEXT_READY:
-        pa_operation_unref(pa_context_get_server_info(c, do_pulse_server_info, NULL));
-        break;
-    default:
-        break;
+// A manual step moves the whole curve, so later sensor readings keep the
+// user's preference instead of undoing it.
+static int als_step(int delta, struct sltp_result *const res) {
+    if (als_ema < 0) {
+        return sltp_brightness_step(daemon_ctx, delta, res);
     }
+    als_shift += delta;
+    return als_apply(true, res);
 }
 
-static void print_usage(void) {
-    fprintf(stderr, "usage: sltpwmt <v(olume)/b(rightness)/s(peaker toggle mute)/m(ic toggle mute)> [arg]\n");
+static int als_attr_path(char *const buf, size_t buflen, const char *const attr) {
+    int len = snprintf(buf, buflen, "%s/%s", als_dev, attr);
+    return len < 0 || (size_t)len >= buflen ? -1 : 0;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        print_usage();
-        return 1;
+static int als_read_double(const char *const attr, double *const out) {
+    char path[512], buf[64];
+    if (als_attr_path(path, sizeof(path), attr) < 0 || access(path, R_OK) == -1
+        || sltp_read_sysfs(path, buf, sizeof(buf)) == -1) {
+        return -1;
     }
+    return sscanf(buf, "%lf", out) < 1 ? -1 : 0;
+}
 
-    int arg = -1;
-    if (argc >= 3 && sscanf(argv[2], "%d", &arg) < 1) {
-        fprintf(stderr, "invalid arg value\n");
-        return 1;
+static int als_write_attr(const char *const attr, const char *const value) {
+    char path[512];
+    if (als_attr_path(path, sizeof(path), attr) < 0) {
+        return -1;
     }
+    return sltp_write_sysfs(path, value, strlen(value)) == -1 ? -1 : 0;
+}
 
-    int ret = 1;
-
-    switch (argv[1][0]) {
-    case 'b': {
-        if (argc < 3) {
-            fprintf(stderr, "need arg for brightness\n");
-            return 1;
+static void als_poll(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)tv; (void)userdata;
+    char buf[64];
+    ssize_t len = pread(als_fd, buf, sizeof(buf) - 1, 0);
+    double raw;
+    if (len > 0) {
+        buf[len] = '\0';
+        if (sscanf(buf, "%lf", &raw) == 1) {
+            als_sample(raw);
         }
-        ret = do_brightness(arg);
-        break;
     }
-    case 'v':
-        if (argc < 3) {
-            fprintf(stderr, "need arg for volume\n");
-            return 1;
-        }
-        // fallthrough
-    case 's':
-    case 'm': {
-        pulse_arg = arg;
-        pulse_op = argv[1][0];
+    struct timeval next;
+    pa_timeval_add(pa_gettimeofday(&next), (pa_usec_t)als_interval_ms * PA_USEC_PER_MSEC);
+    a->time_restart(e, &next);
+}
 
-        pa_mainloop *m = NULL;
-        if (!(m = pa_mainloop_new())) {
-            fprintf(stderr, "pa_mainloop_new failed\n");
-            return 1;
+static void als_buffer_event(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)a; (void)e; (void)events; (void)userdata;
+    unsigned char buf[256];
+    ssize_t len = read(fd, buf, sizeof(buf) - sizeof(buf) % als_sample_bytes);
+    if (len < (ssize_t)als_sample_bytes) {
+        return;
+    }
+
+    // Only the newest sample matters; the EMA runs at the trigger's rate anyway.
+    const unsigned char *sample = buf + (len / als_sample_bytes - 1) * als_sample_bytes;
+    uint64_t v = 0;
+    for (unsigned n = 0; n < als_sample_bytes; ++n) {
+        v |= (uint64_t)sample[als_sample_be ? als_sample_bytes - 1 - n : n] << (8 * n);
+    }
+    v >>= als_sample_shift;
+    if (als_sample_bits < 64) {
+        v &= (UINT64_C(1) << als_sample_bits) - 1;
+        if (als_sample_signed && (v & (UINT64_C(1) << (als_sample_bits - 1)))) {
+            v |= ~((UINT64_C(1) << als_sample_bits) - 1);
         }
-        pulse_mapi = pa_mainloop_get_api(m);
-        if (pa_signal_init(pulse_mapi)) {
-            fprintf(stderr, "pa_signal_init failed\n");
-            pulse_quit(1);
+    }
+    als_sample(als_sample_signed ? (double)(int64_t)v : (double)v);
+}
+
+// Buffered capture through /dev/iio:deviceN. Needs a trigger to be set up and
+// nobody else (e.g. iio-sensor-proxy) owning the buffer; otherwise we poll.
+static int als_open_buffer(void) {
+    char path[512], buf[64];
+    char endian, sign;
+    if (als_attr_path(path, sizeof(path), "scan_elements/in_illuminance_type") < 0
+        || access(path, R_OK) == -1
+        || sltp_read_sysfs(path, buf, sizeof(buf)) == -1
+        || sscanf(buf, "%ce:%c%u/%u>>%u", &endian, &sign, &als_sample_bits, &als_sample_bytes, &als_sample_shift) < 5
+        || als_sample_bytes % 8 || als_sample_bytes == 0 || als_sample_bytes > 64
+        || als_sample_bits == 0 || als_sample_bits > 64) {
+        return -1;
+    }
+    als_sample_bytes /= 8;
+    als_sample_be = endian == 'b';
+    als_sample_signed = sign == 's';
+
+    const char *name = strrchr(als_dev, '/');
+    snprintf(path, sizeof(path), "/dev/%s", name ? name + 1 : als_dev);
+    if (als_write_attr("scan_elements/in_illuminance_en", "1") < 0) {
+        return -1;
+    }
+    if (als_write_attr("buffer/enable", "1") < 0) {
+        als_write_attr("scan_elements/in_illuminance_en", "0");
+        return -1;
+    }
+    if ((als_fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) == -1) {
+        als_write_attr("buffer/enable", "0");
+        als_write_attr("scan_elements/in_illuminance_en", "0");
+        return -1;
+    }
+    als_buffered = true;
+    return 0;
+}
+
+static int als_open(void) {
+    if (!*als_dev) {
+        glob_t g;
+        if (glob("/sys/bus/iio/devices/iio:device*/in_illuminance_*raw", 0, NULL, &g) != 0
+            && glob("/sys/bus/iio/devices/iio:device*/in_illuminance_input", 0, NULL, &g) != 0) {
+            fprintf(stderr, "auto brightness: no illuminance sensor found\n");
             return 1;
         }
-        pa_signal_new(SIGINT, pulse_sigint_callback, NULL);
-        pa_signal_new(SIGTERM, pulse_sigint_callback, NULL);
-        pa_disable_sigpipe();
+        snprintf(als_dev, sizeof(als_dev), "%s", g.gl_pathv[0]);
+        *strrchr(als_dev, '/') = '\0';
+        globfree(&g);
+    }
+    if (sltp_cached_state(daemon_ctx)->max_brightness <= 0) {
+        fprintf(stderr, "auto brightness: no backlight\n");
+        return 1;
+    }
 
-        pa_context *pulse_context = NULL;
-        if (!(pulse_context = pa_context_new(pulse_mapi, NULL))) {
-            fprintf(stderr, "pa_context_new failed\n");
-            ret = 1;
-            goto exit;
-        }
-        pa_context_set_state_callback(pulse_context, pulse_sm, NULL);
-        if (pa_context_connect(pulse_context, NULL, 0, NULL) < 0) {
-            fprintf(stderr, "pa_context_connect failed: %s\n", pa_strerror(pa_context_errno(pulse_context)));
-            ret = 1;
-            goto exit;
-        }
+    if (als_read_double("in_illuminance_scale", &als_scale) < 0) {
+        als_scale = 1.0;
+    }
+    if (als_read_double("in_illuminance_offset", &als_offset) < 0) {
+        als_offset = 0.0;
+    }
 
-        if (pa_mainloop_run(m, &ret) < 0) {
-            fprintf(stderr, "pa_mainloop_run failed\n");
+    if (als_open_buffer() == 0) {
+        daemon_mapi->io_new(daemon_mapi, als_fd, PA_IO_EVENT_INPUT, als_buffer_event, NULL);
+        return 0;
+    }
+
+    char path[512];
+    if (als_attr_path(path, sizeof(path), "in_illuminance_input") == 0 && access(path, R_OK) == 0) {
+        // Already in lux.
+        als_scale = 1.0;
+        als_offset = 0.0;
+    } else if (als_attr_path(path, sizeof(path), "in_illuminance_raw") < 0) {
+        return 1;
+    }
+    if ((als_fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        perror("auto brightness failed (open)");
+        return 1;
+    }
+    struct timeval tv;
+    als_timer = daemon_mapi->time_new(daemon_mapi, pa_gettimeofday(&tv), als_poll, NULL);
+    return 0;
+}
+
+static void als_close(void) {
+    if (als_fd == -1) {
+        return;
+    }
+    close(als_fd);
+    if (als_buffered) {
+        als_write_attr("buffer/enable", "0");
+        als_write_attr("scan_elements/in_illuminance_en", "0");
+    }
+}
+
+// With a schedule in the config and no sensor, brightness follows the time
+// of day. A single CLOCK_REALTIME timerfd is armed for the moment the
+// brightness next changes, so between points the daemon sleeps straight
+// through to the next one. Setting the clock cancels the timer, and the
+// plan is worked out again from the new time.
+static const int64_t SCHEDULE_STEP_MIN_USEC = 16 * PA_USEC_PER_MSEC;
+
+static int schedule_fd = -1;
+static pa_io_event *schedule_io = NULL;
+static int schedule_shift = 0;
+static int schedule_applied = -1;
+
+static int64_t schedule_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int schedule_apply(bool force, struct sltp_result *const res) {
+    const int64_t now = schedule_now();
+    const int max_br = sltp_cached_state(daemon_ctx)->max_brightness;
+    struct sltp_schedule_step step;
+    if (sltp_schedule_plan(&daemon_config, now, max_br, &step) < 0) {
+        return 0;
+    }
+
+    int ret = 0;
+    int target = (int)lround(step.frac * max_br) + schedule_shift;
+    target = target < 0 ? 0 : target > max_br ? max_br : target;
+    if (max_br > 0 && idle_level == SLTP_IDLE_ACTIVE && (force || target != schedule_applied)) {
+        struct sltp_result scratch;
+        struct sltp_result *const out = res ? res : &scratch;
+        if (sltp_brightness_set(daemon_ctx, target, out)) {
             ret = 1;
-            goto exit;
+        } else {
+            schedule_applied = out->value;
         }
-    exit:
-        if (pulse_context) {
-            pa_context_unref(pulse_context);
+    }
+
+    // A fade on a panel with a fine range steps no faster than volume ramps.
+    const int64_t next = step.next > now + SCHEDULE_STEP_MIN_USEC ? step.next : now + SCHEDULE_STEP_MIN_USEC;
+    const struct itimerspec its = { .it_value = { .tv_sec = next / 1000000, .tv_nsec = next % 1000000 * 1000 } };
+    if (timerfd_settime(schedule_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) == -1) {
+        perror("schedule_apply failed (timerfd_settime)");
+    }
+    return ret;
+}
+
+static void schedule_event(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)a; (void)e; (void)events; (void)userdata;
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) == -1 && errno != ECANCELED) {
+        return;
+    }
+    schedule_apply(false, NULL);
+}
+
+// Like the sensor's curve, a manual step moves the whole schedule.
+static int schedule_step(int delta, struct sltp_result *const res) {
+    schedule_shift += delta;
+    return schedule_apply(true, res);
+}
+
+static void schedule_stop(void) {
+    if (schedule_fd == -1) {
+        return;
+    }
+    daemon_mapi->io_free(schedule_io);
+    schedule_io = NULL;
+    close(schedule_fd);
+    schedule_fd = -1;
+    schedule_applied = -1;
+}
+
+// Starts, replans or stops following the schedule after the config is
+// (re)loaded.
+static void schedule_update(void) {
+    if (!daemon_config.schedule_points || als_enabled) {
+        schedule_stop();
+        return;
+    }
+    if (schedule_fd == -1) {
+        if ((schedule_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+            perror("schedule_update: not following the schedule (timerfd_create)");
+            return;
         }
+        schedule_io = daemon_mapi->io_new(daemon_mapi, schedule_fd, PA_IO_EVENT_INPUT, schedule_event, NULL);
+    }
+    schedule_apply(false, NULL);
+}
+
+// With idle_dim or idle_off set, the backlight dims after that long without
+// X input and then switches off through bl_power; the next input puts back
+// exactly the brightness from before. The X server says when each of these
+// happens (see idle.h), and the restore is written straight from its event.
+static struct sltp_idle *idle_watch = NULL;
+static uint32_t idle_dim_s, idle_off_s; // what idle_watch was made with
+static int idle_saved = -1; // brightness before dimming
+static bool idle_powered_off = false;
+
+static void idle_wake(void) {
+    if (idle_level == SLTP_IDLE_ACTIVE) {
+        return;
+    }
+    struct sltp_result res;
+    idle_level = SLTP_IDLE_ACTIVE;
+    if (idle_powered_off) {
+        sltp_backlight_power(daemon_ctx, true);
+        idle_powered_off = false;
+    }
+    if (idle_saved >= 0) {
+        sltp_brightness_set(daemon_ctx, idle_saved, &res);
+        idle_saved = -1;
+    }
+    // Catches up with a schedule that moved on while the panel was dimmed.
+    if (schedule_fd != -1) {
+        schedule_apply(false, NULL);
+    }
+}
 
-        if (m) {
-            pa_signal_done();
-            pa_mainloop_free(m);
+static void idle_changed(struct sltp_idle *idle, enum sltp_idle_level level, void *userdata) {
+    (void)idle; (void)userdata;
+    struct sltp_result res;
+    int br, max_br;
+    if (level == SLTP_IDLE_ACTIVE) {
+        idle_wake();
+        return;
+    }
+    if (idle_level == SLTP_IDLE_ACTIVE && sltp_brightness_get(daemon_ctx, &br, &max_br) == 0) {
+        idle_saved = br;
+    }
+    idle_level = level;
+    if (level == SLTP_IDLE_DIM) {
+        if (idle_saved >= 0) {
+            sltp_brightness_set(daemon_ctx, idle_saved * (int)daemon_config.idle_dim_level / 100, &res);
         }
-        break;
+    } else if (sltp_backlight_power(daemon_ctx, false) == 0) {
+        idle_powered_off = true;
+    } else {
+        sltp_brightness_set(daemon_ctx, 0, &res);
     }
-    default:
-        fprintf(stderr, "unknown action\n");
-        ret = 1;
-        break;
+}
+
+static void idle_stop(void) {
+    idle_wake();
+    sltp_idle_free(idle_watch);
+    idle_watch = NULL;
+}
+
+// Reconnects only when the thresholds changed.
+static void idle_update(void) {
+    const uint32_t dim = daemon_config.idle_dim_s, off = daemon_config.idle_off_s;
+    if (idle_watch && dim == idle_dim_s && off == idle_off_s) {
+        return;
+    }
+    idle_stop();
+    if (!dim && !off) {
+        return;
+    }
+    if (!(idle_watch = sltp_idle_new(daemon_mapi, dim * 1000, off * 1000, idle_changed, NULL))) {
+        fprintf(stderr, "idle_update: not dimming when idle\n");
+        return;
+    }
+    idle_dim_s = dim;
+    idle_off_s = off;
+}
+
+static int daemon_listen_fd = -1;
+static bool daemon_activated = false;
+
+// With -x, the daemon exits once nothing has asked it for anything for that
+// long. Under socket activation systemd keeps the socket open, so the next
+// request starts it again and nothing is lost.
+static pa_usec_t daemon_idle_usec = 0;
+static pa_time_event *daemon_idle_timer = NULL;
+
+static void daemon_idle(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)e; (void)tv; (void)userdata;
+    a->quit(a, 0);
+}
+
+static void daemon_touch(void) {
+    if (!daemon_idle_usec) {
+        return;
+    }
+    struct timeval tv;
+    pa_timeval_add(pa_gettimeofday(&tv), daemon_idle_usec);
+    if (daemon_idle_timer) {
+        daemon_mapi->time_restart(daemon_idle_timer, &tv);
+    } else {
+        daemon_idle_timer = daemon_mapi->time_new(daemon_mapi, &tv, daemon_idle, NULL);
+    }
+}
+
+static int daemon_brightness_step(int delta, struct sltp_result *const res) {
+    const uint64_t start = sltp_metrics_now();
+    sltp_metrics_count(&daemon_metrics.ops[SLTP_METRIC_OP_BRIGHTNESS]);
+    idle_wake();
+    const int ret = als_enabled ? als_step(delta, res)
+        : schedule_fd != -1 ? schedule_step(delta, res)
+        : sltp_brightness_step(daemon_ctx, delta, res);
+    sltp_metrics_observe(&daemon_metrics, SLTP_METRIC_PHASE_SYSFS, start);
+    if (ret) {
+        sltp_metrics_count(&daemon_metrics.failures[SLTP_METRIC_FAIL_SYSFS]);
+    }
+    return ret;
+}
+
+static void daemon_reply(int fd, uint64_t start, const struct sltp_result *const res) {
+    char reply[sizeof(res->msg) + 1];
+    reply[0] = res->status ? '1' : '0';
+    snprintf(reply + 1, sizeof(reply) - 1, "%s", res->msg);
+    send(fd, reply, strlen(reply), MSG_NOSIGNAL);
+    close(fd);
+    sltp_metrics_observe(&daemon_metrics, SLTP_METRIC_PHASE_REQUEST, start);
+}
+
+// Formatted into a static buffer; the reply is too big for a sltp_result.
+static void daemon_reply_metrics(int fd) {
+    static char reply[SLTP_METRICS_TEXT_MAX + 1];
+    const int len = sltp_metrics_format(&daemon_metrics, reply + 1, sizeof(reply) - 1);
+    reply[0] = len < 0 ? '1' : '0';
+    send(fd, reply, len < 0 ? 1 : (size_t)len + 1, MSG_NOSIGNAL);
+    close(fd);
+}
+
+struct daemon_ddc_request {
+    int fd;
+    uint64_t start;
+};
+
+static void daemon_ddc_done(struct sltp_ddc *ddc, const struct sltp_result *res, void *userdata) {
+    (void)ddc;
+    struct daemon_ddc_request *req = userdata;
+    daemon_reply(req->fd, req->start, res);
+    free(req);
+}
+
+// Monitor steps take a few DDC/CI round trips of 40-50 ms each, so they are
+// answered from the timers that drive them.
+static int daemon_ddc_step(int fd, uint64_t start, int delta) {
+    struct daemon_ddc_request *req = malloc(sizeof(*req));
+    if (!req || (!daemon_ddc && !(daemon_ddc = sltp_ddc_new(daemon_mapi, NULL)))) {
+        free(req);
+        return -1;
+    }
+    *req = (struct daemon_ddc_request){ .fd = fd, .start = start };
+    if (sltp_ddc_step(daemon_ddc, delta, daemon_ddc_done, req)) {
+        free(req);
+        return -1;
+    }
+    return 0;
+}
+
+// What both contexts last set, for `sltpwmt restore` and resuming from
+// suspend. A change only marks the file dirty; it is rewritten once after a
+// burst of key presses settles, and fsynced at most once a minute, before
+// sleeping and at exit.
+
+static const pa_usec_t SAVED_DELAY = 2 * PA_USEC_PER_SEC;
+static const pa_usec_t SAVED_SYNC_PERIOD = 60 * PA_USEC_PER_SEC;
+
+static struct sltp_saved daemon_saved;
+static pa_time_event *saved_timer = NULL;
+static bool saved_armed = false;
+static bool saved_unsynced = false; // stored since the last fsync
+static struct timeval saved_synced;
+static struct sltp_dbus *daemon_bus = NULL;
+
+static void saved_arm(const struct timeval *tv);
+
+static void saved_flush(bool sync) {
+    if ((daemon_saved.dirty || (sync && saved_unsynced)) && sltp_saved_store(&daemon_saved, sync) == 0) {
+        saved_unsynced = !sync;
+        if (sync) {
+            pa_gettimeofday(&saved_synced);
+        }
+    }
+}
+
+static void saved_timeout(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)a; (void)e; (void)tv; (void)userdata;
+    struct timeval now, due = saved_synced;
+    saved_armed = false;
+    pa_gettimeofday(&now);
+    pa_timeval_add(&due, SAVED_SYNC_PERIOD);
+    const bool sync = pa_timeval_cmp(&due, &now) <= 0;
+    saved_flush(sync);
+    if (saved_unsynced) {
+        // Come back for the fsync when it is due.
+        saved_arm(&due);
+    }
+}
+
+static void saved_arm(const struct timeval *tv) {
+    if (saved_timer) {
+        daemon_mapi->time_restart(saved_timer, tv);
+    } else {
+        saved_timer = daemon_mapi->time_new(daemon_mapi, tv, saved_timeout, NULL);
+    }
+    saved_armed = true;
+}
+
+static void saved_record(const struct sltp_saved_entry *e) {
+    struct timeval tv;
+    if (sltp_saved_record(&daemon_saved, e) && !saved_armed) {
+        saved_arm(pa_timeval_add(pa_gettimeofday(&tv), SAVED_DELAY));
+    }
+}
+
+// A panel dimmed for idleness is not a brightness anyone chose.
+static void daemon_applied(struct sltp_ctx *ctx, const struct sltp_saved_entry *e, void *userdata) {
+    (void)ctx; (void)userdata;
+    if (idle_level != SLTP_IDLE_ACTIVE && e->kind == SLTP_SAVED_BACKLIGHT) {
+        return;
+    }
+    saved_record(e);
+}
+
+// Backlights are written here and now; the sinks go to the audio thread as
+// one batch, and its result answers the client. With the ALS in charge of
+// brightness, only the sinks are restored.
+static int daemon_restore(int fd, uint64_t start) {
+    struct sltp_result res = { .msg = "Nothing to restore" };
+    if (!als_enabled && sltp_restore_backlights(daemon_ctx, &daemon_saved, &res)) {
+        fprintf(stderr, "daemon_restore: %s\n", res.msg);
+    }
+    size_t sinks = 0;
+    for (size_t n = 0; n < daemon_saved.count; ++n) {
+        sinks += daemon_saved.entries[n].kind == SLTP_SAVED_SINK;
+    }
+    if (!sinks) {
+        if (fd != -1) {
+            daemon_reply(fd, start, &res);
+        }
+        return 0;
+    }
+    struct audio_msg msg = { .type = AUDIO_RESTORE, .fd = fd, .start = start };
+    if (!(msg.restore = malloc(sizeof(*msg.restore)))) {
+        return -1;
+    }
+    *msg.restore = daemon_saved;
+    if (audio_push(&msg) < 0) {
+        free(msg.restore);
+        return -1;
+    }
+    return 0;
+}
+
+static void daemon_scene_reply(struct daemon_scene *s, struct sltp_result *res) {
+    const uint64_t usec = sltp_metrics_now() - s->start;
+    if (res->status) {
+        char why[sizeof(res->msg)];
+        snprintf(why, sizeof(why), "%s", res->msg);
+        snprintf(res->msg, sizeof(res->msg), "Scene %s not applied after %llu us: %.50s", s->name,
+            (unsigned long long)usec, why);
+    } else {
+        snprintf(res->msg, sizeof(res->msg), "Scene %s applied in %llu us", s->name, (unsigned long long)usec);
+    }
+    daemon_reply(s->fd, s->start, res);
+    free(s);
+}
+
+static void daemon_scene_done(struct daemon_scene *s, struct sltp_result *res) {
+    struct sltp_result scratch;
+    if (res->status) {
+        sltp_restore_backlights(daemon_ctx, &s->undo, &scratch);
+    }
+    daemon_scene_reply(s, res);
+}
+
+static int daemon_scene(int fd, uint64_t start, const char *name) {
+    const struct sltp_scene *scene = sltp_config_scene(&daemon_config, name);
+    struct sltp_result res = { .status = 1 };
+    if (!scene) {
+        snprintf(res.msg, sizeof(res.msg), "no scene %.100s", name);
+        daemon_reply(fd, start, &res);
+        return 0;
+    }
+    struct daemon_scene *s = malloc(sizeof(*s));
+    if (!s) {
+        return -1;
+    }
+    *s = (struct daemon_scene){ .fd = fd, .start = start, .count = scene->count };
+    snprintf(s->name, sizeof(s->name), "%s", scene->name);
+    memcpy(s->changes, &daemon_config.changes[scene->first], scene->count * sizeof(s->changes[0]));
+
+    bool audio = false;
+    for (size_t n = 0; n < s->count; ++n) {
+        audio |= s->changes[n].target != SLTP_SCENE_BACKLIGHT;
+    }
+    if (sltp_scene_backlights(daemon_ctx, s->changes, s->count, &s->undo, &res) || !audio) {
+        daemon_scene_reply(s, &res);
+        return 0;
+    }
+    const struct audio_msg msg = { .type = AUDIO_SCENE, .fd = -1, .start = start, .scene = s };
+    if (audio_push(&msg) < 0) {
+        res = (struct sltp_result){ .status = 1, .msg = "audio busy" };
+        daemon_scene_done(s, &res);
+    }
+    return 0;
+}
+
+static void daemon_sleep(struct sltp_dbus *bus, const struct sltp_dbus_msg *msg, void *userdata) {
+    (void)bus; (void)userdata;
+    bool sleeping;
+    if (sltp_dbus_arg_bool(msg, &sleeping) < 0) {
+        return;
+    }
+    if (sleeping) {
+        saved_flush(true);
+    } else if (daemon_restore(-1, sltp_metrics_now()) < 0) {
+        fprintf(stderr, "daemon_sleep: restore failed\n");
+    }
+}
+
+// Audio requests are answered once the server has acknowledged them, so the
+// client fd travels through the audio thread and comes back with the result.
+static void daemon_handle(int fd, const char *const req) {
+    const uint64_t start = sltp_metrics_now();
+    struct sltp_result res = { .status = 1 };
+    char op;
+    int arg;
+    if (!strncmp(req, "a ", 2)) {
+        if (daemon_scene(fd, start, req + 2) < 0) {
+            snprintf(res.msg, sizeof(res.msg), "out of memory");
+            daemon_reply(fd, start, &res);
+        }
+        return;
+    }
+    if (sscanf(req, "%c %d", &op, &arg) < 2) {
+        snprintf(res.msg, sizeof(res.msg), "bad request");
+        daemon_reply(fd, start, &res);
+        return;
+    }
+
+    snprintf(res.msg, sizeof(res.msg), "request failed");
+    switch (op) {
+    case 'b':
+        daemon_brightness_step(arg, &res);
+        break;
+    case 'v':
+        if (audio_submit(AUDIO_VOLUME, arg, fd) == 0) {
+            return;
+        }
+        snprintf(res.msg, sizeof(res.msg), "audio busy");
+        break;
+    case 's':
+        if (audio_submit(AUDIO_MUTE, SLTP_SPEAKERS, fd) == 0) {
+            return;
+        }
+        snprintf(res.msg, sizeof(res.msg), "audio busy");
+        break;
+    case 'm':
+        if (audio_submit(AUDIO_MUTE, SLTP_MIC, fd) == 0) {
+            return;
+        }
+        snprintf(res.msg, sizeof(res.msg), "audio busy");
+        break;
+    case 'p':
+        if (ptt_set(arg != 0, fd) == 0) {
+            return;
+        }
+        snprintf(res.msg, sizeof(res.msg), "audio busy");
+        break;
+    case 'd':
+        if (daemon_ddc_step(fd, start, arg) == 0) {
+            return;
+        }
+        snprintf(res.msg, sizeof(res.msg), "out of memory");
+        break;
+    case 'r':
+        if (daemon_restore(fd, start) == 0) {
+            return;
+        }
+        snprintf(res.msg, sizeof(res.msg), "audio busy");
+        break;
+    case 'w':
+        res.status = 0;
+        snprintf(res.msg, sizeof(res.msg), "%llu", (unsigned long long)sltp_eloop_wakeups(daemon_loop));
+        break;
+    case 'M':
+        daemon_reply_metrics(fd);
+        return;
+    default:
+        snprintf(res.msg, sizeof(res.msg), "unknown action");
+        break;
+    }
+    daemon_reply(fd, start, &res);
+}
+
+static void daemon_audio_event(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)a; (void)e; (void)events; (void)userdata;
+    eventfd_t count;
+    struct audio_msg msg;
+    eventfd_read(fd, &count);
+    while (sltp_spsc_pop(&audio_replies, &msg)) {
+        audio_results_owed -= msg.type == AUDIO_RESULT;
+        if (msg.type == AUDIO_RESULT && msg.scene) {
+            daemon_scene_done(msg.scene, &msg.res);
+            continue;
+        }
+        if (msg.type == AUDIO_RESULT) {
+            daemon_reply(msg.fd, msg.start, &msg.res);
+            continue;
+        }
+        if (msg.type == AUDIO_APPLIED) {
+            saved_record(&msg.applied);
+            continue;
+        }
+        daemon_state.volume = msg.state.volume;
+        daemon_state.muted = msg.state.muted;
+        daemon_state.mic_muted = msg.state.mic_muted;
+        daemon_state.valid = (daemon_state.valid & SLTP_STATE_BRIGHTNESS)
+            | (msg.state.valid & (SLTP_STATE_SINK | SLTP_STATE_SOURCE));
+        daemon_publish();
+    }
+}
+
+static int audio_start(void) {
+    if (sltp_spsc_init(&audio_requests, AUDIO_QUEUE_SIZE, sizeof(struct audio_msg)) < 0
+        || sltp_spsc_init(&audio_replies, AUDIO_QUEUE_SIZE + AUDIO_RESULTS_MAX, sizeof(struct audio_msg)) < 0
+        || (audio_request_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1
+        || (audio_reply_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        perror("audio_start failed");
+        return 1;
+    }
+    if (!(audio_loop = pa_threaded_mainloop_new())) {
+        fprintf(stderr, "pa_threaded_mainloop_new failed\n");
+        return 1;
+    }
+    pa_mainloop_api *api = pa_threaded_mainloop_get_api(audio_loop);
+    if (!(audio_ctx = sltp_new(api))) {
+        return 1;
+    }
+    sltp_set_state_callback(audio_ctx, audio_state, NULL);
+    sltp_set_applied_callback(audio_ctx, audio_applied, NULL);
+    sltp_set_volume_snap(audio_ctx, daemon_config.volume_snap);
+    sltp_set_volume_ramp(audio_ctx, (pa_usec_t)daemon_config.volume_ramp_ms * PA_USEC_PER_MSEC);
+    audio_mics(daemon_config.ptt_sources, daemon_config.ptt_nsources);
+    if (audio_duck_match && sltp_set_ducking(audio_ctx, audio_duck_match, audio_duck_db)) {
+        return 1;
+    }
+    for (size_t n = 0; n < AUDIO_PENDING_MAX; ++n) {
+        audio_pending[n].next_free = audio_pending_free;
+        audio_pending_free = &audio_pending[n];
+    }
+    audio_request_event = api->io_new(api, audio_request_efd, PA_IO_EVENT_INPUT, audio_request, NULL);
+    audio_reply_event = daemon_mapi->io_new(daemon_mapi, audio_reply_efd, PA_IO_EVENT_INPUT, daemon_audio_event, NULL);
+
+    // The thread is not running yet, so none of the above needs its lock.
+    if (sltp_connect(audio_ctx)) {
+        return 1;
+    }
+    if (pa_threaded_mainloop_start(audio_loop) < 0) {
+        fprintf(stderr, "pa_threaded_mainloop_start failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void audio_stop(void) {
+    struct audio_msg msg;
+    if (audio_loop) {
+        pa_threaded_mainloop_stop(audio_loop);
+        // With the thread gone its objects can be torn down from here.
+        if (audio_ctx) {
+            sltp_set_state_callback(audio_ctx, NULL, NULL);
+            sltp_set_applied_callback(audio_ctx, NULL, NULL);
+            sltp_free(audio_ctx);
+        }
+        if (audio_request_event) {
+            pa_threaded_mainloop_get_api(audio_loop)->io_free(audio_request_event);
+        }
+        pa_threaded_mainloop_free(audio_loop);
+    }
+    if (audio_reply_event) {
+        daemon_mapi->io_free(audio_reply_event);
+    }
+    // A scene whose audio half never ran still has its backlights put back.
+    while (audio_replies.slots && sltp_spsc_pop(&audio_replies, &msg)) {
+        if (msg.type == AUDIO_RESULT && msg.scene) {
+            daemon_scene_done(msg.scene, &msg.res);
+        } else if (msg.type == AUDIO_RESULT) {
+            close(msg.fd);
+        } else if (msg.type == AUDIO_APPLIED) {
+            saved_record(&msg.applied);
+        }
+    }
+    while (audio_requests.slots && sltp_spsc_pop(&audio_requests, &msg)) {
+        if (msg.scene) {
+            struct sltp_result res = { .status = 1, .msg = "daemon stopping" };
+            daemon_scene_done(msg.scene, &res);
+        } else if (msg.fd != -1) {
+            close(msg.fd);
+        }
+        free(msg.restore);
+        free(msg.mics);
+    }
+    if (audio_request_efd != -1) {
+        close(audio_request_efd);
+    }
+    if (audio_reply_efd != -1) {
+        close(audio_reply_efd);
+    }
+    sltp_spsc_destroy(&audio_requests);
+    sltp_spsc_destroy(&audio_replies);
+}
+
+// Hotkeys read straight from evdev. Brightness and volume deltas, including
+// autorepeat, are summed by the coalescer and applied at most once per
+// frame; a lone press is applied on the next loop iteration.
+
+static const pa_usec_t COALESCE_PERIOD = 16 * PA_USEC_PER_MSEC;
+
+static int coalesce_brightness = 0;
+static int coalesce_volume = 0;
+static pa_time_event *coalesce_timer = NULL;
+static bool coalesce_armed = false;
+static struct timeval coalesce_last;
+
+static void coalesce_flush(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)a; (void)e; (void)tv; (void)userdata;
+    struct sltp_result res;
+    pa_gettimeofday(&coalesce_last);
+    coalesce_armed = false;
+    if (coalesce_brightness) {
+        daemon_brightness_step(coalesce_brightness, &res);
+        coalesce_brightness = 0;
+    }
+    if (coalesce_volume) {
+        audio_submit(AUDIO_VOLUME, coalesce_volume, -1);
+        coalesce_volume = 0;
+    }
+}
+
+static void coalesce_add(int brightness, int volume) {
+    coalesce_brightness += brightness;
+    coalesce_volume += volume;
+    if (coalesce_armed) {
+        sltp_metrics_count(&daemon_metrics.coalesced);
+        return;
+    }
+
+    struct timeval now, next = coalesce_last;
+    pa_gettimeofday(&now);
+    pa_timeval_add(&next, COALESCE_PERIOD);
+    if (pa_timeval_cmp(&next, &now) < 0) {
+        next = now;
+    }
+    if (coalesce_timer) {
+        daemon_mapi->time_restart(coalesce_timer, &next);
+    } else {
+        coalesce_timer = daemon_mapi->time_new(daemon_mapi, &next, coalesce_flush, NULL);
+    }
+    coalesce_armed = true;
+}
+
+struct evdev_device {
+    int fd;
+    pa_io_event *event;
+    char path[64];
+};
+
+static const unsigned EVDEV_KEYS[] = {
+    KEY_BRIGHTNESSUP, KEY_BRIGHTNESSDOWN, KEY_VOLUMEUP, KEY_VOLUMEDOWN, KEY_MUTE, KEY_MICMUTE,
+};
+
+static bool evdev_enabled = false;
+static struct evdev_device evdev_devices[32];
+static int uevent_fd = -1;
+
+static void evdev_key(unsigned code, int value) {
+    const int max_br = sltp_cached_state(daemon_ctx)->max_brightness;
+    daemon_touch();
+    // 0 is release, 1 press, 2 autorepeat.
+    if (daemon_config.ptt_key && code == daemon_config.ptt_key) {
+        if (value != 2) {
+            ptt_set(value == 1, -1);
+        }
+        return;
+    }
+    if (value == 0) {
+        return;
+    }
+
+    const int br_step = daemon_config.brightness_step ? daemon_config.brightness_step
+        : max_br / 20 > 0 ? max_br / 20 : 1;
+    const int vol_step = (int)daemon_config.volume_step;
+    switch (code) {
+    case KEY_BRIGHTNESSUP:
+        coalesce_add(br_step, 0);
+        break;
+    case KEY_BRIGHTNESSDOWN:
+        coalesce_add(-br_step, 0);
+        break;
+    case KEY_VOLUMEUP:
+        coalesce_add(0, vol_step);
+        break;
+    case KEY_VOLUMEDOWN:
+        coalesce_add(0, -vol_step);
+        break;
+    case KEY_MUTE:
+        if (value == 1) {
+            audio_submit(AUDIO_MUTE, SLTP_SPEAKERS, -1);
+        }
+        break;
+    case KEY_MICMUTE:
+        if (value == 1) {
+            audio_submit(AUDIO_MUTE, SLTP_MIC, -1);
+        }
+        break;
+    }
+}
+
+static void evdev_close(struct evdev_device *const dev) {
+    daemon_mapi->io_free(dev->event);
+    close(dev->fd);
+    dev->fd = -1;
+    dev->event = NULL;
+}
+
+static void evdev_event(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)a; (void)e; (void)events;
+    struct evdev_device *dev = userdata;
+    struct input_event ev[64];
+    ssize_t len;
+    while ((len = read(fd, ev, sizeof(ev))) > 0) {
+        for (size_t n = 0; n < (size_t)len / sizeof(ev[0]); ++n) {
+            if (ev[n].type == EV_KEY) {
+                evdev_key(ev[n].code, ev[n].value);
+            }
+        }
+    }
+    if (len == 0 || (len == -1 && errno != EAGAIN)) {
+        // Unplugged; the remove uevent may not have arrived yet.
+        evdev_close(dev);
+    }
+}
+
+static bool evdev_has_keys(int fd) {
+    unsigned long bits[KEY_MAX / (8 * sizeof(unsigned long)) + 1] = {0};
+    const size_t word = 8 * sizeof(unsigned long);
+    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(bits)), bits) == -1) {
+        return false;
+    }
+    for (size_t n = 0; n < sizeof(EVDEV_KEYS) / sizeof(EVDEV_KEYS[0]); ++n) {
+        if ((bits[EVDEV_KEYS[n] / word] >> (EVDEV_KEYS[n] % word)) & 1) {
+            return true;
+        }
+    }
+    const unsigned ptt = daemon_config.ptt_key;
+    return ptt && (bits[ptt / word] >> (ptt % word)) & 1;
+}
+
+static void evdev_open(const char *const path) {
+    struct evdev_device *slot = NULL;
+    for (size_t n = 0; n < sizeof(evdev_devices) / sizeof(evdev_devices[0]); ++n) {
+        struct evdev_device *dev = &evdev_devices[n];
+        if (dev->fd != -1 && !strcmp(dev->path, path)) {
+            return;
+        }
+        if (dev->fd == -1 && !slot) {
+            slot = dev;
+        }
+    }
+    if (!slot) {
+        return;
+    }
+
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    if (!evdev_has_keys(fd)) {
+        close(fd);
+        return;
+    }
+    slot->fd = fd;
+    snprintf(slot->path, sizeof(slot->path), "%s", path);
+    slot->event = daemon_mapi->io_new(daemon_mapi, fd, PA_IO_EVENT_INPUT, evdev_event, slot);
+}
+
+static void evdev_remove(const char *const path) {
+    for (size_t n = 0; n < sizeof(evdev_devices) / sizeof(evdev_devices[0]); ++n) {
+        if (evdev_devices[n].fd != -1 && !strcmp(evdev_devices[n].path, path)) {
+            evdev_close(&evdev_devices[n]);
+        }
+    }
+}
+
+static pa_io_event *daemon_brightness_io = NULL;
+
+static void daemon_brightness_unwatch(void) {
+    if (daemon_brightness_fd != -1) {
+        daemon_mapi->io_free(daemon_brightness_io);
+        close(daemon_brightness_fd);
+        daemon_brightness_fd = -1;
+        daemon_brightness_io = NULL;
+    }
+}
+
+// The backlight class sysfs_notify()s actual_brightness on every change,
+// which poll() reports as POLLERR|POLLPRI; re-reading the fd rearms it.
+static void daemon_brightness_event(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)a; (void)e; (void)events; (void)userdata;
+    char buf[64];
+    int br, max_br;
+    if (pread(fd, buf, sizeof(buf), 0) == -1) {
+        if (errno == ENODEV || errno == ENOENT) {
+            // Unplugged; the remove uevent may not have arrived yet.
+            daemon_brightness_unwatch();
+            return;
+        }
+        perror("daemon_brightness_event failed (pread)");
+        return;
+    }
+    sltp_brightness_get(daemon_ctx, &br, &max_br);
+}
+
+static void daemon_brightness_watch(void) {
+    char path[300];
+    int br, max_br;
+    sltp_brightness_get(daemon_ctx, &br, &max_br);
+    snprintf(path, sizeof(path), "%s/actual_brightness", sltp_backlight_dir(daemon_ctx));
+    if ((daemon_brightness_fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        perror("daemon_brightness_watch: not watching brightness (open)");
+    } else {
+        daemon_brightness_io = daemon_mapi->io_new(daemon_mapi, daemon_brightness_fd, PA_IO_EVENT_ERROR,
+            daemon_brightness_event, NULL);
+    }
+}
+
+// udev monitor messages start with this header, followed by the same
+// NUL-separated KEY=value properties the kernel sends after its
+// "action@devpath" line.
+struct uevent_udev_header {
+    char prefix[8];
+    uint32_t magic;
+    uint32_t header_size;
+    uint32_t properties_off;
+    uint32_t properties_len;
+};
+
+static void uevent_input(const char *action, const char *devname) {
+    // The kernel sends DEVNAME relative to /dev, udev sends it absolute.
+    char path[64];
+    snprintf(path, sizeof(path), "%s%s", devname[0] == '/' ? "" : "/dev/", devname);
+    if (strncmp(path, "/dev/input/event", 16)) {
+        return;
+    }
+    if (!strcmp(action, "add")) {
+        evdev_open(path);
+    } else if (!strcmp(action, "remove")) {
+        evdev_remove(path);
+    }
+}
+
+// Only our own backlight matters: the device is the last part of its
+// directory, and its class the one before.
+static void uevent_backlight(const char *action, const char *subsystem, const char *devpath) {
+    const char *dir = sltp_backlight_dir(daemon_ctx);
+    const char *name = strrchr(dir, '/'), *dev = strrchr(devpath, '/');
+    if (!name || name == dir || !dev || strcmp(name, dev)) {
+        return;
+    }
+    const char *class = name - 1;
+    while (class > dir && class[-1] != '/') {
+        --class;
+    }
+    if ((size_t)(name - class) != strlen(subsystem) || strncmp(class, subsystem, name - class)) {
+        return;
+    }
+
+    // A change is the device telling us its brightness, which the watch
+    // already hears about.
+    const bool add = !strcmp(action, "add");
+    if (!add && strcmp(action, "remove")) {
+        return;
+    }
+    daemon_brightness_unwatch();
+    sltp_backlight_changed(daemon_ctx);
+    if (add) {
+        daemon_brightness_watch();
+    } else {
+        int br, max_br;
+        sltp_brightness_get(daemon_ctx, &br, &max_br);
+    }
+}
+
+// Anyone may send to the udev group, so only root's messages are believed,
+// and a message in the kernel's own format only from the kernel.
+static bool uevent_trusted(const struct msghdr *msg, bool from_udev) {
+    const struct sockaddr_nl *addr = msg->msg_name;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR((struct msghdr *)msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_CREDENTIALS) {
+            const struct ucred *cred = (const struct ucred *)CMSG_DATA(c);
+            return cred->uid == 0 && (from_udev || (cred->pid == 0 && addr->nl_pid == 0));
+        }
+    }
+    return false;
+}
+
+static void uevent_event(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)a; (void)e; (void)events; (void)userdata;
+    char buf[8192];
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(struct ucred))];
+    } control;
+    struct sockaddr_nl addr;
+    struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) - 1 };
+    struct msghdr msg = { .msg_name = &addr, .msg_namelen = sizeof(addr), .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = &control, .msg_controllen = sizeof(control) };
+    ssize_t len;
+    while ((len = recvmsg(fd, &msg, 0)) > 0) {
+        buf[len] = '\0';
+        const char *p = buf, *end = buf + len;
+        const bool from_udev = !strcmp(buf, "libudev");
+        const bool trusted = uevent_trusted(&msg, from_udev);
+        msg.msg_namelen = sizeof(addr);
+        msg.msg_controllen = sizeof(control);
+        if (!trusted) {
+            continue;
+        }
+        if (from_udev) {
+            const struct uevent_udev_header *h = (const struct uevent_udev_header *)buf;
+            if ((size_t)len < sizeof(*h) || h->properties_off >= (size_t)len) {
+                continue;
+            }
+            p = buf + h->properties_off;
+        } else {
+            p += strlen(p) + 1;
+        }
+
+        const char *action = NULL, *subsystem = NULL, *devname = NULL, *devpath = NULL;
+        for (; p < end; p += strlen(p) + 1) {
+            if (!strncmp(p, "ACTION=", 7)) {
+                action = p + 7;
+            } else if (!strncmp(p, "SUBSYSTEM=", 10)) {
+                subsystem = p + 10;
+            } else if (!strncmp(p, "DEVNAME=", 8)) {
+                devname = p + 8;
+            } else if (!strncmp(p, "DEVPATH=", 8)) {
+                devpath = p + 8;
+            }
+        }
+        if (!action || !subsystem) {
+            continue;
+        }
+        if (!strcmp(subsystem, "input")) {
+            if (evdev_enabled && devname) {
+                uevent_input(action, devname);
+            }
+        } else if (!strcmp(subsystem, "backlight") || !strcmp(subsystem, "leds")) {
+            if (devpath) {
+                uevent_backlight(action, subsystem, devpath);
+            }
+        }
+    }
+}
+
+// Both the kernel (1) and udev (2) groups: the kernel's add can arrive
+// before udev has fixed up the node's permissions, udev's after. Senders
+// are checked with SO_PASSCRED (see uevent_trusted).
+static void uevent_start(void) {
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = 1 | 2 };
+    const int on = 1;
+    if ((uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT)) == -1
+        || setsockopt(uevent_fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) == -1
+        || bind(uevent_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("uevent_start: no hotplug (netlink)");
+        if (uevent_fd != -1) {
+            close(uevent_fd);
+            uevent_fd = -1;
+        }
+    } else {
+        daemon_mapi->io_new(daemon_mapi, uevent_fd, PA_IO_EVENT_INPUT, uevent_event, NULL);
+    }
+}
+
+static void uevent_stop(void) {
+    if (uevent_fd != -1) {
+        close(uevent_fd);
+    }
+}
+
+static int evdev_start(void) {
+    for (size_t n = 0; n < sizeof(evdev_devices) / sizeof(evdev_devices[0]); ++n) {
+        evdev_devices[n].fd = -1;
+    }
+
+    glob_t g;
+    if (glob("/dev/input/event*", 0, NULL, &g) == 0) {
+        for (size_t n = 0; n < g.gl_pathc; ++n) {
+            evdev_open(g.gl_pathv[n]);
+        }
+        globfree(&g);
+    }
+    return 0;
+}
+
+static void evdev_stop(void) {
+    if (!evdev_enabled) {
+        return;
+    }
+    for (size_t n = 0; n < sizeof(evdev_devices) / sizeof(evdev_devices[0]); ++n) {
+        if (evdev_devices[n].fd != -1) {
+            close(evdev_devices[n].fd);
+        }
+    }
+}
+
+static void daemon_control_request(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)events; (void)userdata;
+    char req[256];
+    ssize_t len = recv(fd, req, sizeof(req) - 1, 0);
+    if (len == -1 && errno == EAGAIN) {
+        return;
+    }
+    a->io_free(e);
+    if (len > 0) {
+        req[len] = '\0';
+        daemon_handle(fd, req);
+    } else {
+        close(fd);
+    }
+}
+
+static void daemon_control_accept(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)e; (void)events; (void)userdata;
+    int cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd == -1) {
+        return;
+    }
+    daemon_touch();
+    a->io_new(a, cfd, PA_IO_EVENT_INPUT, daemon_control_request, NULL);
+}
+
+// sd_listen_fds(3) without libsystemd: systemd passes the listening socket
+// as fd 3 and names our pid in LISTEN_PID.
+static int daemon_activation_fd(void) {
+    const char *pid = getenv("LISTEN_PID"), *fds = getenv("LISTEN_FDS");
+    long listen_pid, listen_fds;
+    if (!pid || !fds || sscanf(pid, "%ld", &listen_pid) < 1 || listen_pid != (long)getpid()
+        || sscanf(fds, "%ld", &listen_fds) < 1 || listen_fds < 1) {
+        return -1;
+    }
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    const int fd = 3;
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+        perror("daemon_activation_fd failed (fcntl)");
+        return -1;
+    }
+    return fd;
+}
+
+static int daemon_control_listen(void) {
+    struct sockaddr_un addr;
+    if ((daemon_listen_fd = daemon_activation_fd()) != -1) {
+        daemon_activated = true;
+        daemon_mapi->io_new(daemon_mapi, daemon_listen_fd, PA_IO_EVENT_INPUT, daemon_control_accept, NULL);
+        return 0;
+    }
+    if (control_address(&addr) < 0) {
+        return 1;
+    }
+    if ((daemon_listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        perror("daemon_control_listen failed (socket)");
+        return 1;
+    }
+    if (bind(daemon_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        int fd;
+        if (errno != EADDRINUSE) {
+            perror("daemon_control_listen failed (bind)");
+            return 1;
+        }
+        if ((fd = control_connect()) != -1) {
+            close(fd);
+            fprintf(stderr, "daemon already running\n");
+            return 1;
+        }
+        // Stale socket from a daemon that did not exit cleanly.
+        unlink(addr.sun_path);
+        if (bind(daemon_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            perror("daemon_control_listen failed (bind)");
+            return 1;
+        }
+    }
+    if (listen(daemon_listen_fd, 16) == -1) {
+        perror("daemon_control_listen failed (listen)");
+        return 1;
+    }
+    daemon_mapi->io_new(daemon_mapi, daemon_listen_fd, PA_IO_EVENT_INPUT, daemon_control_accept, NULL);
+    return 0;
+}
+
+static void daemon_control_close(void) {
+    struct sockaddr_un addr;
+    if (daemon_listen_fd == -1) {
+        return;
+    }
+    close(daemon_listen_fd);
+    // An activated socket belongs to systemd, which keeps listening on it.
+    if (!daemon_activated && control_address(&addr) == 0) {
+        unlink(addr.sun_path);
+    }
+}
+
+// The config file is watched through its directory, since editors tend to
+// replace it rather than write to it.
+static int daemon_config_fd = -1;
+
+static void daemon_config_load(void) {
+    sltp_config_load(&daemon_config);
+    sltp_config_merge(&daemon_config, &daemon_flags);
+}
+
+static void daemon_config_reload(void) {
+    const uint32_t ptt_key = daemon_config.ptt_key;
+    daemon_config_load();
+    daemon_brightness_unwatch();
+    sltp_config_apply(daemon_ctx, &daemon_config);
+    daemon_brightness_watch();
+    schedule_update();
+    idle_update();
+    struct audio_msg msg = { .type = AUDIO_CONFIG, .arg = (int)daemon_config.volume_snap, .fd = -1,
+        .ramp = (pa_usec_t)daemon_config.volume_ramp_ms * PA_USEC_PER_MSEC };
+    if (daemon_config.ptt_nsources && (msg.mics = malloc(sizeof(daemon_config.ptt_sources)))) {
+        memcpy(msg.mics, daemon_config.ptt_sources, sizeof(daemon_config.ptt_sources));
+        msg.nmics = daemon_config.ptt_nsources;
+    }
+    if (audio_push(&msg) < 0) {
+        free(msg.mics);
+    }
+    if (daemon_config.ptt_key && !ptt_key) {
+        ptt_set(false, -1);
+    }
+}
+
+static void daemon_config_event(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)a; (void)e; (void)events; (void)userdata;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        for (const char *p = buf; p < buf + len;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            changed |= ev->len && !strcmp(ev->name, SLTP_CONFIG_FILE);
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+    if (changed) {
+        daemon_config_reload();
+    }
+}
+
+static void daemon_config_watch(void) {
+    char dir[480];
+    if (sltp_config_dir(dir, sizeof(dir)) < 0) {
+        return;
+    }
+    if ((daemon_config_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1
+        || inotify_add_watch(daemon_config_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) == -1) {
+        // No directory, no config to reload.
+        if (errno != ENOENT) {
+            perror("daemon_config_watch: not reloading config (inotify)");
+        }
+        if (daemon_config_fd != -1) {
+            close(daemon_config_fd);
+            daemon_config_fd = -1;
+        }
+        return;
+    }
+    daemon_mapi->io_new(daemon_mapi, daemon_config_fd, PA_IO_EVENT_INPUT, daemon_config_event, NULL);
+}
+
+// With -m, the metrics are also written to a file every few seconds for
+// node_exporter's textfile collector.
+static const char *metrics_path = NULL;
+static unsigned metrics_interval = 15;
+
+static void metrics_write(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)userdata;
+    struct timeval next = *tv;
+    sltp_metrics_write_file(&daemon_metrics, metrics_path);
+    a->time_restart(e, pa_timeval_add(&next, (pa_usec_t)metrics_interval * PA_USEC_PER_SEC));
+}
+
+static void print_daemon_usage(void) {
+    fprintf(stderr, "usage: sltpwmt daemon [-a] [-I iio device dir] [-r ALS poll interval ms]\n"
+        "                      [-k] [-B brightness key step] [-V volume key step]\n"
+        "                      [-x idle exit seconds] [-m metrics file] [-M metrics interval seconds]\n"
+        "                      [-R volume ramp ms] [-D duck stream pattern[:dB]]\n");
+}
+
+static int do_daemon(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "aI:r:kB:V:x:m:M:R:D:")) != -1) {
+        switch (opt) {
+        case 'a':
+            als_enabled = true;
+            break;
+        case 'I':
+            snprintf(als_dev, sizeof(als_dev), "%s", optarg);
+            break;
+        case 'r':
+            if (sscanf(optarg, "%d", &als_interval_ms) < 1 || als_interval_ms < 1) {
+                print_daemon_usage();
+                return 1;
+            }
+            break;
+        case 'k':
+            evdev_enabled = true;
+            break;
+        case 'B':
+            if (sscanf(optarg, "%d", &daemon_flags.brightness_step) < 1) {
+                print_daemon_usage();
+                return 1;
+            }
+            daemon_flags.set |= SLTP_CONFIG_BRIGHTNESS_STEP;
+            break;
+        case 'V':
+            if (sscanf(optarg, "%u", &daemon_flags.volume_step) < 1) {
+                print_daemon_usage();
+                return 1;
+            }
+            daemon_flags.set |= SLTP_CONFIG_VOLUME_STEP;
+            break;
+        case 'x': {
+            unsigned idle;
+            if (sscanf(optarg, "%u", &idle) < 1) {
+                print_daemon_usage();
+                return 1;
+            }
+            daemon_idle_usec = (pa_usec_t)idle * PA_USEC_PER_SEC;
+            break;
+        }
+        case 'm':
+            metrics_path = optarg;
+            break;
+        case 'R':
+            if (sscanf(optarg, "%u", &daemon_flags.volume_ramp_ms) < 1) {
+                print_daemon_usage();
+                return 1;
+            }
+            daemon_flags.set |= SLTP_CONFIG_VOLUME_RAMP;
+            break;
+        case 'D': {
+            char *db = strrchr(optarg, ':');
+            if (db) {
+                *db++ = '\0';
+                if (sscanf(db, "%lf", &audio_duck_db) < 1) {
+                    print_daemon_usage();
+                    return 1;
+                }
+            }
+            audio_duck_match = optarg;
+            break;
+        }
+        case 'M':
+            if (sscanf(optarg, "%u", &metrics_interval) < 1 || metrics_interval < 1) {
+                print_daemon_usage();
+                return 1;
+            }
+            break;
+        default:
+            print_daemon_usage();
+            return 1;
+        }
+    }
+
+    int ret = 1;
+    if (!(daemon_loop = sltp_eloop_new())) {
+        return 1;
+    }
+    daemon_mapi = sltp_eloop_get_api(daemon_loop);
+    if (pa_signal_init(daemon_mapi)) {
+        fprintf(stderr, "pa_signal_init failed\n");
+        sltp_eloop_free(daemon_loop);
+        return 1;
+    }
+    pa_signal_new(SIGINT, daemon_sigint_callback, NULL);
+    pa_signal_new(SIGTERM, daemon_sigint_callback, NULL);
+    pa_disable_sigpipe();
+
+    if (!(daemon_ctx = sltp_new(daemon_mapi))) {
+        goto exit;
+    }
+    daemon_config_load();
+    sltp_config_apply(daemon_ctx, &daemon_config);
+    if (!(daemon_page = state_map(true))) {
+        goto exit;
+    }
+    daemon_page->version = SLTP_STATE_VERSION;
+    daemon_page->magic = SLTP_STATE_MAGIC;
+    daemon_publish();
+    sltp_set_state_callback(daemon_ctx, daemon_brightness_changed, NULL);
+    if (sltp_saved_load(&daemon_saved) < 0) {
+        fprintf(stderr, "do_daemon: saved values unreadable, starting afresh\n");
+    }
+    sltp_set_applied_callback(daemon_ctx, daemon_applied, NULL);
+    pa_gettimeofday(&saved_synced);
+    if (!(daemon_bus = sltp_dbus_new(daemon_mapi, NULL))
+        || sltp_dbus_match_signal(daemon_bus, "org.freedesktop.login1", "org.freedesktop.login1.Manager",
+            "PrepareForSleep", daemon_sleep, NULL) < 0) {
+        fprintf(stderr, "do_daemon: not restoring after suspend\n");
+    }
+
+    if (daemon_control_listen()) {
+        goto exit;
+    }
+
+    daemon_brightness_watch();
+    uevent_start();
+    daemon_config_watch();
+
+    if (als_enabled && als_open()) {
+        goto exit;
+    }
+    schedule_update();
+    idle_update();
+    if (evdev_enabled && evdev_start()) {
+        goto exit;
+    }
+
+    if (audio_start()) {
+        goto exit;
+    }
+    if (daemon_config.ptt_key) {
+        ptt_set(false, -1);
+    }
+    daemon_touch();
+    if (metrics_path) {
+        struct timeval tv;
+        daemon_mapi->time_new(daemon_mapi, pa_gettimeofday(&tv), metrics_write, NULL);
+    }
+
+    if (sltp_eloop_run(daemon_loop, &ret) < 0) {
+        ret = 1;
+    }
+
+exit:
+    audio_stop();
+    saved_flush(true);
+    sltp_dbus_free(daemon_bus);
+    sltp_ddc_free(daemon_ddc);
+    if (metrics_path) {
+        sltp_metrics_write_file(&daemon_metrics, metrics_path);
+    }
+    evdev_stop();
+    uevent_stop();
+    if (daemon_config_fd != -1) {
+        close(daemon_config_fd);
+    }
+    als_close();
+    idle_stop();
+    schedule_stop();
+    daemon_control_close();
+    if (daemon_ctx) {
+        sltp_set_state_callback(daemon_ctx, NULL, NULL);
+        sltp_set_applied_callback(daemon_ctx, NULL, NULL);
+        sltp_free(daemon_ctx);
+    }
+    if (daemon_page) {
+        daemon_state.valid = 0;
+        daemon_publish();
+        munmap(daemon_page, SLTP_STATE_SIZE);
+        close(state_lock_fd);
+    }
+    daemon_brightness_unwatch();
+    pa_signal_done();
+    sltp_eloop_free(daemon_loop);
+    return ret;
+}
+
+// Answers from the daemon's state page if one is live; no syscalls beyond
+// the open, flock and mmap.
+static int do_get_cached(void) {
+    struct sltp_state_page *page = state_map(false);
+    if (!page) {
+        return 1;
+    }
+    struct sltp_state st;
+    int ret = sltp_state_read(page, &st) == 0 && st.valid ? 0 : 1;
+    munmap(page, SLTP_STATE_SIZE);
+    if (ret == 0) {
+        print_state(&st);
+    }
+    return ret;
+}
+
+// Prints a line whenever the default source starts or stops being recorded
+// from, is muted or unmuted, or its level crosses the threshold, for status
+// bars to read instead of polling `pactl list source-outputs`. When
+// interrupted it says how much CPU it used, to compare against polling.
+
+static void watch_mic_level(struct sltp_ctx *ctx, const struct sltp_mic_level *level, void *userdata) {
+    (void)ctx; (void)userdata;
+    printf("mic capturing=%d muted=%d active=%d\n", level->capturing, level->muted, level->active);
+    fflush(stdout);
+}
+
+static void print_watch_usage(void) {
+    fprintf(stderr, "usage: sltpwmt watch --mic-level [threshold %%]\n");
+}
+
+static int do_watch(int argc, char *argv[]) {
+    double threshold = 5;
+    if (argc < 2 || argc > 3 || strcmp(argv[1], "--mic-level")
+        || (argc == 3 && (sscanf(argv[2], "%lf", &threshold) < 1 || threshold < 0 || threshold > 100))) {
+        print_watch_usage();
+        return 1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = 1;
+    struct sltp_eloop *loop = sltp_eloop_new();
+    if (!loop) {
+        return 1;
+    }
+    pa_mainloop_api *api = sltp_eloop_get_api(loop);
+    if (pa_signal_init(api)) {
+        fprintf(stderr, "pa_signal_init failed\n");
+        sltp_eloop_free(loop);
+        return 1;
+    }
+    pa_signal_new(SIGINT, daemon_sigint_callback, NULL);
+    pa_signal_new(SIGTERM, daemon_sigint_callback, NULL);
+    pa_disable_sigpipe();
+
+    struct sltp_ctx *ctx = sltp_new(api);
+    if (ctx && !sltp_set_mic_level_callback(ctx, threshold / 100, watch_mic_level, NULL) && !sltp_connect(ctx)
+        && sltp_eloop_run(loop, &ret) == 0) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        fprintf(stderr, "cpu: %.1f ms user, %.1f ms system over %.1f s, %llu wakeups\n",
+            ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3, ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3,
+            elapsed_ms(&start) / 1e3, (unsigned long long)sltp_eloop_wakeups(loop));
+    } else {
+        ret = 1;
+    }
+    sltp_free(ctx);
+    pa_signal_done();
+    sltp_eloop_free(loop);
+    return ret;
+}
+
+// Asks the running daemon for its counters, in Prometheus text format.
+static int do_metrics(void) {
+    static char buf[SLTP_METRICS_TEXT_MAX + 2];
+    int fd = control_connect();
+    if (fd == -1) {
+        fprintf(stderr, "metrics needs a running daemon\n");
+        return 1;
+    }
+    ssize_t len = -1;
+    if (send(fd, "M 0", 3, MSG_NOSIGNAL) == -1 || (len = recv(fd, buf, sizeof(buf) - 1, 0)) < 1) {
+        perror("do_metrics failed");
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    if (buf[0] != '0') {
+        fprintf(stderr, "metrics unavailable\n");
+        return 1;
+    }
+    fwrite(buf + 1, 1, (size_t)len - 1, stdout);
+    return 0;
+}
+
+static void ddc_done(struct sltp_ddc *ddc, const struct sltp_result *res, void *userdata) {
+    (void)ddc;
+    struct sltp_result *out = userdata;
+    *out = *res;
+}
+
+// Without a daemon the monitors are driven from a private loop until they
+// have all answered.
+static int do_ddc(int delta, struct sltp_result *res) {
+    pa_mainloop *loop = pa_mainloop_new();
+    struct sltp_ddc *ddc = loop ? sltp_ddc_new(pa_mainloop_get_api(loop), NULL) : NULL;
+    *res = (struct sltp_result){ .status = -1 };
+    if (!ddc || sltp_ddc_step(ddc, delta, ddc_done, res)) {
+        *res = (struct sltp_result){ .status = 1 };
+        snprintf(res->msg, sizeof(res->msg), "out of memory");
+    }
+    while (res->status == -1) {
+        if (pa_mainloop_iterate(loop, 1, NULL) < 0) {
+            res->status = 1;
+            snprintf(res->msg, sizeof(res->msg), "mainloop stopped");
+        }
+    }
+    sltp_ddc_free(ddc);
+    if (loop) {
+        pa_mainloop_free(loop);
+    }
+    return res->status;
+}
+
+// "[YYYY-MM-DD ]HH:MM[:SS]" in local time; the date defaults to today.
+static int schedule_parse_time(const char *text, int64_t *out) {
+    static const char *const FORMATS[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%H:%M:%S", "%H:%M" };
+    const time_t now = time(NULL);
+    for (size_t n = 0; n < sizeof(FORMATS) / sizeof(FORMATS[0]); ++n) {
+        struct tm tm;
+        localtime_r(&now, &tm);
+        tm.tm_sec = 0;
+        const char *end = strptime(text, FORMATS[n], &tm);
+        if (end && !*end) {
+            tm.tm_isdst = -1;
+            *out = (int64_t)mktime(&tm) * 1000000;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// What the daemon would do at a given time (now by default), without
+// waiting for it.
+static int do_schedule(struct sltp_ctx *ctx, const struct sltp_config *cfg, const char *when,
+    struct sltp_result *res) {
+    int64_t at;
+    int br, max_br;
+    struct sltp_schedule_step step;
+    if (!when) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        at = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    } else if (schedule_parse_time(when, &at) < 0) {
+        snprintf(res->msg, sizeof(res->msg), "times are [YYYY-MM-DD ]HH:MM[:SS]");
+        return 1;
+    }
+    if (sltp_brightness_get(ctx, &br, &max_br) || max_br <= 0) {
+        max_br = 0;
+    }
+    if (sltp_schedule_plan(cfg, at, max_br, &step) < 0) {
+        snprintf(res->msg, sizeof(res->msg), "no schedule");
+        return 1;
+    }
+
+    char next[32];
+    struct tm tm;
+    const time_t sec = (time_t)(step.next / 1000000);
+    strftime(next, sizeof(next), "%Y-%m-%d %H:%M:%S", localtime_r(&sec, &tm));
+    res->status = 0;
+    res->value = (int)lround(step.frac * max_br);
+    if (max_br > 0) {
+        snprintf(res->msg, sizeof(res->msg), "Schedule: %.1f%% (%d of %d), next change %s.%06lld",
+            step.frac * 100, res->value, max_br, next, (long long)(step.next % 1000000));
+    } else {
+        snprintf(res->msg, sizeof(res->msg), "Schedule: %.1f%%, next change %s.%06lld",
+            step.frac * 100, next, (long long)(step.next % 1000000));
+    }
+    return 0;
+}
+
+static void print_profile(void) {
+    sltp_profile_print(stderr);
+}
+
+static void print_usage(void) {
+    fprintf(stderr, "usage: sltpwmt [--profile] <v(olume)/b(rightness)/s(peaker toggle mute)/m(ic toggle mute)/ptt/ddc/sink-next/restore/apply/schedule/get/watch/daemon/metrics> [arg]\n");
+}
+
+static void cli_applied(struct sltp_ctx *ctx, const struct sltp_saved_entry *e, void *userdata) {
+    (void)ctx;
+    sltp_saved_record(userdata, e);
+}
+
+int main(int argc, char *argv[]) {
+    // Profiles whatever this process does, so requests are not forwarded to
+    // a daemon; the table is printed at exit.
+    const bool profile = argc >= 2 && !strcmp(argv[1], "--profile");
+    if (profile) {
+        sltp_profile_enable();
+        atexit(print_profile);
+        --argc;
+        ++argv;
+    }
+    if (argc < 2) {
+        print_usage();
+        return 1;
+    }
+
+    int ret = 1;
+    const char op = !strcmp(argv[1], "sink-next") ? 'n'
+        : !strcmp(argv[1], "daemon") ? 'D'
+        : !strcmp(argv[1], "ptt") ? 'p'
+        : !strcmp(argv[1], "metrics") ? 'P'
+        : !strcmp(argv[1], "watch") ? 'W'
+        : !strcmp(argv[1], "ddc") ? 'd'
+        : !strcmp(argv[1], "restore") ? 'r'
+        : !strcmp(argv[1], "apply") ? 'a'
+        : !strcmp(argv[1], "schedule") ? 'S'
+        : argv[1][0];
+
+    int arg = -1;
+    if (op != 'D' && op != 'W' && op != 'a' && op != 'S' && argc >= 3 && sscanf(argv[2], "%d", &arg) < 1) {
+        fprintf(stderr, "invalid arg value\n");
+        return 1;
+    }
+
+    if (op == 'D') {
+        return do_daemon(argc - 1, argv + 1);
+    }
+    if (op == 'P') {
+        return do_metrics();
+    }
+    if (op == 'W') {
+        return do_watch(argc - 1, argv + 1);
+    }
+    if (op == 'g' && do_get_cached() == 0) {
+        return 0;
+    }
+    if ((op == 'b' || op == 'v' || op == 'd' || op == 'a' || op == 'p') && argc < 3) {
+        fprintf(stderr, "need arg for %s\n", op == 'b' ? "brightness" : op == 'd' ? "ddc" : op == 'a' ? "apply"
+            : op == 'p' ? "ptt" : "volume");
+        return 1;
+    }
+
+    struct sltp_result res = { .status = 1 };
+    if (!profile && (op == 'b' || op == 'v' || op == 's' || op == 'm' || op == 'p' || op == 'd' || op == 'r'
+        || op == 'a')) {
+        char req[64];
+        if (op == 'a') {
+            snprintf(req, sizeof(req), "a %s", argv[2]);
+        } else {
+            snprintf(req, sizeof(req), "%c %d", op, arg);
+        }
+        if (daemon_request(req, &res) != -1) {
+            ret = print_result(&res);
+            fflush(stdout);
+            return ret;
+        }
+    }
+
+    pa_disable_sigpipe();
+    struct sltp_ctx *ctx = sltp_new(NULL);
+    if (!ctx) {
+        return 1;
+    }
+    // Only here, so requests the daemon answers never pay for it.
+    struct sltp_config config;
+    sltp_config_load(&config);
+    sltp_config_apply(ctx, &config);
+    // Without a daemon to batch them, each invocation saves what it set
+    // itself, just without the fsync.
+    struct sltp_saved saved = {0};
+    const bool saving = op == 'b' || op == 'v' || op == 's' || op == 'r' || op == 'a';
+    if (saving && sltp_saved_load(&saved) == 0) {
+        sltp_set_applied_callback(ctx, cli_applied, &saved);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    switch (op) {
+    case 'b':
+        sltp_brightness_step(ctx, arg, &res);
+        break;
+    case 'v':
+        sltp_volume_step(ctx, arg, &res);
+        break;
+    case 'd':
+        do_ddc(arg, &res);
+        break;
+    case 's':
+        sltp_toggle_mute(ctx, SLTP_SPEAKERS, &res);
+        break;
+    case 'm':
+        sltp_toggle_mute(ctx, SLTP_MIC, &res);
+        break;
+    case 'p':
+        sltp_set_mic_mute(ctx, arg == 0, &res);
+        break;
+    case 'r':
+        sltp_restore(ctx, &saved, &res);
+        break;
+    case 'a': {
+        const struct sltp_scene *scene = sltp_config_scene(&config, argv[2]);
+        if (!scene) {
+            snprintf(res.msg, sizeof(res.msg), "no scene %.100s", argv[2]);
+            break;
+        }
+        if (sltp_scene_apply(ctx, &config.changes[scene->first], scene->count, &res)) {
+            fprintf(stderr, "scene %s not applied after %.2f ms\n", scene->name, elapsed_ms(&start));
+        } else {
+            fprintf(stderr, "applied scene %s in %.2f ms\n", scene->name, elapsed_ms(&start));
+        }
+        break;
+    }
+    case 'S':
+        do_schedule(ctx, &config, argc >= 3 ? argv[2] : NULL, &res);
+        break;
+    case 'n':
+        if (sltp_sink_next(ctx, &res) == 0) {
+            fprintf(stderr, "moved %d streams in %.2f ms\n", res.value, elapsed_ms(&start));
+        }
+        break;
+    case 'g': {
+        struct sltp_state st;
+        res.status = sltp_get_state(ctx, &st);
+        print_state(&st);
+        *res.msg = '\0';
+        break;
+    }
+    default:
+        snprintf(res.msg, sizeof(res.msg), "unknown action");
+        break;
+    }
+    ret = print_result(&res);
+    sltp_free(ctx);
+    if (saving && saved.dirty) {
+        sltp_saved_store(&saved, false);
     }
 
     fflush(stdout);
@@ -0,0 +1,74 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTP_SPSC_H
+#define SLTP_SPSC_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. head is only written by the producer and tail only by the
+// consumer; each sits on its own cache line so the two sides do not bounce
+// one line between them. Neither side ever blocks: push fails when full and
+// pop when empty.
+
+struct sltp_spsc {
+    alignas(64) _Atomic size_t head;
+    alignas(64) _Atomic size_t tail;
+    alignas(64) size_t mask;
+    size_t elem_size;
+    unsigned char *slots;
+};
+
+// capacity must be a power of two.
+static inline int sltp_spsc_init(struct sltp_spsc *q, size_t capacity, size_t elem_size) {
+    if (!capacity || capacity & (capacity - 1) || !(q->slots = calloc(capacity, elem_size))) {
+        return -1;
+    }
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    q->mask = capacity - 1;
+    q->elem_size = elem_size;
+    return 0;
+}
+
+static inline void sltp_spsc_destroy(struct sltp_spsc *q) {
+    free(q->slots);
+    q->slots = NULL;
+}
+
+// Fails unless reserve slots are still free afterwards, so a producer can
+// keep room for elements that must not be dropped.
+static inline bool sltp_spsc_push_leaving(struct sltp_spsc *q, const void *elem, size_t reserve) {
+    const size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&q->tail, memory_order_acquire) + reserve > q->mask) {
+        return false;
+    }
+    memcpy(q->slots + (head & q->mask) * q->elem_size, elem, q->elem_size);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return true;
+}
+
+static inline bool sltp_spsc_push(struct sltp_spsc *q, const void *elem) {
+    return sltp_spsc_push_leaving(q, elem, 0);
+}
+
+static inline bool sltp_spsc_pop(struct sltp_spsc *q, void *elem) {
+    const size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&q->head, memory_order_acquire)) {
+        return false;
+    }
+    memcpy(elem, q->slots + (tail & q->mask) * q->elem_size, q->elem_size);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+#endif
@@ -0,0 +1,93 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTPWMT_STATE_H
+#define SLTPWMT_STATE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+// Layout of the page `sltpwmt daemon` publishes at $XDG_RUNTIME_DIR/sltpwmt.state.
+// It is guarded by a seqlock: the daemon makes seq odd, updates the words and
+// makes seq even again. Readers copy the words and retry if seq moved, so a
+// read is a handful of loads and never enters the kernel.
+//
+// The daemon holds an exclusive flock on the file while it runs. A daemon
+// that was killed cannot clear the page, so a reader that can take
+// LOCK_SH | LOCK_NB on the file is looking at a stale page.
+
+#define SLTP_STATE_MAGIC 0x70746c73u
+#define SLTP_STATE_VERSION 1u
+#define SLTP_STATE_SIZE 4096
+#define SLTP_STATE_FILE "sltpwmt.state"
+
+enum {
+    SLTP_STATE_BRIGHTNESS = 1u << 0,
+    SLTP_STATE_SINK = 1u << 1,
+    SLTP_STATE_SOURCE = 1u << 2,
+};
+
+struct sltp_state {
+    uint32_t valid; // SLTP_STATE_* bits
+    int32_t brightness;
+    int32_t max_brightness;
+    uint32_t volume; // pa_volume_t, 0x10000 is 100%
+    int32_t muted;
+    int32_t mic_muted;
+};
+
+#define SLTP_STATE_WORDS (sizeof(struct sltp_state) / sizeof(uint32_t))
+
+struct sltp_state_page {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t seq;
+    _Atomic uint32_t words[SLTP_STATE_WORDS];
+};
+
+_Static_assert(sizeof(struct sltp_state) % sizeof(uint32_t) == 0, "sltp_state must be a whole number of words");
+_Static_assert(sizeof(struct sltp_state_page) <= SLTP_STATE_SIZE, "sltp_state_page must fit in the page");
+
+// Single writer only.
+static inline void sltp_state_write(struct sltp_state_page *p, const struct sltp_state *st) {
+    uint32_t words[SLTP_STATE_WORDS];
+    memcpy(words, st, sizeof(words));
+    const uint32_t seq = atomic_load_explicit(&p->seq, memory_order_relaxed);
+    atomic_store_explicit(&p->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (size_t n = 0; n < SLTP_STATE_WORDS; ++n) {
+        atomic_store_explicit(&p->words[n], words[n], memory_order_relaxed);
+    }
+    atomic_store_explicit(&p->seq, seq + 2, memory_order_release);
+}
+
+// Returns 0 on a consistent snapshot, -1 if the page is not a state page or
+// the writer looks stuck mid-update (e.g. it died there).
+static inline int sltp_state_read(const struct sltp_state_page *p, struct sltp_state *st) {
+    if (p->magic != SLTP_STATE_MAGIC || p->version != SLTP_STATE_VERSION) {
+        return -1;
+    }
+
+    uint32_t words[SLTP_STATE_WORDS];
+    for (unsigned tries = 0; tries < (1u << 20); ++tries) {
+        const uint32_t seq = atomic_load_explicit(&p->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+        for (size_t n = 0; n < SLTP_STATE_WORDS; ++n) {
+            words[n] = atomic_load_explicit(&p->words[n], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&p->seq, memory_order_relaxed) == seq) {
+            memcpy(st, words, sizeof(*st));
+            return 0;
+        }
+    }
+    return -1;
+}
+
+#endif
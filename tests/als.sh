@@ -0,0 +1,48 @@
+#!/bin/sh
+# Copyright (C) angelsl 2021
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+# Auto brightness against a fake IIO sensor that is polled: the reading is
+# smoothed onto the curve, small changes stay inside the hysteresis band,
+# and a manual step shifts the curve.
+
+. tests/lib.sh
+
+iio="$tmp/iio:device0"
+mkdir "$iio"
+echo 0 > "$iio/in_illuminance_raw"
+echo 2 > "$iio/in_illuminance_scale"
+backlight 1000 500
+config "als_curve = 0:0.2 2000:0.9"
+
+start_daemon -a -I "$iio" -r 10
+wait_for 2 brightness_in 200 200 || fail "dark reading not mapped to the bottom of the curve"
+
+# 500 raw is 1000 lux, 836 on the curve. The EMA climbs towards it and the
+# last write lands within the 3% band (30) below it.
+echo 500 > "$iio/in_illuminance_raw"
+wait_for 3 brightness_in 806 836 || fail "brightness did not follow 1000 lux"
+sleep 0.5
+settled=$(brightness)
+
+# 900 lux is 827 on the curve, inside the band, so nothing is written.
+echo 450 > "$iio/in_illuminance_raw"
+sleep 0.5
+[ "$(brightness)" -eq "$settled" ] || fail "change inside the hysteresis band was written"
+
+# A manual step is applied at once and shifts the curve, so the sensor does
+# not take it back.
+./sltpwmt b -300 > /dev/null || fail "b -300 failed"
+brightness_in 527 536 || fail "manual step not applied"
+echo 500 > "$iio/in_illuminance_raw"
+sleep 0.5
+brightness_in 527 536 || fail "manual step undone by the sensor"
+
+# 100 lux is 625 on the curve, 325 once shifted.
+echo 50 > "$iio/in_illuminance_raw"
+wait_for 3 brightness_in 325 355 || fail "shifted curve not followed down"
+
+echo "sensor followed, hysteresis held, manual step kept"
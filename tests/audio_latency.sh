@@ -0,0 +1,44 @@
+#!/bin/sh
+# Copyright (C) angelsl 2021
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+# With PulseAudio answering slowly, brightness requests to the daemon must
+# not wait behind an outstanding volume step: the audio work is on its own
+# thread.
+
+. tests/lib.sh
+
+LATENCY_US=300000
+LIMIT_MS=100
+
+backlight 1000 500
+start_fakepa -l $LATENCY_US
+start_daemon
+need_daemon_audio
+
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+# A volume step is at least two round trips, so it is outstanding for
+# 600 ms while the brightness requests run.
+./sltpwmt v 1 > /dev/null &
+volume_pid=$!
+sleep 0.05
+worst=0
+n=0
+while [ $n -lt 20 ]; do
+    start=$(now_ms)
+    ./sltpwmt b 0 > /dev/null || fail "b 0 failed"
+    ms=$(($(now_ms) - start))
+    [ $ms -gt $worst ] && worst=$ms
+    n=$((n + 1))
+done
+kill -0 $volume_pid 2> /dev/null || fail "volume step finished before the brightness requests; nothing was measured"
+wait $volume_pid || fail "volume step failed"
+
+[ $worst -lt $LIMIT_MS ] || fail "b 0 took $worst ms with a volume step outstanding"
+echo "20 b 0 round trips during a slow volume step: worst $worst ms"
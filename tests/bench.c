@@ -0,0 +1,320 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include <pulse/pulseaudio.h>
+
+#include "config.h"
+#include "tests/control.h"
+
+// Benchmarks a running daemon: loop wakeups while idle, then the round trip
+// of `b 0` requests (a sysfs read and write in the daemon), first alone and
+// then with another client flooding the socket. Against a socket-activated
+// daemon that has exited, the first request includes the activation.
+
+static const unsigned BENCH_IDLE_SECONDS = 10;
+
+static int bench_wakeups(unsigned long long *const out) {
+    struct sltp_result res;
+    if (test_control_request("w 0", &res) != 0 || sscanf(res.msg, "%llu", out) < 1) {
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+    const double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void bench_print(const char *const what, double *const ms, int count) {
+    qsort(ms, count, sizeof(*ms), compare_double);
+    printf("%s: min %.3f ms, median %.3f ms, p99 %.3f ms, max %.3f ms\n",
+        what, ms[0], ms[count / 2], ms[count * 99 / 100], ms[count - 1]);
+}
+
+static int bench_latency(const char *const what, double *const ms, int count) {
+    struct sltp_result res;
+    struct timespec start;
+    for (int n = 0; n < count; ++n) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (test_control_request("b 0", &res) != 0) {
+            return -1;
+        }
+        ms[n] = test_elapsed_ms(&start);
+    }
+    bench_print(what, ms, count);
+    return 0;
+}
+
+static int do_bench(int count) {
+    unsigned long long w0, before, after;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (bench_wakeups(&w0) < 0) {
+        fprintf(stderr, "bench needs a running daemon\n");
+        return 1;
+    }
+    printf("first request: %.3f ms\n", test_elapsed_ms(&start));
+    if (bench_wakeups(&before) < 0) {
+        return 1;
+    }
+    // What one of our own queries costs, so it can be taken out again.
+    const unsigned long long query = before - w0;
+    sleep(BENCH_IDLE_SECONDS);
+    if (bench_wakeups(&after) < 0) {
+        return 1;
+    }
+    printf("idle wakeups: %.1f/min\n", (double)(after - before - query) * 60 / BENCH_IDLE_SECONDS);
+
+    double *ms = calloc(count, sizeof(*ms));
+    if (!ms) {
+        return 1;
+    }
+    int ret = 1;
+    if (bench_latency("latency", ms, count) < 0) {
+        goto exit;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        struct sltp_result res;
+        for (;;) {
+            test_control_request("b 0", &res);
+        }
+    }
+    if (pid > 0) {
+        ret = bench_latency("latency under load", ms, count) < 0 ? 1 : 0;
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+
+exit:
+    free(ms);
+    return ret;
+}
+
+// Times push-to-talk from the key to the server: a uinput keyboard with the
+// push_to_talk key is made for the daemon (run with -k) to pick up, and each
+// press and release is timed until a subscription of our own sees the source
+// change. Without uinput or a key in the config, the key goes through the
+// control socket instead. Point both at tests/serve_fakepa to leave the
+// real microphone alone.
+
+static const unsigned BENCH_PTT_SETTLE_US = 500000; // for the daemon to open the new device
+static const double BENCH_PTT_TIMEOUT_MS = 1000;
+
+struct ptt_bench {
+    pa_mainloop *loop;
+    pa_context *context;
+    uint32_t index; // of the source watched
+    int muted; // -1 until known
+    bool stamped; // changed_at is the first change since the key
+    struct timespec changed_at;
+    int uinput_fd; // -1: through the control socket
+    unsigned key;
+    int reply_fd; // control request awaiting its answer
+};
+
+static void ptt_bench_source(pa_context *c, const pa_source_info *i, int eol, void *userdata) {
+    (void)c;
+    struct ptt_bench *b = userdata;
+    if (eol) {
+        return;
+    }
+    b->index = i->index;
+    b->muted = i->mute;
+}
+
+static void ptt_bench_server(pa_context *c, const pa_server_info *i, void *userdata) {
+    pa_operation_unref(pa_context_get_source_info_by_name(c, i->default_source_name, ptt_bench_source, userdata));
+}
+
+// The event is stamped as it arrives; the lookup it starts says whether it
+// was the mute, and if not the next event is stamped instead.
+static void ptt_bench_event(pa_context *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata) {
+    struct ptt_bench *b = userdata;
+    if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) != PA_SUBSCRIPTION_EVENT_CHANGE || idx != b->index) {
+        return;
+    }
+    if (!b->stamped) {
+        clock_gettime(CLOCK_MONOTONIC, &b->changed_at);
+        b->stamped = true;
+    }
+    pa_operation_unref(pa_context_get_source_info_by_index(c, idx, ptt_bench_source, b));
+}
+
+static int ptt_bench_iterate(struct ptt_bench *b) {
+    return pa_mainloop_prepare(b->loop, 100000) < 0 || pa_mainloop_poll(b->loop) < 0
+        || pa_mainloop_dispatch(b->loop) < 0 ? -1 : 0;
+}
+
+static int ptt_bench_connect(struct ptt_bench *b, const struct sltp_config *cfg) {
+    if (!(b->loop = pa_mainloop_new())
+        || !(b->context = pa_context_new(pa_mainloop_get_api(b->loop), "sltpwmt bench"))
+        || pa_context_connect(b->context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0) {
+        return -1;
+    }
+    pa_context_state_t state;
+    while ((state = pa_context_get_state(b->context)) != PA_CONTEXT_READY) {
+        if (!PA_CONTEXT_IS_GOOD(state) || ptt_bench_iterate(b) < 0) {
+            return -1;
+        }
+    }
+    pa_context_set_subscribe_callback(b->context, ptt_bench_event, b);
+    pa_operation_unref(pa_context_subscribe(b->context, PA_SUBSCRIPTION_MASK_SOURCE, NULL, NULL));
+    pa_operation_unref(cfg->ptt_nsources
+        ? pa_context_get_source_info_by_name(b->context, cfg->ptt_sources[0], ptt_bench_source, b)
+        : pa_context_get_server_info(b->context, ptt_bench_server, b));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (b->muted == -1) {
+        if (test_elapsed_ms(&start) > BENCH_PTT_TIMEOUT_MS || ptt_bench_iterate(b) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int ptt_bench_uinput(unsigned key) {
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    struct uinput_setup setup = { .id = { .bustype = BUS_VIRTUAL }, .name = "sltpwmt push-to-talk bench" };
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) == -1 || ioctl(fd, UI_SET_KEYBIT, key) == -1
+        || ioctl(fd, UI_DEV_SETUP, &setup) == -1 || ioctl(fd, UI_DEV_CREATE) == -1) {
+        perror("ptt_bench_uinput failed (ioctl)");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int ptt_bench_key(struct ptt_bench *b, bool held) {
+    b->stamped = false;
+    if (b->uinput_fd != -1) {
+        const struct input_event ev[2] = {
+            { .type = EV_KEY, .code = (uint16_t)b->key, .value = held },
+            { .type = EV_SYN, .code = SYN_REPORT },
+        };
+        return write(b->uinput_fd, ev, sizeof(ev)) == (ssize_t)sizeof(ev) ? 0 : -1;
+    }
+    // Answered once the server has acknowledged it, which is after the
+    // change event went out; read afterwards so it is not in the way.
+    if ((b->reply_fd = test_control_connect()) == -1
+        || send(b->reply_fd, held ? "p 1" : "p 0", 3, MSG_NOSIGNAL) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+static int ptt_bench_wait(struct ptt_bench *b, int muted, const struct timespec *start, double *ms) {
+    while (b->muted != muted || (ms && !b->stamped)) {
+        if (test_elapsed_ms(start) > BENCH_PTT_TIMEOUT_MS || ptt_bench_iterate(b) < 0) {
+            fprintf(stderr, "no mute change within %.0f ms%s\n", BENCH_PTT_TIMEOUT_MS,
+                b->uinput_fd != -1 ? "; is the daemon running with -k?" : "");
+            return -1;
+        }
+    }
+    if (ms) {
+        *ms = (b->changed_at.tv_sec - start->tv_sec) * 1e3 + (b->changed_at.tv_nsec - start->tv_nsec) / 1e6;
+    }
+    if (b->reply_fd != -1) {
+        char buf[sizeof(((struct sltp_result *)NULL)->msg) + 1];
+        recv(b->reply_fd, buf, sizeof(buf), 0);
+        close(b->reply_fd);
+        b->reply_fd = -1;
+    }
+    return 0;
+}
+
+static int do_bench_ptt(int count) {
+    unsigned long long w;
+    if (bench_wakeups(&w) < 0) {
+        fprintf(stderr, "bench-ptt needs a running daemon\n");
+        return 1;
+    }
+    struct sltp_config cfg;
+    sltp_config_load(&cfg);
+    struct ptt_bench b = { .index = PA_INVALID_INDEX, .muted = -1, .uinput_fd = -1, .reply_fd = -1,
+        .key = cfg.ptt_key };
+    double *down = calloc(count, sizeof(*down)), *up = calloc(count, sizeof(*up));
+    struct timespec start;
+    int ret = 1;
+    if (!down || !up) {
+        goto exit;
+    }
+    if (ptt_bench_connect(&b, &cfg) < 0) {
+        fprintf(stderr, "bench-ptt could not watch the source\n");
+        goto exit;
+    }
+    if (b.key && (b.uinput_fd = ptt_bench_uinput(b.key)) != -1) {
+        printf("key %u through uinput\n", b.key);
+        usleep(BENCH_PTT_SETTLE_US);
+    } else {
+        printf("key through the control socket\n");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ptt_bench_key(&b, false) < 0 || ptt_bench_wait(&b, 1, &start, NULL) < 0) {
+        goto exit;
+    }
+    for (int n = 0; n < count; ++n) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (ptt_bench_key(&b, true) < 0 || ptt_bench_wait(&b, 0, &start, &down[n]) < 0) {
+            goto exit;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (ptt_bench_key(&b, false) < 0 || ptt_bench_wait(&b, 1, &start, &up[n]) < 0) {
+            goto exit;
+        }
+    }
+    bench_print("key down to unmuted", down, count);
+    bench_print("key up to muted", up, count);
+    ret = 0;
+
+exit:
+    if (b.reply_fd != -1) {
+        close(b.reply_fd);
+    }
+    if (b.uinput_fd != -1) {
+        ioctl(b.uinput_fd, UI_DEV_DESTROY);
+        close(b.uinput_fd);
+    }
+    if (b.context) {
+        pa_context_disconnect(b.context);
+        pa_context_unref(b.context);
+    }
+    if (b.loop) {
+        pa_mainloop_free(b.loop);
+    }
+    free(down);
+    free(up);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    const bool ptt = argc >= 2 && !strcmp(argv[1], "ptt");
+    int count = 0;
+    if (argc > 2 + ptt || (argc == 2 + ptt && sscanf(argv[1 + ptt], "%d", &count) < 1)) {
+        fprintf(stderr, "usage: tests/bench [requests]\n"
+            "       tests/bench ptt [presses]\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    return ptt ? do_bench_ptt(count > 0 ? count : 100) : do_bench(count > 0 ? count : 1000);
+}
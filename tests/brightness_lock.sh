@@ -0,0 +1,30 @@
+#!/bin/sh
+# Copyright (C) angelsl 2021
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+# Fires overlapping `sltpwmt b` runs at a fake backlight and checks that
+# the per-device lock and queue lose none of the steps.
+
+runs=${1:-1000}
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+mkdir "$tmp/backlight" "$tmp/run" "$tmp/state" "$tmp/config"
+echo 100000 > "$tmp/backlight/max_brightness"
+echo 0 > "$tmp/backlight/brightness"
+
+export SLTPWMT_BACKLIGHT="$tmp/backlight"
+export XDG_RUNTIME_DIR="$tmp/run" XDG_STATE_HOME="$tmp/state" XDG_CONFIG_HOME="$tmp/config"
+
+n=0
+while [ $n -lt "$runs" ]; do
+    ./sltpwmt b 1 > /dev/null &
+    n=$((n + 1))
+done
+wait
+
+got=$(cat "$tmp/backlight/brightness")
+echo "$runs concurrent steps of +1 from 0: brightness $got"
+[ "$got" -eq "$runs" ]
@@ -0,0 +1,68 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTPWMT_TESTS_CONTROL_H
+#define SLTPWMT_TESTS_CONTROL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "libsltpwmt.h"
+
+// The daemon's control socket, spoken the way the sltpwmt client does:
+// one request and one reply per connection.
+
+static inline int test_control_connect(void) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (sltp_runtime_path(addr.sun_path, sizeof(addr.sun_path), "sltpwmt.sock") < 0) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Returns -1 without a daemon, otherwise its status with its output in res.
+static inline int test_control_request(const char *const req, struct sltp_result *const res) {
+    int fd = test_control_connect();
+    if (fd == -1) {
+        return -1;
+    }
+    char buf[sizeof(res->msg) + 1];
+    ssize_t len = -1;
+    if (send(fd, req, strlen(req), MSG_NOSIGNAL) == -1
+        || (len = recv(fd, buf, sizeof(buf) - 1, 0)) < 1) {
+        close(fd);
+        *res = (struct sltp_result){ .status = 1 };
+        return 1;
+    }
+    close(fd);
+    while (len > 1 && (buf[len - 1] == '\n' || buf[len - 1] == ' ')) {
+        --len;
+    }
+    buf[len] = '\0';
+    res->status = buf[0] == '0' ? 0 : 1;
+    snprintf(res->msg, sizeof(res->msg), "%s", buf + 1);
+    return res->status;
+}
+
+static inline double test_elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+#endif
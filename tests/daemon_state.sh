@@ -0,0 +1,31 @@
+#!/bin/sh
+# Copyright (C) angelsl 2021
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+# The state page has one writer: a second daemon must leave the running
+# one's page untouched on its way out. A page left by a killed daemon is
+# not served.
+
+. tests/lib.sh
+
+backlight 1000 500
+start_daemon
+[ "$(./sltpwmt g)" = "brightness 500/1000" ] || fail "page not published"
+
+cp "$tmp/run/sltpwmt.state" "$tmp/page"
+./sltpwmt daemon 2> "$tmp/second.log" && fail "second daemon started"
+grep -q "already running" "$tmp/second.log" || fail "second daemon: $(cat "$tmp/second.log")"
+cmp -s "$tmp/page" "$tmp/run/sltpwmt.state" || fail "second daemon wrote the page"
+[ "$(./sltpwmt g)" = "brightness 500/1000" ] || fail "page lost after second daemon"
+
+# Killed, the daemon leaves its page marked valid; get must not trust it.
+kill -9 "$daemon_pid"
+wait "$daemon_pid" 2> /dev/null
+daemon_pid=
+echo 600 > "$tmp/backlight/brightness"
+[ "$(./sltpwmt g)" = "brightness 600/1000" ] || fail "stale page served: $(./sltpwmt g)"
+
+echo "second daemon refused, page untouched, stale page ignored"
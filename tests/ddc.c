@@ -0,0 +1,256 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ddc.h"
+#include "eloop.h"
+
+// DDC/CI brightness against fake monitors behind the transport hook. The
+// fake checks every frame's header and checksum and the quiet time the bus
+// needs around it, answers VCP 0x10 gets and applies sets. Monitors come
+// from the runtime cache file, so nothing is probed.
+
+static const double REPLY_DELAY_MS = 40;
+static const double COMMAND_DELAY_MS = 50;
+
+struct monitor {
+    int bus;
+    int max;
+    int value;
+    int nak_writes; // this many writes fail as if NAKed
+    int corrupt_replies; // this many get replies carry a bad checksum
+    int gets;
+    int sets;
+    int bad_frames;
+    int rushed; // messages sent before the bus was quiet long enough
+    bool open;
+    uint8_t reply[11];
+    bool replying;
+    double last_ms;
+    double get_ms;
+};
+
+struct fake {
+    struct monitor monitors[2];
+    size_t nmonitors;
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int fake_open(void *userdata, int bus) {
+    struct fake *f = userdata;
+    for (size_t n = 0; n < f->nmonitors; ++n) {
+        if (f->monitors[n].bus == bus) {
+            f->monitors[n].open = true;
+            return (int)n;
+        }
+    }
+    return -1;
+}
+
+// The host writes to 0x6e from 0x51: the checksum covers the destination
+// too, and the reply's is seeded with 0x50.
+static ssize_t fake_write(void *userdata, int handle, const uint8_t *buf, size_t len) {
+    struct fake *f = userdata;
+    struct monitor *m = &f->monitors[handle];
+    const double now = now_ms();
+    if (m->last_ms && now - m->last_ms < COMMAND_DELAY_MS - 1) {
+        ++m->rushed;
+    }
+    m->last_ms = now;
+    if (m->nak_writes > 0) {
+        --m->nak_writes;
+        errno = EREMOTEIO;
+        return -1;
+    }
+    uint8_t chk = 0x6e;
+    for (size_t n = 0; n < len - 1; ++n) {
+        chk ^= buf[n];
+    }
+    if (len < 4 || buf[0] != 0x51 || buf[1] != (0x80 | (len - 3)) || buf[len - 1] != chk) {
+        ++m->bad_frames;
+        return (ssize_t)len;
+    }
+    if (len == 5 && buf[2] == 0x01 && buf[3] == 0x10) {
+        ++m->gets;
+        m->get_ms = now;
+        const uint8_t r[] = { 0x6e, 0x88, 0x02, 0x00, 0x10, 0x00, (uint8_t)(m->max >> 8), (uint8_t)m->max,
+            (uint8_t)(m->value >> 8), (uint8_t)m->value };
+        memcpy(m->reply, r, sizeof(r));
+        m->reply[10] = 0x50;
+        for (size_t n = 0; n < sizeof(r); ++n) {
+            m->reply[10] ^= r[n];
+        }
+        if (m->corrupt_replies > 0) {
+            --m->corrupt_replies;
+            m->reply[10] ^= 0xff;
+        }
+        m->replying = true;
+    } else if (len == 7 && buf[2] == 0x03 && buf[3] == 0x10) {
+        ++m->sets;
+        m->value = buf[4] << 8 | buf[5];
+    } else {
+        ++m->bad_frames;
+    }
+    return (ssize_t)len;
+}
+
+static ssize_t fake_read(void *userdata, int handle, uint8_t *buf, size_t len) {
+    struct fake *f = userdata;
+    struct monitor *m = &f->monitors[handle];
+    const double now = now_ms();
+    if (!m->replying || len != sizeof(m->reply)) {
+        errno = EIO;
+        return -1;
+    }
+    if (now - m->get_ms < REPLY_DELAY_MS - 1) {
+        ++m->rushed;
+    }
+    m->last_ms = now;
+    m->replying = false;
+    memcpy(buf, m->reply, len);
+    return (ssize_t)len;
+}
+
+static void fake_close(void *userdata, int handle) {
+    struct fake *f = userdata;
+    f->monitors[handle].open = false;
+}
+
+struct step {
+    pa_mainloop_api *api;
+    bool done;
+    struct sltp_result res;
+};
+
+static void step_done(struct sltp_ddc *ddc, const struct sltp_result *res, void *userdata) {
+    (void)ddc;
+    struct step *s = userdata;
+    s->res = *res;
+    s->done = true;
+    s->api->quit(s->api, 0);
+}
+
+static void step_timeout(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)e; (void)tv; (void)userdata;
+    a->quit(a, 1);
+}
+
+static char cache[512];
+
+static void write_cache(const struct fake *f) {
+    FILE *c = fopen(cache, "w");
+    if (!c) {
+        perror("write_cache failed (fopen)");
+        exit(1);
+    }
+    for (size_t n = 0; n < f->nmonitors; ++n) {
+        fprintf(c, "%d %d\n", f->monitors[n].bus, f->monitors[n].max);
+    }
+    fclose(c);
+}
+
+// One step by delta on a fresh sltp_ddc, as a new process would make it.
+static struct sltp_result step(struct fake *f, int delta) {
+    struct sltp_eloop *loop = sltp_eloop_new();
+    if (!loop) {
+        exit(1);
+    }
+    pa_mainloop_api *api = sltp_eloop_get_api(loop);
+    const struct sltp_ddc_transport transport = { fake_open, fake_write, fake_read, fake_close, f };
+    struct sltp_ddc *ddc = sltp_ddc_new(api, &transport);
+    struct step s = { .api = api };
+    struct timeval tv;
+    api->time_new(api, pa_timeval_add(pa_gettimeofday(&tv), 5 * PA_USEC_PER_SEC), step_timeout, NULL);
+    int ret = 0;
+    if (!ddc || sltp_ddc_step(ddc, delta, step_done, &s) < 0 || sltp_eloop_run(loop, &ret) < 0 || !s.done) {
+        check(false, "step finished");
+    }
+    sltp_ddc_free(ddc);
+    sltp_eloop_free(loop);
+    for (size_t n = 0; n < f->nmonitors; ++n) {
+        check(!f->monitors[n].open, "bus closed when done");
+    }
+    return s.res;
+}
+
+int main(void) {
+    char dir[] = "/tmp/sltpwmt-ddc.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp failed");
+        return 1;
+    }
+    setenv("XDG_RUNTIME_DIR", dir, 1);
+    snprintf(cache, sizeof(cache), "%s/sltpwmt-ddc.cache", dir);
+
+    // A get, then a set of 60% of 200, framed and checksummed.
+    struct fake f = { .monitors = { { .bus = 3, .max = 200, .value = 100 } }, .nmonitors = 1 };
+    write_cache(&f);
+    struct sltp_result res = step(&f, 10);
+    struct monitor *m = &f.monitors[0];
+    check(res.status == 0 && res.value == 60, "step answered with the new percentage");
+    check(m->gets == 1 && m->sets == 1 && m->value == 120, "one get and one set of 120");
+    check(m->bad_frames == 0, "every frame well formed");
+    check(m->rushed == 0, "bus left quiet 40 ms before the reply and 50 ms between commands");
+
+    // A NAKed get is retried after the command delay.
+    f.monitors[0] = (struct monitor){ .bus = 3, .max = 100, .value = 50, .nak_writes = 1 };
+    res = step(&f, -10);
+    check(res.status == 0 && m->value == 40, "set after a NAKed get");
+    check(m->gets == 1 && m->rushed == 0, "NAKed get retried once, after the delay");
+
+    // So is a reply whose checksum does not add up, which is not believed.
+    f.monitors[0] = (struct monitor){ .bus = 3, .max = 100, .value = 50, .corrupt_replies = 1 };
+    res = step(&f, 5);
+    check(res.status == 0 && m->value == 55, "set after a corrupt reply");
+    check(m->gets == 2 && m->bad_frames == 0 && m->rushed == 0, "corrupt reply fetched again");
+
+    // A monitor that never answers is given up on after three tries, and
+    // dropped from the cache.
+    f.monitors[0] = (struct monitor){ .bus = 3, .max = 100, .value = 50, .nak_writes = 100 };
+    res = step(&f, 5);
+    check(res.status != 0, "no monitor answered");
+    check(f.monitors[0].nak_writes == 97, "three tries");
+    check(access(cache, F_OK) == -1, "silent monitor dropped from the cache");
+
+    // Two monitors are stepped side by side: each keeps to its own bus's
+    // delays, and together they take about as long as one.
+    f = (struct fake){ .monitors = { { .bus = 3, .max = 100, .value = 50 }, { .bus = 7, .max = 400, .value = 100 } },
+        .nmonitors = 2 };
+    write_cache(&f);
+    const double start = now_ms();
+    res = step(&f, 20);
+    const double ms = now_ms() - start;
+    check(res.status == 0 && res.value == 70, "first monitor's percentage reported");
+    check(f.monitors[0].value == 70 && f.monitors[1].value == 180, "both monitors set");
+    check(f.monitors[0].rushed == 0 && f.monitors[1].rushed == 0, "both buses left quiet long enough");
+    check(ms < 2 * REPLY_DELAY_MS + COMMAND_DELAY_MS, "monitors driven side by side");
+
+    unlink(cache);
+    rmdir(dir);
+    printf("%s\n", failures ? "DDC checks failed" : "DDC/CI framing, checksums and retries as expected");
+    return failures != 0;
+}
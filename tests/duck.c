@@ -0,0 +1,75 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "tests/pa.h"
+
+// Ducking against streams fakepa makes come and go: a matching stream
+// turns every other stream down by the configured dB, and they come back
+// when it stops, is corked or ducking is turned off.
+
+static const double DB = 12;
+static const unsigned SETTLE_MS = 400; // the 250 ms duck ramp, and some
+
+static pa_volume_t input_volume(struct test_pa *t, uint32_t index) {
+    const pa_cvolume *v = sltp_fakepa_volume(t->server, PA_SUBSCRIPTION_EVENT_SINK_INPUT, index, NULL);
+    return v ? pa_cvolume_max(v) : PA_VOLUME_INVALID;
+}
+
+static bool near(pa_volume_t got, pa_volume_t want) {
+    return got != PA_VOLUME_INVALID && (got > want ? got - want : want - got) <= 1;
+}
+
+int main(void) {
+    struct test_pa t;
+    const struct sltp_fakepa_opts opts = { .inputs = 2 };
+    int ret;
+    if ((ret = test_pa_start(&t, &opts))) {
+        test_pa_stop(&t);
+        return ret;
+    }
+    const pa_volume_t full = input_volume(&t, 0);
+    const pa_volume_t ducked = pa_sw_volume_multiply(full, pa_sw_volume_from_dB(-DB));
+    test_check(&t, full != PA_VOLUME_INVALID && input_volume(&t, 1) == full, "streams start at the same volume");
+    test_check(&t, sltp_set_ducking(t.ctx, "voip*", DB) == 0, "ducking set");
+    test_pa_run(&t, 50);
+    test_check(&t, input_volume(&t, 0) == full, "nothing ducked without a match");
+
+    uint32_t call = sltp_fakepa_add_input(t.server, "voip-call", false);
+    test_pa_run(&t, SETTLE_MS);
+    test_check(&t, near(input_volume(&t, 0), ducked) && near(input_volume(&t, 1), ducked),
+        "other streams ducked by 12 dB");
+    test_check(&t, input_volume(&t, call) == full, "matching stream left alone");
+
+    const uint32_t late = sltp_fakepa_add_input(t.server, "music", false);
+    test_pa_run(&t, 100);
+    test_check(&t, near(input_volume(&t, late), ducked), "stream started while ducked joins in");
+
+    sltp_fakepa_remove_input(t.server, call);
+    test_pa_run(&t, SETTLE_MS);
+    test_check(&t, input_volume(&t, 0) == full && input_volume(&t, 1) == full && input_volume(&t, late) == full,
+        "streams restored once the match goes away");
+
+    call = sltp_fakepa_add_input(t.server, "voip-call", false);
+    test_pa_run(&t, SETTLE_MS);
+    test_check(&t, near(input_volume(&t, 0), ducked), "ducked again");
+    sltp_fakepa_cork_input(t.server, call, true);
+    test_pa_run(&t, SETTLE_MS);
+    test_check(&t, input_volume(&t, 0) == full, "restored while the match is corked");
+
+    // Turning ducking off gives the volume back at once, not over a ramp.
+    sltp_fakepa_cork_input(t.server, call, false);
+    test_pa_run(&t, SETTLE_MS);
+    test_check(&t, near(input_volume(&t, 0), ducked), "ducked once uncorked");
+    sltp_set_ducking(t.ctx, NULL, 0);
+    test_pa_run(&t, 10);
+    test_check(&t, input_volume(&t, 0) == full && input_volume(&t, 1) == full,
+        "ducking off restores streams immediately");
+
+    printf("%s\n", t.failures ? "ducking checks failed" : "streams ducked and restored");
+    const int failures = t.failures;
+    test_pa_stop(&t);
+    return failures != 0;
+}
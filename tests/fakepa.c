@@ -0,0 +1,72 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "tests/pa.h"
+
+// Volume step, mute and sink-next through libsltpwmt, checked against what
+// fakepa holds afterwards and against what libsltpwmt then caches from the
+// subscription events.
+
+int main(void) {
+    struct test_pa t;
+    const struct sltp_fakepa_opts opts = { .inputs = 3 };
+    int ret;
+    if ((ret = test_pa_start(&t, &opts))) {
+        test_pa_stop(&t);
+        return ret;
+    }
+    sltp_set_volume_snap(t.ctx, 0);
+    bool mute;
+
+    struct test_result r = {0};
+    sltp_volume_step_async(t.ctx, (int)PA_VOLUME_NORM / 20, test_pa_result, &r);
+    test_check(&t, test_pa_done(&t, &r), "volume step");
+    const pa_volume_t want = PA_VOLUME_NORM / 2 + PA_VOLUME_NORM / 20;
+    test_check(&t, pa_cvolume_max(sltp_fakepa_volume(t.server, PA_SUBSCRIPTION_EVENT_SINK, 0, NULL)) == want,
+        "sink volume up 5%");
+    test_pa_run(&t, 50);
+    test_check(&t, sltp_cached_state(t.ctx)->volume == want, "cached volume follows");
+
+    r = (struct test_result){0};
+    sltp_toggle_mute_async(t.ctx, SLTP_SPEAKERS, test_pa_result, &r);
+    test_check(&t, test_pa_done(&t, &r), "speaker mute");
+    sltp_fakepa_volume(t.server, PA_SUBSCRIPTION_EVENT_SINK, 0, &mute);
+    test_check(&t, mute, "sink muted");
+    test_pa_run(&t, 50);
+    test_check(&t, sltp_cached_state(t.ctx)->muted, "cached mute follows");
+
+    r = (struct test_result){0};
+    sltp_toggle_mute_async(t.ctx, SLTP_MIC, test_pa_result, &r);
+    test_check(&t, test_pa_done(&t, &r), "mic mute");
+    sltp_fakepa_volume(t.server, PA_SUBSCRIPTION_EVENT_SOURCE, 0, &mute);
+    test_check(&t, mute, "source muted");
+
+    r = (struct test_result){0};
+    sltp_sink_next_async(t.ctx, test_pa_result, &r);
+    test_check(&t, test_pa_done(&t, &r), "sink-next");
+    test_check(&t, r.res.value == 3, "sink-next moved three streams");
+    test_check(&t, sltp_fakepa_default_sink(t.server) == 1, "default sink is the next one");
+    for (uint32_t n = 0; n < 3; ++n) {
+        test_check(&t, sltp_fakepa_input_sink(t.server, n) == 1, "stream moved to the next sink");
+    }
+
+    // With every sink gone and back there is no default sink, and sink-next
+    // starts from the first one.
+    sltp_fakepa_plug_sink(t.server, "fakepa.headphones", false);
+    sltp_fakepa_plug_sink(t.server, "fakepa.speakers", false);
+    const uint32_t speakers = sltp_fakepa_plug_sink(t.server, "fakepa.speakers", true);
+    sltp_fakepa_plug_sink(t.server, "fakepa.headphones", true);
+    test_pa_run(&t, 50);
+    r = (struct test_result){0};
+    sltp_sink_next_async(t.ctx, test_pa_result, &r);
+    test_check(&t, test_pa_done(&t, &r), "sink-next without a default sink");
+    test_check(&t, sltp_fakepa_default_sink(t.server) == speakers, "sink-next without a default picks the first sink");
+
+    printf("%s\n", t.failures ? "fakepa checks failed" : "volume step, mute and sink-next match the server");
+    const int failures = t.failures;
+    test_pa_stop(&t);
+    return failures != 0;
+}
@@ -0,0 +1,1059 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include <pulse/pulseaudio.h>
+
+#include "fakepa_server.h"
+
+// The native protocol (pulsecore/pstream.c, tagstruct.c, protocol-native.c):
+// every frame is a 20-byte descriptor of big-endian u32s (length, channel,
+// offset hi/lo, flags) followed by the payload. Control packets use channel
+// -1 and carry a tagstruct that starts with the command and a sequence tag.
+// We announce protocol version 20, the first with a stream's corked state and
+// whether its volume can be set, which ducking goes by; clients format for
+// the server's version, and the info replies stay short of ports and formats.
+
+#define FAKEPA_VERSION 20
+#define FAKEPA_DESCRIPTOR 20
+#define FAKEPA_FRAME_MAX (64 * 1024)
+#define FAKEPA_PACKET_MIN 2048
+
+static const uint32_t FAKEPA_CONTROL = UINT32_MAX;
+
+enum fakepa_command {
+    FAKEPA_ERROR = 0,
+    FAKEPA_REPLY = 2,
+    FAKEPA_AUTH = 8,
+    FAKEPA_SET_CLIENT_NAME = 9,
+    FAKEPA_GET_SERVER_INFO = 20,
+    FAKEPA_GET_SINK_INFO = 21,
+    FAKEPA_GET_SINK_INFO_LIST = 22,
+    FAKEPA_GET_SOURCE_INFO = 23,
+    FAKEPA_GET_SOURCE_INFO_LIST = 24,
+    FAKEPA_GET_SINK_INPUT_INFO = 29,
+    FAKEPA_GET_SINK_INPUT_INFO_LIST = 30,
+    FAKEPA_GET_SOURCE_OUTPUT_INFO = 31,
+    FAKEPA_GET_SOURCE_OUTPUT_INFO_LIST = 32,
+    FAKEPA_SUBSCRIBE = 35,
+    FAKEPA_SET_SINK_VOLUME = 36,
+    FAKEPA_SET_SINK_INPUT_VOLUME = 37,
+    FAKEPA_SET_SOURCE_VOLUME = 38,
+    FAKEPA_SET_SINK_MUTE = 39,
+    FAKEPA_SET_SOURCE_MUTE = 40,
+    FAKEPA_SET_DEFAULT_SINK = 44,
+    FAKEPA_SET_DEFAULT_SOURCE = 45,
+    FAKEPA_SUBSCRIBE_EVENT = 66,
+    FAKEPA_MOVE_SINK_INPUT = 67,
+};
+
+enum fakepa_tag {
+    FAKEPA_TAG_STRING = 't',
+    FAKEPA_TAG_STRING_NULL = 'N',
+    FAKEPA_TAG_U32 = 'L',
+    FAKEPA_TAG_USEC = 'U',
+    FAKEPA_TAG_ARBITRARY = 'x',
+    FAKEPA_TAG_SAMPLE_SPEC = 'a',
+    FAKEPA_TAG_BOOLEAN_TRUE = '1',
+    FAKEPA_TAG_BOOLEAN_FALSE = '0',
+    FAKEPA_TAG_CHANNEL_MAP = 'm',
+    FAKEPA_TAG_CVOLUME = 'v',
+    FAKEPA_TAG_VOLUME = 'V',
+    FAKEPA_TAG_PROPLIST = 'P',
+};
+
+struct fakepa_device {
+    uint32_t index; // a new one each time it is plugged back in
+    const char *name;
+    const char *description;
+    pa_cvolume volume;
+    bool mute;
+    bool present;
+};
+
+// A sink input or source output. Of its properties only application.name
+// is kept, which is what ducking rules and tests go by.
+struct fakepa_stream {
+    uint32_t index;
+    uint32_t device; // the sink it plays to or the source it records from
+    char app[64];
+    pa_cvolume volume;
+    bool corked;
+};
+
+struct fakepa_packet {
+    struct fakepa_packet *next;
+    pa_usec_t due;
+    size_t len;
+    size_t sent;
+    size_t cap;
+    bool overflow;
+    unsigned char *buf;
+};
+
+struct fakepa_client {
+    struct sltp_fakepa *server;
+    int fd;
+    uint32_t index;
+    pa_io_event *io;
+    pa_time_event *timer;
+    bool authed;
+    bool named;
+    bool hangup; // close once the queued replies are out
+    uint32_t subscribed;
+    unsigned requests;
+    struct fakepa_packet *out;
+    struct fakepa_packet **out_tail;
+    size_t in_len;
+    unsigned char in[FAKEPA_DESCRIPTOR + FAKEPA_FRAME_MAX];
+    struct fakepa_client *next;
+};
+
+struct sltp_fakepa {
+    pa_mainloop_api *api;
+    struct sltp_fakepa_opts opts;
+    struct sockaddr_un addr;
+    int fd;
+    pa_io_event *io;
+    struct fakepa_client *clients;
+    uint32_t next_client;
+    struct fakepa_device sinks[2];
+    struct fakepa_device sources[1];
+    uint32_t next_sink;
+    uint32_t default_sink;
+    uint32_t default_source;
+    struct fakepa_stream *inputs;
+    size_t ninputs;
+    uint32_t next_input;
+    struct fakepa_stream *outputs;
+    size_t noutputs;
+    uint32_t next_output;
+    sltp_fakepa_cb changed;
+    void *userdata;
+};
+
+static pa_usec_t fakepa_now(void) {
+    struct timeval tv;
+    return pa_timeval_load(pa_gettimeofday(&tv));
+}
+
+static void put_raw(struct fakepa_packet *p, const void *data, size_t len) {
+    // A list of many streams outgrows the usual packet.
+    if (p->len + len > p->cap) {
+        size_t cap = p->cap * 2;
+        while (cap < p->len + len) {
+            cap *= 2;
+        }
+        unsigned char *buf = cap > FAKEPA_FRAME_MAX + FAKEPA_DESCRIPTOR ? NULL : realloc(p->buf, cap);
+        if (!buf) {
+            p->overflow = true;
+            return;
+        }
+        p->buf = buf;
+        p->cap = cap;
+    }
+    memcpy(p->buf + p->len, data, len);
+    p->len += len;
+}
+
+static void put_u8(struct fakepa_packet *p, uint8_t v) {
+    put_raw(p, &v, 1);
+}
+
+static void put_be32(struct fakepa_packet *p, uint32_t v) {
+    v = htonl(v);
+    put_raw(p, &v, 4);
+}
+
+static void put_u32(struct fakepa_packet *p, uint32_t v) {
+    put_u8(p, FAKEPA_TAG_U32);
+    put_be32(p, v);
+}
+
+static void put_usec(struct fakepa_packet *p, pa_usec_t v) {
+    put_u8(p, FAKEPA_TAG_USEC);
+    put_be32(p, (uint32_t)(v >> 32));
+    put_be32(p, (uint32_t)v);
+}
+
+static void put_string(struct fakepa_packet *p, const char *s) {
+    if (!s) {
+        put_u8(p, FAKEPA_TAG_STRING_NULL);
+        return;
+    }
+    put_u8(p, FAKEPA_TAG_STRING);
+    put_raw(p, s, strlen(s) + 1);
+}
+
+static void put_bool(struct fakepa_packet *p, bool v) {
+    put_u8(p, v ? FAKEPA_TAG_BOOLEAN_TRUE : FAKEPA_TAG_BOOLEAN_FALSE);
+}
+
+static void put_sample_spec(struct fakepa_packet *p) {
+    put_u8(p, FAKEPA_TAG_SAMPLE_SPEC);
+    put_u8(p, PA_SAMPLE_S16LE);
+    put_u8(p, 2);
+    put_be32(p, 44100);
+}
+
+static void put_channel_map(struct fakepa_packet *p) {
+    put_u8(p, FAKEPA_TAG_CHANNEL_MAP);
+    put_u8(p, 2);
+    put_u8(p, PA_CHANNEL_POSITION_FRONT_LEFT);
+    put_u8(p, PA_CHANNEL_POSITION_FRONT_RIGHT);
+}
+
+static void put_cvolume(struct fakepa_packet *p, const pa_cvolume *v) {
+    put_u8(p, FAKEPA_TAG_CVOLUME);
+    put_u8(p, v->channels);
+    for (unsigned n = 0; n < v->channels; ++n) {
+        put_be32(p, v->values[n]);
+    }
+}
+
+static void put_volume(struct fakepa_packet *p, pa_volume_t v) {
+    put_u8(p, FAKEPA_TAG_VOLUME);
+    put_be32(p, v);
+}
+
+// Each property is its key, then its value as a length and an arbitrary
+// blob that, for a string, includes the terminator; a NULL key ends the list.
+static void put_proplist(struct fakepa_packet *p, const char *app) {
+    put_u8(p, FAKEPA_TAG_PROPLIST);
+    if (app && *app) {
+        const uint32_t len = (uint32_t)strlen(app) + 1;
+        put_string(p, PA_PROP_APPLICATION_NAME);
+        put_u32(p, len);
+        put_u8(p, FAKEPA_TAG_ARBITRARY);
+        put_be32(p, len);
+        put_raw(p, app, len);
+    }
+    put_u8(p, FAKEPA_TAG_STRING_NULL);
+}
+
+// Sinks and sources share a layout up to version 20.
+static void put_device(struct fakepa_packet *p, const struct fakepa_device *d) {
+    put_u32(p, d->index);
+    put_string(p, d->name);
+    put_string(p, d->description);
+    put_sample_spec(p);
+    put_channel_map(p);
+    put_u32(p, PA_INVALID_INDEX); // owner module
+    put_cvolume(p, &d->volume);
+    put_bool(p, d->mute);
+    put_u32(p, PA_INVALID_INDEX); // monitor source, or monitored sink
+    put_string(p, NULL);
+    put_usec(p, 0); // latency
+    put_string(p, "fakepa"); // driver
+    put_u32(p, 0); // flags
+    put_proplist(p, NULL);
+    put_usec(p, 0); // configured latency
+    put_volume(p, PA_VOLUME_NORM); // base volume
+    put_u32(p, 0); // state: running
+    put_u32(p, PA_VOLUME_NORM + 1); // volume steps
+    put_u32(p, PA_INVALID_INDEX); // card
+    put_u32(p, 0); // ports
+    put_string(p, NULL); // active port
+}
+
+static void put_input(struct fakepa_packet *p, const struct fakepa_stream *i) {
+    put_u32(p, i->index);
+    put_string(p, "fakepa playback");
+    put_u32(p, PA_INVALID_INDEX); // owner module
+    put_u32(p, PA_INVALID_INDEX); // client
+    put_u32(p, i->device);
+    put_sample_spec(p);
+    put_channel_map(p);
+    put_cvolume(p, &i->volume);
+    put_usec(p, 0); // buffer latency
+    put_usec(p, 0); // sink latency
+    put_string(p, "trivial");
+    put_string(p, "fakepa");
+    put_bool(p, false); // mute
+    put_proplist(p, i->app);
+    put_bool(p, i->corked);
+    put_bool(p, true); // has volume
+    put_bool(p, true); // volume writable
+}
+
+static void put_output(struct fakepa_packet *p, const struct fakepa_stream *o) {
+    put_u32(p, o->index);
+    put_string(p, "fakepa record");
+    put_u32(p, PA_INVALID_INDEX); // owner module
+    put_u32(p, PA_INVALID_INDEX); // client
+    put_u32(p, o->device);
+    put_sample_spec(p);
+    put_channel_map(p);
+    put_usec(p, 0); // buffer latency
+    put_usec(p, 0); // source latency
+    put_string(p, "trivial");
+    put_string(p, "fakepa");
+    put_proplist(p, o->app);
+    put_bool(p, o->corked);
+}
+
+struct fakepa_reader {
+    const unsigned char *p;
+    size_t len;
+};
+
+static int get_raw(struct fakepa_reader *r, void *out, size_t len) {
+    if (r->len < len) {
+        return -1;
+    }
+    memcpy(out, r->p, len);
+    r->p += len;
+    r->len -= len;
+    return 0;
+}
+
+static int get_tag(struct fakepa_reader *r, uint8_t tag) {
+    uint8_t t;
+    return get_raw(r, &t, 1) < 0 || t != tag ? -1 : 0;
+}
+
+static int get_u32(struct fakepa_reader *r, uint32_t *v) {
+    if (get_tag(r, FAKEPA_TAG_U32) < 0 || get_raw(r, v, 4) < 0) {
+        return -1;
+    }
+    *v = ntohl(*v);
+    return 0;
+}
+
+static int get_string(struct fakepa_reader *r, const char **s) {
+    uint8_t t;
+    if (get_raw(r, &t, 1) < 0) {
+        return -1;
+    }
+    if (t == FAKEPA_TAG_STRING_NULL) {
+        *s = NULL;
+        return 0;
+    }
+    const unsigned char *end;
+    if (t != FAKEPA_TAG_STRING || !(end = memchr(r->p, '\0', r->len))) {
+        return -1;
+    }
+    *s = (const char *)r->p;
+    r->len -= (size_t)(end - r->p) + 1;
+    r->p = end + 1;
+    return 0;
+}
+
+static int get_bool(struct fakepa_reader *r, bool *v) {
+    uint8_t t;
+    if (get_raw(r, &t, 1) < 0 || (t != FAKEPA_TAG_BOOLEAN_TRUE && t != FAKEPA_TAG_BOOLEAN_FALSE)) {
+        return -1;
+    }
+    *v = t == FAKEPA_TAG_BOOLEAN_TRUE;
+    return 0;
+}
+
+static int get_cvolume(struct fakepa_reader *r, pa_cvolume *v) {
+    uint8_t channels;
+    if (get_tag(r, FAKEPA_TAG_CVOLUME) < 0 || get_raw(r, &channels, 1) < 0
+        || channels < 1 || channels > PA_CHANNELS_MAX) {
+        return -1;
+    }
+    v->channels = channels;
+    for (unsigned n = 0; n < channels; ++n) {
+        uint32_t be;
+        if (get_raw(r, &be, 4) < 0) {
+            return -1;
+        }
+        v->values[n] = ntohl(be);
+    }
+    return 0;
+}
+
+static void packet_free(struct fakepa_packet *p) {
+    free(p->buf);
+    free(p);
+}
+
+static struct fakepa_packet *packet_new(uint32_t command, uint32_t tag) {
+    struct fakepa_packet *p = malloc(sizeof(*p));
+    if (!p || !(p->buf = malloc(FAKEPA_PACKET_MIN))) {
+        free(p);
+        return NULL;
+    }
+    p->next = NULL;
+    p->len = FAKEPA_DESCRIPTOR;
+    p->cap = FAKEPA_PACKET_MIN;
+    p->sent = 0;
+    p->overflow = false;
+    put_u32(p, command);
+    put_u32(p, tag);
+    return p;
+}
+
+static void client_free(struct fakepa_client *c) {
+    struct sltp_fakepa *s = c->server;
+    for (struct fakepa_client **p = &s->clients; *p; p = &(*p)->next) {
+        if (*p == c) {
+            *p = c->next;
+            break;
+        }
+    }
+    while (c->out) {
+        struct fakepa_packet *p = c->out;
+        c->out = p->next;
+        packet_free(p);
+    }
+    if (c->timer) {
+        s->api->time_free(c->timer);
+    }
+    s->api->io_free(c->io);
+    close(c->fd);
+    free(c);
+}
+
+static void client_timer(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata);
+
+// Writes whatever is due and arranges to be called again for the rest.
+// Returns -1 if the client is gone.
+static int client_flush(struct fakepa_client *c) {
+    pa_mainloop_api *a = c->server->api;
+    const pa_usec_t now = fakepa_now();
+    while (c->out && c->out->due <= now) {
+        struct fakepa_packet *p = c->out;
+        ssize_t n = send(c->fd, p->buf + p->sent, p->len - p->sent, MSG_NOSIGNAL);
+        if (n == -1 && errno == EAGAIN) {
+            break;
+        }
+        if (n == -1) {
+            client_free(c);
+            return -1;
+        }
+        if ((p->sent += (size_t)n) < p->len) {
+            break;
+        }
+        if (!(c->out = p->next)) {
+            c->out_tail = &c->out;
+        }
+        packet_free(p);
+    }
+    if (!c->out && c->hangup) {
+        client_free(c);
+        return -1;
+    }
+
+    const bool writable = c->out && c->out->due <= now;
+    a->io_enable(c->io, (c->hangup ? 0 : PA_IO_EVENT_INPUT) | (writable ? PA_IO_EVENT_OUTPUT : 0));
+    if (c->out && !writable) {
+        struct timeval tv;
+        pa_timeval_store(&tv, c->out->due);
+        if (c->timer) {
+            a->time_restart(c->timer, &tv);
+        } else {
+            c->timer = a->time_new(a, &tv, client_timer, c);
+        }
+    }
+    return 0;
+}
+
+static void client_timer(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)a; (void)e; (void)tv;
+    client_flush(userdata);
+}
+
+// Queues a packet behind the configured latency; the caller flushes.
+static void client_queue(struct fakepa_client *c, struct fakepa_packet *p) {
+    if (!p) {
+        return;
+    }
+    if (p->overflow) {
+        fprintf(stderr, "fakepa: reply too large\n");
+        packet_free(p);
+        return;
+    }
+    const uint32_t descriptor[5] = { htonl((uint32_t)(p->len - FAKEPA_DESCRIPTOR)), htonl(FAKEPA_CONTROL), 0, 0, 0 };
+    memcpy(p->buf, descriptor, sizeof(descriptor));
+    p->due = fakepa_now() + c->server->opts.latency;
+    *c->out_tail = p;
+    c->out_tail = &p->next;
+}
+
+static void client_error(struct fakepa_client *c, uint32_t tag, uint32_t error) {
+    struct fakepa_packet *p = packet_new(FAKEPA_ERROR, tag);
+    if (p) {
+        put_u32(p, error);
+    }
+    client_queue(c, p);
+}
+
+// Sent to every subscriber, and to the change callback.
+static void fakepa_event(struct sltp_fakepa *s, uint32_t t, uint32_t index) {
+    for (struct fakepa_client *c = s->clients; c; c = c->next) {
+        if (!(c->subscribed & (1u << (t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK)))) {
+            continue;
+        }
+        struct fakepa_packet *p = packet_new(FAKEPA_SUBSCRIBE_EVENT, UINT32_MAX);
+        if (p) {
+            put_u32(p, t);
+            put_u32(p, index);
+        }
+        client_queue(c, p);
+    }
+    if (s->changed) {
+        s->changed(s, t, index, s->userdata);
+    }
+}
+
+// By index, by name, or @DEFAULT_SINK@/@DEFAULT_SOURCE@.
+static struct fakepa_device *fakepa_lookup(struct fakepa_device *devs, size_t count, uint32_t def,
+    uint32_t index, const char *name) {
+    if (index == PA_INVALID_INDEX && name && name[0] == '@') {
+        index = def;
+    }
+    for (size_t n = 0; n < count; ++n) {
+        if (devs[n].present
+            && (index != PA_INVALID_INDEX ? devs[n].index == index : name && !strcmp(devs[n].name, name))) {
+            return &devs[n];
+        }
+    }
+    return NULL;
+}
+
+static struct fakepa_device *fakepa_sink(struct sltp_fakepa *s, uint32_t index, const char *name) {
+    return fakepa_lookup(s->sinks, sizeof(s->sinks) / sizeof(*s->sinks), s->default_sink, index, name);
+}
+
+static struct fakepa_device *fakepa_source(struct sltp_fakepa *s, uint32_t index, const char *name) {
+    return fakepa_lookup(s->sources, sizeof(s->sources) / sizeof(*s->sources), s->default_source, index, name);
+}
+
+static struct fakepa_stream *fakepa_stream(struct fakepa_stream *streams, size_t count, uint32_t index) {
+    for (size_t n = 0; n < count; ++n) {
+        if (streams[n].index == index) {
+            return &streams[n];
+        }
+    }
+    return NULL;
+}
+
+static struct fakepa_stream *fakepa_input(struct sltp_fakepa *s, uint32_t index) {
+    return fakepa_stream(s->inputs, s->ninputs, index);
+}
+
+// Answers one request. Returns the error to send instead of a reply, or 0
+// when a reply has been queued.
+static uint32_t client_command(struct fakepa_client *c, uint32_t command, uint32_t tag, struct fakepa_reader *r) {
+    struct sltp_fakepa *s = c->server;
+    struct fakepa_packet *p = NULL;
+    struct fakepa_device *d, *def;
+    struct fakepa_stream *i;
+    uint32_t index, index2;
+    const char *name;
+    pa_cvolume volume;
+    bool mute;
+
+    switch (command) {
+    case FAKEPA_AUTH:
+        if (s->opts.refuse_auth) {
+            return PA_ERR_ACCESS;
+        }
+        // The client's version carries its shm flags in the top bits; not
+        // echoing them keeps it off shared memory.
+        c->authed = true;
+        if ((p = packet_new(FAKEPA_REPLY, tag))) {
+            put_u32(p, FAKEPA_VERSION);
+        }
+        break;
+    case FAKEPA_SET_CLIENT_NAME:
+        c->named = true;
+        if ((p = packet_new(FAKEPA_REPLY, tag))) {
+            put_u32(p, c->index);
+        }
+        break;
+    case FAKEPA_GET_SERVER_INFO:
+        if ((p = packet_new(FAKEPA_REPLY, tag))) {
+            put_string(p, "fakepa");
+            put_string(p, "sltpwmt");
+            put_string(p, "sltpwmt");
+            put_string(p, "localhost");
+            put_sample_spec(p);
+            def = fakepa_sink(s, s->default_sink, NULL);
+            put_string(p, def ? def->name : NULL);
+            def = fakepa_source(s, s->default_source, NULL);
+            put_string(p, def ? def->name : NULL);
+            put_u32(p, 0x5117); // cookie
+            put_channel_map(p);
+        }
+        break;
+    case FAKEPA_GET_SINK_INFO:
+    case FAKEPA_GET_SOURCE_INFO:
+        if (get_u32(r, &index) < 0 || get_string(r, &name) < 0) {
+            return PA_ERR_PROTOCOL;
+        }
+        d = command == FAKEPA_GET_SINK_INFO ? fakepa_sink(s, index, name) : fakepa_source(s, index, name);
+        if (!d) {
+            return PA_ERR_NOENTITY;
+        }
+        if ((p = packet_new(FAKEPA_REPLY, tag))) {
+            put_device(p, d);
+        }
+        break;
+    case FAKEPA_GET_SINK_INFO_LIST:
+        if ((p = packet_new(FAKEPA_REPLY, tag))) {
+            for (size_t n = 0; n < sizeof(s->sinks) / sizeof(*s->sinks); ++n) {
+                if (s->sinks[n].present) {
+                    put_device(p, &s->sinks[n]);
+                }
+            }
+        }
+        break;
+    case FAKEPA_GET_SOURCE_INFO_LIST:
+        if ((p = packet_new(FAKEPA_REPLY, tag))) {
+            for (size_t n = 0; n < sizeof(s->sources) / sizeof(*s->sources); ++n) {
+                if (s->sources[n].present) {
+                    put_device(p, &s->sources[n]);
+                }
+            }
+        }
+        break;
+    case FAKEPA_GET_SINK_INPUT_INFO:
+    case FAKEPA_GET_SOURCE_OUTPUT_INFO:
+        if (get_u32(r, &index) < 0) {
+            return PA_ERR_PROTOCOL;
+        }
+        i = command == FAKEPA_GET_SINK_INPUT_INFO ? fakepa_input(s, index)
+            : fakepa_stream(s->outputs, s->noutputs, index);
+        if (!i) {
+            return PA_ERR_NOENTITY;
+        }
+        if ((p = packet_new(FAKEPA_REPLY, tag))) {
+            (command == FAKEPA_GET_SINK_INPUT_INFO ? put_input : put_output)(p, i);
+        }
+        break;
+    case FAKEPA_GET_SINK_INPUT_INFO_LIST:
+        if ((p = packet_new(FAKEPA_REPLY, tag))) {
+            for (size_t n = 0; n < s->ninputs; ++n) {
+                put_input(p, &s->inputs[n]);
+            }
+        }
+        break;
+    case FAKEPA_GET_SOURCE_OUTPUT_INFO_LIST:
+        if ((p = packet_new(FAKEPA_REPLY, tag))) {
+            for (size_t n = 0; n < s->noutputs; ++n) {
+                put_output(p, &s->outputs[n]);
+            }
+        }
+        break;
+    case FAKEPA_SUBSCRIBE:
+        if (get_u32(r, &c->subscribed) < 0) {
+            return PA_ERR_PROTOCOL;
+        }
+        p = packet_new(FAKEPA_REPLY, tag);
+        break;
+    case FAKEPA_SET_SINK_VOLUME:
+    case FAKEPA_SET_SOURCE_VOLUME:
+        if (get_u32(r, &index) < 0 || get_string(r, &name) < 0 || get_cvolume(r, &volume) < 0) {
+            return PA_ERR_PROTOCOL;
+        }
+        d = command == FAKEPA_SET_SINK_VOLUME ? fakepa_sink(s, index, name) : fakepa_source(s, index, name);
+        if (!d) {
+            return PA_ERR_NOENTITY;
+        }
+        if (volume.channels != d->volume.channels) {
+            return PA_ERR_INVALID;
+        }
+        d->volume = volume;
+        p = packet_new(FAKEPA_REPLY, tag);
+        client_queue(c, p);
+        fakepa_event(s, (command == FAKEPA_SET_SINK_VOLUME ? PA_SUBSCRIPTION_EVENT_SINK : PA_SUBSCRIPTION_EVENT_SOURCE)
+            | PA_SUBSCRIPTION_EVENT_CHANGE, d->index);
+        return 0;
+    case FAKEPA_SET_SINK_INPUT_VOLUME:
+        if (get_u32(r, &index) < 0 || get_cvolume(r, &volume) < 0) {
+            return PA_ERR_PROTOCOL;
+        }
+        if (!(i = fakepa_input(s, index))) {
+            return PA_ERR_NOENTITY;
+        }
+        if (volume.channels != i->volume.channels) {
+            return PA_ERR_INVALID;
+        }
+        i->volume = volume;
+        p = packet_new(FAKEPA_REPLY, tag);
+        client_queue(c, p);
+        fakepa_event(s, PA_SUBSCRIPTION_EVENT_SINK_INPUT | PA_SUBSCRIPTION_EVENT_CHANGE, i->index);
+        return 0;
+    case FAKEPA_SET_SINK_MUTE:
+    case FAKEPA_SET_SOURCE_MUTE:
+        if (get_u32(r, &index) < 0 || get_string(r, &name) < 0 || get_bool(r, &mute) < 0) {
+            return PA_ERR_PROTOCOL;
+        }
+        d = command == FAKEPA_SET_SINK_MUTE ? fakepa_sink(s, index, name) : fakepa_source(s, index, name);
+        if (!d) {
+            return PA_ERR_NOENTITY;
+        }
+        d->mute = mute;
+        p = packet_new(FAKEPA_REPLY, tag);
+        client_queue(c, p);
+        fakepa_event(s, (command == FAKEPA_SET_SINK_MUTE ? PA_SUBSCRIPTION_EVENT_SINK : PA_SUBSCRIPTION_EVENT_SOURCE)
+            | PA_SUBSCRIPTION_EVENT_CHANGE, d->index);
+        return 0;
+    case FAKEPA_SET_DEFAULT_SINK:
+    case FAKEPA_SET_DEFAULT_SOURCE:
+        if (get_string(r, &name) < 0) {
+            return PA_ERR_PROTOCOL;
+        }
+        d = command == FAKEPA_SET_DEFAULT_SINK ? fakepa_sink(s, PA_INVALID_INDEX, name) : fakepa_source(s, PA_INVALID_INDEX, name);
+        if (!d) {
+            return PA_ERR_NOENTITY;
+        }
+        *(command == FAKEPA_SET_DEFAULT_SINK ? &s->default_sink : &s->default_source) = d->index;
+        p = packet_new(FAKEPA_REPLY, tag);
+        client_queue(c, p);
+        fakepa_event(s, PA_SUBSCRIPTION_EVENT_SERVER | PA_SUBSCRIPTION_EVENT_CHANGE, PA_INVALID_INDEX);
+        return 0;
+    case FAKEPA_MOVE_SINK_INPUT:
+        if (get_u32(r, &index) < 0 || get_u32(r, &index2) < 0 || get_string(r, &name) < 0) {
+            return PA_ERR_PROTOCOL;
+        }
+        if (!(i = fakepa_input(s, index)) || !(d = fakepa_sink(s, index2, name))) {
+            return PA_ERR_NOENTITY;
+        }
+        i->device = d->index;
+        p = packet_new(FAKEPA_REPLY, tag);
+        client_queue(c, p);
+        fakepa_event(s, PA_SUBSCRIPTION_EVENT_SINK_INPUT | PA_SUBSCRIPTION_EVENT_CHANGE, i->index);
+        return 0;
+    default:
+        return PA_ERR_NOTSUPPORTED;
+    }
+    client_queue(c, p);
+    return 0;
+}
+
+// Returns -1 if the client is gone.
+static int client_packet(struct fakepa_client *c, const unsigned char *data, size_t len) {
+    struct sltp_fakepa *s = c->server;
+    struct fakepa_reader r = { data, len };
+    uint32_t command, tag;
+    if (get_u32(&r, &command) < 0 || get_u32(&r, &tag) < 0) {
+        client_free(c);
+        return -1;
+    }
+    if (!c->authed && command != FAKEPA_AUTH) {
+        client_error(c, tag, PA_ERR_ACCESS);
+        return 0;
+    }
+
+    // Injected faults only hit requests after the handshake, so a client
+    // always gets far enough to see them.
+    if (c->named && command != FAKEPA_AUTH && command != FAKEPA_SET_CLIENT_NAME) {
+        const unsigned n = ++c->requests;
+        if (s->opts.drop_after && n >= s->opts.drop_after) {
+            c->hangup = true;
+            return 0;
+        }
+        if (s->opts.fail_every && n % s->opts.fail_every == 0) {
+            client_error(c, tag, PA_ERR_INTERNAL);
+            return 0;
+        }
+    }
+
+    const uint32_t error = client_command(c, command, tag, &r);
+    if (error) {
+        client_error(c, tag, error);
+    }
+    return 0;
+}
+
+static void client_event(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)a; (void)e;
+    struct fakepa_client *c = userdata;
+    struct sltp_fakepa *s = c->server;
+
+    if (events & PA_IO_EVENT_INPUT) {
+        ssize_t n = recv(fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+        if (n == 0 || (n == -1 && errno != EAGAIN)) {
+            client_free(c);
+            return;
+        }
+        c->in_len += n > 0 ? (size_t)n : 0;
+
+        while (c->in_len >= FAKEPA_DESCRIPTOR && !c->hangup) {
+            uint32_t descriptor[5];
+            memcpy(descriptor, c->in, sizeof(descriptor));
+            const size_t len = ntohl(descriptor[0]);
+            if (len > FAKEPA_FRAME_MAX) {
+                client_free(c);
+                return;
+            }
+            if (c->in_len < FAKEPA_DESCRIPTOR + len) {
+                break;
+            }
+            // Anything not on the control channel would be audio, and we
+            // never create a stream for it to belong to.
+            if (ntohl(descriptor[1]) == FAKEPA_CONTROL && client_packet(c, c->in + FAKEPA_DESCRIPTOR, len) < 0) {
+                return;
+            }
+            c->in_len -= FAKEPA_DESCRIPTOR + len;
+            memmove(c->in, c->in + FAKEPA_DESCRIPTOR + len, c->in_len);
+        }
+    } else if (events & (PA_IO_EVENT_HANGUP | PA_IO_EVENT_ERROR)) {
+        client_free(c);
+        return;
+    }
+
+    // Events may have been queued for any client, not just this one.
+    for (struct fakepa_client *o = s->clients, *next; o; o = next) {
+        next = o->next;
+        if (o != c) {
+            client_flush(o);
+        }
+    }
+    client_flush(c);
+}
+
+static void fakepa_accept(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    (void)e; (void)events;
+    struct sltp_fakepa *s = userdata;
+    int cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd == -1) {
+        return;
+    }
+    struct fakepa_client *c = malloc(sizeof(*c));
+    if (!c) {
+        close(cfd);
+        return;
+    }
+    *c = (struct fakepa_client){
+        .server = s,
+        .fd = cfd,
+        .index = s->next_client++,
+        .next = s->clients,
+    };
+    c->out_tail = &c->out;
+    if (!(c->io = a->io_new(a, cfd, PA_IO_EVENT_INPUT, client_event, c))) {
+        close(cfd);
+        free(c);
+        return;
+    }
+    s->clients = c;
+}
+
+// Changes made through the calls below did not come from a client, so
+// nothing else would send out the events they queued.
+static void fakepa_flush(struct sltp_fakepa *s) {
+    for (struct fakepa_client *c = s->clients, *next; c; c = next) {
+        next = c->next;
+        client_flush(c);
+    }
+}
+
+static uint32_t fakepa_add(struct sltp_fakepa *s, struct fakepa_stream **streams, size_t *count, uint32_t *next,
+    uint32_t device, const char *app, bool corked) {
+    struct fakepa_stream *grown = realloc(*streams, (*count + 1) * sizeof(**streams));
+    if (!grown) {
+        return PA_INVALID_INDEX;
+    }
+    *streams = grown;
+    struct fakepa_stream *st = &grown[(*count)++];
+    *st = (struct fakepa_stream){ .index = (*next)++, .device = device, .corked = corked };
+    snprintf(st->app, sizeof(st->app), "%s", app ? app : "");
+    pa_cvolume_set(&st->volume, 2, PA_VOLUME_NORM);
+    const uint32_t t = streams == &s->inputs ? PA_SUBSCRIPTION_EVENT_SINK_INPUT : PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT;
+    fakepa_event(s, t | PA_SUBSCRIPTION_EVENT_NEW, st->index);
+    fakepa_flush(s);
+    return st->index;
+}
+
+static int fakepa_remove(struct sltp_fakepa *s, struct fakepa_stream *streams, size_t *count, uint32_t index) {
+    struct fakepa_stream *st = fakepa_stream(streams, *count, index);
+    if (!st) {
+        return -1;
+    }
+    *st = streams[--*count];
+    const uint32_t t = streams == s->inputs ? PA_SUBSCRIPTION_EVENT_SINK_INPUT : PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT;
+    fakepa_event(s, t | PA_SUBSCRIPTION_EVENT_REMOVE, index);
+    fakepa_flush(s);
+    return 0;
+}
+
+uint32_t sltp_fakepa_add_input(struct sltp_fakepa *s, const char *app, bool corked) {
+    return fakepa_add(s, &s->inputs, &s->ninputs, &s->next_input, s->default_sink, app, corked);
+}
+
+uint32_t sltp_fakepa_add_output(struct sltp_fakepa *s, const char *app, bool corked) {
+    return fakepa_add(s, &s->outputs, &s->noutputs, &s->next_output, s->default_source, app, corked);
+}
+
+int sltp_fakepa_remove_input(struct sltp_fakepa *s, uint32_t index) {
+    return fakepa_remove(s, s->inputs, &s->ninputs, index);
+}
+
+int sltp_fakepa_remove_output(struct sltp_fakepa *s, uint32_t index) {
+    return fakepa_remove(s, s->outputs, &s->noutputs, index);
+}
+
+int sltp_fakepa_cork_input(struct sltp_fakepa *s, uint32_t index, bool corked) {
+    struct fakepa_stream *i = fakepa_input(s, index);
+    if (!i) {
+        return -1;
+    }
+    i->corked = corked;
+    fakepa_event(s, PA_SUBSCRIPTION_EVENT_SINK_INPUT | PA_SUBSCRIPTION_EVENT_CHANGE, index);
+    fakepa_flush(s);
+    return 0;
+}
+
+// Like PulseAudio, a sink that goes away takes the default and its streams
+// to another one, and comes back under a new index. With no sink left there
+// is no default until a client sets one.
+uint32_t sltp_fakepa_plug_sink(struct sltp_fakepa *s, const char *name, bool present) {
+    struct fakepa_device *d = NULL;
+    for (size_t n = 0; n < sizeof(s->sinks) / sizeof(*s->sinks); ++n) {
+        if (!strcmp(s->sinks[n].name, name)) {
+            d = &s->sinks[n];
+        }
+    }
+    if (!d || d->present == present) {
+        return d && present ? d->index : PA_INVALID_INDEX;
+    }
+    if (present) {
+        d->present = true;
+        d->index = s->next_sink++;
+        fakepa_event(s, PA_SUBSCRIPTION_EVENT_SINK | PA_SUBSCRIPTION_EVENT_NEW, d->index);
+        fakepa_flush(s);
+        return d->index;
+    }
+
+    d->present = false;
+    fakepa_event(s, PA_SUBSCRIPTION_EVENT_SINK | PA_SUBSCRIPTION_EVENT_REMOVE, d->index);
+    const struct fakepa_device *other = NULL;
+    for (size_t n = 0; n < sizeof(s->sinks) / sizeof(*s->sinks) && !other; ++n) {
+        other = s->sinks[n].present ? &s->sinks[n] : NULL;
+    }
+    const uint32_t to = other ? other->index : PA_INVALID_INDEX;
+    for (size_t n = 0; n < s->ninputs; ++n) {
+        if (s->inputs[n].device == d->index) {
+            s->inputs[n].device = to;
+            fakepa_event(s, PA_SUBSCRIPTION_EVENT_SINK_INPUT | PA_SUBSCRIPTION_EVENT_CHANGE, s->inputs[n].index);
+        }
+    }
+    if (s->default_sink == d->index) {
+        s->default_sink = to;
+        fakepa_event(s, PA_SUBSCRIPTION_EVENT_SERVER | PA_SUBSCRIPTION_EVENT_CHANGE, PA_INVALID_INDEX);
+    }
+    fakepa_flush(s);
+    return PA_INVALID_INDEX;
+}
+
+const pa_cvolume *sltp_fakepa_volume(struct sltp_fakepa *s, pa_subscription_event_type_t facility, uint32_t index,
+    bool *mute) {
+    const struct fakepa_device *d = facility == PA_SUBSCRIPTION_EVENT_SINK ? fakepa_sink(s, index, NULL)
+        : facility == PA_SUBSCRIPTION_EVENT_SOURCE ? fakepa_source(s, index, NULL) : NULL;
+    if (d) {
+        if (mute) {
+            *mute = d->mute;
+        }
+        return &d->volume;
+    }
+    const struct fakepa_stream *i = facility == PA_SUBSCRIPTION_EVENT_SINK_INPUT ? fakepa_input(s, index) : NULL;
+    if (i && mute) {
+        *mute = false;
+    }
+    return i ? &i->volume : NULL;
+}
+
+uint32_t sltp_fakepa_connections(const struct sltp_fakepa *s) {
+    return s->next_client;
+}
+
+uint32_t sltp_fakepa_default_sink(const struct sltp_fakepa *s) {
+    return s->default_sink;
+}
+
+uint32_t sltp_fakepa_input_sink(struct sltp_fakepa *s, uint32_t index) {
+    const struct fakepa_stream *i = fakepa_input(s, index);
+    return i ? i->device : PA_INVALID_INDEX;
+}
+
+void sltp_fakepa_set_callback(struct sltp_fakepa *s, sltp_fakepa_cb cb, void *userdata) {
+    s->changed = cb;
+    s->userdata = userdata;
+}
+
+struct sltp_fakepa *sltp_fakepa_new(pa_mainloop_api *api, const char *path, const struct sltp_fakepa_opts *opts) {
+    struct sltp_fakepa *s = calloc(1, sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    s->api = api;
+    if (opts) {
+        s->opts = *opts;
+    }
+    s->sinks[0] = (struct fakepa_device){ .index = 0, .name = "fakepa.speakers", .description = "Fake Speakers",
+        .present = true };
+    s->sinks[1] = (struct fakepa_device){ .index = 1, .name = "fakepa.headphones", .description = "Fake Headphones",
+        .present = true };
+    s->sources[0] = (struct fakepa_device){ .index = 0, .name = "fakepa.mic", .description = "Fake Microphone",
+        .present = true };
+    s->next_sink = 2;
+    for (size_t n = 0; n < sizeof(s->sinks) / sizeof(*s->sinks); ++n) {
+        pa_cvolume_set(&s->sinks[n].volume, 2, PA_VOLUME_NORM / 2);
+    }
+    pa_cvolume_set(&s->sources[0].volume, 2, PA_VOLUME_NORM);
+    for (unsigned n = 0; n < s->opts.inputs; ++n) {
+        if (sltp_fakepa_add_input(s, "fakepa", false) == PA_INVALID_INDEX) {
+            sltp_fakepa_free(s);
+            return NULL;
+        }
+    }
+
+    s->addr.sun_family = AF_UNIX;
+    if (snprintf(s->addr.sun_path, sizeof(s->addr.sun_path), "%s", path) >= (int)sizeof(s->addr.sun_path)) {
+        fprintf(stderr, "sltp_fakepa_new failed: path too long\n");
+        sltp_fakepa_free(s);
+        return NULL;
+    }
+    if ((s->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        perror("sltp_fakepa_new failed (socket)");
+        sltp_fakepa_free(s);
+        return NULL;
+    }
+    unlink(s->addr.sun_path);
+    if (bind(s->fd, (struct sockaddr *)&s->addr, sizeof(s->addr)) == -1 || listen(s->fd, 16) == -1) {
+        perror("sltp_fakepa_new failed (bind)");
+        close(s->fd);
+        sltp_fakepa_free(s);
+        return NULL;
+    }
+    s->io = api->io_new(api, s->fd, PA_IO_EVENT_INPUT, fakepa_accept, s);
+    return s;
+}
+
+void sltp_fakepa_free(struct sltp_fakepa *s) {
+    if (!s) {
+        return;
+    }
+    while (s->clients) {
+        client_free(s->clients);
+    }
+    if (s->io) {
+        s->api->io_free(s->io);
+        close(s->fd);
+        unlink(s->addr.sun_path);
+    }
+    free(s->inputs);
+    free(s->outputs);
+    free(s);
+}
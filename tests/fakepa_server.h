@@ -0,0 +1,64 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTPWMT_TESTS_FAKEPA_SERVER_H
+#define SLTPWMT_TESTS_FAKEPA_SERVER_H
+
+#include <stdbool.h>
+
+#include <pulse/pulseaudio.h>
+
+// A stand-in PulseAudio server speaking just enough of the native protocol
+// for sltpwmt: auth, server info, sink/source/sink input/source output info,
+// sink, source and sink input volume, mute, default sink, moves and
+// subscriptions. It has two sinks and one source, keeps no audio and cannot
+// open streams, so a client's own record or playback stream fails. It runs
+// on any pa_mainloop_api, so it can share a loop with the client under test
+// or run alone as tests/serve_fakepa. Clients reach it through
+// PULSE_SERVER=unix:<path>.
+
+struct sltp_fakepa_opts {
+    pa_usec_t latency; // every reply and event is held back this long
+    unsigned fail_every; // answer every nth request on a connection with an error
+    unsigned drop_after; // hang up instead of answering the nth request on a connection
+    bool refuse_auth;
+    unsigned inputs; // sink inputs playing from the start
+};
+
+struct sltp_fakepa;
+
+// Called after every change, whether a client or the calls below made it,
+// with the event subscribers get for it.
+typedef void (*sltp_fakepa_cb)(struct sltp_fakepa *s, pa_subscription_event_type_t t, uint32_t index,
+    void *userdata);
+
+struct sltp_fakepa *sltp_fakepa_new(pa_mainloop_api *api, const char *path, const struct sltp_fakepa_opts *opts);
+void sltp_fakepa_free(struct sltp_fakepa *s);
+void sltp_fakepa_set_callback(struct sltp_fakepa *s, sltp_fakepa_cb cb, void *userdata);
+
+// Streams come and go as if other clients played and recorded: sink inputs
+// on the default sink, source outputs on the default source, with app as
+// their application.name. The adds return the new index, or
+// PA_INVALID_INDEX when out of memory; the rest return -1 for no such stream.
+uint32_t sltp_fakepa_add_input(struct sltp_fakepa *s, const char *app, bool corked);
+uint32_t sltp_fakepa_add_output(struct sltp_fakepa *s, const char *app, bool corked);
+int sltp_fakepa_remove_input(struct sltp_fakepa *s, uint32_t index);
+int sltp_fakepa_remove_output(struct sltp_fakepa *s, uint32_t index);
+int sltp_fakepa_cork_input(struct sltp_fakepa *s, uint32_t index, bool corked);
+
+// Unplugs or replugs a sink by name. Returns its new index when plugged.
+uint32_t sltp_fakepa_plug_sink(struct sltp_fakepa *s, const char *name, bool present);
+
+// What the server holds now. facility is PA_SUBSCRIPTION_EVENT_SINK, _SOURCE
+// or _SINK_INPUT; NULL if there is no such object.
+const pa_cvolume *sltp_fakepa_volume(struct sltp_fakepa *s, pa_subscription_event_type_t facility, uint32_t index,
+    bool *mute);
+uint32_t sltp_fakepa_default_sink(const struct sltp_fakepa *s);
+// How many clients have connected so far.
+uint32_t sltp_fakepa_connections(const struct sltp_fakepa *s);
+uint32_t sltp_fakepa_input_sink(struct sltp_fakepa *s, uint32_t index);
+
+#endif
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Copyright (C) angelsl 2021
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+# Gamma brightness under Xvfb: sltp_gamma scales every CRTC's ramps and
+# reads them back, and with no backlight directory `sltpwmt b` falls back
+# to it.
+
+. tests/lib.sh
+
+[ -x tests/gamma_check ] || { echo "built without xcb"; exit 77; }
+start_xvfb
+export SLTPWMT_BACKLIGHT="$tmp/no-backlight"
+
+tests/gamma_check || exit $?
+
+# gamma_check leaves the ramps at 55%.
+./sltpwmt b -20 > /dev/null || fail "b -20 failed"
+tests/gamma_check 35 || fail "b -20 did not scale the ramps to 35%"
+./sltpwmt b -90 > /dev/null || fail "b -90 failed"
+tests/gamma_check 10 || fail "b -90 went below the 10% floor"
+
+echo "gamma ramps scaled directly and through sltpwmt b"
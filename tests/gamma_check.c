@@ -0,0 +1,117 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <xcb/xcb.h>
+#include <xcb/randr.h>
+
+#include "gamma.h"
+
+// For tests/gamma.sh, on the X server in $DISPLAY. Without an argument it
+// drives sltp_gamma and reads every CRTC's ramps back over a connection of
+// its own; with one, it only checks that every ramp tops out at that many
+// percent. Exits 77 when the server has no CRTC with a gamma ramp.
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+static xcb_connection_t *conn;
+static xcb_randr_crtc_t crtcs[32];
+static int ncrtcs;
+
+static int crtcs_find(void) {
+    conn = xcb_connect(NULL, NULL);
+    if (xcb_connection_has_error(conn)) {
+        return -1;
+    }
+    xcb_screen_t *screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+    xcb_randr_get_screen_resources_current_reply_t *res = xcb_randr_get_screen_resources_current_reply(conn,
+        xcb_randr_get_screen_resources_current(conn, screen->root), NULL);
+    if (!res) {
+        return -1;
+    }
+    const xcb_randr_crtc_t *ids = xcb_randr_get_screen_resources_current_crtcs(res);
+    for (int n = 0; n < xcb_randr_get_screen_resources_current_crtcs_length(res) && ncrtcs < 32; ++n) {
+        xcb_randr_get_crtc_gamma_size_reply_t *size = xcb_randr_get_crtc_gamma_size_reply(conn,
+            xcb_randr_get_crtc_gamma_size(conn, ids[n]), NULL);
+        if (size && size->size >= 2) {
+            crtcs[ncrtcs++] = ids[n];
+        }
+        free(size);
+    }
+    free(res);
+    return ncrtcs ? 0 : -1;
+}
+
+// Every channel of every CRTC rises from 0 to percent of full scale.
+static bool ramps_at(int percent) {
+    bool ok = true;
+    for (int n = 0; n < ncrtcs; ++n) {
+        xcb_randr_get_crtc_gamma_reply_t *g = xcb_randr_get_crtc_gamma_reply(conn,
+            xcb_randr_get_crtc_gamma(conn, crtcs[n]), NULL);
+        if (!g) {
+            return false;
+        }
+        const int len = xcb_randr_get_crtc_gamma_red_length(g);
+        const uint16_t *ramps[] = { xcb_randr_get_crtc_gamma_red(g), xcb_randr_get_crtc_gamma_green(g),
+            xcb_randr_get_crtc_gamma_blue(g) };
+        const int want = 65535 * percent / 100;
+        for (size_t c = 0; c < 3; ++c) {
+            const uint16_t *r = ramps[c];
+            ok &= r[0] == 0 && abs((int)r[len - 1] - want) <= 2;
+            for (int i = 1; i < len; ++i) {
+                ok &= r[i] >= r[i - 1];
+            }
+        }
+        free(g);
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    if (crtcs_find() < 0) {
+        printf("no CRTC with a gamma ramp on $DISPLAY\n");
+        return 77;
+    }
+    if (argc == 2) {
+        const int percent = atoi(argv[1]);
+        check(ramps_at(percent), "ramps at the expected percentage");
+        return failures != 0;
+    }
+
+    struct sltp_gamma *g = sltp_gamma_new();
+    check(g != NULL, "connected");
+    if (!g) {
+        return 1;
+    }
+    check(sltp_gamma_set(g, 40) == 40, "set 40%");
+    check(ramps_at(40), "every ramp scaled to 40%");
+    check(sltp_gamma_get(g) == 40, "get returns what was set");
+    check(sltp_gamma_set(g, 3) == 10, "set below the floor is held at 10%");
+    check(ramps_at(10), "ramps at 10%");
+    check(sltp_gamma_set(g, 150) == 100, "set above 100% is held at 100%");
+    check(ramps_at(100), "ramps back to identity");
+    check(sltp_gamma_set(g, 55) == 55, "set 55%");
+
+    // A new handle has nothing cached, so it reads the server.
+    struct sltp_gamma *other = sltp_gamma_new();
+    check(other && sltp_gamma_get(other) == 55, "fresh handle reads 55% from the server");
+    sltp_gamma_free(other);
+    sltp_gamma_free(g);
+    xcb_disconnect(conn);
+
+    printf("%s on %d CRTCs\n", failures ? "gamma checks failed" : "gamma ramps scaled and read back", ncrtcs);
+    return failures != 0;
+}
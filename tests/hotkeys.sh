@@ -0,0 +1,47 @@
+#!/bin/sh
+# Copyright (C) angelsl 2021
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+# Hotkeys read by the daemon (-k) from a uinput keyboard that appears after
+# it started, so it is found through hotplug: single presses step once each,
+# and a held key's autorepeats are coalesced without losing any steps.
+
+[ -w /dev/uinput ] || { echo "no /dev/uinput"; exit 77; }
+. tests/lib.sh
+
+backlight 1000 500
+config "brightness_step = 10"
+start_daemon -k
+
+mkfifo "$tmp/keys"
+tests/uinput_keys < "$tmp/keys" > "$tmp/keys.out" &
+keys_pid=$!
+exec 3> "$tmp/keys"
+wait_for 5 grep -q ready "$tmp/keys.out" || fail "virtual keyboard not created"
+# The daemon opens the new device on the kernel's uevent.
+sleep 0.5
+
+keys() {
+    echo "$@" >&3
+}
+
+keys tap brightnessup
+keys tap brightnessup
+keys tap brightnessdown
+wait_for 2 brightness_in 510 510 || fail "presses did not step once each"
+
+# 1 press and 29 repeats, 5 ms apart, are 30 steps in about 10 frames.
+keys hold brightnessup 29
+wait_for 2 brightness_in 810 810 || fail "held key lost steps"
+coalesced=$(./sltpwmt metrics | sed -n 's/^sltpwmt_coalesced_deltas_total //p')
+[ "${coalesced:-0}" -gt 0 ] || fail "autorepeat was not coalesced"
+
+keys hold brightnessdown 9
+wait_for 2 brightness_in 710 710 || fail "held key lost steps going down"
+
+exec 3>&-
+wait "$keys_pid" || fail "virtual keyboard failed"
+echo "presses stepped once each, $coalesced repeats coalesced"
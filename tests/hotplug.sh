@@ -0,0 +1,67 @@
+#!/bin/sh
+# Copyright (C) angelsl 2021
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+# Backlight hotplug against a fake sysfs class directory and uevents sent
+# by tests/uevent_send: a removed panel is let go, one that comes back is
+# reopened with its max_brightness read afresh, and a uevent in the
+# kernel's format that did not come from the kernel is ignored.
+
+. tests/lib.sh
+
+panel="$tmp/class/backlight/panel0"
+devpath=/devices/pci0000:00/0000:00:02.0/drm/card0/card0-eDP-1/backlight/panel0
+mkdir -p "$panel"
+export SLTPWMT_BACKLIGHT="$panel"
+echo 1000 > "$panel/max_brightness"
+echo 500 > "$panel/brightness"
+
+# send [-k] <action>
+send() {
+    if [ "$1" = -k ]; then
+        shift
+        set -- -k "$1"
+    fi
+    tests/uevent_send "$@" backlight "$devpath"
+    ret=$?
+    [ $ret -eq 77 ] && { echo "uevents cannot be sent here"; exit 77; }
+    [ $ret -eq 0 ] || fail "uevent_send failed"
+    # Gives the daemon a round trip to take it in.
+    ./sltpwmt g > /dev/null 2>&1
+}
+
+start_daemon
+./sltpwmt b 10 > /dev/null || fail "b 10 failed"
+brightness_in 510 510 || fail "step before hotplug not written"
+
+# Gone: with no X display to fall back to, steps fail.
+rm -r "$panel"
+send remove
+./sltpwmt b 10 > /dev/null 2>&1 && fail "step after remove reported as done"
+
+# Back with a larger range. Without the add, the old max of 1000 would
+# clamp the step.
+mkdir -p "$panel"
+echo 2000 > "$panel/max_brightness"
+echo 1500 > "$panel/brightness"
+send add
+./sltpwmt g | grep -q 'brightness 1500/2000' || fail "new max_brightness not read: $(./sltpwmt g)"
+./sltpwmt b 10 > /dev/null || fail "b 10 after add failed"
+brightness_in 1510 1510 || fail "step after add not written"
+
+# A kernel-format add from userspace would make the daemon read 3000.
+echo 3000 > "$panel/max_brightness"
+send -k add
+echo 1995 > "$panel/brightness"
+./sltpwmt b 10 > /dev/null || fail "b 10 after spoofed add failed"
+brightness_in 2000 2000 || fail "kernel-format uevent from userspace believed"
+
+# The same add from udev is.
+send add
+./sltpwmt b 10 > /dev/null || fail "b 10 after udev add failed"
+brightness_in 2010 2010 || fail "udev add not followed"
+
+echo "panel removed, re-added with a new range, spoofed uevent ignored"
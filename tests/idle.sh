@@ -0,0 +1,41 @@
+#!/bin/sh
+# Copyright (C) angelsl 2021
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+# Idle dimming under Xvfb: with nobody touching the server, the backlight
+# dims at idle_dim and switches off through bl_power at idle_off, and the
+# next XTEST pointer movement puts both back.
+
+. tests/lib.sh
+
+[ -x tests/x_input ] || { echo "built without xcb-xtest"; exit 77; }
+start_xvfb
+backlight 1000 900
+echo 0 > "$tmp/backlight/bl_power"
+config "idle_dim = 1"
+config "idle_off = 2"
+
+bl_power() {
+    [ "$(cat "$tmp/backlight/bl_power")" = "$1" ]
+}
+
+start_daemon
+wait_for 3 brightness_in 270 270 || fail "not dimmed to 30% after a second idle"
+bl_power 0 || fail "switched off at the dim threshold"
+wait_for 3 bl_power 4 || fail "bl_power not switched off after two seconds idle"
+brightness_in 270 270 || fail "brightness moved while switched off"
+
+tests/x_input || exit $?
+wait_for 1 bl_power 0 || fail "bl_power not switched back on by input"
+wait_for 1 brightness_in 900 900 || fail "brightness not restored by input"
+
+# Input while only dimmed restores the brightness and leaves the panel on.
+wait_for 3 brightness_in 270 270 || fail "not dimmed again after a second idle"
+tests/x_input || exit $?
+wait_for 1 brightness_in 900 900 || fail "brightness not restored from dim"
+bl_power 0 || fail "bl_power touched when only dimmed"
+
+echo "dimmed, switched off and restored by XTEST input"
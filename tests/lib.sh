@@ -0,0 +1,120 @@
+# Copyright (C) angelsl 2021
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+# Sourced by the shell tests. Gives each test private runtime, state and
+# config directories and a fake backlight, and keeps the daemon away from
+# the machine's own sound server, system bus and X display.
+
+tmp=$(mktemp -d) || exit 1
+daemon_pid=
+fakepa_pid=
+xvfb_pid=
+trap 'stop_daemon; stop_fakepa; stop_xvfb; rm -rf "$tmp"' EXIT
+mkdir -p "$tmp/backlight" "$tmp/run" "$tmp/state" "$tmp/config/sltpwmt"
+export SLTPWMT_BACKLIGHT="$tmp/backlight"
+export XDG_RUNTIME_DIR="$tmp/run" XDG_STATE_HOME="$tmp/state" XDG_CONFIG_HOME="$tmp/config"
+export PULSE_SERVER="unix:$tmp/no-pulse" DBUS_SYSTEM_BUS_ADDRESS="unix:path=$tmp/no-dbus"
+unset DISPLAY
+
+# backlight <max> <brightness>
+backlight() {
+    echo "$1" > "$tmp/backlight/max_brightness"
+    echo "$2" > "$tmp/backlight/brightness"
+}
+
+# These are regular files, so a shorter write leaves the old tail behind;
+# tests keep every value they expect to the same number of digits.
+brightness() {
+    cat "$SLTPWMT_BACKLIGHT/brightness"
+}
+
+config() {
+    echo "$1" >> "$tmp/config/sltpwmt/config"
+}
+
+# wait_for <seconds> <command...> retries the command until it succeeds.
+wait_for() {
+    tries=$(($1 * 50))
+    shift
+    while ! "$@"; do
+        tries=$((tries - 1))
+        [ $tries -gt 0 ] || return 1
+        sleep 0.02
+    done
+}
+
+start_daemon() {
+    ./sltpwmt daemon "$@" 2> "$tmp/daemon.log" &
+    daemon_pid=$!
+    wait_for 5 test -S "$tmp/run/sltpwmt.sock" || fail "daemon did not start"
+}
+
+stop_daemon() {
+    if [ -n "$daemon_pid" ]; then
+        kill "$daemon_pid" 2> /dev/null
+        wait "$daemon_pid" 2> /dev/null
+        daemon_pid=
+    fi
+}
+
+# start_fakepa [serve_fakepa options] serves the stand-in PulseAudio and
+# points everything started afterwards at it.
+start_fakepa() {
+    tests/serve_fakepa "$@" "$tmp/pulse" 2> "$tmp/fakepa.log" &
+    fakepa_pid=$!
+    wait_for 5 test -S "$tmp/pulse" || fail "fakepa did not start"
+    export PULSE_SERVER="unix:$tmp/pulse"
+}
+
+stop_fakepa() {
+    if [ -n "$fakepa_pid" ]; then
+        kill "$fakepa_pid" 2> /dev/null
+        wait "$fakepa_pid" 2> /dev/null
+        fakepa_pid=
+    fi
+}
+
+# start_xvfb gives the test an X server of its own on a free display and
+# points everything started afterwards at it; skips the test without Xvfb.
+start_xvfb() {
+    command -v Xvfb > /dev/null || { echo "no Xvfb"; exit 77; }
+    Xvfb -displayfd 3 -nolisten tcp -screen 0 640x480x24 3> "$tmp/display" 2> "$tmp/xvfb.log" &
+    xvfb_pid=$!
+    wait_for 5 test -s "$tmp/display" || fail "Xvfb did not start"
+    DISPLAY=":$(cat "$tmp/display")"
+    export DISPLAY
+}
+
+stop_xvfb() {
+    if [ -n "$xvfb_pid" ]; then
+        kill "$xvfb_pid" 2> /dev/null
+        wait "$xvfb_pid" 2> /dev/null
+        xvfb_pid=
+    fi
+}
+
+daemon_has_sink() {
+    ./sltpwmt g | grep -q '^volume'
+}
+
+# Skips the test when the daemon cannot reach fakepa, as with a libpulse
+# that does not honour PULSE_SERVER.
+need_daemon_audio() {
+    wait_for 5 daemon_has_sink || { echo "daemon never connected to fakepa"; exit 77; }
+}
+
+# brightness_in <low> <high>
+brightness_in() {
+    b=$(brightness)
+    [ "$b" -ge "$1" ] && [ "$b" -le "$2" ]
+}
+
+fail() {
+    echo "FAILED: $*"
+    echo "brightness: $(brightness)"
+    [ -f "$tmp/daemon.log" ] && sed 's/^/daemon: /' "$tmp/daemon.log"
+    exit 1
+}
@@ -0,0 +1,360 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// For tests/logind.sh: a stand-in for logind on a private bus. It owns
+// org.freedesktop.login1 and answers Session.SetBrightness("backlight",
+// name, value) by writing value to the brightness file in the backlight
+// directory it was given, as logind would, and printing the call. With
+// "deny" it refuses every call instead. Prints "ready" once it owns the
+// name.
+//
+//     tests/login1_stub <bus socket> <backlight dir> [deny]
+
+#define MSG_MAX 65536
+
+enum {
+    METHOD_CALL = 1,
+    METHOD_RETURN = 2,
+    ERROR = 3,
+};
+
+enum {
+    FIELD_PATH = 1,
+    FIELD_INTERFACE = 2,
+    FIELD_MEMBER = 3,
+    FIELD_ERROR_NAME = 4,
+    FIELD_REPLY_SERIAL = 5,
+    FIELD_DESTINATION = 6,
+    FIELD_SENDER = 7,
+    FIELD_SIGNATURE = 8,
+};
+
+static int fd;
+static uint32_t serial;
+
+struct msg {
+    uint8_t type;
+    uint32_t serial, reply_serial;
+    const char *interface, *member, *sender, *signature;
+    const uint8_t *body;
+    size_t body_len;
+};
+
+struct buf {
+    uint8_t p[MSG_MAX];
+    size_t len;
+};
+
+static void put(struct buf *b, const void *data, size_t len) {
+    if (b->len + len > sizeof(b->p)) {
+        fprintf(stderr, "login1_stub: message too long\n");
+        exit(1);
+    }
+    memcpy(b->p + b->len, data, len);
+    b->len += len;
+}
+
+static void align(struct buf *b, size_t n) {
+    static const uint8_t zero[8];
+    put(b, zero, (n - b->len % n) % n);
+}
+
+static void put_u32(struct buf *b, uint32_t v) {
+    align(b, 4);
+    put(b, &v, 4);
+}
+
+static void put_str(struct buf *b, char type, const char *s) {
+    const size_t len = strlen(s);
+    if (type == 'g') {
+        const uint8_t l = (uint8_t)len;
+        put(b, &l, 1);
+    } else {
+        put_u32(b, (uint32_t)len);
+    }
+    put(b, s, len + 1);
+}
+
+static void put_field(struct buf *b, uint8_t code, char type, const char *s) {
+    const char sig[3] = { 1, type, '\0' };
+    align(b, 8);
+    put(b, &code, 1);
+    put(b, sig, 3);
+    put_str(b, type, s);
+}
+
+// Sends a message with a body of strings (s) and integers (u).
+static void send_msg(uint8_t type, const char *dest, const char *path, const char *interface, const char *member,
+    const char *error, uint32_t reply_serial, const char *signature, ...) {
+    static struct buf m;
+    const uint8_t head[4] = { 'l', type, 0, 1 };
+    m.len = 0;
+    put(&m, head, 4);
+    put_u32(&m, 0);
+    put_u32(&m, ++serial);
+    put_u32(&m, 0);
+    if (path) {
+        put_field(&m, FIELD_PATH, 'o', path);
+    }
+    if (interface) {
+        put_field(&m, FIELD_INTERFACE, 's', interface);
+    }
+    if (member) {
+        put_field(&m, FIELD_MEMBER, 's', member);
+    }
+    if (error) {
+        put_field(&m, FIELD_ERROR_NAME, 's', error);
+    }
+    if (reply_serial) {
+        const uint8_t code = FIELD_REPLY_SERIAL;
+        align(&m, 8);
+        put(&m, &code, 1);
+        put(&m, "\1u", 3);
+        put_u32(&m, reply_serial);
+    }
+    if (dest) {
+        put_field(&m, FIELD_DESTINATION, 's', dest);
+    }
+    if (*signature) {
+        put_field(&m, FIELD_SIGNATURE, 'g', signature);
+    }
+    const uint32_t fields = (uint32_t)(m.len - 16);
+    memcpy(m.p + 12, &fields, 4);
+    align(&m, 8);
+
+    const size_t body = m.len;
+    va_list ap;
+    va_start(ap, signature);
+    for (const char *t = signature; *t; ++t) {
+        if (*t == 's') {
+            put_str(&m, 's', va_arg(ap, const char *));
+        } else {
+            put_u32(&m, va_arg(ap, unsigned));
+        }
+    }
+    va_end(ap);
+    const uint32_t body_len = (uint32_t)(m.len - body);
+    memcpy(m.p + 4, &body_len, 4);
+    if (write(fd, m.p, m.len) != (ssize_t)m.len) {
+        perror("login1_stub: send failed (write)");
+        exit(1);
+    }
+}
+
+// Replies to a call with an error and its message.
+static void send_error(const struct msg *call, const char *name, const char *text) {
+    send_msg(ERROR, call->sender, NULL, NULL, NULL, name, call->serial, "s", text);
+}
+
+struct reader {
+    const uint8_t *p;
+    size_t len, pos;
+};
+
+static bool get_u32(struct reader *r, uint32_t *v) {
+    r->pos = (r->pos + 3) / 4 * 4;
+    if (r->pos + 4 > r->len) {
+        return false;
+    }
+    memcpy(v, r->p + r->pos, 4);
+    r->pos += 4;
+    return true;
+}
+
+static bool get_str(struct reader *r, char type, const char **s) {
+    uint32_t len;
+    if (type == 'g') {
+        if (r->pos >= r->len) {
+            return false;
+        }
+        len = r->p[r->pos++];
+    } else if (!get_u32(r, &len)) {
+        return false;
+    }
+    if (r->pos + len >= r->len || r->p[r->pos + len]) {
+        return false;
+    }
+    *s = (const char *)r->p + r->pos;
+    r->pos += len + 1;
+    return true;
+}
+
+static uint8_t in[MSG_MAX];
+static size_t in_len;
+
+static void fill(size_t want) {
+    while (in_len < want) {
+        const ssize_t n = read(fd, in + in_len, sizeof(in) - in_len);
+        if (n <= 0) {
+            exit(n == 0 ? 0 : 1);
+        }
+        in_len += (size_t)n;
+    }
+}
+
+// The next message from the bus, valid until the next call. Only
+// little-endian messages are expected, as everything here is local.
+static bool recv_msg(struct msg *msg) {
+    static size_t used;
+    memmove(in, in + used, in_len - used);
+    in_len -= used;
+    fill(16);
+    uint32_t body_len, fields_len;
+    memcpy(&body_len, in + 4, 4);
+    memcpy(&fields_len, in + 12, 4);
+    const size_t header = (16 + (size_t)fields_len + 7) / 8 * 8;
+    if (in[0] != 'l' || header + body_len > sizeof(in)) {
+        return false;
+    }
+    fill(header + body_len);
+    used = header + body_len;
+
+    *msg = (struct msg){ .type = in[1], .signature = "", .body = in + header, .body_len = body_len };
+    memcpy(&msg->serial, in + 8, 4);
+    struct reader r = { in, 16 + fields_len, 16 };
+    while (r.pos < r.len) {
+        const char *sig, *str = NULL;
+        uint32_t u;
+        r.pos = (r.pos + 7) / 8 * 8;
+        if (r.pos >= r.len) {
+            break;
+        }
+        const uint8_t code = in[r.pos++];
+        if (!get_str(&r, 'g', &sig)) {
+            return false;
+        }
+        if (!strcmp(sig, "u")) {
+            if (!get_u32(&r, &u)) {
+                return false;
+            }
+            if (code == FIELD_REPLY_SERIAL) {
+                msg->reply_serial = u;
+            }
+            continue;
+        }
+        if (!get_str(&r, *sig, &str)) {
+            return false;
+        }
+        if (code == FIELD_INTERFACE) {
+            msg->interface = str;
+        } else if (code == FIELD_MEMBER) {
+            msg->member = str;
+        } else if (code == FIELD_SENDER) {
+            msg->sender = str;
+        } else if (code == FIELD_SIGNATURE) {
+            msg->signature = str;
+        }
+    }
+    return true;
+}
+
+static void connect_bus(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    char auth[64];
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1
+        || connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("login1_stub: connect failed");
+        exit(1);
+    }
+    char uid[16];
+    const int uid_len = snprintf(uid, sizeof(uid), "%u", (unsigned)getuid());
+    int len = snprintf(auth, sizeof(auth), "%cAUTH EXTERNAL ", '\0');
+    for (int n = 0; n < uid_len; ++n) {
+        len += snprintf(auth + len, sizeof(auth) - (size_t)len, "%02x", (unsigned char)uid[n]);
+    }
+    len += snprintf(auth + len, sizeof(auth) - (size_t)len, "\r\n");
+    if (write(fd, auth, (size_t)len) != len) {
+        perror("login1_stub: auth failed (write)");
+        exit(1);
+    }
+    // Nothing is sent before BEGIN, so the OK line is all there is.
+    fill(2);
+    while (!memchr(in, '\n', in_len)) {
+        fill(in_len + 1);
+    }
+    if (memcmp(in, "OK ", 3)) {
+        fprintf(stderr, "login1_stub: authentication rejected\n");
+        exit(1);
+    }
+    in_len = 0;
+    if (write(fd, "BEGIN\r\n", 7) != 7) {
+        perror("login1_stub: auth failed (write)");
+        exit(1);
+    }
+}
+
+static void set_brightness(const struct msg *msg, const char *dir, bool deny) {
+    struct reader r = { msg->body, msg->body_len, 0 };
+    const char *subsystem, *name;
+    uint32_t value;
+    if (strcmp(msg->signature, "ssu") || !get_str(&r, 's', &subsystem) || !get_str(&r, 's', &name)
+        || !get_u32(&r, &value)) {
+        send_error(msg, "org.freedesktop.DBus.Error.InvalidArgs", "SetBrightness takes (ssu)");
+        return;
+    }
+    printf("SetBrightness %s %s %u\n", subsystem, name, (unsigned)value);
+    fflush(stdout);
+    const char *base = strrchr(dir, '/');
+    if (deny || strcmp(subsystem, "backlight") || strcmp(name, base ? base + 1 : dir)) {
+        send_error(msg, "org.freedesktop.DBus.Error.AccessDenied", "not this session's device");
+        return;
+    }
+    char path[512];
+    snprintf(path, sizeof(path), "%s/brightness", dir);
+    FILE *f = fopen(path, "w");
+    if (!f || fprintf(f, "%u\n", (unsigned)value) < 0 || fclose(f) == EOF) {
+        send_error(msg, "org.freedesktop.DBus.Error.IOError", "write failed");
+        return;
+    }
+    send_msg(METHOD_RETURN, msg->sender, NULL, NULL, NULL, NULL, msg->serial, "");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <bus socket> <backlight dir> [deny]\n", argv[0]);
+        return 2;
+    }
+    const bool deny = argc > 3 && !strcmp(argv[3], "deny");
+    connect_bus(argv[1]);
+    send_msg(METHOD_CALL, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "Hello", NULL, 0,
+        "");
+    // Without queueing: a name someone else owns is an error, not a wait.
+    send_msg(METHOD_CALL, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "RequestName",
+        NULL, 0, "su", "org.freedesktop.login1", 4u);
+    const uint32_t request = serial;
+
+    struct msg msg;
+    while (recv_msg(&msg)) {
+        if (msg.reply_serial == request) {
+            struct reader r = { msg.body, msg.body_len, 0 };
+            uint32_t result;
+            if (msg.type != METHOD_RETURN || !get_u32(&r, &result) || result != 1) {
+                fprintf(stderr, "login1_stub: could not own org.freedesktop.login1\n");
+                return 1;
+            }
+            printf("ready\n");
+            fflush(stdout);
+        } else if (msg.type == METHOD_CALL && msg.member && !strcmp(msg.member, "SetBrightness") && msg.interface
+            && !strcmp(msg.interface, "org.freedesktop.login1.Session")) {
+            set_brightness(&msg, argv[2], deny);
+        } else if (msg.type == METHOD_CALL) {
+            send_error(&msg, "org.freedesktop.DBus.Error.UnknownMethod", "only SetBrightness is stubbed");
+        }
+    }
+    fprintf(stderr, "login1_stub: bad message\n");
+    return 1;
+}
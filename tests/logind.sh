@@ -0,0 +1,77 @@
+#!/bin/sh
+# Copyright (C) angelsl 2021
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+# The logind backend against tests/login1_stub on a private dbus-daemon:
+# one-shot and daemon steps become SetBrightness calls with the right
+# device and value, and a refused call is reported rather than written.
+
+. tests/lib.sh
+
+command -v dbus-daemon > /dev/null || { echo "no dbus-daemon"; exit 77; }
+cat > "$tmp/bus.conf" << CONF
+<!DOCTYPE busconfig PUBLIC "-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <listen>unix:path=$tmp/bus</listen>
+  <auth>EXTERNAL</auth>
+  <policy context="default">
+    <allow user="*"/>
+    <allow own="*"/>
+    <allow send_destination="*"/>
+    <allow receive_sender="*"/>
+  </policy>
+</busconfig>
+CONF
+dbus-daemon --nofork --nopidfile --config-file="$tmp/bus.conf" 2> "$tmp/bus.log" &
+bus_pid=$!
+stub_pid=
+trap 'stop_daemon; [ -n "$stub_pid" ] && kill $stub_pid; kill $bus_pid; rm -rf "$tmp"' EXIT
+wait_for 5 test -S "$tmp/bus" || fail "dbus-daemon did not start"
+export DBUS_SYSTEM_BUS_ADDRESS="unix:path=$tmp/bus"
+
+# start_stub [deny]
+start_stub() {
+    [ -n "$stub_pid" ] && kill $stub_pid && wait $stub_pid 2> /dev/null
+    tests/login1_stub "$tmp/bus" "$tmp/backlight" "$@" > "$tmp/calls" &
+    stub_pid=$!
+    wait_for 5 grep -q ready "$tmp/calls" || fail "login1 stub did not start"
+}
+
+calls() {
+    grep -c SetBrightness "$tmp/calls"
+}
+
+backlight 1000 500
+config "brightness_backend = logind"
+start_stub
+
+./sltpwmt b 30 > /dev/null || fail "one-shot b 30 failed"
+grep -q "SetBrightness backlight backlight 530" "$tmp/calls" || fail "one-shot step not sent as SetBrightness"
+brightness_in 530 530 || fail "one-shot step not written by the stub"
+
+# The daemon keeps one connection and does not wait for each reply.
+start_daemon
+for n in 1 2 3; do
+    ./sltpwmt b 10 > /dev/null || fail "daemon step $n failed"
+done
+wait_for 2 brightness_in 560 560 || fail "daemon steps did not add up to 560"
+[ "$(calls)" -eq 4 ] || fail "expected 4 SetBrightness calls, got $(calls)"
+stop_daemon
+
+# A refused call fails the step and leaves the backlight alone.
+start_stub deny
+./sltpwmt b 10 > /dev/null 2> "$tmp/denied" && fail "refused SetBrightness reported as done"
+grep -q AccessDenied "$tmp/denied" || fail "refusal not reported: $(cat "$tmp/denied")"
+brightness_in 560 560 || fail "refused step changed the brightness"
+
+# So is a bus with no logind on it.
+kill $stub_pid
+wait $stub_pid 2> /dev/null
+stub_pid=
+./sltpwmt b 10 > /dev/null 2>&1 && fail "step without logind reported as done"
+
+echo "SetBrightness sent one-shot and pipelined from the daemon, refusals reported"
@@ -0,0 +1,144 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifndef SLTPWMT_TESTS_PA_H
+#define SLTPWMT_TESTS_PA_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <pulse/pulseaudio.h>
+
+#include "tests/fakepa_server.h"
+#include "libsltpwmt.h"
+
+// Runs libsltpwmt against fakepa, both on one pa_mainloop in this process,
+// so a test drives the client and looks straight at what the server holds.
+
+struct test_pa {
+    pa_mainloop *loop;
+    pa_mainloop_api *api;
+    struct sltp_fakepa *server;
+    struct sltp_ctx *ctx;
+    char dir[64];
+    char path[96];
+    int failures;
+};
+
+// Every check is reported, so one run shows everything that broke.
+static inline void test_check(struct test_pa *t, bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        ++t->failures;
+    }
+}
+
+static inline void test_pa_timeout(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    (void)a; (void)e; (void)tv;
+    *(bool *)userdata = true;
+}
+
+// Runs the loop until *flag is set or ms have gone by. Returns *flag.
+static inline bool test_pa_wait(struct test_pa *t, const bool *flag, unsigned ms) {
+    bool expired = false;
+    struct timeval tv;
+    pa_time_event *e = t->api->time_new(t->api, pa_timeval_add(pa_gettimeofday(&tv), (pa_usec_t)ms * PA_USEC_PER_MSEC),
+        test_pa_timeout, &expired);
+    while (!*flag && !expired && pa_mainloop_iterate(t->loop, 1, NULL) >= 0) {
+    }
+    if (!expired) {
+        t->api->time_free(e);
+    }
+    return *flag;
+}
+
+// Lets the loop run for ms, e.g. for events to settle.
+static inline void test_pa_run(struct test_pa *t, unsigned ms) {
+    const bool never = false;
+    test_pa_wait(t, &never, ms);
+}
+
+static inline void test_pa_state(struct sltp_ctx *ctx, const struct sltp_state *st, void *userdata) {
+    (void)ctx;
+    *(bool *)userdata = (st->valid & SLTP_STATE_SINK) && (st->valid & SLTP_STATE_SOURCE);
+}
+
+// Exit status for a test that cannot run here; tests/run.sh skips it.
+#define TEST_SKIP 77
+
+// Returns 0 once libsltpwmt is connected to a fresh fakepa and knows its
+// default sink and source. When the client never reached the server, as
+// with a libpulse that does not honour PULSE_SERVER, returns TEST_SKIP; a
+// client that connected and then failed is a failure, returning 1.
+static inline int test_pa_start(struct test_pa *t, const struct sltp_fakepa_opts *opts) {
+    char server[128];
+    bool ready = false;
+    *t = (struct test_pa){0};
+    snprintf(t->dir, sizeof(t->dir), "/tmp/sltpwmt-test.XXXXXX");
+    if (!mkdtemp(t->dir)) {
+        perror("mkdtemp failed");
+        return 1;
+    }
+    snprintf(t->path, sizeof(t->path), "%s/native", t->dir);
+    snprintf(server, sizeof(server), "unix:%s", t->path);
+    setenv("PULSE_SERVER", server, 1);
+    if (!(t->loop = pa_mainloop_new())) {
+        return 1;
+    }
+    t->api = pa_mainloop_get_api(t->loop);
+    if (!(t->server = sltp_fakepa_new(t->api, t->path, opts)) || !(t->ctx = sltp_new(t->api))) {
+        return 1;
+    }
+    sltp_set_state_callback(t->ctx, test_pa_state, &ready);
+    if (sltp_connect(t->ctx) || !test_pa_wait(t, &ready, 5000)) {
+        if (!sltp_fakepa_connections(t->server)) {
+            printf("libpulse never connected to fakepa\n");
+            return TEST_SKIP;
+        }
+        fprintf(stderr, "FAILED: connected to fakepa but never learned the default sink and source\n");
+        return 1;
+    }
+    sltp_set_state_callback(t->ctx, NULL, NULL);
+    return 0;
+}
+
+static inline void test_pa_stop(struct test_pa *t) {
+    sltp_free(t->ctx);
+    sltp_fakepa_free(t->server);
+    if (t->loop) {
+        pa_mainloop_free(t->loop);
+    }
+    rmdir(t->dir);
+}
+
+struct test_result {
+    bool done;
+    struct sltp_result res;
+};
+
+static inline void test_pa_result(struct sltp_ctx *ctx, const struct sltp_result *res, void *userdata) {
+    (void)ctx;
+    struct test_result *r = userdata;
+    r->res = *res;
+    r->done = true;
+}
+
+// Waits for an op started with test_pa_result; true if it completed and
+// succeeded.
+static inline bool test_pa_done(struct test_pa *t, struct test_result *r) {
+    if (!test_pa_wait(t, &r->done, 5000)) {
+        fprintf(stderr, "no result\n");
+        return false;
+    }
+    if (r->res.status) {
+        fprintf(stderr, "failed: %s\n", r->res.msg);
+    }
+    return !r->res.status;
+}
+
+#endif
@@ -0,0 +1,153 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <math.h>
+#include <time.h>
+
+#include "tests/pa.h"
+
+// Volume ramps as fakepa sees them: every sink volume it is sent is
+// recorded with the time it arrived. A ramp must move one way only, evenly
+// in dB and no lower than -60 dB on the way, send at most one update per
+// 16 ms frame, and end exactly on the target. A step mid-ramp carries on
+// from where the ramp got to.
+
+#define SAMPLES_MAX 256
+
+static const unsigned DURATION_MS = 200;
+static const double FRAME_MS = 16;
+static const double FLOOR_DB = -60;
+
+struct sample {
+    double ms;
+    pa_volume_t volume;
+};
+
+struct recorder {
+    double start_ms;
+    size_t n;
+    struct sample samples[SAMPLES_MAX];
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void record(struct sltp_fakepa *s, pa_subscription_event_type_t t, uint32_t index, void *userdata) {
+    struct recorder *rec = userdata;
+    if ((t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) != PA_SUBSCRIPTION_EVENT_SINK || rec->n == SAMPLES_MAX) {
+        return;
+    }
+    const pa_cvolume *v = sltp_fakepa_volume(s, PA_SUBSCRIPTION_EVENT_SINK, index, NULL);
+    if (v) {
+        rec->samples[rec->n++] = (struct sample){ .ms = now_ms() - rec->start_ms, .volume = pa_cvolume_max(v) };
+    }
+}
+
+static double db(pa_volume_t v) {
+    const double d = pa_sw_volume_to_dB(v);
+    return d < FLOOR_DB ? FLOOR_DB : d;
+}
+
+// Checks a recorded ramp from one volume to another that was not retargeted.
+static void check_ramp(struct test_pa *t, const struct recorder *rec, pa_volume_t from, pa_volume_t to) {
+    const size_t n = rec->n;
+    test_check(t, n >= DURATION_MS / FRAME_MS / 2, "ramp sent a volume every frame");
+    if (n < 2) {
+        return;
+    }
+    test_check(t, rec->samples[n - 1].volume == to, "ramp ends exactly on the target");
+
+    // One frame's worth of movement either side of the straight line in dB.
+    const double from_db = db(from), to_db = db(to);
+    const double slack = fabs(to_db - from_db) * (FRAME_MS + 4) / DURATION_MS + 0.1;
+    bool monotonic = true, floored = true, even = true, paced = true;
+    for (size_t i = 0; i < n; ++i) {
+        const struct sample *s = &rec->samples[i];
+        if (i > 0) {
+            const pa_volume_t prev = rec->samples[i - 1].volume;
+            monotonic &= to > from ? s->volume >= prev : s->volume <= prev;
+            paced &= s->ms - rec->samples[i - 1].ms >= FRAME_MS - 1;
+        }
+        if (i == n - 1) {
+            break;
+        }
+        floored &= pa_sw_volume_to_dB(s->volume) >= FLOOR_DB - 0.1;
+        const double frac = s->ms >= DURATION_MS ? 1 : s->ms / DURATION_MS;
+        even &= fabs(db(s->volume) - (from_db + (to_db - from_db) * frac)) <= slack;
+    }
+    test_check(t, monotonic, "ramp moves one way only");
+    test_check(t, floored, "ramp stays at or above -60 dB until it lands");
+    test_check(t, even, "ramp is even in dB");
+    test_check(t, paced, "at most one volume per frame");
+}
+
+// Steps by delta with the ramp on, recording from the start of the step.
+static pa_volume_t ramp_step(struct test_pa *t, struct recorder *rec, int delta, const char *what) {
+    struct test_result r = {0};
+    *rec = (struct recorder){ .start_ms = now_ms() };
+    sltp_volume_step_async(t->ctx, delta, test_pa_result, &r);
+    test_check(t, test_pa_done(t, &r), what);
+    test_check(t, now_ms() - rec->start_ms >= DURATION_MS, "step answered once the ramp lands");
+    return (pa_volume_t)r.res.value;
+}
+
+int main(void) {
+    struct test_pa t;
+    struct recorder rec;
+    const struct sltp_fakepa_opts opts = { .inputs = 1 };
+    int ret;
+    if ((ret = test_pa_start(&t, &opts))) {
+        test_pa_stop(&t);
+        return ret;
+    }
+    sltp_set_volume_snap(t.ctx, 0);
+    sltp_set_volume_ramp(t.ctx, (pa_usec_t)DURATION_MS * PA_USEC_PER_MSEC);
+    sltp_fakepa_set_callback(t.server, record, &rec);
+    const pa_volume_t start = pa_cvolume_max(sltp_fakepa_volume(t.server, PA_SUBSCRIPTION_EVENT_SINK, 0, NULL));
+
+    // Down to silence: the ramp bottoms out at -60 dB, then lands on 0.
+    pa_volume_t target = ramp_step(&t, &rec, -(int)start, "ramp down");
+    test_check(&t, target == PA_VOLUME_MUTED, "stepped to silence");
+    check_ramp(&t, &rec, start, target);
+    const size_t down = rec.n;
+
+    // And back up, starting from -60 dB rather than from silence.
+    target = ramp_step(&t, &rec, (int)start, "ramp up");
+    check_ramp(&t, &rec, PA_VOLUME_MUTED, target);
+    test_check(&t, rec.n > 0 && fabs(db(rec.samples[0].volume) - FLOOR_DB) < 3, "ramp up starts near -60 dB");
+    const size_t up = rec.n;
+
+    // Retargeted halfway: the first step is answered at once, and the
+    // volume keeps going the same way until it lands on the second target.
+    struct test_result first = {0}, second = {0};
+    rec = (struct recorder){ .start_ms = now_ms() };
+    sltp_volume_step_async(t.ctx, (int)PA_VOLUME_NORM / 4, test_pa_result, &first);
+    test_pa_run(&t, DURATION_MS / 2);
+    test_check(&t, !first.done, "first step still ramping");
+    const size_t before = rec.n;
+    sltp_volume_step_async(t.ctx, (int)PA_VOLUME_NORM / 8, test_pa_result, &second);
+    test_pa_run(&t, 5);
+    test_check(&t, first.done && !first.res.status, "superseded step answered");
+    test_check(&t, test_pa_done(&t, &second), "retargeted step");
+    bool monotonic = rec.n > before;
+    for (size_t i = 1; i < rec.n; ++i) {
+        monotonic &= rec.samples[i].volume >= rec.samples[i - 1].volume;
+    }
+    test_check(&t, monotonic, "retargeted ramp keeps going up without a jump back");
+    test_check(&t, rec.n > 0 && rec.samples[rec.n - 1].volume == (pa_volume_t)second.res.value,
+        "retargeted ramp ends on the second target");
+    test_check(&t, second.res.value == (int)(start + PA_VOLUME_NORM / 4 + PA_VOLUME_NORM / 8),
+        "second target builds on the first");
+
+    printf("%s: %zu volumes down, %zu up, %zu retargeted\n", t.failures ? "ramp checks failed" : "ramps even in dB",
+        down, up, rec.n);
+    const int failures = t.failures;
+    test_pa_stop(&t);
+    return failures != 0;
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Copyright (C) angelsl 2021
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+# Runs each test given and reports it. A test exits 77 when what it needs
+# (a device, a server) is not there, and is skipped rather than failed.
+
+failed=0
+for t in "$@"; do
+    out=$("$t" 2>&1)
+    case $? in
+    0) result=PASS ;;
+    77) result=SKIP ;;
+    *) result=FAIL; failed=1 ;;
+    esac
+    echo "$result: $t"
+    [ -n "$out" ] && echo "$out" | sed 's/^/    /'
+done
+exit $failed
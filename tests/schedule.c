@@ -0,0 +1,118 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "schedule.h"
+
+// The schedule plan at chosen moments, with the zone set through TZ as a
+// POSIX rule so no tzdata is needed: levels and next changes across
+// midnight, fades that run past it, points that fall in the spring-forward
+// gap, and a config without a schedule.
+
+static const int64_t USEC = 1000000;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+static void zone(const char *tz) {
+    setenv("TZ", tz, 1);
+    tzset();
+}
+
+// usec since the epoch of a UTC date and time.
+static int64_t utc(int year, int month, int day, int hour, int min) {
+    struct tm t = { .tm_year = year - 1900, .tm_mon = month - 1, .tm_mday = day, .tm_hour = hour, .tm_min = min };
+    return (int64_t)timegm(&t) * USEC;
+}
+
+static void schedule(struct sltp_config *cfg, uint32_t fade_s, uint32_t n, const uint32_t *seconds,
+    const double *fracs) {
+    sltp_config_defaults(cfg);
+    cfg->schedule_fade_s = fade_s;
+    cfg->schedule_points = n;
+    for (uint32_t k = 0; k < n; ++k) {
+        cfg->schedule[k] = (struct sltp_config_time){ .second = seconds[k], .frac = fracs[k] };
+    }
+}
+
+static struct sltp_schedule_step plan(const struct sltp_config *cfg, int64_t now, int max_brightness) {
+    struct sltp_schedule_step step = { .frac = -1, .next = -1 };
+    check(sltp_schedule_plan(cfg, now, max_brightness, &step) == 0, "planned");
+    check(step.next > now, "next change is after now");
+    return step;
+}
+
+static bool near(double a, double b) {
+    return fabs(a - b) < 1e-9;
+}
+
+int main(void) {
+    struct sltp_config cfg;
+
+    // No points, no plan.
+    sltp_config_defaults(&cfg);
+    struct sltp_schedule_step step;
+    check(sltp_schedule_plan(&cfg, utc(2026, 1, 1, 12, 0), 1000, &step) == -1, "empty schedule has no plan");
+
+    zone("UTC0");
+    schedule(&cfg, 600, 2, (const uint32_t[]){ 7 * 3600, 22 * 3600 }, (const double[]){ 1.0, 0.2 });
+
+    // Held overnight: the next change is tomorrow's first point, both before
+    // and after midnight.
+    step = plan(&cfg, utc(2026, 1, 1, 23, 0), 1000);
+    check(near(step.frac, 0.2) && step.next == utc(2026, 1, 2, 7, 0), "evening level held until tomorrow 07:00");
+    step = plan(&cfg, utc(2026, 1, 2, 3, 0), 1000);
+    check(near(step.frac, 0.2) && step.next == utc(2026, 1, 2, 7, 0), "before the first point, yesterday's last holds");
+
+    // Halfway through the morning fade. Without a brightness range the next
+    // change is the end of the fade; with one, the next whole step.
+    const int64_t mid = utc(2026, 1, 2, 7, 5);
+    step = plan(&cfg, mid, 0);
+    check(near(step.frac, 0.6) && step.next == utc(2026, 1, 2, 7, 10), "fade ends at 07:10");
+    step = plan(&cfg, mid, 1000);
+    check(near(step.frac, 0.6), "halfway through the fade");
+    const struct sltp_schedule_step after = plan(&cfg, step.next, 1000);
+    const struct sltp_schedule_step before = plan(&cfg, step.next - 1, 1000);
+    check(lround(after.frac * 1000) == 601 && lround(before.frac * 1000) == 600,
+        "next change is exactly where 600 rounds to 601");
+
+    // A fade into a point just before midnight carries on into the next day.
+    schedule(&cfg, 600, 2, (const uint32_t[]){ 7 * 3600, 23 * 3600 + 55 * 60 }, (const double[]){ 1.0, 0.2 });
+    step = plan(&cfg, utc(2026, 1, 2, 0, 2), 0);
+    check(near(step.frac, 1.0 - 0.8 * 0.7) && step.next == utc(2026, 1, 2, 0, 5), "fade runs past midnight");
+    step = plan(&cfg, utc(2026, 1, 2, 0, 6), 0);
+    check(near(step.frac, 0.2) && step.next == utc(2026, 1, 2, 7, 0), "faded level held after midnight");
+
+    // US Eastern: on 2026-03-08 the clocks go from 02:00 EST (07:00 UTC)
+    // to 03:00 EDT, so 02:30 never happens that day.
+    zone("EST5EDT,M3.2.0,M11.1.0");
+    schedule(&cfg, 0, 2, (const uint32_t[]){ 2 * 3600 + 30 * 60, 12 * 3600 }, (const double[]){ 0.5, 1.0 });
+    step = plan(&cfg, utc(2026, 3, 8, 6, 59), 0);
+    check(near(step.frac, 1.0), "yesterday's noon level before the gap");
+    check(step.next >= utc(2026, 3, 8, 7, 0) && step.next <= utc(2026, 3, 8, 7, 30),
+        "point in the gap lands by 03:30 EDT");
+    check(near(plan(&cfg, step.next, 0).frac, 0.5), "and takes effect then");
+    step = plan(&cfg, utc(2026, 3, 8, 7, 10), 0);
+    check(near(step.frac, 0.5), "03:10 EDT is after the 02:30 point");
+    check(step.next == utc(2026, 3, 8, 16, 0), "noon is 12:00 EDT, an hour earlier in UTC than the day before");
+    check(plan(&cfg, utc(2026, 3, 7, 16, 59), 0).next == utc(2026, 3, 7, 17, 0), "noon the day before is 12:00 EST");
+
+    printf("%s\n", failures ? "schedule checks failed" : "schedule planned across midnight, fades and DST");
+    return failures != 0;
+}
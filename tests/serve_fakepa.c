@@ -0,0 +1,96 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <pulse/pulseaudio.h>
+
+#include "eloop.h"
+#include "tests/fakepa_server.h"
+
+// Serves the stand-in PulseAudio until interrupted; point clients at it
+// with PULSE_SERVER=unix:<socket>.
+
+static void stop(pa_mainloop_api *m, pa_signal_event *e, int sig, void *userdata) {
+    (void)e; (void)sig; (void)userdata;
+    m->quit(m, 0);
+}
+
+static void print_usage(void) {
+    fprintf(stderr, "usage: tests/serve_fakepa [-l reply latency us] [-e fail every nth request]\n"
+        "                          [-k hang up on nth request] [-r(efuse auth)] [-i sink inputs] <socket>\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct sltp_fakepa_opts opts = { .inputs = 1 };
+    unsigned long long latency;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:e:k:ri:")) != -1) {
+        switch (opt) {
+        case 'l':
+            if (sscanf(optarg, "%llu", &latency) < 1) {
+                print_usage();
+                return 1;
+            }
+            opts.latency = latency;
+            break;
+        case 'e':
+            if (sscanf(optarg, "%u", &opts.fail_every) < 1) {
+                print_usage();
+                return 1;
+            }
+            break;
+        case 'k':
+            if (sscanf(optarg, "%u", &opts.drop_after) < 1) {
+                print_usage();
+                return 1;
+            }
+            break;
+        case 'r':
+            opts.refuse_auth = true;
+            break;
+        case 'i':
+            if (sscanf(optarg, "%u", &opts.inputs) < 1) {
+                print_usage();
+                return 1;
+            }
+            break;
+        default:
+            print_usage();
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        print_usage();
+        return 1;
+    }
+
+    int ret = 1;
+    struct sltp_eloop *loop = sltp_eloop_new();
+    if (!loop) {
+        return 1;
+    }
+    pa_mainloop_api *api = sltp_eloop_get_api(loop);
+    if (pa_signal_init(api)) {
+        fprintf(stderr, "pa_signal_init failed\n");
+        sltp_eloop_free(loop);
+        return 1;
+    }
+    pa_signal_new(SIGINT, stop, NULL);
+    pa_signal_new(SIGTERM, stop, NULL);
+
+    struct sltp_fakepa *server = sltp_fakepa_new(api, argv[optind], &opts);
+    if (server && sltp_eloop_run(loop, &ret) < 0) {
+        ret = 1;
+    }
+    sltp_fakepa_free(server);
+    pa_signal_done();
+    sltp_eloop_free(loop);
+    return ret;
+}
@@ -0,0 +1,55 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <time.h>
+
+#include "tests/pa.h"
+
+// Times sink-next against fakepa with more and more streams playing. Every
+// reply is held back by LATENCY, so a switch that waited for each move in
+// turn would take streams * LATENCY; pipelined it stays a few round trips.
+
+static const pa_usec_t LATENCY = 5000;
+static const unsigned STREAMS[] = { 1, 50, 200 };
+static const double LIMIT_MS = 200;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+int main(void) {
+    int failures = 0;
+    for (size_t n = 0; n < sizeof(STREAMS) / sizeof(*STREAMS); ++n) {
+        struct test_pa t;
+        const struct sltp_fakepa_opts opts = { .latency = LATENCY, .inputs = STREAMS[n] };
+        int ret;
+        if ((ret = test_pa_start(&t, &opts))) {
+            test_pa_stop(&t);
+            return ret;
+        }
+
+        struct test_result r = {0};
+        const double start = now_ms();
+        sltp_sink_next_async(t.ctx, test_pa_result, &r);
+        test_check(&t, test_pa_done(&t, &r), "sink-next");
+        const double ms = now_ms() - start;
+        printf("%u streams: switched in %.1f ms with %.1f ms per reply\n", STREAMS[n], ms, (double)LATENCY / 1e3);
+
+        test_check(&t, r.res.value == (int)STREAMS[n], "every stream moved");
+        for (uint32_t i = 0; i < STREAMS[n]; ++i) {
+            if (sltp_fakepa_input_sink(t.server, i) != sltp_fakepa_default_sink(t.server)) {
+                test_check(&t, false, "stream on the new default sink");
+                break;
+            }
+        }
+        test_check(&t, ms < LIMIT_MS, "switch takes a few round trips, not one per stream");
+        failures += t.failures;
+        test_pa_stop(&t);
+    }
+    return failures != 0;
+}
@@ -0,0 +1,94 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "state.h"
+
+// One writer publishes states whose every word is derived from a counter;
+// readers check that each snapshot sltp_state_read accepts came from a
+// single write, and that they never see the counter go backwards.
+
+#define READERS 4
+#define WRITES 2000000u
+
+static struct sltp_state_page page = { .magic = SLTP_STATE_MAGIC, .version = SLTP_STATE_VERSION };
+static _Atomic bool done = false;
+
+struct reader {
+    pthread_t thread;
+    unsigned long accepted;
+    unsigned long torn;
+};
+
+static struct sltp_state state_for(uint32_t i) {
+    return (struct sltp_state){
+        .valid = i,
+        .brightness = (int32_t)(i * 3),
+        .max_brightness = (int32_t)~i,
+        .volume = i ^ 0x5a5a5a5au,
+        .muted = (int32_t)(i * 7),
+        .mic_muted = -(int32_t)i,
+    };
+}
+
+static void *writer(void *arg) {
+    (void)arg;
+    for (uint32_t i = 1; i <= WRITES; ++i) {
+        const struct sltp_state st = state_for(i);
+        sltp_state_write(&page, &st);
+    }
+    atomic_store(&done, true);
+    return NULL;
+}
+
+static void *reader(void *arg) {
+    struct reader *r = arg;
+    uint32_t last = 0;
+    while (!atomic_load_explicit(&done, memory_order_relaxed)) {
+        struct sltp_state st;
+        if (sltp_state_read(&page, &st) < 0) {
+            continue;
+        }
+        const struct sltp_state want = state_for(st.valid);
+        if (memcmp(&st, &want, sizeof(st)) || st.valid < last) {
+            ++r->torn;
+        }
+        last = st.valid;
+        ++r->accepted;
+    }
+    return NULL;
+}
+
+int main(void) {
+    struct reader readers[READERS] = {0};
+    pthread_t w;
+    const struct sltp_state first = state_for(0);
+    sltp_state_write(&page, &first);
+    for (size_t n = 0; n < READERS; ++n) {
+        if (pthread_create(&readers[n].thread, NULL, reader, &readers[n])) {
+            perror("pthread_create failed");
+            return 1;
+        }
+    }
+    if (pthread_create(&w, NULL, writer, NULL)) {
+        perror("pthread_create failed");
+        return 1;
+    }
+    pthread_join(w, NULL);
+
+    unsigned long accepted = 0, torn = 0;
+    for (size_t n = 0; n < READERS; ++n) {
+        pthread_join(readers[n].thread, NULL);
+        accepted += readers[n].accepted;
+        torn += readers[n].torn;
+    }
+    printf("%u writes, %lu snapshots read by %d readers, %lu torn\n", WRITES, accepted, READERS, torn);
+    return torn || !accepted;
+}
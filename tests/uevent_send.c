@@ -0,0 +1,73 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+// For tests/hotplug.sh: multicasts one uevent the way udev does, to the
+// udev group with udev's header, or with -k in the kernel's own format to
+// the kernel group, as only the kernel should. Exits 77 when this process
+// may not send uevents at all.
+//
+//     tests/uevent_send [-k] <action> <subsystem> <devpath>
+
+struct udev_header {
+    char prefix[8];
+    uint32_t magic;
+    uint32_t header_size;
+    uint32_t properties_off;
+    uint32_t properties_len;
+    uint32_t filter_subsystem_hash;
+    uint32_t filter_devtype_hash;
+    uint32_t filter_tag_bloom_hi;
+    uint32_t filter_tag_bloom_lo;
+};
+
+int main(int argc, char *argv[]) {
+    const int kernel = argc == 5 && !strcmp(argv[1], "-k");
+    if (argc != 4 + kernel) {
+        fprintf(stderr, "usage: %s [-k] <action> <subsystem> <devpath>\n", argv[0]);
+        return 2;
+    }
+    const char *action = argv[1 + kernel], *subsystem = argv[2 + kernel], *devpath = argv[3 + kernel];
+
+    char props[1024];
+    const int props_len = snprintf(props, sizeof(props), "ACTION=%s%cDEVPATH=%s%cSUBSYSTEM=%s%cSEQNUM=1%c", action,
+        '\0', devpath, '\0', subsystem, '\0', '\0');
+    char buf[2048];
+    size_t len;
+    if (kernel) {
+        len = (size_t)snprintf(buf, sizeof(buf), "%s@%s", action, devpath) + 1;
+    } else {
+        const struct udev_header h = {
+            .prefix = "libudev",
+            .magic = htonl(0xfeedcafe),
+            .header_size = sizeof(h),
+            .properties_off = sizeof(h),
+            .properties_len = (uint32_t)props_len,
+        };
+        memcpy(buf, &h, sizeof(h));
+        len = sizeof(h);
+    }
+    memcpy(buf + len, props, (size_t)props_len);
+    len += (size_t)props_len;
+
+    const struct sockaddr_nl to = { .nl_family = AF_NETLINK, .nl_groups = kernel ? 1 : 2 };
+    const int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd == -1 || sendto(fd, buf, len, 0, (const struct sockaddr *)&to, sizeof(to)) != (ssize_t)len) {
+        const int err = errno;
+        perror("uevent_send: send failed");
+        return err == EPERM || err == EACCES || err == EPROTONOSUPPORT || err == EAFNOSUPPORT ? 77 : 1;
+    }
+    close(fd);
+    return 0;
+}
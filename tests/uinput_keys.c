@@ -0,0 +1,117 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+
+// A virtual keyboard for tests/hotkeys.sh. It prints "ready" once the
+// device exists, then plays the commands read from stdin, one per line:
+//   tap <key>             press and release
+//   hold <key> <repeats>  press, autorepeat, release, 5 ms apart
+//   sleep <ms>
+// and removes the device at end of input. Exits 77 without /dev/uinput.
+
+static const struct {
+    const char *name;
+    unsigned code;
+} KEYS[] = {
+    { "brightnessup", KEY_BRIGHTNESSUP },
+    { "brightnessdown", KEY_BRIGHTNESSDOWN },
+    { "volumeup", KEY_VOLUMEUP },
+    { "volumedown", KEY_VOLUMEDOWN },
+    { "mute", KEY_MUTE },
+    { "micmute", KEY_MICMUTE },
+};
+
+static int fd;
+
+static void sleep_ms(long ms) {
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = ms % 1000 * 1000000 };
+    while (nanosleep(&ts, &ts) && errno == EINTR) {
+    }
+}
+
+static void emit(unsigned type, unsigned code, int value) {
+    struct input_event ev = { .type = type, .code = code, .value = value };
+    if (write(fd, &ev, sizeof(ev)) != sizeof(ev)) {
+        perror("emit failed (write)");
+        exit(1);
+    }
+}
+
+static void key(unsigned code, int value) {
+    emit(EV_KEY, code, value);
+    emit(EV_SYN, SYN_REPORT, 0);
+}
+
+static int lookup(const char *const name) {
+    for (size_t n = 0; n < sizeof(KEYS) / sizeof(KEYS[0]); ++n) {
+        if (!strcmp(KEYS[n].name, name)) {
+            return (int)KEYS[n].code;
+        }
+    }
+    fprintf(stderr, "unknown key %s\n", name);
+    exit(1);
+}
+
+int main(void) {
+    if ((fd = open("/dev/uinput", O_WRONLY | O_CLOEXEC)) == -1) {
+        perror("main: no virtual keyboard (open /dev/uinput)");
+        return 77;
+    }
+
+    struct uinput_setup setup = { .id = { .bustype = BUS_VIRTUAL }, .name = "sltpwmt test keys" };
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) == -1) {
+        perror("main failed (UI_SET_EVBIT)");
+        return 1;
+    }
+    for (size_t n = 0; n < sizeof(KEYS) / sizeof(KEYS[0]); ++n) {
+        if (ioctl(fd, UI_SET_KEYBIT, KEYS[n].code) == -1) {
+            perror("main failed (UI_SET_KEYBIT)");
+            return 1;
+        }
+    }
+    if (ioctl(fd, UI_DEV_SETUP, &setup) == -1 || ioctl(fd, UI_DEV_CREATE) == -1) {
+        perror("main failed (UI_DEV_CREATE)");
+        return 1;
+    }
+    printf("ready\n");
+    fflush(stdout);
+
+    char line[128], name[32];
+    long arg;
+    while (fgets(line, sizeof(line), stdin)) {
+        if (sscanf(line, "tap %31s", name) == 1) {
+            const unsigned code = (unsigned)lookup(name);
+            key(code, 1);
+            key(code, 0);
+        } else if (sscanf(line, "hold %31s %ld", name, &arg) == 2) {
+            const unsigned code = (unsigned)lookup(name);
+            key(code, 1);
+            for (long n = 0; n < arg; ++n) {
+                sleep_ms(5);
+                key(code, 2);
+            }
+            key(code, 0);
+        } else if (sscanf(line, "sleep %ld", &arg) == 1) {
+            sleep_ms(arg);
+        } else if (line[0] != '\n') {
+            fprintf(stderr, "bad command: %s", line);
+            return 1;
+        }
+    }
+
+    ioctl(fd, UI_DEV_DESTROY);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,38 @@
+/* Copyright (C) angelsl 2021
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xtest.h>
+
+// For tests/idle.sh: moves the pointer on $DISPLAY through XTEST, which the
+// server counts as user input, and returns once the server has handled it.
+// Exits 77 without XTEST.
+
+int main(void) {
+    xcb_connection_t *conn = xcb_connect(NULL, NULL);
+    if (xcb_connection_has_error(conn)) {
+        fprintf(stderr, "x_input: cannot connect to $DISPLAY\n");
+        return 1;
+    }
+    const xcb_query_extension_reply_t *ext = xcb_get_extension_data(conn, &xcb_test_id);
+    if (!ext || !ext->present) {
+        printf("no XTEST on $DISPLAY\n");
+        xcb_disconnect(conn);
+        return 77;
+    }
+    xcb_screen_t *screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+    xcb_query_pointer_reply_t *ptr = xcb_query_pointer_reply(conn, xcb_query_pointer(conn, screen->root), NULL);
+    // Somewhere the pointer is not, so the server sees it move.
+    const int16_t x = ptr && ptr->root_x < 10 ? 20 : 0;
+    free(ptr);
+    xcb_test_fake_input(conn, XCB_MOTION_NOTIFY, 0, XCB_CURRENT_TIME, screen->root, x, x, 0);
+    free(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), NULL));
+    xcb_disconnect(conn);
+    return 0;
+}